@@ -0,0 +1,92 @@
+/*
+ * Benchmark Harness Implementation
+ * Each subsystem provides its benchmark function; this table names them
+ */
+
+#include "bench.h"
+#include "../output/output.h"
+#include "../lib/string.h"
+#include "../task/task.h"
+#include "../task/syscall.h"
+#include "../task/msg.h"
+#include "../drivers/virtio_blk.h"
+#include "../fs/fat.h"
+
+/* Benchmark table - array of all available benchmarks */
+static Benchmark benchmarks[] = {
+	{"console", output_bench_flush, "Full-screen flush, uncached vs write-combining"},
+	{"string", string_bench, "memcpy/memset/strlen per implementation"},
+	{"switch", task_bench_switch, "Task switch cost, with and without lazy FPU save"},
+	{"syscall", syscall_bench, "System call round trip from ring 3, sysenter vs int 0x80"},
+	{"msg", msg_bench, "Message queue round trip and msgs/s, 4 KB copied vs page moved"},
+	{"virtio", virtio_blk_bench, "virtio-blk requests/s and latency, single vs batched"},
+	{"fat", fat_bench, "FAT16 write, cold/warm read and seek over a 4 MB file"},
+	{0, 0, 0}  /* Sentinel entry */
+};
+
+/* List available benchmarks */
+void bench_list(void)
+{
+	int i;
+
+	kprint("Available benchmarks:\n");
+	for (i = 0; benchmarks[i].name != 0; i++) {
+		kprint(" - ");
+		kprint(benchmarks[i].name);
+		kprint(": ");
+		kprint(benchmarks[i].description);
+		kprint_newline();
+	}
+	kprint(" - all: Run every benchmark\n");
+}
+
+/* Run a benchmark by name ("all" runs every one) - returns 0 if found, -1 if not */
+int bench_run(const char *name)
+{
+	int i;
+	int all = strcmp(name, "all") == 0;
+	int found = -1;
+
+	for (i = 0; benchmarks[i].name != 0; i++) {
+		if (all || strcmp(name, benchmarks[i].name) == 0) {
+			kprint("[");
+			kprint(benchmarks[i].name);
+			kprint("]\n");
+			benchmarks[i].run();
+			found = 0;
+		}
+	}
+	return found;
+}
+
+/* 64-bit by 32-bit division without libgcc */
+unsigned long long bench_div64(unsigned long long value, unsigned int divisor)
+{
+	unsigned long long quotient = 0;
+	unsigned long long remainder = 0;
+	int bit;
+
+	if (divisor == 0) {
+		return 0;
+	}
+	for (bit = 63; bit >= 0; bit--) {
+		remainder = (remainder << 1) | ((value >> bit) & 1);
+		if (remainder >= divisor) {
+			remainder -= divisor;
+			quotient |= 1ULL << bit;
+		}
+	}
+	return quotient;
+}
+
+/* Print "label: <cycles per iteration> cycles/iter (<iterations> iterations)" */
+void bench_report(const char *label, unsigned long long cycles, unsigned int iterations)
+{
+	kprint("  ");
+	kprint(label);
+	kprint(": ");
+	kprint_dec64(bench_div64(cycles, iterations));
+	kprint(" cycles/iter (");
+	kprint_dec(iterations);
+	kprint(" iterations)\n");
+}
@@ -0,0 +1,23 @@
+/*
+ * Benchmark Harness - Named in-kernel benchmarks run from the shell
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Benchmark structure */
+typedef struct {
+	const char *name;
+	void (*run)(void);
+	const char *description;
+} Benchmark;
+
+/* Harness functions */
+void bench_list(void);
+int bench_run(const char *name);
+
+/* Helpers for benchmark implementations */
+void bench_report(const char *label, unsigned long long cycles, unsigned int iterations);
+unsigned long long bench_div64(unsigned long long value, unsigned int divisor);
+
+#endif /* BENCH_H */
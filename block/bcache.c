@@ -0,0 +1,635 @@
+/*
+ * Block Cache Implementation
+ * Page-sized blocks keyed by (device, block) in a hash table, with one
+ * LRU list for eviction. Writes only dirty the cached copy; dirty blocks
+ * go back to the disk sorted by position, a batch at a time, when too
+ * much of the cache is dirty, when a victim is needed, or on sync.
+ *
+ * Read-ahead follows each device's access pattern: a miss right after
+ * the previous block reads a window of following blocks in the same
+ * batch, the window doubles while the pattern holds, and touching the
+ * back half of a read-ahead window fetches the next one.
+ */
+
+#include "bcache.h"
+#include "../memory/page.h"
+#include "../memory/slab.h"
+#include "../output/output.h"
+#include "../lib/string.h"
+#include "../cpu/cpu.h"
+#include "../bench/bench.h"
+#include "../essentials/sections.h"
+
+/* Blocks handed to block_submit() at once */
+#define BCACHE_BATCH (BCACHE_READAHEAD_MAX + 1)
+
+/* Per-device sequential access detector */
+typedef struct {
+	BlockDevice *dev;
+	unsigned long long last;        /* Last block asked for */
+	unsigned long long next;        /* First block after the read-ahead window */
+	unsigned int window;
+} ReadAhead;
+
+static CacheBlock *blocks;
+static unsigned int block_count = 0;
+static CacheBlock **hash_table;
+static unsigned int hash_mask;
+static CacheBlock *lru_head = 0;
+static CacheBlock *lru_tail = 0;
+static unsigned int dirty_count = 0;
+static WaitQueue bcache_wait = WAIT_QUEUE_INIT;
+static ReadAhead readahead[MAX_BLOCK_DEVICES];
+static BcacheStats stats;
+
+static unsigned int bcache_hash(BlockDevice *dev, unsigned long long block)
+{
+	unsigned int key = (unsigned int)block ^ (unsigned int)(block >> 32) ^
+	                   ((unsigned long)dev >> 4);
+
+	return (key * 2654435761u) >> 8 & hash_mask;
+}
+
+/* Size the cache from free memory and put every block on the LRU list */
+__init void bcache_init(void)
+{
+	unsigned int count = page_free_count() / BCACHE_MEMORY_SHARE;
+	unsigned int buckets = 1;
+	unsigned int i;
+
+	if (count > BCACHE_MAX_BLOCKS) {
+		count = BCACHE_MAX_BLOCKS;
+	}
+	if (count < BCACHE_MIN_BLOCKS) {
+		count = BCACHE_MIN_BLOCKS;
+	}
+	while (buckets < count) {
+		buckets <<= 1;
+	}
+
+	blocks = (CacheBlock*)kzalloc(count * sizeof(CacheBlock));
+	hash_table = (CacheBlock**)kzalloc(buckets * sizeof(CacheBlock*));
+	if (!blocks || !hash_table) {
+		return;
+	}
+	hash_mask = buckets - 1;
+
+	/* page_alloc() frames are identity mapped, so drivers can DMA into them */
+	for (i = 0; i < count; i++) {
+		blocks[i].data = (char*)page_alloc();
+		if (!blocks[i].data) {
+			break;
+		}
+		blocks[i].lru_prev = lru_tail;
+		if (lru_tail) {
+			lru_tail->lru_next = &blocks[i];
+		} else {
+			lru_head = &blocks[i];
+		}
+		lru_tail = &blocks[i];
+	}
+	block_count = i;
+}
+
+static CacheBlock* bcache_lookup(BlockDevice *dev, unsigned long long block)
+{
+	CacheBlock *b = hash_table[bcache_hash(dev, block)];
+
+	while (b && (b->dev != dev || b->block != block)) {
+		b = b->hash_next;
+	}
+	return b;
+}
+
+static void bcache_hash_insert(CacheBlock *b)
+{
+	CacheBlock **bucket = &hash_table[bcache_hash(b->dev, b->block)];
+
+	b->hash_next = *bucket;
+	*bucket = b;
+}
+
+static void bcache_hash_remove(CacheBlock *b)
+{
+	CacheBlock **link = &hash_table[bcache_hash(b->dev, b->block)];
+
+	while (*link && *link != b) {
+		link = &(*link)->hash_next;
+	}
+	if (*link) {
+		*link = b->hash_next;
+	}
+	b->hash_next = 0;
+}
+
+/* Move a block to the most-recently-used end */
+static void bcache_touch(CacheBlock *b)
+{
+	if (b == lru_head) {
+		return;
+	}
+	b->lru_prev->lru_next = b->lru_next;
+	if (b->lru_next) {
+		b->lru_next->lru_prev = b->lru_prev;
+	} else {
+		lru_tail = b->lru_prev;
+	}
+	b->lru_prev = 0;
+	b->lru_next = lru_head;
+	lru_head->lru_prev = b;
+	lru_head = b;
+}
+
+/* Take the least recently used clean, idle block for (dev, block) - 0 if none */
+static CacheBlock* bcache_evict(BlockDevice *dev, unsigned long long block)
+{
+	CacheBlock *b;
+
+	for (b = lru_tail; b; b = b->lru_prev) {
+		if (b->refs == 0 && !(b->flags & (BCACHE_DIRTY | BCACHE_LOCKED))) {
+			break;
+		}
+	}
+	if (!b) {
+		return 0;
+	}
+
+	if (b->dev) {
+		bcache_hash_remove(b);
+		stats.evictions++;
+		if (b->flags & BCACHE_READAHEAD) {
+			stats.readahead_wasted++;
+		}
+	}
+	b->dev = dev;
+	b->block = block;
+	b->flags = 0;
+	bcache_hash_insert(b);
+	bcache_touch(b);
+	return b;
+}
+
+/* Sectors in a block - the last block of a device may be short */
+static unsigned int bcache_block_sectors(BlockDevice *dev, unsigned long long block)
+{
+	unsigned long long lba = block << BCACHE_BLOCK_SHIFT;
+
+	if (lba + BCACHE_BLOCK_SECTORS > dev->sectors) {
+		return (unsigned int)(dev->sectors - lba);
+	}
+	return BCACHE_BLOCK_SECTORS;
+}
+
+/* Finish I/O on a block and let waiters look at it again */
+static void bcache_unlock(CacheBlock *b)
+{
+	b->flags &= ~BCACHE_LOCKED;
+	wait_queue_wake_all(&bcache_wait);
+}
+
+static ReadAhead* bcache_readahead_state(BlockDevice *dev)
+{
+	int i;
+	int free_slot = -1;
+
+	for (i = 0; i < MAX_BLOCK_DEVICES; i++) {
+		if (readahead[i].dev == dev) {
+			return &readahead[i];
+		}
+		if (!readahead[i].dev && free_slot < 0) {
+			free_slot = i;
+		}
+	}
+	if (free_slot < 0) {
+		return 0;
+	}
+	readahead[free_slot].dev = dev;
+	readahead[free_slot].last = ~0ull;
+	return &readahead[free_slot];
+}
+
+/*
+ * Read up to count blocks from first in one batch, skipping blocks
+ * already cached. Blocks other than want are marked read-ahead; want
+ * (if in range) comes back referenced. Stops early if no victim is free.
+ */
+static CacheBlock* bcache_fill(BlockDevice *dev, unsigned long long first,
+                               unsigned int count, unsigned long long want)
+{
+	BlockRequest requests[BCACHE_BATCH];
+	CacheBlock *batch[BCACHE_BATCH];
+	CacheBlock *wanted = 0;
+	CacheBlock *b;
+	unsigned long long block;
+	unsigned int n = 0;
+	unsigned int i;
+
+	if (count > BCACHE_BATCH) {
+		count = BCACHE_BATCH;
+	}
+	for (block = first; block < first + count; block++) {
+		if ((block << BCACHE_BLOCK_SHIFT) >= dev->sectors) {
+			break;
+		}
+		if (bcache_lookup(dev, block)) {
+			continue;
+		}
+		b = bcache_evict(dev, block);
+		if (!b) {
+			break;
+		}
+		b->flags = BCACHE_LOCKED;
+		if (block == want) {
+			b->refs++;
+			wanted = b;
+		} else {
+			b->flags |= BCACHE_READAHEAD;
+			stats.readahead_blocks++;
+		}
+		requests[n].lba = block << BCACHE_BLOCK_SHIFT;
+		requests[n].count = bcache_block_sectors(dev, block);
+		requests[n].buffer = b->data;
+		requests[n].write = 0;
+		batch[n++] = b;
+	}
+	if (n == 0) {
+		return wanted;
+	}
+
+	block_submit(dev, requests, n);
+	for (i = 0; i < n; i++) {
+		if (requests[i].status == 0) {
+			batch[i]->flags |= BCACHE_VALID;
+		} else {
+			batch[i]->flags &= ~BCACHE_READAHEAD;
+			stats.errors++;
+		}
+		bcache_unlock(batch[i]);
+	}
+	return wanted;
+}
+
+/* Update the sequential detector for an access to block; start read-ahead if it pays */
+static void bcache_readahead(BlockDevice *dev, unsigned long long block, CacheBlock *hit)
+{
+	ReadAhead *ra = bcache_readahead_state(dev);
+
+	if (!ra) {
+		return;
+	}
+	if (block != ra->last + 1) {
+		/* Random access: drop back to no read-ahead */
+		if (block != ra->last) {
+			ra->window = 0;
+		}
+		ra->last = block;
+		return;
+	}
+	ra->last = block;
+
+	/* Sequential: on a miss grow the window, on a hit keep ahead of the reader */
+	if (!hit) {
+		ra->window = ra->window ? ra->window * 2 : BCACHE_READAHEAD_MIN;
+		if (ra->window > BCACHE_READAHEAD_MAX) {
+			ra->window = BCACHE_READAHEAD_MAX;
+		}
+		ra->next = block + 1;
+	} else if (ra->window == 0 || ra->next - block > ra->window / 2) {
+		return;
+	}
+	bcache_fill(dev, ra->next, ra->window, ~0ull);
+	ra->next += ra->window;
+}
+
+/* Find or load a block; if read is 0 the caller overwrites it all and no read is done */
+static CacheBlock* bcache_getblk(BlockDevice *dev, unsigned long long block, int read)
+{
+	unsigned long flags;
+	unsigned int dirty;
+	CacheBlock *b;
+
+	if (block_count == 0 || (block << BCACHE_BLOCK_SHIFT) >= dev->sectors) {
+		return 0;
+	}
+
+	for (;;) {
+		b = bcache_lookup(dev, block);
+		if (b && (b->flags & BCACHE_LOCKED)) {
+			flags = irq_save();
+			while (b->flags & BCACHE_LOCKED) {
+				wait_queue_sleep(&bcache_wait);
+			}
+			irq_restore(flags);
+			continue;
+		}
+
+		if (b && (b->flags & BCACHE_VALID)) {
+			b->refs++;
+			bcache_touch(b);
+			stats.hits++;
+			if (b->flags & BCACHE_READAHEAD) {
+				b->flags &= ~BCACHE_READAHEAD;
+				stats.readahead_used++;
+			}
+			if (read) {
+				bcache_readahead(dev, block, b);
+			}
+			return b;
+		}
+
+		stats.misses++;
+		if (!read) {
+			b = b ? b : bcache_evict(dev, block);
+			if (b) {
+				b->refs++;
+				b->flags = BCACHE_VALID;
+				return b;
+			}
+		} else {
+			/* A failed earlier read leaves an invalid block behind - reuse it */
+			if (b) {
+				bcache_hash_remove(b);
+				b->dev = 0;
+			}
+			b = bcache_fill(dev, block, 1, block);
+			if (b) {
+				if (!(b->flags & BCACHE_VALID)) {
+					b->refs--;
+					return 0;
+				}
+				bcache_readahead(dev, block, 0);
+				return b;
+			}
+		}
+
+		/* Everything is dirty or in use: write back and retry while that frees blocks */
+		dirty = dirty_count;
+		if (dirty == 0) {
+			return 0;
+		}
+		bcache_sync(0);
+		if (dirty_count == dirty) {
+			return 0;
+		}
+	}
+}
+
+CacheBlock* bcache_get(BlockDevice *dev, unsigned long long block)
+{
+	return bcache_getblk(dev, block, 1);
+}
+
+void bcache_put(CacheBlock *b)
+{
+	if (b->refs > 0) {
+		b->refs--;
+	}
+}
+
+void bcache_mark_dirty(CacheBlock *b)
+{
+	if (!(b->flags & BCACHE_DIRTY)) {
+		b->flags |= BCACHE_DIRTY;
+		dirty_count++;
+		if (dirty_count > block_count / BCACHE_DIRTY_SHARE) {
+			bcache_sync(0);
+		}
+	}
+}
+
+/* Copy sectors out through the cache */
+int bcache_read(BlockDevice *dev, unsigned long long lba, unsigned int count, void *buffer)
+{
+	char *dest = (char*)buffer;
+	unsigned int offset;
+	unsigned int chunk;
+	CacheBlock *b;
+
+	if (lba + count > dev->sectors) {
+		return -1;
+	}
+	while (count > 0) {
+		offset = lba & (BCACHE_BLOCK_SECTORS - 1);
+		chunk = BCACHE_BLOCK_SECTORS - offset;
+		if (chunk > count) {
+			chunk = count;
+		}
+		b = bcache_get(dev, lba >> BCACHE_BLOCK_SHIFT);
+		if (!b) {
+			return -1;
+		}
+		memcpy(dest, b->data + offset * BLOCK_SECTOR_SIZE, chunk * BLOCK_SECTOR_SIZE);
+		bcache_put(b);
+		lba += chunk;
+		dest += chunk * BLOCK_SECTOR_SIZE;
+		count -= chunk;
+	}
+	return 0;
+}
+
+/* Copy sectors into the cache; whole blocks are not read first */
+int bcache_write(BlockDevice *dev, unsigned long long lba, unsigned int count, const void *buffer)
+{
+	const char *src = (const char*)buffer;
+	unsigned long long block;
+	unsigned int offset;
+	unsigned int chunk;
+	CacheBlock *b;
+
+	if (lba + count > dev->sectors) {
+		return -1;
+	}
+	while (count > 0) {
+		block = lba >> BCACHE_BLOCK_SHIFT;
+		offset = lba & (BCACHE_BLOCK_SECTORS - 1);
+		chunk = BCACHE_BLOCK_SECTORS - offset;
+		if (chunk > count) {
+			chunk = count;
+		}
+		b = bcache_getblk(dev, block, offset != 0 || chunk != bcache_block_sectors(dev, block));
+		if (!b) {
+			return -1;
+		}
+		memcpy(b->data + offset * BLOCK_SECTOR_SIZE, src, chunk * BLOCK_SECTOR_SIZE);
+		bcache_mark_dirty(b);
+		bcache_put(b);
+		lba += chunk;
+		src += chunk * BLOCK_SECTOR_SIZE;
+		count -= chunk;
+	}
+	return 0;
+}
+
+/* Order by device, then block, so write-back sweeps the disk once */
+static int bcache_before(CacheBlock *a, CacheBlock *b)
+{
+	if (a->dev != b->dev) {
+		return (unsigned long)a->dev < (unsigned long)b->dev;
+	}
+	return a->block < b->block;
+}
+
+int bcache_sync(BlockDevice *dev)
+{
+	BlockRequest requests[BCACHE_BATCH];
+	CacheBlock **dirty;
+	CacheBlock *b;
+	unsigned int total = dirty_count;
+	unsigned int count = 0;
+	unsigned int gap;
+	unsigned int done;
+	unsigned int n;
+	unsigned int i;
+	unsigned int j;
+	int result = 0;
+
+	if (total == 0) {
+		return 0;
+	}
+	dirty = (CacheBlock**)kmalloc(total * sizeof(CacheBlock*));
+	if (!dirty) {
+		return -1;
+	}
+
+	/*
+	 * Claim the dirty blocks so nobody else writes them back meanwhile.
+	 * They are clean from here: a holder changing one while the write
+	 * sleeps marks it dirty again, and that change goes out next time.
+	 */
+	for (i = 0; i < block_count && count < total; i++) {
+		b = &blocks[i];
+		if ((b->flags & BCACHE_DIRTY) && !(b->flags & BCACHE_LOCKED) && (!dev || b->dev == dev)) {
+			b->flags = (b->flags & ~BCACHE_DIRTY) | BCACHE_LOCKED;
+			dirty_count--;
+			dirty[count++] = b;
+		}
+	}
+
+	/* Shell sort by position */
+	for (gap = count / 2; gap > 0; gap /= 2) {
+		for (i = gap; i < count; i++) {
+			b = dirty[i];
+			for (j = i; j >= gap && bcache_before(b, dirty[j - gap]); j -= gap) {
+				dirty[j] = dirty[j - gap];
+			}
+			dirty[j] = b;
+		}
+	}
+
+	/* One submission per run of blocks on the same device */
+	for (done = 0; done < count; done += n) {
+		for (n = 0; n < BCACHE_BATCH && done + n < count; n++) {
+			b = dirty[done + n];
+			if (b->dev != dirty[done]->dev) {
+				break;
+			}
+			requests[n].lba = b->block << BCACHE_BLOCK_SHIFT;
+			requests[n].count = bcache_block_sectors(b->dev, b->block);
+			requests[n].buffer = b->data;
+			requests[n].write = 1;
+		}
+		block_submit(dirty[done]->dev, requests, n);
+		stats.writeback_requests++;
+
+		for (i = 0; i < n; i++) {
+			b = dirty[done + i];
+			if (requests[i].status == 0) {
+				b->flags &= ~BCACHE_ERROR;
+				stats.writebacks++;
+			} else {
+				/*
+				 * Retrying can't be told apart from a dead disk, and
+				 * a block kept dirty would pin the cache for every
+				 * device: report it and let it go
+				 */
+				b->flags |= BCACHE_ERROR;
+				stats.errors++;
+				stats.lost_writes++;
+				kprint_colored("Block cache: write error on ", 0x04);
+				kprint(b->dev->name);
+				kprint(", block ");
+				kprint_dec64(b->block);
+				kprint(" lost\n");
+				result = -1;
+			}
+			bcache_unlock(b);
+		}
+	}
+
+	kfree(dirty);
+	return result;
+}
+
+void bcache_invalidate(BlockDevice *dev)
+{
+	CacheBlock *b;
+	unsigned int i;
+
+	for (i = 0; i < block_count; i++) {
+		b = &blocks[i];
+		if (b->dev == dev && b->refs == 0 && !(b->flags & (BCACHE_DIRTY | BCACHE_LOCKED))) {
+			bcache_hash_remove(b);
+			b->dev = 0;
+			b->flags = 0;
+		}
+	}
+}
+
+/* part as a percentage of whole */
+static unsigned int bcache_percent(unsigned int part, unsigned int whole)
+{
+	if (whole == 0) {
+		return 0;
+	}
+	return (unsigned int)bench_div64((unsigned long long)part * 100, whole);
+}
+
+void bcache_print_stats(void)
+{
+	unsigned int used = 0;
+	unsigned int i;
+
+	for (i = 0; i < block_count; i++) {
+		if (blocks[i].flags & BCACHE_VALID) {
+			used++;
+		}
+	}
+
+	kprint("Block cache: ");
+	kprint_dec(block_count);
+	kprint(" blocks of 4 KB, ");
+	kprint_dec(used);
+	kprint(" in use, ");
+	kprint_dec(dirty_count);
+	kprint(" dirty\n");
+
+	kprint("  hits ");
+	kprint_dec(stats.hits);
+	kprint(", misses ");
+	kprint_dec(stats.misses);
+	kprint(" (");
+	kprint_dec(bcache_percent(stats.hits, stats.hits + stats.misses));
+	kprint("% hit rate), evictions ");
+	kprint_dec(stats.evictions);
+	kprint_newline();
+
+	kprint("  read-ahead ");
+	kprint_dec(stats.readahead_blocks);
+	kprint(" blocks, used ");
+	kprint_dec(stats.readahead_used);
+	kprint(", wasted ");
+	kprint_dec(stats.readahead_wasted);
+	kprint(" (");
+	kprint_dec(bcache_percent(stats.readahead_used, stats.readahead_blocks));
+	kprint("% efficiency)\n");
+
+	kprint("  written back ");
+	kprint_dec(stats.writebacks);
+	kprint(" blocks in ");
+	kprint_dec(stats.writeback_requests);
+	kprint(" batches, errors ");
+	kprint_dec(stats.errors);
+	kprint(", lost writes ");
+	kprint_dec(stats.lost_writes);
+	kprint_newline();
+}
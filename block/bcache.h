@@ -0,0 +1,81 @@
+/*
+ * Block Cache - Cached, write-back access to block devices
+ */
+
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "block.h"
+#include "../task/task.h"
+
+/* Cache blocks are one page: 8 sectors, aligned on an 8-sector boundary */
+#define BCACHE_BLOCK_SIZE 4096
+#define BCACHE_BLOCK_SECTORS (BCACHE_BLOCK_SIZE / BLOCK_SECTOR_SIZE)
+#define BCACHE_BLOCK_SHIFT 3            /* log2(BCACHE_BLOCK_SECTORS) */
+
+/* Use up to 1/BCACHE_MEMORY_SHARE of free pages, within these bounds */
+#define BCACHE_MEMORY_SHARE 8
+#define BCACHE_MIN_BLOCKS 32
+#define BCACHE_MAX_BLOCKS 4096
+
+/* Read-ahead window in blocks, doubled on every sequential miss */
+#define BCACHE_READAHEAD_MIN 4
+#define BCACHE_READAHEAD_MAX 32
+
+/* Write back once this share (1/n) of the cache is dirty */
+#define BCACHE_DIRTY_SHARE 4
+
+/* Block flags */
+#define BCACHE_VALID 0x01
+#define BCACHE_DIRTY 0x02
+#define BCACHE_LOCKED 0x04              /* I/O in progress */
+#define BCACHE_READAHEAD 0x08           /* Read ahead, not used yet */
+#define BCACHE_ERROR 0x10               /* Write-back failed: the disk never got this copy */
+
+typedef struct CacheBlock {
+	BlockDevice *dev;
+	unsigned long long block;       /* lba / BCACHE_BLOCK_SECTORS */
+	char *data;
+	unsigned int flags;
+	unsigned int refs;
+	struct CacheBlock *hash_next;
+	struct CacheBlock *lru_prev;    /* Most recently used at the head */
+	struct CacheBlock *lru_next;
+} CacheBlock;
+
+/* Counters shown by cachestat */
+typedef struct {
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int readahead_blocks;  /* Read ahead */
+	unsigned int readahead_used;    /* ...and later hit */
+	unsigned int readahead_wasted;  /* ...and evicted unused */
+	unsigned int evictions;
+	unsigned int writebacks;        /* Blocks written back */
+	unsigned int writeback_requests;
+	unsigned int errors;
+	unsigned int lost_writes;       /* Dirty blocks given up after a failed write-back */
+} BcacheStats;
+
+/* Setup */
+void bcache_init(void);
+
+/* Block interface - get returns a referenced, valid block or 0 on error */
+CacheBlock* bcache_get(BlockDevice *dev, unsigned long long block);
+void bcache_put(CacheBlock *b);
+void bcache_mark_dirty(CacheBlock *b);
+
+/* Sector interface - same contract as block_read()/block_write() */
+int bcache_read(BlockDevice *dev, unsigned long long lba, unsigned int count, void *buffer);
+int bcache_write(BlockDevice *dev, unsigned long long lba, unsigned int count, const void *buffer);
+
+/* Write back dirty blocks (dev 0: every device) - -1 if any write failed */
+int bcache_sync(BlockDevice *dev);
+
+/* Drop clean, idle blocks of dev so the next reads go to the disk */
+void bcache_invalidate(BlockDevice *dev);
+
+/* Statistics */
+void bcache_print_stats(void);
+
+#endif /* BCACHE_H */
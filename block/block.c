@@ -0,0 +1,346 @@
+/*
+ * Block Layer Implementation
+ * Drivers register a BlockDevice; callers read and write any number of
+ * sectors and the layer splits them into requests the driver accepts.
+ */
+
+#include "block.h"
+#include "../output/output.h"
+#include "../memory/slab.h"
+#include "../lib/string.h"
+#include "../cpu/cpu.h"
+#include "../bench/bench.h"
+#include "../drivers/pit.h"
+#include "../task/task.h"
+#include "../debug/trace.h"
+
+/* Benchmark shape */
+#define BENCH_SEQ_BYTES (4 * 1024 * 1024)
+#define BENCH_SEQ_SECTORS 128            /* 64 KB per request */
+#define BENCH_RANDOM_READS 256
+#define BENCH_RANDOM_SECTORS 8           /* 4 KB per request */
+#define BENCH_BATCH_MAX 32
+
+static BlockDevice *devices[MAX_BLOCK_DEVICES];
+static int device_count = 0;
+
+/* Add a device - returns 0 on success, -1 if the table is full */
+int block_register(BlockDevice *dev)
+{
+	if (device_count >= MAX_BLOCK_DEVICES) {
+		return -1;
+	}
+	devices[device_count++] = dev;
+	return 0;
+}
+
+BlockDevice* block_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < device_count; i++) {
+		if (strcmp(devices[i]->name, name) == 0) {
+			return devices[i];
+		}
+	}
+	return 0;
+}
+
+/* Device by registration order (0 if out of range) */
+BlockDevice* block_get(int index)
+{
+	if (index < 0 || index >= device_count) {
+		return 0;
+	}
+	return devices[index];
+}
+
+/* One line per device: name, size and I/O counters */
+void block_print_devices(void)
+{
+	int i;
+	BlockDevice *dev;
+
+	if (device_count == 0) {
+		kprint("No block devices\n");
+		return;
+	}
+	for (i = 0; i < device_count; i++) {
+		dev = devices[i];
+		kprint(dev->name);
+		kprint(": ");
+		kprint_dec64(dev->sectors >> 11);
+		kprint(" MB, reads ");
+		kprint_dec(dev->read_requests);
+		kprint(" writes ");
+		kprint_dec(dev->write_requests);
+		kprint(" errors ");
+		kprint_dec(dev->errors);
+		kprint_newline();
+	}
+}
+
+static int block_check(BlockDevice *dev, unsigned long long lba, unsigned int count)
+{
+	return (lba + count <= dev->sectors) ? 0 : -1;
+}
+
+int block_read(BlockDevice *dev, unsigned long long lba, unsigned int count, void *buffer)
+{
+	char *dest = (char*)buffer;
+	unsigned int chunk;
+
+	if (block_check(dev, lba, count) != 0) {
+		return -1;
+	}
+	while (count > 0) {
+		chunk = count < dev->max_transfer ? count : dev->max_transfer;
+		dev->read_requests++;
+		TRACE(TRACE_BLOCK_SUBMIT, (unsigned int)lba);
+		if (dev->read(dev, lba, chunk, dest) != 0) {
+			dev->errors++;
+			return -1;
+		}
+		dev->sectors_read += chunk;
+		lba += chunk;
+		dest += chunk * BLOCK_SECTOR_SIZE;
+		count -= chunk;
+	}
+	return 0;
+}
+
+int block_write(BlockDevice *dev, unsigned long long lba, unsigned int count, const void *buffer)
+{
+	const char *src = (const char*)buffer;
+	unsigned int chunk;
+
+	if (block_check(dev, lba, count) != 0) {
+		return -1;
+	}
+	while (count > 0) {
+		chunk = count < dev->max_transfer ? count : dev->max_transfer;
+		dev->write_requests++;
+		TRACE(TRACE_BLOCK_SUBMIT, (unsigned int)lba);
+		if (dev->write(dev, lba, chunk, src) != 0) {
+			dev->errors++;
+			return -1;
+		}
+		dev->sectors_written += chunk;
+		lba += chunk;
+		src += chunk * BLOCK_SECTOR_SIZE;
+		count -= chunk;
+	}
+	return 0;
+}
+
+/*
+ * Drivers with a submit hook get the whole batch (and can start every
+ * request before waiting for any); others run it one request at a time.
+ */
+int block_submit(BlockDevice *dev, BlockRequest *requests, unsigned int count)
+{
+	BlockRequest *req;
+	unsigned int i;
+	int result = 0;
+
+	for (i = 0; i < count; i++) {
+		req = &requests[i];
+		req->status = 0;
+		if (req->count == 0 || req->count > dev->max_transfer ||
+		    block_check(dev, req->lba, req->count) != 0) {
+			return -1;
+		}
+		if (req->write) {
+			dev->write_requests++;
+			dev->sectors_written += req->count;
+		} else {
+			dev->read_requests++;
+			dev->sectors_read += req->count;
+		}
+		TRACE(TRACE_BLOCK_SUBMIT, (unsigned int)req->lba);
+	}
+
+	if (dev->submit) {
+		dev->submit(dev, requests, count);
+	} else {
+		for (i = 0; i < count; i++) {
+			req = &requests[i];
+			if (req->write) {
+				req->status = dev->write(dev, req->lba, req->count, req->buffer);
+			} else {
+				req->status = dev->read(dev, req->lba, req->count, req->buffer);
+			}
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (requests[i].status != 0) {
+			dev->errors++;
+			result = -1;
+		}
+	}
+	return result;
+}
+
+/* part as a percentage of whole (bench_div64 takes a 32-bit divisor) */
+static unsigned int percent(unsigned long long part, unsigned long long whole)
+{
+	while (whole > 0xFFFFFFFFull) {
+		whole >>= 1;
+		part >>= 1;
+	}
+	if (whole == 0) {
+		return 0;
+	}
+	return (unsigned int)bench_div64(part * 100, (unsigned int)whole);
+}
+
+/* Print KB/s for bytes moved in cycles, and how much of that time the CPU was idle */
+static void report_throughput(const char *label, unsigned long long bytes,
+                              unsigned long long cycles, unsigned long long idle,
+                              unsigned int requests)
+{
+	unsigned int khz = pit_tsc_khz();
+	unsigned long long us = bench_div64(cycles * 1000, khz);
+
+	if (us == 0) {
+		us = 1;
+	}
+	kprint("  ");
+	kprint(label);
+	kprint(": ");
+	kprint_dec64(bench_div64(bytes * 1000000 / 1024, (unsigned int)us));
+	kprint(" KB/s, ");
+	kprint_dec64(bench_div64(us, requests));
+	kprint(" us/request, CPU idle ");
+	kprint_dec(percent(idle, cycles));
+	kprint("%\n");
+}
+
+/* Sequential 64 KB reads, then random 4 KB reads */
+void block_bench(BlockDevice *dev)
+{
+	char *buffer;
+	unsigned long long start;
+	unsigned long long cycles;
+	unsigned long long lba;
+	unsigned long long idle;
+	unsigned int seq_sectors = BENCH_SEQ_BYTES / BLOCK_SECTOR_SIZE;
+	unsigned int span;
+	unsigned int seed = 12345;
+	unsigned int done;
+	int i;
+
+	if (dev->sectors < seq_sectors) {
+		seq_sectors = (unsigned int)dev->sectors & ~(BENCH_SEQ_SECTORS - 1);
+	}
+	if (seq_sectors == 0) {
+		kprint("Device too small\n");
+		return;
+	}
+
+	buffer = (char*)kmalloc(BENCH_SEQ_SECTORS * BLOCK_SECTOR_SIZE);
+	if (!buffer) {
+		kprint("Out of memory\n");
+		return;
+	}
+
+	kprint(dev->name);
+	kprint_newline();
+
+	idle = task_idle_cycles();
+	start = cpu_rdtsc();
+	for (done = 0; done < seq_sectors; done += BENCH_SEQ_SECTORS) {
+		if (block_read(dev, done, BENCH_SEQ_SECTORS, buffer) != 0) {
+			kprint("Read error\n");
+			kfree(buffer);
+			return;
+		}
+	}
+	cycles = cpu_rdtsc() - start;
+	report_throughput("sequential 64 KB", (unsigned long long)seq_sectors * BLOCK_SECTOR_SIZE,
+	                  cycles, task_idle_cycles() - idle, seq_sectors / BENCH_SEQ_SECTORS);
+
+	/* Random 4 KB-aligned reads over the same span */
+	span = seq_sectors / BENCH_RANDOM_SECTORS;
+	idle = task_idle_cycles();
+	start = cpu_rdtsc();
+	for (i = 0; i < BENCH_RANDOM_READS; i++) {
+		seed = seed * 1103515245 + 12345;
+		lba = (unsigned long long)((seed >> 8) % span) * BENCH_RANDOM_SECTORS;
+		if (block_read(dev, lba, BENCH_RANDOM_SECTORS, buffer) != 0) {
+			kprint("Read error\n");
+			kfree(buffer);
+			return;
+		}
+	}
+	cycles = cpu_rdtsc() - start;
+	report_throughput("random 4 KB", (unsigned long long)BENCH_RANDOM_READS *
+	                  BENCH_RANDOM_SECTORS * BLOCK_SECTOR_SIZE, cycles, task_idle_cycles() - idle,
+	                  BENCH_RANDOM_READS);
+
+	kfree(buffer);
+}
+
+/* Random 4 KB reads, batch requests per submission */
+void block_bench_requests(BlockDevice *dev, unsigned int batch)
+{
+	BlockRequest requests[BENCH_BATCH_MAX];
+	char *buffer;
+	unsigned long long start;
+	unsigned long long cycles;
+	unsigned long long us;
+	unsigned int span;
+	unsigned int seed = 12345;
+	unsigned int done;
+	unsigned int i;
+
+	if (batch == 0 || batch > BENCH_BATCH_MAX) {
+		batch = BENCH_BATCH_MAX;
+	}
+	span = (unsigned int)(dev->sectors / BENCH_RANDOM_SECTORS);
+	if ((dev->sectors >> 32) != 0) {
+		span = 0xFFFFFFFF / BENCH_RANDOM_SECTORS;
+	}
+	if (span == 0) {
+		kprint("Device too small\n");
+		return;
+	}
+
+	buffer = (char*)kmalloc(batch * BENCH_RANDOM_SECTORS * BLOCK_SECTOR_SIZE);
+	if (!buffer) {
+		kprint("Out of memory\n");
+		return;
+	}
+
+	start = cpu_rdtsc();
+	for (done = 0; done < BENCH_RANDOM_READS; done += batch) {
+		for (i = 0; i < batch; i++) {
+			seed = seed * 1103515245 + 12345;
+			requests[i].lba = (unsigned long long)((seed >> 8) % span) * BENCH_RANDOM_SECTORS;
+			requests[i].count = BENCH_RANDOM_SECTORS;
+			requests[i].buffer = buffer + i * BENCH_RANDOM_SECTORS * BLOCK_SECTOR_SIZE;
+			requests[i].write = 0;
+		}
+		if (block_submit(dev, requests, batch) != 0) {
+			kprint("Read error\n");
+			kfree(buffer);
+			return;
+		}
+	}
+	cycles = cpu_rdtsc() - start;
+	us = bench_div64(cycles * 1000, pit_tsc_khz());
+	if (us == 0) {
+		us = 1;
+	}
+
+	kprint("  batch ");
+	kprint_dec(batch);
+	kprint(": ");
+	kprint_dec64(bench_div64((unsigned long long)done * 1000000, (unsigned int)us));
+	kprint(" requests/s, ");
+	kprint_dec64(bench_div64(us * batch, done));
+	kprint(" us/request latency\n");
+
+	kfree(buffer);
+}
@@ -0,0 +1,68 @@
+/*
+ * Block Layer - Sector-addressed storage devices
+ */
+
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#define BLOCK_SECTOR_SIZE 512
+#define MAX_BLOCK_DEVICES 8
+#define BLOCK_NAME_LENGTH 8
+
+struct BlockDevice;
+
+typedef int (*BlockReadFunc)(struct BlockDevice *dev, unsigned long long lba,
+                             unsigned int count, void *buffer);
+typedef int (*BlockWriteFunc)(struct BlockDevice *dev, unsigned long long lba,
+                              unsigned int count, const void *buffer);
+
+/* One request of a batch; status is filled in on completion (0 or -1) */
+typedef struct {
+	unsigned long long lba;
+	unsigned int count;             /* At most max_transfer sectors */
+	void *buffer;
+	int write;
+	int status;
+} BlockRequest;
+
+typedef int (*BlockSubmitFunc)(struct BlockDevice *dev, BlockRequest *requests,
+                               unsigned int count);
+
+/* A disk as seen by the rest of the kernel */
+typedef struct BlockDevice {
+	char name[BLOCK_NAME_LENGTH];
+	unsigned long long sectors;     /* Capacity */
+	unsigned int max_transfer;      /* Sectors per driver request */
+	BlockReadFunc read;
+	BlockWriteFunc write;
+	BlockSubmitFunc submit;         /* Optional: whole batch in one go */
+	void *driver_data;
+
+	/* Statistics */
+	unsigned int read_requests;
+	unsigned int write_requests;
+	unsigned long long sectors_read;
+	unsigned long long sectors_written;
+	unsigned int errors;
+} BlockDevice;
+
+/* Registry */
+int block_register(BlockDevice *dev);
+BlockDevice* block_find(const char *name);
+BlockDevice* block_get(int index);
+void block_print_devices(void);
+
+/* I/O - split into driver-sized requests; 0 on success, -1 on error */
+int block_read(BlockDevice *dev, unsigned long long lba, unsigned int count, void *buffer);
+int block_write(BlockDevice *dev, unsigned long long lba, unsigned int count, const void *buffer);
+
+/* Run a batch of requests and wait for all of them - -1 if any failed */
+int block_submit(BlockDevice *dev, BlockRequest *requests, unsigned int count);
+
+/* Sequential and random read throughput */
+void block_bench(BlockDevice *dev);
+
+/* Random 4 KB reads issued batch at a time: requests/s and latency */
+void block_bench_requests(BlockDevice *dev, unsigned int batch);
+
+#endif /* BLOCK_H */
@@ -0,0 +1,157 @@
+; LZ4 boot stub - a multiboot kernel whose payload is the real one
+; Decompresses the image tools/mklz4.py made from bin/kernel to its load
+; address, clears the bss and jumps to `start` with the loader's eax/ebx.
+; The code only addresses its payload relative to itself, so it runs
+; wherever the loader put it, as long as that is above the kernel image.
+;
+; Decompression time goes into the loader stage table (naoboot.inc) as
+; "unlz4": appended to NaoBoot's, or a new table whose first entry is
+; everything before the stub.
+
+%include "naoboot.inc"
+
+EARLY_STACK	equ 0x7C00		;below the boot sector, free under every loader
+LZ4K_MAGIC	equ 0x4B345A4C		;"LZ4K"
+
+bits 32
+section .text
+	align 4
+	dd 0x1BADB002			;multiboot magic
+	dd 0x03				;flags: page-aligned modules, memory info
+	dd - (0x1BADB002 + 0x03)
+
+global lz4_start
+
+lz4_start:
+	mov ecx, eax			;multiboot magic, rdtsc clobbers eax
+	rdtsc
+	mov esp, EARLY_STACK
+	push ecx
+	push ebx
+	cld
+	call .here
+.here:
+	pop ebp
+
+	;no table from NaoBoot: start one, unless the boot info is in its way
+	cmp dword [STAGES_ADDR], STAGES_MAGIC
+	je .have_table
+	cmp ebx, STAGES_ADDR + 0x1000
+	jb .have_table
+	mov [STAGE_FIRST_TSC], eax
+	mov [STAGE_FIRST_TSC + 4], edx
+	mov dword [STAGES_ADDR], STAGES_MAGIC
+	mov dword [STAGES_ADDR + 4], 1
+	lea esi, [ebp + name_loader - .here]
+	mov edi, STAGES_ADDR + 8
+	mov ecx, STAGE_NAME_LENGTH
+	rep movsb
+.have_table:
+
+	lea esi, [ebp + payload - .here]
+	cmp dword [esi], LZ4K_MAGIC
+	jne halt
+	lea eax, [ebp + lz4_start - .here]
+	cmp [esi + 12], eax		;bss end must stay below the stub
+	ja halt
+	push dword [esi + 16]		;entry
+	push dword [esi + 12]		;bss end
+	mov edi, [esi + 4]		;load address
+	mov ebx, edi
+	add ebx, [esi + 8]		;image end
+	mov edx, [esi + 20]
+	add esi, 24
+	add edx, esi			;block end
+	call lz4_decompress
+	cmp edi, ebx
+	jne halt			;corrupt block
+
+	pop ecx				;clear bss
+	sub ecx, edi
+	xor eax, eax
+	rep stosb
+
+	lea esi, [ebp + name_unlz4 - .here]
+	call mark
+	pop edx
+	pop ebx
+	pop eax
+	jmp edx
+
+halt:
+	cli
+	hlt
+	jmp halt
+
+; Decompress the LZ4 block esi..edx to edi; edi ends past the output.
+; Sequences are a token (literal and match length nibbles), literals,
+; a 16-bit back offset and the match; the last has literals only.
+; rep movsb copies forward byte by byte, so overlapping matches repeat
+; their pattern as LZ4 requires.
+lz4_decompress:
+.sequence:
+	movzx eax, byte [esi]		;token
+	inc esi
+	push eax
+	shr eax, 4
+	call lz4_length
+	mov ecx, eax
+	rep movsb			;literals
+	pop eax
+	cmp esi, edx
+	jae .done
+	movzx ecx, word [esi]		;offset
+	add esi, 2
+	and eax, 0x0F
+	call lz4_length
+	push esi
+	mov esi, edi
+	sub esi, ecx
+	lea ecx, [eax + 4]		;matches are at least 4 bytes
+	rep movsb
+	pop esi
+	jmp .sequence
+.done:
+	ret
+
+; eax = length nibble; a nibble of 15 continues in bytes until one < 255
+lz4_length:
+	cmp eax, 15
+	jne .done
+	push ebx
+.more:
+	movzx ebx, byte [esi]
+	inc esi
+	add eax, ebx
+	cmp ebx, 255
+	je .more
+	pop ebx
+.done:
+	ret
+
+; Append a stage to the table, if there is one; esi = 12-byte name
+mark:
+	pushad
+	cmp dword [STAGES_ADDR], STAGES_MAGIC
+	jne .done
+	mov ecx, [STAGES_ADDR + 4]
+	cmp ecx, STAGES_MAX
+	jae .done
+	imul edi, ecx, STAGE_SIZE
+	add edi, STAGES_ADDR + 8
+	mov ecx, STAGE_NAME_LENGTH
+	rep movsb
+	rdtsc
+	mov [edi], eax
+	mov [edi + 4], edx
+	inc dword [STAGES_ADDR + 4]
+.done:
+	popad
+	ret
+
+name_loader:	db "loader", 0, 0, 0, 0, 0, 0
+name_unlz4:	db "unlz4", 0, 0, 0, 0, 0, 0, 0
+
+	align 4
+payload:
+	incbin "bin/kernel.lz4"
@@ -0,0 +1,131 @@
+/*
+ * Multiboot Implementation
+ * The boot info lives in memory the page allocator will hand out, so the
+ * command line and module list are copied out first thing. Module
+ * contents are not copied: their frames are reserved and they are used
+ * in place. Loader stage timestamps are left at LOADER_STAGES_ADDR by
+ * NaoBoot and by the LZ4 boot stub; the magic tells whether they are there.
+ */
+
+#include "multiboot.h"
+#include "../memory/page.h"
+#include "../output/output.h"
+#include "../lib/string.h"
+#include "../essentials/sections.h"
+
+static char cmdline[MULTIBOOT_CMDLINE_LENGTH];
+static char loader_name[MULTIBOOT_NAME_LENGTH];
+static BootModule modules[MULTIBOOT_MAX_MODULES];
+static int module_count = 0;
+static LoaderStage loader_stages[LOADER_MAX_STAGES];
+static int loader_stage_count = 0;
+
+/* Copy the loader stage table, if there is one */
+__init static void copy_loader_stages(void)
+{
+	const LoaderStages *table = (const LoaderStages*)LOADER_STAGES_ADDR;
+	unsigned int i;
+
+	if (table->magic != LOADER_STAGES_MAGIC) {
+		return;
+	}
+	for (i = 0; i < table->count && i < LOADER_MAX_STAGES; i++) {
+		loader_stages[i] = table->stages[i];
+		loader_stages[i].name[LOADER_STAGE_NAME_LENGTH - 1] = '\0';
+	}
+	loader_stage_count = i;
+}
+
+__init void multiboot_init(unsigned int magic, const MultibootInfo *info)
+{
+	const MultibootModule *mod;
+	unsigned int i;
+
+	if (magic != MULTIBOOT_BOOTLOADER_MAGIC || !info) {
+		return;
+	}
+	if ((info->flags & MULTIBOOT_INFO_CMDLINE) && info->cmdline) {
+		strlcpy(cmdline, (const char*)info->cmdline, sizeof(cmdline));
+	}
+	if ((info->flags & MULTIBOOT_INFO_LOADER_NAME) && info->boot_loader_name) {
+		strlcpy(loader_name, (const char*)info->boot_loader_name, sizeof(loader_name));
+	}
+	copy_loader_stages();
+	if (!(info->flags & MULTIBOOT_INFO_MODS)) {
+		return;
+	}
+
+	mod = (const MultibootModule*)info->mods_addr;
+	for (i = 0; i < info->mods_count && module_count < MULTIBOOT_MAX_MODULES; i++) {
+		if (mod[i].mod_end <= mod[i].mod_start) {
+			continue;
+		}
+		modules[module_count].start = mod[i].mod_start;
+		modules[module_count].end = mod[i].mod_end;
+		if (mod[i].string) {
+			strlcpy(modules[module_count].name, (const char*)mod[i].string, MULTIBOOT_NAME_LENGTH);
+		}
+		page_reserve_early(mod[i].mod_start, mod[i].mod_end);
+		module_count++;
+	}
+}
+
+const char* multiboot_cmdline(void)
+{
+	return cmdline;
+}
+
+const char* multiboot_loader_name(void)
+{
+	return loader_name[0] ? loader_name : "unknown";
+}
+
+int multiboot_module_count(void)
+{
+	return module_count;
+}
+
+const BootModule* multiboot_module(int index)
+{
+	if (index < 0 || index >= module_count) {
+		return 0;
+	}
+	return &modules[index];
+}
+
+int multiboot_loader_stage_count(void)
+{
+	return loader_stage_count;
+}
+
+const LoaderStage* multiboot_loader_stage(int index)
+{
+	if (index < 0 || index >= loader_stage_count) {
+		return 0;
+	}
+	return &loader_stages[index];
+}
+
+__cold void multiboot_print(void)
+{
+	int i;
+
+	kprint("Boot loader: ");
+	kprint(multiboot_loader_name());
+	kprint("\nCommand line: ");
+	kprint(cmdline);
+	kprint_newline();
+	for (i = 0; i < module_count; i++) {
+		kprint("  module ");
+		kprint_dec(i);
+		kprint(": ");
+		kprint_hex(modules[i].start);
+		kprint(" - ");
+		kprint_hex(modules[i].end);
+		kprint(", ");
+		kprint_dec((modules[i].end - modules[i].start) / 1024);
+		kprint(" KB ");
+		kprint(modules[i].name);
+		kprint_newline();
+	}
+}
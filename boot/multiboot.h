@@ -0,0 +1,84 @@
+/*
+ * Multiboot - What the boot loader hands the kernel
+ */
+
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+/* In eax on entry */
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+/* MultibootInfo.flags: which fields are valid */
+#define MULTIBOOT_INFO_MEMORY 0x001
+#define MULTIBOOT_INFO_BOOT_DEVICE 0x002
+#define MULTIBOOT_INFO_CMDLINE 0x004
+#define MULTIBOOT_INFO_MODS 0x008
+#define MULTIBOOT_INFO_MMAP 0x040
+#define MULTIBOOT_INFO_LOADER_NAME 0x200
+
+#define MULTIBOOT_MAX_MODULES 8
+#define MULTIBOOT_CMDLINE_LENGTH 256
+#define MULTIBOOT_NAME_LENGTH 64
+
+typedef struct {
+	unsigned int flags;
+	unsigned int mem_lower;         /* KB below 1 MB */
+	unsigned int mem_upper;         /* KB above 1 MB */
+	unsigned int boot_device;
+	unsigned int cmdline;
+	unsigned int mods_count;
+	unsigned int mods_addr;
+	unsigned int syms[4];
+	unsigned int mmap_length;
+	unsigned int mmap_addr;
+	unsigned int drives_length;
+	unsigned int drives_addr;
+	unsigned int config_table;
+	unsigned int boot_loader_name;
+} __attribute__((packed)) MultibootInfo;
+
+typedef struct {
+	unsigned int mod_start;
+	unsigned int mod_end;           /* One past the last byte */
+	unsigned int string;
+	unsigned int reserved;
+} __attribute__((packed)) MultibootModule;
+
+/* A module as the kernel keeps it - the contents stay where they were loaded */
+typedef struct {
+	unsigned long start;
+	unsigned long end;
+	char name[MULTIBOOT_NAME_LENGTH];
+} BootModule;
+
+/* NaoBoot (boot/stage1.asm, stage2.asm) and the LZ4 stub leave a
+ * timestamp per loader stage in low memory; the layout must match
+ * boot/naoboot.inc */
+#define LOADER_STAGES_ADDR 0x1000
+#define LOADER_STAGES_MAGIC 0x424F414E  /* "NAOB" */
+#define LOADER_MAX_STAGES 8
+#define LOADER_STAGE_NAME_LENGTH 12
+
+typedef struct {
+	char name[LOADER_STAGE_NAME_LENGTH];
+	unsigned long long tsc;         /* RDTSC at the end of the stage */
+} __attribute__((packed)) LoaderStage;
+
+typedef struct {
+	unsigned int magic;
+	unsigned int count;
+	LoaderStage stages[LOADER_MAX_STAGES];
+} __attribute__((packed)) LoaderStages;
+
+/* Copy what is needed out of the boot info; call before page_init */
+void multiboot_init(unsigned int magic, const MultibootInfo *info);
+
+const char* multiboot_cmdline(void);
+const char* multiboot_loader_name(void);
+int multiboot_module_count(void);
+const BootModule* multiboot_module(int index);
+int multiboot_loader_stage_count(void);
+const LoaderStage* multiboot_loader_stage(int index);
+void multiboot_print(void);
+
+#endif /* MULTIBOOT_H */
@@ -0,0 +1,77 @@
+; NaoBoot stage 1 - master boot record
+; Takes the first timestamp, then pulls stage 2 in with a single INT 13h
+; extended read and jumps to it with the boot drive still in dl.
+
+%include "naoboot.inc"
+
+bits 16
+org 0x7C00
+
+start:
+	mov bp, dx			;boot drive, rdtsc clobbers edx
+	rdtsc				;end of firmware: before anything else
+	cli
+	xor bx, bx
+	mov ds, bx
+	mov es, bx
+	mov ss, bx
+	mov sp, 0x7C00
+	mov [STAGE_FIRST_TSC], eax
+	mov [STAGE_FIRST_TSC + 4], edx
+	jmp 0:.flush			;some BIOSes enter at 07C0:0000
+.flush:
+	sti
+	cld
+	mov dx, bp
+	mov [boot_drive], dl
+
+	mov ah, 0x41			;INT 13h extensions present?
+	mov bx, 0x55AA
+	int 0x13
+	jc .no_extensions
+	cmp bx, 0xAA55
+	jne .no_extensions
+	test cl, 1			;packet interface supported
+	jz .no_extensions
+
+	mov si, dap
+	mov dl, [boot_drive]
+	mov ah, 0x42
+	int 0x13
+	jc .disk_error
+
+	mov dl, [boot_drive]
+	jmp 0:STAGE2_ADDR
+
+.no_extensions:
+	mov si, msg_no_extensions
+	jmp fatal
+.disk_error:
+	mov si, msg_disk_error
+
+fatal:
+	lodsb
+	test al, al
+	jz .halt
+	mov ah, 0x0E
+	mov bx, 0x0007
+	int 0x10
+	jmp fatal
+.halt:
+	cli
+	hlt
+	jmp .halt
+
+boot_drive:	db 0
+
+	align 4
+dap:	db 0x10, 0			;disk address packet
+	dw STAGE2_SECTORS
+	dw STAGE2_ADDR, 0		;offset, segment
+	dq 1				;stage 2 follows the MBR
+
+msg_no_extensions:	db "NaoBoot: no INT 13h extensions", 0
+msg_disk_error:		db "NaoBoot: disk read error", 0
+
+	times 510 - ($ - $$) db 0
+	dw 0xAA55
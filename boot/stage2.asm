@@ -0,0 +1,419 @@
+; NaoBoot stage 2 - loads the kernel ELF and the initrd, then enters it
+; the way a multiboot loader would: protected mode, paging off,
+; eax = 0x2BADB002, ebx = multiboot info.
+;
+; Disk reads use INT 13h extended reads of up to 127 sectors into a low
+; bounce buffer, copied above 1 MB from unreal mode. If the BIOS rejects
+; a transfer that large the count is halved and kept for later reads.
+; Each stage records a timestamp at 0x1000; the kernel's boot log turns
+; them into per-stage cycle counts.
+
+%include "naoboot.inc"
+
+CODE_SEL	equ 0x08
+DATA_SEL	equ 0x10
+
+bits 16
+org STAGE2_ADDR
+
+stage2:
+	jmp stage2_main
+
+	times CONFIG_OFFSET - ($ - $$) db 0
+config:		dd CONFIG_MAGIC
+kernel_lba:	dd 0
+kernel_size:	dd 0			;bytes
+initrd_lba:	dd 0
+initrd_size:	dd 0			;bytes, 0 for none
+cmdline:	times CMDLINE_LENGTH db 0
+
+stage2_main:
+	cli
+	xor ax, ax
+	mov ds, ax
+	mov es, ax
+	mov ss, ax
+	mov sp, 0x7C00
+	sti
+	cld
+	mov [boot_drive], dl
+
+	;stage 1 left the firmware timestamp in entry 0
+	mov dword [STAGES_ADDR], STAGES_MAGIC
+	mov dword [STAGES_ADDR + 4], 1
+	mov si, name_firmware
+	mov di, STAGES_ADDR + 8
+	mov cx, STAGE_NAME_LENGTH
+	rep movsb
+	mov si, name_mbr
+	call mark
+
+	call enable_a20
+	mov si, name_a20
+	call mark
+
+	;kernel: read the whole ELF to the staging area, then place segments
+	call enter_unreal
+	mov eax, [kernel_lba]
+	mov ecx, [kernel_size]
+	mov edi, ELF_STAGING
+	call read_high
+	call load_elf
+	mov si, name_kernel
+	call mark
+
+	;initrd: first page boundary after the kernel image
+	mov ecx, [initrd_size]
+	test ecx, ecx
+	jz .no_initrd
+	mov edi, [image_end]
+	add edi, 0xFFF
+	and edi, 0xFFFFF000
+	mov [MB_MODULE_ADDR], edi	;mod_start
+	lea edx, [edi + ecx]
+	mov [MB_MODULE_ADDR + 4], edx	;mod_end
+	mov dword [MB_MODULE_ADDR + 8], module_name
+	mov dword [MB_MODULE_ADDR + 12], 0
+	mov eax, [initrd_lba]
+	call read_high
+	mov si, name_initrd
+	call mark
+.no_initrd:
+
+	call build_info
+	mov si, name_bootinfo
+	call mark
+
+	;enter the kernel
+	cli
+	lgdt [gdt_desc]
+	mov eax, cr0
+	or al, 1
+	mov cr0, eax
+	jmp CODE_SEL:protected_mode
+
+; Record the end of a boot stage; si = 12-byte name
+mark:
+	pushad
+	mov bx, [STAGES_ADDR + 4]
+	cmp bx, STAGES_MAX
+	jae .done
+	imul di, bx, STAGE_SIZE
+	add di, STAGES_ADDR + 8
+	mov cx, STAGE_NAME_LENGTH
+	rep movsb
+	rdtsc
+	mov [di], eax
+	mov [di + 4], edx
+	inc word [STAGES_ADDR + 4]
+.done:
+	popad
+	ret
+
+; A20: already on (QEMU, most modern boards), then the BIOS call, then
+; port 0x92, and the keyboard controller only as the slow last resort
+enable_a20:
+	call a20_enabled
+	jnz .done
+	mov ax, 0x2401
+	int 0x15
+	call a20_enabled
+	jnz .done
+	in al, 0x92
+	test al, 0x02
+	jnz .keyboard			;bit already set and still off: no fast gate
+	or al, 0x02
+	and al, 0xFE			;bit 0 would reset the machine
+	out 0x92, al
+	call a20_enabled
+	jnz .done
+.keyboard:
+	call kbc_wait
+	mov al, 0xD1			;write output port
+	out 0x64, al
+	call kbc_wait
+	mov al, 0xDF
+	out 0x60, al
+	call kbc_wait
+	call a20_enabled
+	jnz .done
+	mov si, msg_a20
+	jmp fatal
+.done:
+	ret
+
+kbc_wait:
+	in al, 0x64
+	test al, 0x02
+	jnz kbc_wait
+	ret
+
+; ZF clear when A20 is on - with it off FFFF:7E0E wraps onto 0000:7DFE
+a20_enabled:
+	push ds
+	push es
+	push bx
+	xor ax, ax
+	mov ds, ax
+	not ax
+	mov es, ax
+	mov bl, [ds:0x7DFE]
+	mov byte [ds:0x7DFE], 0x00
+	mov byte [es:0x7E0E], 0xFF
+	cmp byte [ds:0x7DFE], 0xFF
+	mov [ds:0x7DFE], bl
+	pop bx
+	pop es
+	pop ds
+	ret
+
+; Load ds/es with 4 GB limits and drop back to real mode; the cached
+; limits stay, so 32-bit addresses reach all memory. BIOS calls may
+; reload the segments, so this is repeated after each one.
+enter_unreal:
+	push eax
+	push ds
+	push es
+	cli
+	lgdt [gdt_desc]
+	mov eax, cr0
+	or al, 1
+	mov cr0, eax
+	jmp $ + 2
+	mov ax, DATA_SEL
+	mov ds, ax
+	mov es, ax
+	mov eax, cr0
+	and al, 0xFE
+	mov cr0, eax
+	pop es
+	pop ds
+	sti
+	pop eax
+	ret
+
+; Read ecx bytes starting at LBA eax to the flat address edi
+read_high:
+	add ecx, 511
+	shr ecx, 9			;sectors left
+.next:
+	test ecx, ecx
+	jz .done
+	movzx ebx, word [max_sectors]
+	cmp ecx, ebx
+	jae .read
+	mov ebx, ecx
+.read:
+	mov [dap.count], bx
+	mov [dap.lba], eax
+	push eax
+	push ebx
+	push ecx
+	push edi
+	mov si, dap
+	mov dl, [boot_drive]
+	mov ah, 0x42
+	int 0x13
+	pop edi
+	pop ecx
+	pop ebx
+	pop eax
+	jc .failed
+	call enter_unreal
+	push ecx
+	mov esi, BOUNCE_ADDR
+	mov ecx, ebx
+	shl ecx, 7			;dwords
+	a32 rep movsd
+	pop ecx
+	add eax, ebx
+	sub ecx, ebx
+	jmp .next
+.failed:
+	cmp word [max_sectors], 1
+	je .error
+	shr word [max_sectors], 1
+	jmp .next
+.error:
+	mov si, msg_disk_error
+	jmp fatal
+.done:
+	ret
+
+; Copy the PT_LOAD segments of the staged ELF to their physical
+; addresses and clear their bss; image_end is the highest end address
+load_elf:
+	mov esi, ELF_STAGING
+	cmp dword [esi], 0x464C457F	;"\x7FELF"
+	jne .bad
+	mov eax, [esi + 24]		;e_entry
+	mov [kernel_entry], eax
+	mov ebx, [esi + 28]		;e_phoff
+	add ebx, esi
+	mov ax, [esi + 42]		;e_phentsize
+	mov [phentsize], ax
+	movzx edx, word [esi + 44]	;e_phnum
+.segment:
+	test edx, edx
+	jz .done
+	cmp dword [ebx], 1		;PT_LOAD
+	jne .skip
+	mov edi, [ebx + 12]		;p_paddr
+	mov esi, [ebx + 4]		;p_offset
+	add esi, ELF_STAGING
+	mov ecx, [ebx + 16]		;p_filesz
+	push ecx
+	shr ecx, 2
+	a32 rep movsd
+	pop ecx
+	and ecx, 3
+	a32 rep movsb
+	mov ecx, [ebx + 20]		;p_memsz
+	sub ecx, [ebx + 16]
+	xor al, al
+	a32 rep stosb
+	cmp edi, [image_end]
+	jbe .skip
+	mov [image_end], edi
+.skip:
+	movzx eax, word [phentsize]
+	add ebx, eax
+	dec edx
+	jmp .segment
+.bad:
+	mov si, msg_bad_kernel
+	jmp fatal
+.done:
+	ret
+
+; Fill in the multiboot info: memory sizes, boot device, command line,
+; the initrd module, the E820 map and the loader name
+build_info:
+	mov dword [MB_INFO_ADDR], 0x001 | 0x002 | 0x004 | 0x040 | 0x200
+	movzx eax, byte [boot_drive]
+	shl eax, 24
+	or eax, 0x00FFFFFF		;no partition
+	mov [MB_INFO_ADDR + 12], eax
+	mov dword [MB_INFO_ADDR + 16], cmdline
+	mov dword [MB_INFO_ADDR + 64], loader_name
+
+	int 0x12			;KB below 1 MB
+	movzx eax, ax
+	mov [MB_INFO_ADDR + 4], eax
+	mov dword [MB_INFO_ADDR + 8], 0
+	mov ax, 0xE801
+	int 0x15
+	jc .no_e801
+	test ax, ax
+	jnz .e801
+	mov ax, cx
+	mov bx, dx
+.e801:
+	movzx eax, ax			;KB from 1 to 16 MB
+	movzx ebx, bx			;64 KB blocks above 16 MB
+	shl ebx, 6
+	add eax, ebx
+	mov [MB_INFO_ADDR + 8], eax
+.no_e801:
+
+	cmp dword [initrd_size], 0
+	je .no_modules
+	or dword [MB_INFO_ADDR], 0x008
+	mov dword [MB_INFO_ADDR + 20], 1
+	mov dword [MB_INFO_ADDR + 24], MB_MODULE_ADDR
+.no_modules:
+
+	mov di, MB_MMAP_ADDR + 4	;each entry is preceded by its size
+	xor ebx, ebx
+	xor bp, bp
+.e820:
+	mov eax, 0xE820
+	mov edx, 0x534D4150		;"SMAP"
+	mov ecx, 20
+	int 0x15
+	jc .e820_done
+	cmp eax, 0x534D4150
+	jne .e820_done
+	mov dword [di - 4], 20
+	add di, 24
+	inc bp
+	test ebx, ebx
+	jz .e820_done
+	cmp bp, MB_MMAP_MAX
+	jb .e820
+.e820_done:
+	movzx eax, bp
+	imul eax, eax, 24
+	mov [MB_INFO_ADDR + 44], eax
+	mov dword [MB_INFO_ADDR + 48], MB_MMAP_ADDR
+	ret
+
+print:
+	lodsb
+	test al, al
+	jz .done
+	mov ah, 0x0E
+	mov bx, 0x0007
+	int 0x10
+	jmp print
+.done:
+	ret
+
+fatal:
+	call print
+.halt:
+	cli
+	hlt
+	jmp .halt
+
+bits 32
+protected_mode:
+	mov ax, DATA_SEL
+	mov ds, ax
+	mov es, ax
+	mov fs, ax
+	mov gs, ax
+	mov ss, ax
+	mov esp, 0x7C00
+	mov eax, 0x2BADB002
+	mov ebx, MB_INFO_ADDR
+	jmp [kernel_entry]
+
+boot_drive:	db 0
+max_sectors:	dw BOUNCE_SECTORS
+kernel_entry:	dd 0
+phentsize:	dw 0
+image_end:	dd 0
+
+	align 4
+dap:		db 0x10, 0
+.count:		dw 0
+		dw 0, BOUNCE_SEGMENT	;offset, segment
+.lba:		dq 0
+
+	align 8
+gdt:		dq 0
+		dq 0x00CF9A000000FFFF	;code: base 0, 4 GB, 32-bit
+		dq 0x00CF92000000FFFF	;data: base 0, 4 GB
+gdt_desc:	dw gdt_desc - gdt - 1
+		dd gdt
+
+%macro stage_name 2
+%1:	db %2
+	times STAGE_NAME_LENGTH - ($ - %1) db 0
+%endmacro
+
+stage_name name_firmware, "firmware"
+stage_name name_mbr, "mbr"
+stage_name name_a20, "a20"
+stage_name name_kernel, "kernel"
+stage_name name_initrd, "initrd"
+stage_name name_bootinfo, "bootinfo"
+
+loader_name:	db "NaoBoot", 0
+module_name:	db "initrd", 0
+msg_a20:	db "NaoBoot: cannot enable A20", 0
+msg_disk_error:	db "NaoBoot: disk read error", 0
+msg_bad_kernel:	db "NaoBoot: kernel is not an ELF image", 0
+
+	times STAGE2_SECTORS * 512 - ($ - $$) db 0
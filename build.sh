@@ -3,29 +3,150 @@
 
 mkdir -p bin
 
+# Freestanding kernel code: no libc, no builtins, no position independence.
+# One section per function so link.ld can order them
+CFLAGS="-fno-stack-protector -m32 -ffreestanding -fno-pie -fno-strict-aliasing -O2 -ffunction-sections"
+
+# Function order from a profile (tools/prof2order.py), empty without one
+if [[ -f link.order ]]; then
+    sed 's/.*/*(.text.&)/' link.order > bin/link_order.ld
+else
+    : > bin/link_order.ld
+fi
+
 # Compile kernel assembly
 echo "Compiling kernel assembly..."
 nasm -f elf32 kernel.asm -o bin/kasm.o
 
+# Assemble the NaoBoot loader (tools/mkboot.py turns it into a disk image)
+echo "Assembling boot loader..."
+nasm -f bin -I boot/ boot/stage1.asm -o bin/stage1.bin
+nasm -f bin -I boot/ boot/stage2.asm -o bin/stage2.bin
+
+# Compile boot interface
+echo "Compiling boot interface..."
+gcc $CFLAGS -c boot/multiboot.c -o bin/multiboot.o
+
+# Compile CPU support
+echo "Compiling CPU support..."
+gcc $CFLAGS -c cpu/cpu.c -o bin/cpu.o
+gcc $CFLAGS -c cpu/fpu.c -o bin/fpu.o
+gcc $CFLAGS -c cpu/gdt.c -o bin/gdt.o
+
+# Compile drivers
+echo "Compiling drivers..."
+gcc $CFLAGS -c drivers/serial.c -o bin/serial.o
+gcc $CFLAGS -c drivers/pit.c -o bin/pit.o
+gcc $CFLAGS -c drivers/pci.c -o bin/pci.o
+gcc $CFLAGS -c drivers/virtio.c -o bin/virtio.o
+gcc $CFLAGS -c drivers/virtio_blk.c -o bin/virtio_blk.o
+gcc $CFLAGS -c drivers/ata.c -o bin/ata.o
+
+# Compile block layer
+echo "Compiling block layer..."
+gcc $CFLAGS -c block/block.c -o bin/block.o
+gcc $CFLAGS -c block/bcache.c -o bin/bcache.o
+
+# Compile filesystem
+echo "Compiling filesystem..."
+gcc $CFLAGS -c fs/fat.c -o bin/fat.o
+gcc $CFLAGS -c fs/vfs.c -o bin/vfs.o
+gcc $CFLAGS -c fs/ramfs.c -o bin/ramfs.o
+gcc $CFLAGS -c fs/fatfs.c -o bin/fatfs.o
+gcc $CFLAGS -c fs/initrd.c -o bin/initrd.o
+
+# Compile tracing and profiling
+echo "Compiling tracing and profiling..."
+gcc $CFLAGS -c debug/trace.c -o bin/trace.o
+gcc $CFLAGS -c debug/prof.c -o bin/prof.o
+gcc $CFLAGS -c debug/ksyms.c -o bin/ksyms_lookup.o
+gcc $CFLAGS -c debug/bootlog.c -o bin/bootlog.o
+
+# Compile tasks
+echo "Compiling tasks..."
+nasm -f elf32 task/switch.asm -o bin/switch.o
+gcc $CFLAGS -c task/task.c -o bin/task.o
+gcc $CFLAGS -c task/softirq.c -o bin/softirq.o
+gcc $CFLAGS -c task/pipe.c -o bin/pipe.o
+gcc $CFLAGS -c task/msg.c -o bin/msg.o
+nasm -f elf32 task/syscall.asm -o bin/syscall_asm.o
+gcc $CFLAGS -c task/syscall.c -o bin/syscall.o
+gcc $CFLAGS -c task/user.c -o bin/user.o
+gcc $CFLAGS -c task/exec.c -o bin/exec.o
+
+# Compile string library (no loop-to-memcpy rewriting inside memcpy itself)
+echo "Compiling string library..."
+gcc $CFLAGS -fno-tree-loop-distribute-patterns -c lib/string.c -o bin/string.o
+
+# Compile essentials
+echo "Compiling essentials..."
+gcc $CFLAGS -c essentials/types.c -o bin/types.o
+
+# Compile memory subsystem
+echo "Compiling memory subsystem..."
+gcc $CFLAGS -c memory/page.c -o bin/page.o
+gcc $CFLAGS -c memory/slab.c -o bin/slab.o
+gcc $CFLAGS -c memory/arena.c -o bin/arena.o
+gcc $CFLAGS -c memory/paging.c -o bin/paging.o
+gcc $CFLAGS -c memory/cache.c -o bin/cache.o
+gcc $CFLAGS -c memory/vma.c -o bin/vma.o
+
 # Compile output subsystem
 echo "Compiling output subsystem..."
-gcc -fno-stack-protector -m32 -c output/output.c -o bin/output.o
+gcc $CFLAGS -c output/output.c -o bin/output.o
 
 # Compile input subsystem
 echo "Compiling input subsystem..."
-gcc -fno-stack-protector -m32 -c input/input.c -o bin/input.o
+gcc $CFLAGS -c input/input.c -o bin/input.o
 
 # Compile shell
 echo "Compiling shell..."
-gcc -fno-stack-protector -m32 -c shell/shell.c -o bin/shell.o
+gcc $CFLAGS -c shell/shell.c -o bin/shell.o
+gcc $CFLAGS -c shell/fs_commands.c -o bin/fs_commands.o
+gcc $CFLAGS -c shell/script.c -o bin/script.o
+gcc $CFLAGS -c shell/pipeline.c -o bin/pipeline.o
+gcc $CFLAGS -c shell/filters.c -o bin/filters.o
+
+# Compile benchmark harness
+echo "Compiling benchmarks..."
+gcc $CFLAGS -c bench/bench.c -o bin/bench.o
 
 # Compile kernel
 echo "Compiling kernel..."
-gcc -fno-stack-protector -m32 -c kernel.c -o bin/kc.o
+gcc $CFLAGS -c kernel.c -o bin/kc.o
 
-# Link everything together
+# Link everything together - twice: the first image is run through nm to
+# generate the symbol table, the second embeds it after .text
 echo "Linking kernel..."
-ld -m elf_i386 -T link.ld -o bin/kernel bin/kasm.o bin/kc.o bin/output.o bin/input.o bin/shell.o
+OBJS="bin/kasm.o bin/kc.o bin/output.o bin/input.o bin/shell.o bin/page.o bin/slab.o bin/arena.o bin/paging.o bin/cache.o bin/cpu.o bin/bench.o bin/string.o bin/types.o bin/fpu.o bin/task.o bin/switch.o bin/serial.o bin/trace.o bin/pit.o bin/prof.o bin/ksyms_lookup.o bin/bootlog.o bin/softirq.o bin/ata.o bin/block.o bin/pci.o bin/virtio.o bin/virtio_blk.o bin/bcache.o bin/fat.o bin/vfs.o bin/ramfs.o bin/fatfs.o bin/initrd.o bin/multiboot.o bin/fs_commands.o bin/script.o bin/pipeline.o bin/filters.o bin/pipe.o bin/gdt.o bin/syscall_asm.o bin/syscall.o bin/user.o bin/vma.o bin/exec.o bin/msg.o"
+tools/mksyms.sh > bin/ksyms.c
+gcc $CFLAGS -c bin/ksyms.c -o bin/ksyms.o
+ld -m elf_i386 -T link.ld -o bin/kernel $OBJS bin/ksyms.o
+
+echo "Embedding symbol table..."
+nm -n bin/kernel | grep ' [Tt] ' > bin/ksyms.pass1
+tools/mksyms.sh bin/kernel > bin/ksyms.c
+gcc $CFLAGS -c bin/ksyms.c -o bin/ksyms.o
+ld -m elf_i386 -T link.ld -o bin/kernel $OBJS bin/ksyms.o
+nm -n bin/kernel | grep ' [Tt] ' | cmp -s - bin/ksyms.pass1 || echo "Warning: symbol addresses moved between link passes"
+
+# Compressed image: the LZ4 stub carries bin/kernel as its payload and is
+# loaded instead of it, above the kernel's own load address
+echo "Compressing kernel..."
+tools/mklz4.py bin/kernel bin/kernel.lz4
+nasm -f elf32 -I boot/ boot/lz4stub.asm -o bin/lz4stub.o
+ld -m elf_i386 -Ttext 0x800000 -e lz4_start -o bin/kernelz bin/lz4stub.o
+
+# User programs: ELF files linked at the user base, packed into the initrd
+# under /bin by run.sh. crt0 goes first so _start is the entry point
+echo "Compiling user programs..."
+mkdir -p bin/initrd/bin
+UCFLAGS="-m32 -ffreestanding -fno-pie -fno-stack-protector -O2 -fno-asynchronous-unwind-tables"
+gcc $UCFLAGS -c user/crt0.c -o bin/ucrt0.o
+gcc $UCFLAGS -c user/hello.c -o bin/uhello.o
+gcc $UCFLAGS -c user/pagetest.c -o bin/upagetest.o
+ld -m elf_i386 -T user/user.ld -o bin/initrd/bin/hello bin/ucrt0.o bin/uhello.o
+ld -m elf_i386 -T user/user.ld -o bin/initrd/bin/pagetest bin/ucrt0.o bin/upagetest.o
 
 # Run in QEMU if --run argument is provided
 if [[ "$1" == "--run" ]]; then
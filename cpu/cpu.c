@@ -0,0 +1,37 @@
+/*
+ * CPU Feature Detection
+ * CPUID is executed once at boot and cached
+ */
+
+#include "cpu.h"
+#include "../essentials/sections.h"
+
+/* CPUID leaf 1 EDX feature bits */
+static unsigned int feature_edx;
+
+/* Interrupt handler nesting depth */
+volatile int irq_nesting = 0;
+
+/* Read and cache CPU features */
+__init void cpu_init(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	unsigned int max_leaf;
+
+	cpu_cpuid(0, &max_leaf, &ebx, &ecx, &edx);
+	if (max_leaf >= 1) {
+		cpu_cpuid(1, &eax, &ebx, &ecx, &edx);
+
+		/* The Pentium Pro reports SEP but has no SYSENTER/SYSEXIT */
+		if (((eax >> 8) & 0xF) == 6 && ((eax >> 4) & 0xF) < 3 && (eax & 0xF) < 3) {
+			edx &= ~CPU_FEATURE_SEP;
+		}
+		feature_edx = edx;
+	}
+}
+
+/* Check a CPUID leaf 1 EDX feature bit */
+int cpu_has_feature(unsigned int feature)
+{
+	return (feature_edx & feature) != 0;
+}
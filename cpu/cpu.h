@@ -0,0 +1,214 @@
+/*
+ * CPU Helpers - Interrupt state, per-CPU identity and spinlocks
+ */
+
+#ifndef CPU_H
+#define CPU_H
+
+/* Number of CPUs the kernel keeps per-CPU state for */
+#define NR_CPUS 1
+
+/* EFLAGS interrupt enable bit */
+#define EFLAGS_IF 0x200
+
+/* Control register bits */
+#define CR0_MP 0x00000002
+#define CR0_EM 0x00000004
+#define CR0_TS 0x00000008
+#define CR0_NE 0x00000020
+#define CR0_PG 0x80000000
+#define CR0_CD 0x40000000
+#define CR0_NW 0x20000000
+#define CR0_WP 0x00010000
+#define CR4_PSE 0x00000010
+#define CR4_PGE 0x00000080
+#define CR4_OSFXSR 0x00000200
+#define CR4_OSXMMEXCPT 0x00000400
+
+/* CPUID leaf 1 feature bits (EDX) */
+#define CPU_FEATURE_FPU (1u << 0)
+#define CPU_FEATURE_PSE (1u << 3)
+#define CPU_FEATURE_TSC (1u << 4)
+#define CPU_FEATURE_MSR (1u << 5)
+#define CPU_FEATURE_SEP (1u << 11)
+#define CPU_FEATURE_MTRR (1u << 12)
+#define CPU_FEATURE_PGE (1u << 13)
+#define CPU_FEATURE_PAT (1u << 16)
+#define CPU_FEATURE_FXSR (1u << 24)
+#define CPU_FEATURE_SSE (1u << 25)
+#define CPU_FEATURE_SSE2 (1u << 26)
+
+/* Spinlock - also disables interrupts on the local CPU while held */
+typedef struct {
+	volatile int locked;
+} SpinLock;
+
+#define SPINLOCK_INIT { 0 }
+
+/* Index of the CPU we are running on */
+static inline unsigned int cpu_id(void)
+{
+	return 0;
+}
+
+/* Interrupt handler nesting depth (0 = task context) */
+extern volatile int irq_nesting;
+
+static inline void irq_enter(void)
+{
+	irq_nesting++;
+}
+
+static inline void irq_exit(void)
+{
+	irq_nesting--;
+}
+
+/* True while running inside an interrupt handler */
+static inline int cpu_in_irq(void)
+{
+	return irq_nesting != 0;
+}
+
+/* Execute CPUID for a leaf */
+static inline void cpu_cpuid(unsigned int leaf, unsigned int *eax, unsigned int *ebx,
+                             unsigned int *ecx, unsigned int *edx)
+{
+	__asm__ volatile("cpuid"
+	                 : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+	                 : "a"(leaf), "c"(0));
+}
+
+/* Control register access */
+static inline unsigned long cpu_read_cr0(void)
+{
+	unsigned long value;
+	__asm__ volatile("movl %%cr0, %0" : "=r"(value));
+	return value;
+}
+
+static inline void cpu_write_cr0(unsigned long value)
+{
+	__asm__ volatile("movl %0, %%cr0" : : "r"(value) : "memory");
+}
+
+static inline unsigned long cpu_read_cr2(void)
+{
+	unsigned long value;
+	__asm__ volatile("movl %%cr2, %0" : "=r"(value));
+	return value;
+}
+
+static inline unsigned long cpu_read_cr3(void)
+{
+	unsigned long value;
+	__asm__ volatile("movl %%cr3, %0" : "=r"(value));
+	return value;
+}
+
+static inline void cpu_write_cr3(unsigned long value)
+{
+	__asm__ volatile("movl %0, %%cr3" : : "r"(value) : "memory");
+}
+
+static inline unsigned long cpu_read_cr4(void)
+{
+	unsigned long value;
+	__asm__ volatile("movl %%cr4, %0" : "=r"(value));
+	return value;
+}
+
+static inline void cpu_write_cr4(unsigned long value)
+{
+	__asm__ volatile("movl %0, %%cr4" : : "r"(value) : "memory");
+}
+
+/* Model specific registers */
+static inline unsigned long long cpu_rdmsr(unsigned int msr)
+{
+	unsigned int low, high;
+	__asm__ volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+	return ((unsigned long long)high << 32) | low;
+}
+
+static inline void cpu_wrmsr(unsigned int msr, unsigned long long value)
+{
+	__asm__ volatile("wrmsr" : : "c"(msr), "a"((unsigned int)value),
+	                 "d"((unsigned int)(value >> 32)) : "memory");
+}
+
+/* Write back and invalidate all caches */
+static inline void cpu_wbinvd(void)
+{
+	__asm__ volatile("wbinvd" : : : "memory");
+}
+
+/* Invalidate the TLB entry for one page */
+static inline void cpu_invlpg(unsigned long addr)
+{
+	__asm__ volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+/* Read the time stamp counter */
+static inline unsigned long long cpu_rdtsc(void)
+{
+	unsigned int low, high;
+	__asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+	return ((unsigned long long)high << 32) | low;
+}
+
+/* Enable / disable interrupts on the local CPU */
+static inline void irq_enable(void)
+{
+	__asm__ volatile("sti" : : : "memory");
+}
+
+static inline void irq_disable(void)
+{
+	__asm__ volatile("cli" : : : "memory");
+}
+
+/* Idle until the next interrupt, then return with interrupts disabled */
+static inline void cpu_wait_for_interrupt(void)
+{
+	__asm__ volatile("sti; hlt; cli" : : : "memory");
+}
+
+/* Disable interrupts and return the previous EFLAGS */
+static inline unsigned long irq_save(void)
+{
+	unsigned long flags;
+	__asm__ volatile("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+	return flags;
+}
+
+/* Restore the interrupt state returned by irq_save() */
+static inline void irq_restore(unsigned long flags)
+{
+	__asm__ volatile("pushl %0; popfl" : : "r"(flags) : "memory", "cc");
+}
+
+/* Acquire a spinlock with local interrupts disabled */
+static inline unsigned long spin_lock_irqsave(SpinLock *lock)
+{
+	unsigned long flags = irq_save();
+	while (__sync_lock_test_and_set(&lock->locked, 1)) {
+		while (lock->locked) {
+			__asm__ volatile("pause");
+		}
+	}
+	return flags;
+}
+
+/* Release a spinlock and restore the previous interrupt state */
+static inline void spin_unlock_irqrestore(SpinLock *lock, unsigned long flags)
+{
+	__sync_lock_release(&lock->locked);
+	irq_restore(flags);
+}
+
+/* Feature detection */
+void cpu_init(void);
+int cpu_has_feature(unsigned int feature);
+
+#endif /* CPU_H */
@@ -0,0 +1,161 @@
+/*
+ * FPU/SSE Context Management
+ * The FPU register file is switched lazily: a context switch only sets
+ * CR0.TS, and the first FPU/SSE instruction of the next task raises #NM.
+ * The handler saves the previous owner's registers and loads the current
+ * task's, so tasks that never touch the FPU pay nothing per switch.
+ */
+
+#include "fpu.h"
+#include "cpu.h"
+#include "../kernel.h"
+#include "../output/output.h"
+#include "../memory/slab.h"
+#include "../essentials/sections.h"
+
+/* Power-on MXCSR: all SIMD exceptions masked, round to nearest */
+#define MXCSR_DEFAULT 0x1F80
+
+extern void device_not_available_handler(void);
+
+/* Task whose state is currently in the FPU registers (0 = nobody) */
+static Task *owner = 0;
+
+/* FXSAVE/FXRSTOR available - otherwise FNSAVE/FRSTOR */
+static int use_fxsr = 0;
+
+/* CR0.TS mirror so a switch between non-FPU tasks skips the CR0 write */
+static int ts_set = 0;
+
+static inline void fpu_clts(void)
+{
+	__asm__ volatile("clts" : : : "memory");
+	ts_set = 0;
+}
+
+static inline void fpu_stts(void)
+{
+	cpu_write_cr0(cpu_read_cr0() | CR0_TS);
+	ts_set = 1;
+}
+
+static inline void fpu_save(FpuState *state)
+{
+	if (use_fxsr) {
+		__asm__ volatile("fxsave (%0)" : : "r"(state) : "memory");
+	} else {
+		__asm__ volatile("fnsave (%0); fwait" : : "r"(state) : "memory");
+	}
+}
+
+static inline void fpu_restore(FpuState *state)
+{
+	if (use_fxsr) {
+		__asm__ volatile("fxrstor (%0)" : : "r"(state) : "memory");
+	} else {
+		__asm__ volatile("frstor (%0)" : : "r"(state) : "memory");
+	}
+}
+
+/* Enable the x87 unit and, when present, SSE; install the #NM handler */
+__init void fpu_init(void)
+{
+	unsigned long cr0;
+
+	if (!cpu_has_feature(CPU_FEATURE_FPU)) {
+		kprint("FPU: not present");
+		kprint_newline();
+		return;
+	}
+
+	/* Native error reporting, WAIT honours TS, no emulation */
+	cr0 = cpu_read_cr0();
+	cr0 &= ~(CR0_EM | CR0_TS);
+	cr0 |= CR0_MP | CR0_NE;
+	cpu_write_cr0(cr0);
+	__asm__ volatile("fninit");
+
+	use_fxsr = cpu_has_feature(CPU_FEATURE_FXSR);
+	if (use_fxsr && cpu_has_feature(CPU_FEATURE_SSE)) {
+		cpu_write_cr4(cpu_read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+	}
+
+	idt_set_gate(VECTOR_DEVICE_NOT_AVAILABLE, device_not_available_handler, INTERRUPT_GATE);
+
+	/* Nobody owns the freshly initialised registers yet */
+	owner = 0;
+	fpu_stts();
+}
+
+/* Called on every context switch: trap the next FPU use unless next owns it */
+void fpu_switch_to(Task *next)
+{
+	if (next == owner) {
+		if (ts_set) {
+			fpu_clts();
+		}
+	} else if (!ts_set) {
+		fpu_stts();
+	}
+}
+
+/* Forget a dying task's FPU state */
+void fpu_task_exit(Task *task)
+{
+	if (owner == task) {
+		owner = 0;
+	}
+	if (task->fpu) {
+		kfree(task->fpu);
+		task->fpu = 0;
+	}
+}
+
+/* Task whose registers are live in the FPU */
+Task* fpu_owner(void)
+{
+	return owner;
+}
+
+/* SSE state is being saved and restored (CR4.OSFXSR) */
+int fpu_has_sse(void)
+{
+	return (cpu_read_cr4() & CR4_OSFXSR) != 0;
+}
+
+/* #NM: hand the FPU to the current task */
+void device_not_available_main(void)
+{
+	Task *current = task_current();
+
+	fpu_clts();
+	if (owner == current) {
+		return;
+	}
+
+	if (owner && owner->fpu) {
+		fpu_save(owner->fpu);
+	}
+
+	if (current->fpu) {
+		fpu_restore(current->fpu);
+	} else {
+		/* First FPU use - slab objects of 512 bytes are 16-byte aligned */
+		current->fpu = (FpuState*)kzalloc(sizeof(FpuState));
+		if (!current->fpu) {
+			kprint("FPU: out of memory for task state");
+			kprint_newline();
+			while (1) {
+				__asm__ volatile("cli; hlt");
+			}
+		}
+		__asm__ volatile("fninit");
+		if (use_fxsr && fpu_has_sse()) {
+			unsigned int mxcsr = MXCSR_DEFAULT;
+			__asm__ volatile("ldmxcsr %0" : : "m"(mxcsr));
+		}
+	}
+
+	owner = current;
+	current->fpu_traps++;
+}
@@ -0,0 +1,25 @@
+/*
+ * FPU/SSE - x87 and SSE enablement with lazy per-task context save
+ */
+
+#ifndef FPU_H
+#define FPU_H
+
+#include "../task/task.h"
+
+/* CPU exception vector for "device not available" (CR0.TS set) */
+#define VECTOR_DEVICE_NOT_AVAILABLE 7
+
+/* FXSAVE image - 512 bytes, must be 16-byte aligned (FNSAVE uses the first 108) */
+typedef struct FpuState {
+	unsigned char data[512];
+} __attribute__((aligned(16))) FpuState;
+
+/* FPU functions */
+void fpu_init(void);
+void fpu_switch_to(Task *next);
+void fpu_task_exit(Task *task);
+Task* fpu_owner(void);
+int fpu_has_sse(void);
+
+#endif /* FPU_H */
@@ -0,0 +1,73 @@
+/*
+ * GDT/TSS Implementation
+ * Replaces whatever descriptor table the boot loader left behind with
+ * flat 4 GB kernel and user segments and a TSS. Paging does all of the
+ * protection; the segments only select the privilege level.
+ */
+
+#include "gdt.h"
+#include "../essentials/sections.h"
+
+#define GDT_ENTRIES 6
+
+/* Access bytes */
+#define GDT_ACCESS_KERNEL_CODE 0x9A  /* present, ring 0, code, readable */
+#define GDT_ACCESS_KERNEL_DATA 0x92  /* present, ring 0, data, writable */
+#define GDT_ACCESS_USER_CODE 0xFA
+#define GDT_ACCESS_USER_DATA 0xF2
+#define GDT_ACCESS_TSS 0x89          /* present, ring 0, available 32-bit TSS */
+
+/* Flags nibble: 4 KB granularity, 32-bit */
+#define GDT_FLAGS_FLAT 0xC
+
+Tss tss;
+
+static unsigned long long gdt[GDT_ENTRIES] __attribute__((aligned(8)));
+
+/* Encode one segment descriptor */
+static void gdt_set(int selector, unsigned long base, unsigned long limit,
+                    unsigned char access, unsigned char flags)
+{
+	unsigned long long entry;
+
+	entry = limit & 0xFFFF;
+	entry |= (unsigned long long)(base & 0xFFFFFF) << 16;
+	entry |= (unsigned long long)access << 40;
+	entry |= (unsigned long long)((limit >> 16) & 0xF) << 48;
+	entry |= (unsigned long long)(flags & 0xF) << 52;
+	entry |= (unsigned long long)((base >> 24) & 0xFF) << 56;
+	gdt[selector >> 3] = entry;
+}
+
+/* Load the GDT, reload every segment register and the task register */
+__init void gdt_init(void)
+{
+	struct {
+		unsigned short limit;
+		unsigned long base;
+	} __attribute__((packed)) gdt_ptr;
+
+	gdt_set(GDT_KERNEL_CODE, 0, 0xFFFFF, GDT_ACCESS_KERNEL_CODE, GDT_FLAGS_FLAT);
+	gdt_set(GDT_KERNEL_DATA, 0, 0xFFFFF, GDT_ACCESS_KERNEL_DATA, GDT_FLAGS_FLAT);
+	gdt_set(GDT_USER_CODE, 0, 0xFFFFF, GDT_ACCESS_USER_CODE, GDT_FLAGS_FLAT);
+	gdt_set(GDT_USER_DATA, 0, 0xFFFFF, GDT_ACCESS_USER_DATA, GDT_FLAGS_FLAT);
+
+	/* No I/O bitmap: the map offset points past the segment limit */
+	tss.ss0 = GDT_KERNEL_DATA;
+	tss.iomap_base = sizeof(Tss);
+	gdt_set(GDT_TSS, (unsigned long)&tss, sizeof(Tss) - 1, GDT_ACCESS_TSS, 0);
+
+	gdt_ptr.limit = sizeof(gdt) - 1;
+	gdt_ptr.base = (unsigned long)gdt;
+	__asm__ volatile("lgdt %0\n\t"
+	                 "ljmp %1, $1f\n"
+	                 "1:\n\t"
+	                 "movw %w2, %%ds\n\t"
+	                 "movw %w2, %%es\n\t"
+	                 "movw %w2, %%fs\n\t"
+	                 "movw %w2, %%gs\n\t"
+	                 "movw %w2, %%ss\n\t"
+	                 "ltr %w3"
+	                 : : "m"(gdt_ptr), "i"(GDT_KERNEL_CODE), "r"(GDT_KERNEL_DATA), "r"(GDT_TSS)
+	                 : "memory");
+}
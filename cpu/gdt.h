@@ -0,0 +1,44 @@
+/*
+ * GDT/TSS - Kernel and user segments and the task state segment
+ */
+
+#ifndef GDT_H
+#define GDT_H
+
+/*
+ * Segment selectors. SYSENTER/SYSEXIT derive every selector from the
+ * kernel code one, so the order is fixed: kernel code, kernel data,
+ * user code, user data. task/syscall.asm repeats these values.
+ */
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_CODE 0x1B  /* 0x18 | RPL 3 */
+#define GDT_USER_DATA 0x23  /* 0x20 | RPL 3 */
+#define GDT_TSS 0x28
+
+/* 32-bit task state segment - only ss0/esp0 are used, for ring 3 -> 0 */
+typedef struct {
+	unsigned int link;
+	unsigned int esp0;
+	unsigned int ss0;
+	unsigned int esp1, ss1, esp2, ss2;
+	unsigned int cr3, eip, eflags;
+	unsigned int eax, ecx, edx, ebx, esp, ebp, esi, edi;
+	unsigned int es, cs, ss, ds, fs, gs;
+	unsigned int ldt;
+	unsigned short trap;
+	unsigned short iomap_base;
+} __attribute__((packed)) Tss;
+
+extern Tss tss;
+
+/* GDT functions */
+void gdt_init(void);
+
+/* Kernel stack the CPU switches to when ring 3 is interrupted */
+static inline void tss_set_kernel_stack(unsigned long esp0)
+{
+	tss.esp0 = esp0;
+}
+
+#endif /* GDT_H */
@@ -0,0 +1,128 @@
+/*
+ * Boot Log Implementation
+ * Marks are a name and a TSC value; the first one is taken on entry to
+ * kmain, so its value is the time spent in firmware and the loader. When
+ * NaoBoot or the LZ4 stub ran, their stage timestamps come first,
+ * splitting that time up. The TSC is only calibrated when the log is printed,
+ * keeping it off the boot path.
+ */
+
+#include "bootlog.h"
+#include "../cpu/cpu.h"
+#include "../output/output.h"
+#include "../drivers/pit.h"
+#include "../bench/bench.h"
+#include "../lib/string.h"
+#include "../boot/multiboot.h"
+#include "../essentials/sections.h"
+
+/* Kernel image without bss (link.ld) - what the LZ4 stub writes */
+extern char _kernel_start[];
+extern char _edata[];
+
+typedef struct {
+	const char *phase;
+	unsigned long long tsc;
+} BootMark;
+
+static BootMark marks[BOOTLOG_MAX_PHASES];
+static int mark_count = 0;
+
+void bootlog_mark(const char *phase)
+{
+	if (mark_count < BOOTLOG_MAX_PHASES) {
+		marks[mark_count].phase = phase;
+		marks[mark_count].tsc = cpu_rdtsc();
+		mark_count++;
+	}
+}
+
+/* Cycles as microseconds at khz */
+static unsigned long long cycles_to_us(unsigned long long cycles, unsigned int khz)
+{
+	return bench_div64(cycles * 1000, khz);
+}
+
+static void print_padded(const char *text, int width)
+{
+	int len = strlen(text);
+
+	kprint(text);
+	while (len++ < width) {
+		kprint_char(' ');
+	}
+}
+
+/* Decompressed bytes per microsecond, i.e. MB/s */
+static void print_unlz4_rate(unsigned long long cycles, unsigned int khz)
+{
+	unsigned long long us = cycles_to_us(cycles, khz);
+
+	if (us == 0) {
+		return;
+	}
+	kprint(", ");
+	kprint_dec64(bench_div64(_edata - _kernel_start, (unsigned int)us));
+	kprint(" MB/s");
+}
+
+/* Loader stages up to the last one; returns its timestamp */
+static unsigned long long print_loader_stages(unsigned int khz)
+{
+	const LoaderStage *stage;
+	unsigned long long prev = 0;
+	int i;
+
+	for (i = 0; i < multiboot_loader_stage_count(); i++) {
+		stage = multiboot_loader_stage(i);
+		kprint("loader ");
+		print_padded(stage->name, 9);
+		kprint_dec64(cycles_to_us(stage->tsc - prev, khz));
+		kprint(" us  (");
+		kprint_dec64(stage->tsc - prev);
+		kprint(" cycles");
+		if (strcmp(stage->name, "unlz4") == 0) {
+			print_unlz4_rate(stage->tsc - prev, khz);
+		}
+		kprint(")\n");
+		prev = stage->tsc;
+	}
+	return prev;
+}
+
+/* Phase durations and the running total since kmain */
+__cold void bootlog_print(void)
+{
+	unsigned long long loader_end;
+	unsigned int khz;
+	int i;
+
+	if (mark_count == 0) {
+		kprint("No boot marks\n");
+		return;
+	}
+
+	khz = pit_tsc_khz();
+	kprint("TSC: ");
+	kprint_dec(khz / 1000);
+	kprint(" MHz\n");
+
+	loader_end = print_loader_stages(khz);
+	print_padded("before kmain", 16);
+	kprint_dec64(cycles_to_us(marks[0].tsc - loader_end, khz));
+	kprint(loader_end ? " us (kernel entry)\n" : " us (firmware and loader)\n");
+
+	for (i = 1; i < mark_count; i++) {
+		print_padded(marks[i].phase, 16);
+		kprint_dec64(cycles_to_us(marks[i].tsc - marks[i - 1].tsc, khz));
+		kprint(" us  (");
+		kprint_dec64(marks[i].tsc - marks[i - 1].tsc);
+		kprint(" cycles)\n");
+	}
+
+	print_padded("time to prompt", 16);
+	kprint_dec64(cycles_to_us(marks[mark_count - 1].tsc - marks[0].tsc, khz));
+	kprint(" us since kmain, ");
+	kprint_dec64(cycles_to_us(marks[mark_count - 1].tsc, khz));
+	kprint(" us since reset\n");
+}
@@ -0,0 +1,16 @@
+/*
+ * Boot Log - RDTSC timestamps of the boot phases
+ */
+
+#ifndef BOOTLOG_H
+#define BOOTLOG_H
+
+#define BOOTLOG_MAX_PHASES 24
+
+/* Record the end of a boot phase */
+void bootlog_mark(const char *phase);
+
+/* Print every phase with its duration */
+void bootlog_print(void);
+
+#endif /* BOOTLOG_H */
@@ -0,0 +1,49 @@
+/*
+ * Kernel Symbol Lookup
+ * build.sh links the kernel twice: the first image is run through nm to
+ * generate the table, the second embeds it. The table only adds read-only
+ * data after .text, so function addresses are identical in both images.
+ */
+
+#include "ksyms.h"
+
+/* End of kernel code (link.ld) */
+extern char _etext[];
+
+/* Index of the function containing address, or -1 */
+int ksyms_index(unsigned long address)
+{
+	int low = 0;
+	int high = (int)kernel_symbol_count - 1;
+	int mid;
+
+	if (kernel_symbol_count == 0 || address < kernel_symbols[0].address ||
+	    address >= (unsigned long)_etext) {
+		return -1;
+	}
+
+	/* Last symbol at or below address */
+	while (low < high) {
+		mid = (low + high + 1) / 2;
+		if (kernel_symbols[mid].address <= address) {
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
+	}
+	return low;
+}
+
+/* Name of the function containing address (0 if unknown) */
+const char* ksyms_lookup(unsigned long address, unsigned long *offset)
+{
+	int index = ksyms_index(address);
+
+	if (index < 0) {
+		return 0;
+	}
+	if (offset) {
+		*offset = address - kernel_symbols[index].address;
+	}
+	return kernel_symbols[index].name;
+}
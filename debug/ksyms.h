@@ -0,0 +1,22 @@
+/*
+ * Kernel Symbols - Function table embedded at build time
+ */
+
+#ifndef KSYMS_H
+#define KSYMS_H
+
+/* One text symbol */
+typedef struct {
+	unsigned long address;
+	const char *name;
+} KernelSymbol;
+
+/* Generated by tools/mksyms.sh into bin/ksyms.c, sorted by address */
+extern const KernelSymbol kernel_symbols[];
+extern const unsigned int kernel_symbol_count;
+
+/* Lookup */
+int ksyms_index(unsigned long address);
+const char* ksyms_lookup(unsigned long address, unsigned long *offset);
+
+#endif /* KSYMS_H */
@@ -0,0 +1,190 @@
+/*
+ * Sampling Profiler Implementation
+ * Every timer tick adds the interrupted EIP to a per-function histogram;
+ * the report names the functions through the embedded symbol table. The
+ * full ranking can be sent out on the serial port, where it becomes the
+ * function order of the next build (link.order, see link.ld).
+ */
+
+#include "prof.h"
+#include "ksyms.h"
+#include "../cpu/cpu.h"
+#include "../output/output.h"
+#include "../memory/slab.h"
+#include "../drivers/pit.h"
+#include "../bench/bench.h"
+#include "../drivers/serial.h"
+#include "../essentials/sections.h"
+
+volatile int prof_running = 0;
+
+/* Samples per entry of kernel_symbols */
+static unsigned int *histogram = 0;
+static unsigned int total_samples = 0;
+static unsigned int outside_samples = 0;
+
+/* Record one sample (timer interrupt context) */
+void prof_sample(unsigned long eip)
+{
+	int index = ksyms_index(eip);
+
+	total_samples++;
+	if (index < 0) {
+		outside_samples++;
+	} else {
+		histogram[index]++;
+	}
+}
+
+/* Start sampling - returns -1 if there is no symbol table or memory */
+int prof_start(void)
+{
+	if (kernel_symbol_count == 0) {
+		return -1;
+	}
+	if (!histogram) {
+		histogram = (unsigned int*)kzalloc(kernel_symbol_count * sizeof(unsigned int));
+		if (!histogram) {
+			return -1;
+		}
+	}
+	prof_running = 1;
+	return 0;
+}
+
+void prof_stop(void)
+{
+	prof_running = 0;
+}
+
+/* Drop all samples */
+void prof_clear(void)
+{
+	unsigned long flags = irq_save();
+	unsigned int i;
+
+	if (histogram) {
+		for (i = 0; i < kernel_symbol_count; i++) {
+			histogram[i] = 0;
+		}
+	}
+	total_samples = 0;
+	outside_samples = 0;
+	irq_restore(flags);
+}
+
+/* Print samples as a percentage with one decimal */
+static void print_share(unsigned int samples)
+{
+	unsigned int permille = (unsigned int)bench_div64((unsigned long long)samples * 1000, total_samples);
+
+	if (permille < 100) {
+		kprint(" ");
+	}
+	kprint_dec(permille / 10);
+	kprint_char('.');
+	kprint_dec(permille % 10);
+	kprint("%  ");
+	kprint_dec(samples);
+	kprint("  ");
+}
+
+/* Top functions by samples */
+__cold void prof_report(void)
+{
+	unsigned int shown[PROF_TOP_FUNCTIONS];
+	unsigned int rank;
+	unsigned int i;
+	unsigned int r;
+	int best;
+	int taken;
+
+	kprint("Samples: ");
+	kprint_dec(total_samples);
+	kprint(" at ");
+	kprint_dec(PIT_HZ);
+	kprint(" Hz");
+	kprint(prof_running ? " (running)\n" : "\n");
+	if (!histogram || total_samples == 0) {
+		return;
+	}
+
+	/* Selection of the largest counts - the table is small */
+	for (rank = 0; rank < PROF_TOP_FUNCTIONS; rank++) {
+		best = -1;
+		for (i = 0; i < kernel_symbol_count; i++) {
+			taken = 0;
+			for (r = 0; r < rank; r++) {
+				if (shown[r] == i) {
+					taken = 1;
+				}
+			}
+			if (!taken && histogram[i] > 0 &&
+			    (best < 0 || histogram[i] > histogram[best])) {
+				best = i;
+			}
+		}
+		if (best < 0) {
+			break;
+		}
+		shown[rank] = best;
+		print_share(histogram[best]);
+		kprint(kernel_symbols[best].name);
+		kprint_newline();
+	}
+
+	if (outside_samples) {
+		print_share(outside_samples);
+		kprint("(outside kernel text)\n");
+	}
+}
+
+/* Every sampled function with its count, most samples first */
+__cold void prof_dump_order(void)
+{
+	unsigned int *order;
+	unsigned int count = 0;
+	unsigned int i;
+	unsigned int j;
+	unsigned int index;
+
+	if (!serial_present()) {
+		kprint("No serial port\n");
+		return;
+	}
+	if (!histogram || total_samples == 0) {
+		kprint("No samples\n");
+		return;
+	}
+	order = (unsigned int*)kmalloc(kernel_symbol_count * sizeof(unsigned int));
+	if (!order) {
+		kprint("Out of memory\n");
+		return;
+	}
+
+	/* Insertion sort of the sampled entries - few have samples */
+	for (i = 0; i < kernel_symbol_count; i++) {
+		if (histogram[i] == 0) {
+			continue;
+		}
+		for (j = count; j > 0 && histogram[order[j - 1]] < histogram[i]; j--) {
+			order[j] = order[j - 1];
+		}
+		order[j] = i;
+		count++;
+	}
+
+	serial_write("#naoprof order\n");
+	for (i = 0; i < count; i++) {
+		index = order[i];
+		serial_write(kernel_symbols[index].name);
+		serial_write_char(' ');
+		serial_write_hex(histogram[index]);
+		serial_write_char('\n');
+	}
+	serial_write("#end\n");
+	kfree(order);
+
+	kprint_dec(count);
+	kprint(" functions written to serial\n");
+}
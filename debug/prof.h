@@ -0,0 +1,33 @@
+/*
+ * Profiler - Timer-driven sampling of the interrupted EIP
+ */
+
+#ifndef PROF_H
+#define PROF_H
+
+/* Functions shown by prof_report() */
+#define PROF_TOP_FUNCTIONS 15
+
+/* Sampling is on */
+extern volatile int prof_running;
+
+void prof_sample(unsigned long eip);
+
+/* Called from the timer interrupt */
+static inline void prof_tick(unsigned long eip)
+{
+	if (__builtin_expect(prof_running, 0)) {
+		prof_sample(eip);
+	}
+}
+
+/* Control and report */
+int prof_start(void);
+void prof_stop(void);
+void prof_clear(void);
+void prof_report(void);
+
+/* Sampled functions, hottest first, on COM1 for tools/prof2order.py */
+void prof_dump_order(void);
+
+#endif /* PROF_H */
@@ -0,0 +1,197 @@
+/*
+ * Event Tracing Implementation
+ * Writers claim a slot with one atomic increment of the per-CPU head, so
+ * an interrupt that traces in the middle of another event simply takes the
+ * next slot. The ring overwrites the oldest events once it is full.
+ */
+
+#include "trace.h"
+#include "../output/output.h"
+#include "../drivers/serial.h"
+
+/* Events shown by an on-screen dump (the newest ones) */
+#define TRACE_SCREEN_EVENTS 40
+
+volatile int trace_enabled = 0;
+
+static TraceBuffer trace_buffers[NR_CPUS];
+
+/* Names by event ID - also emitted in the serial header */
+static const char *trace_event_names[TRACE_NR_EVENTS] = {
+	"none",
+	"irq_entry",
+	"irq_exit",
+	"keyboard",
+	"input_complete",
+	"command_begin",
+	"command_end",
+	"scroll",
+	"task_switch",
+	"softirq",
+	"block_submit",
+	"block_complete"
+};
+
+/* Record one event on the local CPU */
+void trace_event(unsigned int id, unsigned int arg)
+{
+	unsigned int cpu = cpu_id();
+	TraceBuffer *buf = &trace_buffers[cpu];
+	unsigned int slot = __sync_fetch_and_add(&buf->head, 1) & (TRACE_BUFFER_EVENTS - 1);
+	TraceEvent *ev = &buf->events[slot];
+
+	ev->tsc = cpu_rdtsc();
+	ev->id = id;
+	ev->cpu = cpu;
+	ev->arg = arg;
+}
+
+void trace_start(void)
+{
+	trace_enabled = 1;
+}
+
+void trace_stop(void)
+{
+	trace_enabled = 0;
+}
+
+/* Forget all recorded events */
+void trace_clear(void)
+{
+	int cpu;
+	int was_enabled = trace_enabled;
+
+	trace_enabled = 0;
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		trace_buffers[cpu].head = 0;
+	}
+	trace_enabled = was_enabled;
+}
+
+/* Index of the oldest event still in a ring and the number of events */
+static unsigned int trace_window(TraceBuffer *buf, unsigned int *count)
+{
+	unsigned int head = buf->head;
+
+	if (head > TRACE_BUFFER_EVENTS) {
+		*count = TRACE_BUFFER_EVENTS;
+		return head - TRACE_BUFFER_EVENTS;
+	}
+	*count = head;
+	return 0;
+}
+
+static const char* trace_name(unsigned int id)
+{
+	return id < TRACE_NR_EVENTS ? trace_event_names[id] : "unknown";
+}
+
+/* Print the newest events with cycle offsets from the first one shown */
+void trace_dump(void)
+{
+	int cpu;
+	int was_enabled = trace_enabled;
+	unsigned int first;
+	unsigned int count;
+	unsigned int i;
+	TraceEvent *ev;
+	unsigned long long base;
+
+	/* Tracing pauses so the rings hold still while we read them */
+	trace_enabled = 0;
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		first = trace_window(&trace_buffers[cpu], &count);
+		kprint("CPU ");
+		kprint_dec(cpu);
+		kprint(": ");
+		kprint_dec(trace_buffers[cpu].head);
+		kprint(" events recorded\n");
+		if (count > TRACE_SCREEN_EVENTS) {
+			first += count - TRACE_SCREEN_EVENTS;
+			count = TRACE_SCREEN_EVENTS;
+		}
+
+		base = trace_buffers[cpu].events[first & (TRACE_BUFFER_EVENTS - 1)].tsc;
+		for (i = 0; i < count; i++) {
+			ev = &trace_buffers[cpu].events[(first + i) & (TRACE_BUFFER_EVENTS - 1)];
+			kprint("  +");
+			kprint_dec64(ev->tsc - base);
+			kprint(" ");
+			kprint(trace_name(ev->id));
+			kprint(" ");
+			kprint_hex(ev->arg);
+			kprint_newline();
+		}
+	}
+	trace_enabled = was_enabled;
+}
+
+/* 64-bit value as hex */
+static void serial_write_hex64(unsigned long long value)
+{
+	unsigned int high = (unsigned int)(value >> 32);
+	unsigned int low = (unsigned int)value;
+	int shift;
+
+	if (high == 0) {
+		serial_write_hex(low);
+		return;
+	}
+	serial_write_hex(high);
+	for (shift = 28; shift >= 0; shift -= 4) {
+		serial_write_char("0123456789abcdef"[(low >> shift) & 15]);
+	}
+}
+
+/*
+ * Send every recorded event over COM1, one line each:
+ *   <cpu> <tsc> <id> <arg>    (all hex)
+ * preceded by "#event <id> <name>" lines; tools/trace2json.py turns
+ * this into a Chrome/Perfetto timeline.
+ */
+void trace_dump_serial(void)
+{
+	int cpu;
+	int was_enabled = trace_enabled;
+	unsigned int first;
+	unsigned int count;
+	unsigned int i;
+	TraceEvent *ev;
+
+	if (!serial_present()) {
+		kprint("No serial port\n");
+		return;
+	}
+
+	trace_enabled = 0;
+	serial_write("#naotrace 1\n");
+	for (i = 1; i < TRACE_NR_EVENTS; i++) {
+		serial_write("#event ");
+		serial_write_hex(i);
+		serial_write(" ");
+		serial_write(trace_event_names[i]);
+		serial_write("\n");
+	}
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		first = trace_window(&trace_buffers[cpu], &count);
+		for (i = 0; i < count; i++) {
+			ev = &trace_buffers[cpu].events[(first + i) & (TRACE_BUFFER_EVENTS - 1)];
+			serial_write_hex(ev->cpu);
+			serial_write_char(' ');
+			serial_write_hex64(ev->tsc);
+			serial_write_char(' ');
+			serial_write_hex(ev->id);
+			serial_write_char(' ');
+			serial_write_hex(ev->arg);
+			serial_write("\n");
+		}
+		kprint_dec(count);
+		kprint(" events sent for CPU ");
+		kprint_dec(cpu);
+		kprint_newline();
+	}
+	serial_write("#end\n");
+	trace_enabled = was_enabled;
+}
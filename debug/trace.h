@@ -0,0 +1,61 @@
+/*
+ * Trace - Per-CPU binary event ring with TSC timestamps
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "../cpu/cpu.h"
+
+/* Events per CPU ring (power of two) */
+#define TRACE_BUFFER_EVENTS 2048
+
+/* Event IDs - keep trace_event_names in trace.c in sync */
+#define TRACE_IRQ_ENTRY 1
+#define TRACE_IRQ_EXIT 2
+#define TRACE_KEYBOARD 3
+#define TRACE_INPUT_COMPLETE 4
+#define TRACE_COMMAND_BEGIN 5
+#define TRACE_COMMAND_END 6
+#define TRACE_SCROLL 7
+#define TRACE_TASK_SWITCH 8
+#define TRACE_SOFTIRQ 9
+#define TRACE_BLOCK_SUBMIT 10      /* Block request events: arg = LBA (low 32 bits) */
+#define TRACE_BLOCK_COMPLETE 11
+#define TRACE_NR_EVENTS 12
+
+/* One event - 16 bytes */
+typedef struct {
+	unsigned long long tsc;
+	unsigned short id;
+	unsigned short cpu;
+	unsigned int arg;
+} TraceEvent;
+
+/* Ring for one CPU; head counts every event ever written */
+typedef struct {
+	TraceEvent events[TRACE_BUFFER_EVENTS];
+	volatile unsigned int head;
+} TraceBuffer;
+
+/* Global switch read by every tracepoint */
+extern volatile int trace_enabled;
+
+/* Record an event - use TRACE() so disabled tracepoints cost one branch */
+void trace_event(unsigned int id, unsigned int arg);
+
+#define TRACE(id, arg) \
+	do { \
+		if (__builtin_expect(trace_enabled, 0)) { \
+			trace_event((id), (arg)); \
+		} \
+	} while (0)
+
+/* Control */
+void trace_start(void);
+void trace_stop(void);
+void trace_clear(void);
+void trace_dump(void);
+void trace_dump_serial(void);
+
+#endif /* TRACE_H */
@@ -0,0 +1,609 @@
+/*
+ * ATA Driver
+ * IDENTIFY, 28/48-bit LBA and READ/WRITE MULTIPLE. Every DRQ block moves
+ * up to `multiple` sectors with one rep insw/outsw, and the task sleeps
+ * on the channel's wait queue until IRQ14/15 announces the next block
+ * instead of polling the status register per sector.
+ *
+ * When the PCI IDE controller (PIIX) can bus-master, requests use DMA
+ * instead: the PRD table is built straight from the caller's pages, so
+ * there is no bounce copy and the CPU is free until the single
+ * completion interrupt.
+ */
+
+#include "ata.h"
+#include "pit.h"
+#include "pci.h"
+#include "../memory/page.h"
+#include "../memory/paging.h"
+#include "../kernel.h"
+#include "../cpu/cpu.h"
+#include "../output/output.h"
+#include "../lib/string.h"
+#include "../debug/trace.h"
+#include "../essentials/sections.h"
+
+/* Task file registers (offsets from the base port) */
+#define ATA_REG_DATA 0
+#define ATA_REG_ERROR 1
+#define ATA_REG_COUNT 2
+#define ATA_REG_LBA0 3
+#define ATA_REG_LBA1 4
+#define ATA_REG_LBA2 5
+#define ATA_REG_DRIVE 6
+#define ATA_REG_STATUS 7
+#define ATA_REG_COMMAND 7
+
+/* Status bits */
+#define ATA_STATUS_ERR 0x01
+#define ATA_STATUS_DRQ 0x08
+#define ATA_STATUS_DF 0x20
+#define ATA_STATUS_BSY 0x80
+
+/* Commands */
+#define ATA_CMD_READ_SECTORS 0x20
+#define ATA_CMD_READ_SECTORS_EXT 0x24
+#define ATA_CMD_WRITE_SECTORS 0x30
+#define ATA_CMD_WRITE_SECTORS_EXT 0x34
+#define ATA_CMD_READ_MULTIPLE 0xC4
+#define ATA_CMD_READ_MULTIPLE_EXT 0x29
+#define ATA_CMD_WRITE_MULTIPLE 0xC5
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_SET_MULTIPLE 0xC6
+#define ATA_CMD_CACHE_FLUSH 0xE7
+#define ATA_CMD_CACHE_FLUSH_EXT 0xEA
+#define ATA_CMD_IDENTIFY 0xEC
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+
+/* Bus master IDE registers (offsets from the channel's BMIDE base) */
+#define BM_COMMAND 0
+#define BM_STATUS 2
+#define BM_PRDT 4
+
+#define BM_CMD_START 0x01
+#define BM_CMD_READ 0x08                /* Device to memory */
+#define BM_STATUS_ERR 0x02
+#define BM_STATUS_IRQ 0x04
+
+/* PRDs in one page; no entry may cross a 64 KB boundary */
+#define ATA_PRD_ENTRIES (PAGE_SIZE / sizeof(AtaPrd))
+#define ATA_PRD_WINDOW 0x10000
+
+/* IDENTIFY word 49 bit 8: DMA supported */
+#define ATA_IDENTIFY_DMA (1 << 8)
+
+/* Largest READ/WRITE MULTIPLE block we ask for */
+#define ATA_MULTIPLE_LIMIT 16
+
+/* Polling bound for BSY/DRQ during IDENTIFY and write setup */
+#define ATA_POLL_LIMIT 1000000
+
+#define ATA_MAX_DRIVES 4
+
+static AtaChannel channels[2] = {
+	{ATA_PRIMARY_BASE, ATA_PRIMARY_CTRL, ATA_PRIMARY_IRQ, 0, 0, 0, WAIT_QUEUE_INIT, 0, 0, 0},
+	{ATA_SECONDARY_BASE, ATA_SECONDARY_CTRL, ATA_SECONDARY_IRQ, 0, 0, 0, WAIT_QUEUE_INIT, 0, 0, 0}
+};
+
+static AtaDrive drives[ATA_MAX_DRIVES];
+static int drive_count = 0;
+
+/* ~400 ns: four reads of the alternate status register */
+static void ata_delay(AtaChannel *ch)
+{
+	read_port(ch->ctrl);
+	read_port(ch->ctrl);
+	read_port(ch->ctrl);
+	read_port(ch->ctrl);
+}
+
+/* Poll until BSY clears; returns the status or -1 on timeout */
+static int ata_wait_not_busy(AtaChannel *ch)
+{
+	unsigned char status;
+	int i;
+
+	for (i = 0; i < ATA_POLL_LIMIT; i++) {
+		status = read_port(ch->ctrl);
+		if (!(status & ATA_STATUS_BSY)) {
+			return status;
+		}
+	}
+	return -1;
+}
+
+/* Poll until the drive wants data (DRQ) or reports an error */
+static int ata_wait_drq(AtaChannel *ch)
+{
+	int status = ata_wait_not_busy(ch);
+
+	if (status < 0 || (status & (ATA_STATUS_ERR | ATA_STATUS_DF)) || !(status & ATA_STATUS_DRQ)) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Sleep until the channel raises its IRQ; returns the status or -1 */
+static int ata_wait_irq(AtaChannel *ch)
+{
+	unsigned int start = pit_ticks();
+	unsigned long flags = irq_save();
+	int status;
+
+	while (!ch->irq_pending) {
+		if (pit_ticks() - start > ATA_TIMEOUT_TICKS) {
+			irq_restore(flags);
+			return -1;
+		}
+		wait_queue_sleep(&ch->wait);
+	}
+	ch->irq_pending = 0;
+	status = ch->irq_status;
+	irq_restore(flags);
+
+	if (status & (ATA_STATUS_ERR | ATA_STATUS_DF)) {
+		return -1;
+	}
+	return status;
+}
+
+static void ata_irq(AtaChannel *ch)
+{
+	/* Reading STATUS acknowledges the interrupt */
+	ch->irq_status = read_port(ch->base + ATA_REG_STATUS);
+	ch->irq_pending = 1;
+	ch->interrupts++;
+	wait_queue_wake_all(&ch->wait);
+}
+
+static void ata_primary_irq(IrqFrame *frame)
+{
+	(void)frame;
+	ata_irq(&channels[0]);
+}
+
+static void ata_secondary_irq(IrqFrame *frame)
+{
+	(void)frame;
+	ata_irq(&channels[1]);
+}
+
+/* One command at a time per channel */
+static void ata_channel_acquire(AtaChannel *ch)
+{
+	unsigned long flags = irq_save();
+
+	while (ch->busy) {
+		wait_queue_sleep(&ch->wait);
+	}
+	ch->busy = 1;
+	irq_restore(flags);
+}
+
+static void ata_channel_release(AtaChannel *ch)
+{
+	ch->busy = 0;
+	wait_queue_wake_all(&ch->wait);
+}
+
+/* Load the task file for an LBA28 or LBA48 command and issue it */
+static void ata_issue(AtaDrive *drive, unsigned long long lba, unsigned int count,
+                      unsigned char command)
+{
+	AtaChannel *ch = drive->channel;
+
+	ch->irq_pending = 0;
+	if (drive->lba48) {
+		write_port(ch->base + ATA_REG_DRIVE, 0x40 | (drive->slave << 4));
+		ata_delay(ch);
+		write_port(ch->base + ATA_REG_COUNT, (count >> 8) & 0xFF);
+		write_port(ch->base + ATA_REG_LBA0, (lba >> 24) & 0xFF);
+		write_port(ch->base + ATA_REG_LBA1, (lba >> 32) & 0xFF);
+		write_port(ch->base + ATA_REG_LBA2, (lba >> 40) & 0xFF);
+	} else {
+		write_port(ch->base + ATA_REG_DRIVE, 0xE0 | (drive->slave << 4) | ((lba >> 24) & 0x0F));
+		ata_delay(ch);
+	}
+	write_port(ch->base + ATA_REG_COUNT, count & 0xFF);
+	write_port(ch->base + ATA_REG_LBA0, lba & 0xFF);
+	write_port(ch->base + ATA_REG_LBA1, (lba >> 8) & 0xFF);
+	write_port(ch->base + ATA_REG_LBA2, (lba >> 16) & 0xFF);
+	write_port(ch->base + ATA_REG_COMMAND, command);
+}
+
+static unsigned char ata_read_command(AtaDrive *drive)
+{
+	if (drive->multiple > 1) {
+		return drive->lba48 ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE;
+	}
+	return drive->lba48 ? ATA_CMD_READ_SECTORS_EXT : ATA_CMD_READ_SECTORS;
+}
+
+static unsigned char ata_write_command(AtaDrive *drive)
+{
+	if (drive->multiple > 1) {
+		return drive->lba48 ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_MULTIPLE;
+	}
+	return drive->lba48 ? ATA_CMD_WRITE_SECTORS_EXT : ATA_CMD_WRITE_SECTORS;
+}
+
+/*
+ * Describe a buffer as PRDs: one per page, merged while the pages are
+ * physically contiguous and inside one 64 KB window. Returns -1 if the
+ * buffer cannot be described (odd address, unmapped page, too many PRDs).
+ */
+static int ata_build_prdt(AtaChannel *ch, const void *buffer, unsigned int bytes)
+{
+	unsigned long virt = (unsigned long)buffer;
+	unsigned long phys;
+	unsigned long chunk;
+	unsigned long length = 0;
+	AtaPrd *prd = 0;
+	unsigned int entries = 0;
+
+	if (virt & 1) {
+		return -1;
+	}
+
+	while (bytes > 0) {
+		phys = paging_virt_to_phys(virt);
+		if (!phys) {
+			return -1;
+		}
+		chunk = PAGE_SIZE - (virt & (PAGE_SIZE - 1));
+		if (chunk > bytes) {
+			chunk = bytes;
+		}
+
+		if (prd && prd->address + length == phys &&
+		    ((prd->address ^ (phys + chunk - 1)) & ~(ATA_PRD_WINDOW - 1)) == 0) {
+			length += chunk;
+		} else {
+			if (entries == ATA_PRD_ENTRIES) {
+				return -1;
+			}
+			prd = &ch->prdt[entries++];
+			prd->address = phys;
+			prd->flags = 0;
+			length = chunk;
+		}
+		prd->count = length & 0xFFFF;
+
+		virt += chunk;
+		bytes -= chunk;
+	}
+
+	prd->flags = ATA_PRD_EOT;
+	return 0;
+}
+
+/*
+ * One DMA command for the whole request. Returns 1 if the buffer could
+ * not be described (the caller falls back to PIO), 0 or -1 otherwise.
+ */
+static int ata_dma(AtaDrive *drive, unsigned long long lba, unsigned int count,
+                   const void *buffer, int write)
+{
+	AtaChannel *ch = drive->channel;
+	unsigned char direction = write ? 0 : BM_CMD_READ;
+	unsigned char bm_status;
+	unsigned char command;
+	int status;
+
+	if (ata_build_prdt(ch, buffer, count * BLOCK_SECTOR_SIZE) != 0) {
+		return 1;
+	}
+
+	write_port_long(ch->bmide + BM_PRDT, (unsigned long)ch->prdt);
+	write_port(ch->bmide + BM_STATUS, BM_STATUS_ERR | BM_STATUS_IRQ);
+	write_port(ch->bmide + BM_COMMAND, direction);
+
+	if (write) {
+		command = drive->lba48 ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA;
+	} else {
+		command = drive->lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA;
+	}
+	ata_issue(drive, lba, count, command);
+	write_port(ch->bmide + BM_COMMAND, direction | BM_CMD_START);
+
+	status = ata_wait_irq(ch);
+
+	bm_status = read_port(ch->bmide + BM_STATUS);
+	write_port(ch->bmide + BM_COMMAND, 0);
+	write_port(ch->bmide + BM_STATUS, BM_STATUS_ERR | BM_STATUS_IRQ);
+	drive->dma_requests++;
+
+	if (status < 0 || (bm_status & BM_STATUS_ERR)) {
+		return -1;
+	}
+	return 0;
+}
+
+/* PIO read: one IRQ per DRQ block of `multiple` sectors */
+static int ata_read_pio(AtaDrive *drive, unsigned long long lba, unsigned int count, void *buffer)
+{
+	AtaChannel *ch = drive->channel;
+	char *dest = (char*)buffer;
+	unsigned int block;
+
+	drive->pio_requests++;
+	ata_issue(drive, lba, count, ata_read_command(drive));
+	while (count > 0) {
+		if (ata_wait_irq(ch) < 0) {
+			return -1;
+		}
+		block = count < drive->multiple ? count : drive->multiple;
+		read_port_words(ch->base + ATA_REG_DATA, dest, block * BLOCK_SECTOR_SIZE / 2);
+		dest += block * BLOCK_SECTOR_SIZE;
+		count -= block;
+	}
+	return 0;
+}
+
+/* PIO write: the first block goes on DRQ, the rest after each IRQ */
+static int ata_write_pio(AtaDrive *drive, unsigned long long lba, unsigned int count, const void *buffer)
+{
+	AtaChannel *ch = drive->channel;
+	const char *src = (const char*)buffer;
+	unsigned int block;
+
+	drive->pio_requests++;
+	ata_issue(drive, lba, count, ata_write_command(drive));
+	if (ata_wait_drq(ch) != 0) {
+		return -1;
+	}
+	while (count > 0) {
+		block = count < drive->multiple ? count : drive->multiple;
+		write_port_words(ch->base + ATA_REG_DATA, src, block * BLOCK_SECTOR_SIZE / 2);
+		src += block * BLOCK_SECTOR_SIZE;
+		count -= block;
+		/* An IRQ follows every block, the last one signals completion */
+		if (ata_wait_irq(ch) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* BlockDevice read: DMA when the buffer allows it, else PIO */
+static int ata_read(BlockDevice *dev, unsigned long long lba, unsigned int count, void *buffer)
+{
+	AtaDrive *drive = (AtaDrive*)dev->driver_data;
+	int result = 1;
+
+	ata_channel_acquire(drive->channel);
+	if (drive->use_dma) {
+		result = ata_dma(drive, lba, count, buffer, 0);
+	}
+	if (result > 0) {
+		result = ata_read_pio(drive, lba, count, buffer);
+	}
+	ata_channel_release(drive->channel);
+	TRACE(TRACE_BLOCK_COMPLETE, (unsigned int)lba);
+	return result;
+}
+
+/* BlockDevice write: DMA or PIO, then flush the drive's write cache */
+static int ata_write(BlockDevice *dev, unsigned long long lba, unsigned int count, const void *buffer)
+{
+	AtaDrive *drive = (AtaDrive*)dev->driver_data;
+	AtaChannel *ch = drive->channel;
+	int result = 1;
+
+	ata_channel_acquire(ch);
+	if (drive->use_dma) {
+		result = ata_dma(drive, lba, count, buffer, 1);
+	}
+	if (result > 0) {
+		result = ata_write_pio(drive, lba, count, buffer);
+	}
+	if (result == 0) {
+		write_port(ch->base + ATA_REG_COMMAND,
+		           drive->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+		if (ata_wait_irq(ch) < 0) {
+			result = -1;
+		}
+	}
+	ata_channel_release(ch);
+	TRACE(TRACE_BLOCK_COMPLETE, (unsigned int)lba);
+	return result;
+}
+
+/* IDENTIFY strings are big-endian word pairs padded with spaces */
+static void ata_copy_model(char *dest, const unsigned short *words)
+{
+	int i;
+
+	for (i = 0; i < 20; i++) {
+		dest[i * 2] = words[i] >> 8;
+		dest[i * 2 + 1] = words[i] & 0xFF;
+	}
+	dest[40] = '\0';
+	for (i = 39; i >= 0 && dest[i] == ' '; i--) {
+		dest[i] = '\0';
+	}
+}
+
+/* IDENTIFY one drive (polled) and register it - ATAPI and absent drives are skipped */
+static void ata_probe(AtaChannel *ch, int slave)
+{
+	static unsigned short identify[256];
+	AtaDrive *drive;
+	int status;
+	unsigned int multiple;
+
+	write_port(ch->base + ATA_REG_DRIVE, 0xA0 | (slave << 4));
+	ata_delay(ch);
+	write_port(ch->base + ATA_REG_COUNT, 0);
+	write_port(ch->base + ATA_REG_LBA0, 0);
+	write_port(ch->base + ATA_REG_LBA1, 0);
+	write_port(ch->base + ATA_REG_LBA2, 0);
+	write_port(ch->base + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+
+	status = read_port(ch->base + ATA_REG_STATUS);
+	if (status == 0 || status == 0xFF) {
+		return;
+	}
+	if (ata_wait_not_busy(ch) < 0) {
+		return;
+	}
+	/* ATAPI and SATA bridges set a signature instead of answering */
+	if (read_port(ch->base + ATA_REG_LBA1) || read_port(ch->base + ATA_REG_LBA2)) {
+		return;
+	}
+	if (ata_wait_drq(ch) != 0) {
+		return;
+	}
+	read_port_words(ch->base + ATA_REG_DATA, identify, 256);
+	read_port(ch->base + ATA_REG_STATUS);
+
+	drive = &drives[drive_count];
+	drive->channel = ch;
+	drive->slave = slave;
+	drive->lba48 = (identify[83] & (1 << 10)) != 0;
+	drive->dma_capable = ch->bmide && (identify[49] & ATA_IDENTIFY_DMA);
+	drive->use_dma = drive->dma_capable;
+	ata_copy_model(drive->model, &identify[27]);
+
+	if (drive->lba48) {
+		drive->block.sectors = identify[100] | ((unsigned long long)identify[101] << 16) |
+		                       ((unsigned long long)identify[102] << 32) |
+		                       ((unsigned long long)identify[103] << 48);
+	} else {
+		drive->block.sectors = identify[60] | ((unsigned long)identify[61] << 16);
+	}
+
+	/* READ/WRITE MULTIPLE block size: the drive's maximum, capped */
+	multiple = identify[47] & 0xFF;
+	if (multiple > ATA_MULTIPLE_LIMIT) {
+		multiple = ATA_MULTIPLE_LIMIT;
+	}
+	drive->multiple = 1;
+	if (multiple > 1) {
+		ch->irq_pending = 0;
+		write_port(ch->base + ATA_REG_COUNT, multiple);
+		write_port(ch->base + ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+		status = ata_wait_not_busy(ch);
+		if (status >= 0 && !(status & ATA_STATUS_ERR)) {
+			drive->multiple = multiple;
+		}
+	}
+
+	drive->block.name[0] = 'h';
+	drive->block.name[1] = 'd';
+	drive->block.name[2] = 'a' + (ch == &channels[1]) * 2 + slave;
+	drive->block.name[3] = '\0';
+	drive->block.max_transfer = ATA_MAX_SECTORS;
+	drive->block.read = ata_read;
+	drive->block.write = ata_write;
+	drive->block.driver_data = drive;
+
+	if (block_register(&drive->block) == 0) {
+		drive_count++;
+	}
+}
+
+/* Find the PCI IDE controller and set both channels up for bus mastering */
+static void ata_init_dma(void)
+{
+	PciDevice *ide = pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, 0);
+	unsigned short bmide;
+	int c;
+
+	if (!ide) {
+		return;
+	}
+	bmide = pci_bar_io(ide, 4);
+	if (!bmide) {
+		return;
+	}
+	pci_enable(ide, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+	for (c = 0; c < 2; c++) {
+		/* page_alloc() frames are identity mapped - the PRDT address is physical */
+		channels[c].prdt = (AtaPrd*)page_alloc();
+		if (channels[c].prdt) {
+			channels[c].bmide = bmide + c * 8;
+		}
+	}
+}
+
+/* Probe both channels for disks */
+__init void ata_init(void)
+{
+	int c;
+
+	ata_init_dma();
+
+	irq_register(ATA_PRIMARY_IRQ, ata_primary_irq);
+	irq_register(ATA_SECONDARY_IRQ, ata_secondary_irq);
+
+	for (c = 0; c < 2; c++) {
+		/* Floating bus: no controller on this channel */
+		if ((unsigned char)read_port(channels[c].base + ATA_REG_STATUS) == 0xFF) {
+			continue;
+		}
+		write_port(channels[c].ctrl, 0);  /* interrupts on (nIEN clear) */
+		ata_probe(&channels[c], 0);
+		ata_probe(&channels[c], 1);
+		irq_unmask(channels[c].irq);
+	}
+}
+
+/* Model, size and transfer mode of every drive */
+void ata_print_drives(void)
+{
+	int i;
+	AtaDrive *drive;
+
+	for (i = 0; i < drive_count; i++) {
+		drive = &drives[i];
+		kprint(drive->block.name);
+		kprint(": ");
+		kprint(drive->model);
+		kprint(", ");
+		kprint_dec64(drive->block.sectors >> 11);
+		kprint(" MB, LBA");
+		kprint(drive->lba48 ? "48" : "28");
+		kprint(", ");
+		kprint_dec(drive->multiple);
+		kprint(" sectors/IRQ, ");
+		kprint(drive->use_dma ? "DMA" : (drive->dma_capable ? "PIO (DMA capable)" : "PIO"));
+		kprint_newline();
+		kprint("  requests: ");
+		kprint_dec(drive->pio_requests);
+		kprint(" PIO, ");
+		kprint_dec(drive->dma_requests);
+		kprint(" DMA, ");
+		kprint_dec(drive->channel->interrupts);
+		kprint(" IRQs\n");
+	}
+}
+
+/* Benchmark an ATA disk with PIO and, if it can, with DMA - -1 if dev is not ATA */
+int ata_bench(BlockDevice *dev)
+{
+	AtaDrive *drive;
+	int use_dma;
+
+	if (dev->read != ata_read) {
+		return -1;
+	}
+	drive = (AtaDrive*)dev->driver_data;
+	use_dma = drive->use_dma;
+
+	kprint("PIO: ");
+	drive->use_dma = 0;
+	block_bench(dev);
+	if (drive->dma_capable) {
+		kprint("DMA: ");
+		drive->use_dma = 1;
+		block_bench(dev);
+	}
+
+	drive->use_dma = use_dma;
+	return 0;
+}
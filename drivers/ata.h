@@ -0,0 +1,68 @@
+/*
+ * ATA - PIO driver for IDE disks
+ */
+
+#ifndef ATA_H
+#define ATA_H
+
+#include "../block/block.h"
+#include "../task/task.h"
+
+#define ATA_PRIMARY_BASE 0x1F0
+#define ATA_PRIMARY_CTRL 0x3F6
+#define ATA_PRIMARY_IRQ 14
+#define ATA_SECONDARY_BASE 0x170
+#define ATA_SECONDARY_CTRL 0x376
+#define ATA_SECONDARY_IRQ 15
+
+/* Sectors per command (256 is sent as a count of 0 in LBA28 mode) */
+#define ATA_MAX_SECTORS 256
+
+/* Wait for an interrupt at most this many timer ticks */
+#define ATA_TIMEOUT_TICKS 2000
+
+#define ATA_MODEL_LENGTH 41
+
+/* Physical Region Descriptor - one contiguous piece of a DMA buffer */
+typedef struct {
+	unsigned int address;
+	unsigned short count;           /* Bytes, 0 = 64 KB */
+	unsigned short flags;           /* ATA_PRD_EOT on the last entry */
+} __attribute__((packed)) AtaPrd;
+
+#define ATA_PRD_EOT 0x8000
+
+/* One IDE channel - two drives share its registers and IRQ */
+typedef struct {
+	unsigned short base;
+	unsigned short ctrl;
+	int irq;
+	volatile int irq_pending;       /* Set by the IRQ handler */
+	volatile unsigned char irq_status;
+	int busy;                       /* A command is in flight */
+	WaitQueue wait;                 /* IRQ and channel-free waiters */
+	unsigned int interrupts;
+	unsigned short bmide;           /* Bus master registers (0 = no DMA) */
+	AtaPrd *prdt;                   /* One page of PRDs, identity mapped */
+} AtaChannel;
+
+/* One drive */
+typedef struct {
+	AtaChannel *channel;
+	int slave;
+	int lba48;
+	unsigned int multiple;          /* Sectors per DRQ block (READ/WRITE MULTIPLE) */
+	int dma_capable;
+	int use_dma;
+	unsigned int pio_requests;
+	unsigned int dma_requests;
+	char model[ATA_MODEL_LENGTH];
+	BlockDevice block;
+} AtaDrive;
+
+/* ATA functions */
+void ata_init(void);
+void ata_print_drives(void);
+int ata_bench(BlockDevice *dev);
+
+#endif /* ATA_H */
@@ -0,0 +1,227 @@
+/*
+ * PCI Bus Driver
+ * Configuration mechanism #1 (ports 0xCF8/0xCFC). Bus 0 and the buses
+ * behind PCI-to-PCI bridges are scanned once at boot into a small device
+ * table that drivers search by vendor/device or class. Following bridges
+ * instead of probing all 256 buses keeps the scan off the boot time.
+ */
+
+#include "pci.h"
+#include "../kernel.h"
+#include "../output/output.h"
+#include "../essentials/sections.h"
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+/* PCI-to-PCI bridge: class 06, subclass 04, secondary bus number at 0x19 */
+#define PCI_CLASS_BRIDGE 0x06
+#define PCI_SUBCLASS_PCI_BRIDGE 0x04
+#define PCI_SECONDARY_BUS 0x19
+
+static PciDevice devices[PCI_MAX_DEVICES];
+static int device_count = 0;
+
+/* Raw configuration read of a dword */
+static unsigned int pci_config_read(int bus, int slot, int func, unsigned int offset)
+{
+	write_port_long(PCI_CONFIG_ADDRESS, 0x80000000 | (bus << 16) | (slot << 11) |
+	                (func << 8) | (offset & 0xFC));
+	return read_port_long(PCI_CONFIG_DATA);
+}
+
+unsigned int pci_read_config32(PciDevice *dev, unsigned int offset)
+{
+	return pci_config_read(dev->bus, dev->slot, dev->func, offset);
+}
+
+unsigned short pci_read_config16(PciDevice *dev, unsigned int offset)
+{
+	return pci_read_config32(dev, offset) >> ((offset & 2) * 8);
+}
+
+unsigned char pci_read_config8(PciDevice *dev, unsigned int offset)
+{
+	return pci_read_config32(dev, offset) >> ((offset & 3) * 8);
+}
+
+void pci_write_config32(PciDevice *dev, unsigned int offset, unsigned int value)
+{
+	write_port_long(PCI_CONFIG_ADDRESS, 0x80000000 | (dev->bus << 16) | (dev->slot << 11) |
+	                (dev->func << 8) | (offset & 0xFC));
+	write_port_long(PCI_CONFIG_DATA, value);
+}
+
+/* Read-modify-write of the containing dword */
+void pci_write_config16(PciDevice *dev, unsigned int offset, unsigned short value)
+{
+	unsigned int shift = (offset & 2) * 8;
+	unsigned int dword = pci_read_config32(dev, offset);
+
+	dword = (dword & ~(0xFFFFu << shift)) | ((unsigned int)value << shift);
+	pci_write_config32(dev, offset, dword);
+}
+
+/* Record one function - returns 0 when the table is full */
+static PciDevice* pci_add(int bus, int slot, int func)
+{
+	PciDevice *dev;
+	unsigned int id;
+	unsigned int class_rev;
+	int i;
+
+	if (device_count >= PCI_MAX_DEVICES) {
+		return 0;
+	}
+
+	id = pci_config_read(bus, slot, func, PCI_VENDOR_ID);
+	class_rev = pci_config_read(bus, slot, func, PCI_CLASS_REVISION);
+
+	dev = &devices[device_count++];
+	dev->bus = bus;
+	dev->slot = slot;
+	dev->func = func;
+	dev->vendor = id & 0xFFFF;
+	dev->device = id >> 16;
+	dev->class_code = class_rev >> 24;
+	dev->subclass = (class_rev >> 16) & 0xFF;
+	dev->prog_if = (class_rev >> 8) & 0xFF;
+	dev->irq = pci_config_read(bus, slot, func, PCI_INTERRUPT_LINE) & 0xFF;
+	for (i = 0; i < 6; i++) {
+		dev->bars[i] = pci_config_read(bus, slot, func, PCI_BAR0 + i * 4);
+	}
+	return dev;
+}
+
+/* Scan one bus; functions 1-7 only on multi-function devices */
+static void pci_scan_bus(int bus, int depth)
+{
+	int slot, func;
+	unsigned int header;
+	PciDevice *dev;
+
+	for (slot = 0; slot < 32; slot++) {
+		if ((pci_config_read(bus, slot, 0, PCI_VENDOR_ID) & 0xFFFF) == 0xFFFF) {
+			continue;
+		}
+		header = (pci_config_read(bus, slot, 0, PCI_HEADER_TYPE) >> 16) & 0xFF;
+		for (func = 0; func < ((header & 0x80) ? 8 : 1); func++) {
+			if ((pci_config_read(bus, slot, func, PCI_VENDOR_ID) & 0xFFFF) == 0xFFFF) {
+				continue;
+			}
+			dev = pci_add(bus, slot, func);
+			if (dev && dev->class_code == PCI_CLASS_BRIDGE && dev->subclass == PCI_SUBCLASS_PCI_BRIDGE &&
+			    depth < 8) {
+				pci_scan_bus(pci_read_config8(dev, PCI_SECONDARY_BUS), depth + 1);
+			}
+		}
+	}
+}
+
+__init void pci_init(void)
+{
+	pci_scan_bus(0, 0);
+}
+
+/* The index'th device with this vendor/device ID, or 0 */
+PciDevice* pci_find_device(unsigned short vendor, unsigned short device, int index)
+{
+	int i;
+
+	for (i = 0; i < device_count; i++) {
+		if (devices[i].vendor == vendor && devices[i].device == device && index-- == 0) {
+			return &devices[i];
+		}
+	}
+	return 0;
+}
+
+/* The index'th device of a class/subclass, or 0 */
+PciDevice* pci_find_class(unsigned char class_code, unsigned char subclass, int index)
+{
+	int i;
+
+	for (i = 0; i < device_count; i++) {
+		if (devices[i].class_code == class_code && devices[i].subclass == subclass &&
+		    index-- == 0) {
+			return &devices[i];
+		}
+	}
+	return 0;
+}
+
+/* Set bits in the command register (I/O, memory, bus master) */
+void pci_enable(PciDevice *dev, unsigned short command_bits)
+{
+	pci_write_config16(dev, PCI_COMMAND, pci_read_config16(dev, PCI_COMMAND) | command_bits);
+}
+
+/* I/O port base of a BAR (0 if it is not an I/O BAR) */
+unsigned short pci_bar_io(PciDevice *dev, int bar)
+{
+	if (!(dev->bars[bar] & PCI_BAR_IO)) {
+		return 0;
+	}
+	return dev->bars[bar] & 0xFFFC;
+}
+
+/* Physical address of a memory BAR (0 if it is an I/O BAR) */
+unsigned long pci_bar_memory(PciDevice *dev, int bar)
+{
+	if (dev->bars[bar] & PCI_BAR_IO) {
+		return 0;
+	}
+	return dev->bars[bar] & 0xFFFFFFF0;
+}
+
+/* Class names for lspci */
+static const char* pci_class_name(unsigned char class_code)
+{
+	static const char *names[] = {
+		"Unclassified", "Storage", "Network", "Display", "Multimedia",
+		"Memory", "Bridge", "Communication", "System", "Input"
+	};
+
+	if (class_code < sizeof(names) / sizeof(names[0])) {
+		return names[class_code];
+	}
+	return "Other";
+}
+
+/* Print a number as fixed-width hex */
+static void print_hex_digits(unsigned int value, int digits)
+{
+	while (digits-- > 0) {
+		kprint_char("0123456789abcdef"[(value >> (digits * 4)) & 15]);
+	}
+}
+
+/* bus:slot.func vendor:device class, IRQ */
+void pci_print_devices(void)
+{
+	int i;
+	PciDevice *dev;
+
+	for (i = 0; i < device_count; i++) {
+		dev = &devices[i];
+		print_hex_digits(dev->bus, 2);
+		kprint_char(':');
+		print_hex_digits(dev->slot, 2);
+		kprint_char('.');
+		kprint_char('0' + dev->func);
+		kprint(" ");
+		print_hex_digits(dev->vendor, 4);
+		kprint_char(':');
+		print_hex_digits(dev->device, 4);
+		kprint(" ");
+		print_hex_digits(dev->class_code, 2);
+		print_hex_digits(dev->subclass, 2);
+		kprint(" ");
+		kprint(pci_class_name(dev->class_code));
+		if (dev->irq && dev->irq != 0xFF) {
+			kprint(", IRQ ");
+			kprint_dec(dev->irq);
+		}
+		kprint_newline();
+	}
+}
@@ -0,0 +1,63 @@
+/*
+ * PCI - Configuration space access and device enumeration
+ */
+
+#ifndef PCI_H
+#define PCI_H
+
+#define PCI_MAX_DEVICES 32
+
+/* Configuration space offsets */
+#define PCI_VENDOR_ID 0x00
+#define PCI_DEVICE_ID 0x02
+#define PCI_COMMAND 0x04
+#define PCI_STATUS 0x06
+#define PCI_CLASS_REVISION 0x08
+#define PCI_HEADER_TYPE 0x0E
+#define PCI_BAR0 0x10
+#define PCI_SUBSYSTEM_ID 0x2E
+#define PCI_INTERRUPT_LINE 0x3C
+
+/* Command register bits */
+#define PCI_COMMAND_IO 0x0001
+#define PCI_COMMAND_MEMORY 0x0002
+#define PCI_COMMAND_MASTER 0x0004
+
+/* BAR bit 0: I/O space */
+#define PCI_BAR_IO 0x01
+
+/* Classes we look for */
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+
+/* One function found on the bus */
+typedef struct {
+	unsigned char bus;
+	unsigned char slot;
+	unsigned char func;
+	unsigned short vendor;
+	unsigned short device;
+	unsigned char class_code;
+	unsigned char subclass;
+	unsigned char prog_if;
+	unsigned char irq;
+	unsigned int bars[6];
+} PciDevice;
+
+/* Configuration space access */
+unsigned int pci_read_config32(PciDevice *dev, unsigned int offset);
+unsigned short pci_read_config16(PciDevice *dev, unsigned int offset);
+unsigned char pci_read_config8(PciDevice *dev, unsigned int offset);
+void pci_write_config32(PciDevice *dev, unsigned int offset, unsigned int value);
+void pci_write_config16(PciDevice *dev, unsigned int offset, unsigned short value);
+
+/* Enumeration */
+void pci_init(void);
+PciDevice* pci_find_device(unsigned short vendor, unsigned short device, int index);
+PciDevice* pci_find_class(unsigned char class_code, unsigned char subclass, int index);
+void pci_enable(PciDevice *dev, unsigned short command_bits);
+unsigned short pci_bar_io(PciDevice *dev, int bar);
+unsigned long pci_bar_memory(PciDevice *dev, int bar);
+void pci_print_devices(void);
+
+#endif /* PCI_H */
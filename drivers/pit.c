@@ -0,0 +1,84 @@
+/*
+ * PIT Driver
+ * Channel 0 drives IRQ0 at PIT_HZ; each tick feeds the profiler
+ */
+
+#include "pit.h"
+#include "../kernel.h"
+#include "../debug/prof.h"
+#include "../cpu/cpu.h"
+#include "../essentials/sections.h"
+
+#define PIT_CHANNEL0 0x40
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND 0x43
+
+/* Port B: bit 0 gates channel 2, bit 1 drives the speaker, bit 5 is channel 2's output */
+#define PIT_PORT_B 0x61
+#define PORT_B_GATE2 0x01
+#define PORT_B_SPEAKER 0x02
+#define PORT_B_OUT2 0x20
+
+/* Channel 0, lobyte/hibyte, mode 2 (rate generator) */
+#define PIT_MODE_RATE 0x34
+
+/* Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count) */
+#define PIT_MODE_ONESHOT2 0xB0
+
+/* TSC calibration window */
+#define CALIBRATE_MS 10
+
+static volatile unsigned int ticks = 0;
+
+__hot static void pit_handler(IrqFrame *frame)
+{
+	ticks++;
+	prof_tick(frame->eip);
+}
+
+/* Start the system tick */
+__init void pit_init(void)
+{
+	unsigned int divisor = PIT_FREQUENCY / PIT_HZ;
+
+	write_port(PIT_COMMAND, PIT_MODE_RATE);
+	write_port(PIT_CHANNEL0, divisor & 0xFF);
+	write_port(PIT_CHANNEL0, divisor >> 8);
+
+	irq_register(IRQ_TIMER, pit_handler);
+	irq_unmask(IRQ_TIMER);
+}
+
+/* Ticks since pit_init() */
+unsigned int pit_ticks(void)
+{
+	return ticks;
+}
+
+/* TSC frequency, measured against a channel 2 one-shot on first use */
+unsigned int pit_tsc_khz(void)
+{
+	static unsigned int khz = 0;
+	unsigned int count = PIT_FREQUENCY / (1000 / CALIBRATE_MS);
+	unsigned long long start;
+	unsigned long flags;
+
+	if (khz) {
+		return khz;
+	}
+
+	flags = irq_save();
+	write_port(PIT_PORT_B, (read_port(PIT_PORT_B) & ~PORT_B_SPEAKER) | PORT_B_GATE2);
+	write_port(PIT_COMMAND, PIT_MODE_ONESHOT2);
+	write_port(PIT_CHANNEL2, count & 0xFF);
+	write_port(PIT_CHANNEL2, count >> 8);
+
+	start = cpu_rdtsc();
+	while (!(read_port(PIT_PORT_B) & PORT_B_OUT2)) {
+		__asm__ volatile("pause");
+	}
+	khz = (unsigned int)(cpu_rdtsc() - start) / CALIBRATE_MS;
+	irq_restore(flags);
+
+	return khz;
+}
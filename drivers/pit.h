@@ -0,0 +1,19 @@
+/*
+ * PIT - 8253/8254 programmable interval timer
+ */
+
+#ifndef PIT_H
+#define PIT_H
+
+/* Input clock of the PIT */
+#define PIT_FREQUENCY 1193182
+
+/* System tick rate */
+#define PIT_HZ 1000
+
+/* PIT functions */
+void pit_init(void);
+unsigned int pit_ticks(void);
+unsigned int pit_tsc_khz(void);
+
+#endif /* PIT_H */
@@ -0,0 +1,80 @@
+/*
+ * Serial Port Driver
+ * COM1 at 115200 8N1, polled transmit only
+ */
+
+#include "serial.h"
+#include "../kernel.h"
+#include "../essentials/sections.h"
+
+/* UART registers (offsets from the base port) */
+#define UART_DATA 0
+#define UART_IER 1
+#define UART_FCR 2
+#define UART_LCR 3
+#define UART_MCR 4
+#define UART_LSR 5
+#define UART_SCRATCH 7
+
+#define UART_LCR_DLAB 0x80
+#define UART_LSR_THRE 0x20
+
+static int present = 0;
+
+/* Program COM1; a missing UART is detected through the scratch register */
+__init void serial_init(void)
+{
+	write_port(SERIAL_COM1 + UART_SCRATCH, 0x5A);
+	if ((unsigned char)read_port(SERIAL_COM1 + UART_SCRATCH) != 0x5A) {
+		return;
+	}
+
+	write_port(SERIAL_COM1 + UART_IER, 0x00);       /* No interrupts */
+	write_port(SERIAL_COM1 + UART_LCR, UART_LCR_DLAB);
+	write_port(SERIAL_COM1 + UART_DATA, 0x01);      /* Divisor 1 = 115200 baud */
+	write_port(SERIAL_COM1 + UART_IER, 0x00);
+	write_port(SERIAL_COM1 + UART_LCR, 0x03);       /* 8 bits, no parity, 1 stop */
+	write_port(SERIAL_COM1 + UART_FCR, 0xC7);       /* FIFO on, cleared, 14-byte threshold */
+	write_port(SERIAL_COM1 + UART_MCR, 0x03);       /* DTR + RTS */
+	present = 1;
+}
+
+int serial_present(void)
+{
+	return present;
+}
+
+void serial_write_char(char c)
+{
+	if (!present) {
+		return;
+	}
+	while (!(read_port(SERIAL_COM1 + UART_LSR) & UART_LSR_THRE)) {
+		__asm__ volatile("pause");
+	}
+	write_port(SERIAL_COM1 + UART_DATA, c);
+}
+
+void serial_write(const char *str)
+{
+	while (*str) {
+		if (*str == '\n') {
+			serial_write_char('\r');
+		}
+		serial_write_char(*str++);
+	}
+}
+
+/* Lower-case hex without leading zeros */
+void serial_write_hex(unsigned int value)
+{
+	char digits[9];
+	int pos = 8;
+
+	digits[pos] = '\0';
+	do {
+		digits[--pos] = "0123456789abcdef"[value & 15];
+		value >>= 4;
+	} while (value);
+	serial_write(&digits[pos]);
+}
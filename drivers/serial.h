@@ -0,0 +1,17 @@
+/*
+ * Serial - COM1 polled output
+ */
+
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#define SERIAL_COM1 0x3F8
+
+/* Serial functions */
+void serial_init(void);
+int serial_present(void);
+void serial_write_char(char c);
+void serial_write(const char *str);
+void serial_write_hex(unsigned int value);
+
+#endif /* SERIAL_H */
@@ -0,0 +1,203 @@
+/*
+ * Virtio Legacy Transport
+ * Split virtqueues in identity-mapped pages. Chains are published in the
+ * available ring as they are added, but the device is only notified by
+ * virtq_kick(), so a driver can hand over a whole batch with one I/O
+ * write (and none at all while the device says it is still polling).
+ */
+
+#include "virtio.h"
+#include "../kernel.h"
+#include "../memory/page.h"
+#include "../lib/string.h"
+
+/* Keep the compiler from reordering ring accesses (x86 stores are ordered) */
+#define virtio_barrier() __asm__ volatile("" : : : "memory")
+
+/* Reset, then announce that a driver is here */
+void virtio_begin_init(unsigned short io_base)
+{
+	write_port(io_base + VIRTIO_PCI_STATUS, 0);
+	write_port(io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+	write_port(io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+}
+
+unsigned int virtio_host_features(unsigned short io_base)
+{
+	return read_port_long(io_base + VIRTIO_PCI_HOST_FEATURES);
+}
+
+void virtio_set_features(unsigned short io_base, unsigned int features)
+{
+	write_port_long(io_base + VIRTIO_PCI_GUEST_FEATURES, features);
+}
+
+void virtio_driver_ok(unsigned short io_base)
+{
+	write_port(io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE |
+	           VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+}
+
+void virtio_failed(unsigned short io_base)
+{
+	write_port(io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+}
+
+/* Reading ISR acknowledges the interrupt */
+unsigned char virtio_isr(unsigned short io_base)
+{
+	return read_port(io_base + VIRTIO_PCI_ISR);
+}
+
+/* Bytes for a legacy ring of size entries: descriptors and avail, then used on the next page */
+static unsigned int virtq_bytes(unsigned short size)
+{
+	unsigned int first = sizeof(VirtqDesc) * size + sizeof(unsigned short) * (3 + size);
+	unsigned int second = sizeof(unsigned short) * 3 + sizeof(VirtqUsedElem) * size;
+
+	return PAGE_ALIGN_UP(first) + PAGE_ALIGN_UP(second);
+}
+
+/* Allocate and register queue index - returns 0 on success */
+int virtq_init(VirtQueue *q, unsigned short io_base, unsigned short index)
+{
+	unsigned int bytes;
+	char *ring;
+
+	write_port_word(io_base + VIRTIO_PCI_QUEUE_SELECT, index);
+	q->size = read_port_word(io_base + VIRTIO_PCI_QUEUE_SIZE);
+	if (q->size == 0) {
+		return -1;
+	}
+
+	bytes = virtq_bytes(q->size);
+	ring = (char*)page_alloc_contig(bytes / PAGE_SIZE);
+	if (!ring) {
+		return -1;
+	}
+
+	q->io_base = io_base;
+	q->index = index;
+	q->desc = (VirtqDesc*)ring;
+	q->avail = (VirtqAvail*)(ring + sizeof(VirtqDesc) * q->size);
+	q->used = (VirtqUsed*)(ring + PAGE_ALIGN_UP(sizeof(VirtqDesc) * q->size +
+	                                            sizeof(unsigned short) * (3 + q->size)));
+	virtq_reset(q);
+	return 0;
+}
+
+/*
+ * Empty the rings, put every descriptor back on the free list and hand
+ * the ring to the device again - after a device reset, which forgets it
+ */
+void virtq_reset(VirtQueue *q)
+{
+	unsigned short i;
+
+	memset(q->desc, 0, virtq_bytes(q->size));
+	for (i = 0; i < q->size; i++) {
+		q->desc[i].next = i + 1;
+	}
+	q->free_head = 0;
+	q->num_free = q->size;
+	q->last_used = 0;
+	q->added = 0;
+
+	/* page_alloc_contig() memory is identity mapped */
+	write_port_word(q->io_base + VIRTIO_PCI_QUEUE_SELECT, q->index);
+	write_port_long(q->io_base + VIRTIO_PCI_QUEUE_PFN, (unsigned long)q->desc / VIRTQ_ALIGN);
+}
+
+/* Add a descriptor chain - returns its head (the request ID) or -1 if the ring is full */
+int virtq_add(VirtQueue *q, VirtqBuffer *buffers, unsigned int count)
+{
+	unsigned short head;
+	unsigned short id;
+	unsigned int i;
+	VirtqDesc *desc = 0;
+
+	if (count == 0 || count > q->num_free) {
+		return -1;
+	}
+
+	head = q->free_head;
+	id = head;
+	for (i = 0; i < count; i++) {
+		desc = &q->desc[id];
+		desc->addr = buffers[i].phys;
+		desc->len = buffers[i].len;
+		desc->flags = buffers[i].device_writes ? VIRTQ_DESC_F_WRITE : 0;
+		if (i + 1 < count) {
+			desc->flags |= VIRTQ_DESC_F_NEXT;
+		}
+		id = desc->next;
+	}
+	q->free_head = id;
+	q->num_free -= count;
+
+	q->avail->ring[q->avail->idx % q->size] = head;
+	virtio_barrier();
+	q->avail->idx++;
+	q->added++;
+	return head;
+}
+
+/* Notify the device of everything added since the last kick */
+void virtq_kick(VirtQueue *q)
+{
+	if (q->added == 0) {
+		return;
+	}
+	q->added = 0;
+
+	/* The device reads the ring before deciding to sleep - order our idx store first */
+	__sync_synchronize();
+	if (q->used->flags & VIRTQ_USED_F_NO_NOTIFY) {
+		q->kicks_suppressed++;
+		return;
+	}
+	write_port_word(q->io_base + VIRTIO_PCI_QUEUE_NOTIFY, q->index);
+	q->kicks++;
+}
+
+int virtq_has_used(VirtQueue *q)
+{
+	virtio_barrier();
+	return q->last_used != q->used->idx;
+}
+
+/* Take one completed chain - returns its head or -1; frees the descriptors */
+int virtq_get_used(VirtQueue *q, unsigned int *len)
+{
+	volatile VirtqUsedElem *elem;
+	unsigned short id;
+	unsigned short last;
+
+	if (!virtq_has_used(q)) {
+		return -1;
+	}
+	elem = &q->used->ring[q->last_used % q->size];
+	id = elem->id;
+	if (len) {
+		*len = elem->len;
+	}
+	q->last_used++;
+
+	/* Walk the chain back onto the free list */
+	last = id;
+	q->num_free++;
+	while (q->desc[last].flags & VIRTQ_DESC_F_NEXT) {
+		last = q->desc[last].next;
+		q->num_free++;
+	}
+	q->desc[last].next = q->free_head;
+	q->free_head = id;
+	return id;
+}
+
+/* Ask the device to interrupt on completions (or not, while we poll) */
+void virtq_interrupts(VirtQueue *q, int enable)
+{
+	q->avail->flags = enable ? 0 : VIRTQ_AVAIL_F_NO_INTERRUPT;
+	__sync_synchronize();
+}
@@ -0,0 +1,103 @@
+/*
+ * Virtio - Legacy PCI transport and split virtqueues
+ */
+
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#define VIRTIO_VENDOR 0x1AF4
+#define VIRTIO_DEVICE_BLK_LEGACY 0x1001
+
+/* Legacy PCI I/O registers (BAR0) */
+#define VIRTIO_PCI_HOST_FEATURES 0x00
+#define VIRTIO_PCI_GUEST_FEATURES 0x04
+#define VIRTIO_PCI_QUEUE_PFN 0x08
+#define VIRTIO_PCI_QUEUE_SIZE 0x0C
+#define VIRTIO_PCI_QUEUE_SELECT 0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY 0x10
+#define VIRTIO_PCI_STATUS 0x12
+#define VIRTIO_PCI_ISR 0x13
+#define VIRTIO_PCI_CONFIG 0x14          /* Device-specific, without MSI-X */
+
+/* Device status */
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER 0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED 0x80
+
+/* Descriptor flags */
+#define VIRTQ_DESC_F_NEXT 0x01
+#define VIRTQ_DESC_F_WRITE 0x02
+
+/* Ring flags */
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 0x01
+#define VIRTQ_USED_F_NO_NOTIFY 0x01
+
+/* Legacy rings are laid out with this alignment */
+#define VIRTQ_ALIGN 4096
+
+typedef struct {
+	unsigned long long addr;
+	unsigned int len;
+	unsigned short flags;
+	unsigned short next;
+} __attribute__((packed)) VirtqDesc;
+
+typedef struct {
+	unsigned short flags;
+	unsigned short idx;
+	unsigned short ring[];
+} __attribute__((packed)) VirtqAvail;
+
+typedef struct {
+	unsigned int id;
+	unsigned int len;
+} __attribute__((packed)) VirtqUsedElem;
+
+typedef struct {
+	unsigned short flags;
+	unsigned short idx;
+	VirtqUsedElem ring[];
+} __attribute__((packed)) VirtqUsed;
+
+/* One buffer of a descriptor chain */
+typedef struct {
+	unsigned long phys;
+	unsigned int len;
+	int device_writes;
+} VirtqBuffer;
+
+/* Driver side of a split virtqueue */
+typedef struct {
+	unsigned short io_base;
+	unsigned short index;
+	unsigned short size;
+	VirtqDesc *desc;
+	volatile VirtqAvail *avail;
+	volatile VirtqUsed *used;
+	unsigned short free_head;
+	unsigned short num_free;
+	unsigned short last_used;
+	unsigned short added;            /* Chains added since the last kick */
+	unsigned int kicks;
+	unsigned int kicks_suppressed;   /* Device asked for no notification */
+} VirtQueue;
+
+/* Device setup */
+void virtio_begin_init(unsigned short io_base);
+unsigned int virtio_host_features(unsigned short io_base);
+void virtio_set_features(unsigned short io_base, unsigned int features);
+void virtio_driver_ok(unsigned short io_base);
+void virtio_failed(unsigned short io_base);
+unsigned char virtio_isr(unsigned short io_base);
+
+/* Virtqueues */
+int virtq_init(VirtQueue *q, unsigned short io_base, unsigned short index);
+void virtq_reset(VirtQueue *q);
+int virtq_add(VirtQueue *q, VirtqBuffer *buffers, unsigned int count);
+void virtq_kick(VirtQueue *q);
+int virtq_has_used(VirtQueue *q);
+int virtq_get_used(VirtQueue *q, unsigned int *len);
+void virtq_interrupts(VirtQueue *q, int enable);
+
+#endif /* VIRTIO_H */
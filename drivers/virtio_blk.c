@@ -0,0 +1,411 @@
+/*
+ * Virtio Block Driver
+ * Legacy (transitional) virtio-blk over PCI with one split virtqueue.
+ * A batch of requests is placed in the ring and the device is notified
+ * once. Completions are then polled with device interrupts suppressed;
+ * only if the device is still busy after a short spin does the driver
+ * turn the interrupt back on and sleep.
+ */
+
+#include "virtio_blk.h"
+#include "pit.h"
+#include "../kernel.h"
+#include "../cpu/cpu.h"
+#include "../memory/page.h"
+#include "../memory/paging.h"
+#include "../memory/slab.h"
+#include "../output/output.h"
+#include "../lib/string.h"
+#include "../debug/trace.h"
+#include "../essentials/sections.h"
+
+static VirtioBlk disks[VIRTIO_BLK_MAX_DISKS];
+static int disk_count = 0;
+
+static void virtio_blk_irq(IrqFrame *frame)
+{
+	int i;
+
+	(void)frame;
+	/* The line may be shared by several virtio disks */
+	for (i = 0; i < disk_count; i++) {
+		if (disks[i].irq && (virtio_isr(disks[i].io_base) & 1)) {
+			disks[i].interrupts++;
+			wait_queue_wake_all(&disks[i].wait);
+		}
+	}
+}
+
+/* One batch at a time per disk */
+static void virtio_blk_acquire(VirtioBlk *vb)
+{
+	unsigned long flags = irq_save();
+
+	while (vb->busy) {
+		wait_queue_sleep(&vb->wait);
+	}
+	vb->busy = 1;
+	irq_restore(flags);
+}
+
+static void virtio_blk_release(VirtioBlk *vb)
+{
+	vb->busy = 0;
+	wait_queue_wake_all(&vb->wait);
+}
+
+/*
+ * Describe a request as header, data pages and status byte and add it
+ * to the ring. Returns 1 if the ring is full, -1 if the buffer can't be
+ * described (the request fails), 0 once it is queued.
+ */
+static int virtio_blk_queue(VirtioBlk *vb, BlockRequest *req)
+{
+	VirtqBuffer buffers[VIRTIO_BLK_MAX_SEGMENTS + 2];
+	unsigned long virt = (unsigned long)req->buffer;
+	unsigned int bytes = req->count * BLOCK_SECTOR_SIZE;
+	unsigned int n = 1;
+	unsigned long phys;
+	unsigned long chunk;
+	int head;
+
+	if (req->write && vb->read_only) {
+		return -1;
+	}
+
+	/* One segment per page, merged while physically contiguous */
+	while (bytes > 0) {
+		phys = paging_virt_to_phys(virt);
+		if (!phys) {
+			return -1;
+		}
+		chunk = PAGE_SIZE - (virt & (PAGE_SIZE - 1));
+		if (chunk > bytes) {
+			chunk = bytes;
+		}
+		if (n > 1 && buffers[n - 1].phys + buffers[n - 1].len == phys) {
+			buffers[n - 1].len += chunk;
+		} else {
+			if (n == VIRTIO_BLK_MAX_SEGMENTS + 1) {
+				return -1;
+			}
+			buffers[n].phys = phys;
+			buffers[n].len = chunk;
+			buffers[n].device_writes = !req->write;
+			n++;
+		}
+		virt += chunk;
+		bytes -= chunk;
+	}
+
+	/* Header and status slots are chosen by the head, so fill them in after adding */
+	buffers[0].len = sizeof(VirtioBlkHeader);
+	buffers[0].device_writes = 0;
+	buffers[n].len = 1;
+	buffers[n].device_writes = 1;
+	if (n + 1 > vb->queue.num_free) {
+		return 1;
+	}
+	head = vb->queue.free_head;
+	buffers[0].phys = (unsigned long)&vb->headers[head];
+	buffers[n].phys = (unsigned long)&vb->status[head];
+
+	vb->headers[head].type = req->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+	vb->headers[head].reserved = 0;
+	vb->headers[head].sector = req->lba;
+	vb->status[head] = 0xFF;
+	vb->inflight[head] = req;
+
+	virtq_add(&vb->queue, buffers, n + 1);
+	return 0;
+}
+
+/* Reap everything the device has finished - returns how many */
+static unsigned int virtio_blk_reap(VirtioBlk *vb)
+{
+	unsigned int count = 0;
+	int head;
+
+	while ((head = virtq_get_used(&vb->queue, 0)) >= 0) {
+		TRACE(TRACE_BLOCK_COMPLETE, (unsigned int)vb->inflight[head]->lba);
+		vb->inflight[head]->status = (vb->status[head] == VIRTIO_BLK_S_OK) ? 0 : -1;
+		vb->inflight[head] = 0;
+		count++;
+	}
+	return count;
+}
+
+/* Wait for at least one completion: spin first, then sleep on the IRQ */
+static int virtio_blk_wait(VirtioBlk *vb)
+{
+	unsigned int start;
+	unsigned long flags;
+	int spin;
+
+	for (spin = 0; spin < VIRTIO_BLK_POLL_SPINS; spin++) {
+		if (virtq_has_used(&vb->queue)) {
+			vb->polled++;
+			return 0;
+		}
+		__asm__ volatile("pause");
+	}
+
+	start = pit_ticks();
+	vb->sleeps++;
+	flags = irq_save();
+	if (vb->irq) {
+		virtq_interrupts(&vb->queue, 1);
+	}
+	/* Re-check after enabling: a completion may have slipped in between */
+	while (!virtq_has_used(&vb->queue)) {
+		if (pit_ticks() - start > VIRTIO_BLK_TIMEOUT_TICKS) {
+			virtq_interrupts(&vb->queue, 0);
+			irq_restore(flags);
+			return -1;
+		}
+		if (vb->irq) {
+			wait_queue_sleep(&vb->wait);
+		} else {
+			irq_restore(flags);
+			task_yield();
+			flags = irq_save();
+		}
+	}
+	virtq_interrupts(&vb->queue, 0);
+	irq_restore(flags);
+	return 0;
+}
+
+/*
+ * The device stopped answering: fail what it still holds, then reset it
+ * so it forgets those buffers and the next request starts on an empty
+ * ring
+ */
+static void virtio_blk_reset(VirtioBlk *vb)
+{
+	unsigned int i;
+
+	for (i = 0; i < vb->queue.size; i++) {
+		if (vb->inflight[i]) {
+			TRACE(TRACE_BLOCK_COMPLETE, (unsigned int)vb->inflight[i]->lba);
+			vb->inflight[i]->status = -1;
+			vb->inflight[i] = 0;
+		}
+	}
+	virtio_begin_init(vb->io_base);
+	virtio_set_features(vb->io_base, vb->read_only ? VIRTIO_BLK_F_RO : 0);
+	virtq_reset(&vb->queue);
+	virtq_interrupts(&vb->queue, 0);
+	virtio_driver_ok(vb->io_base);
+	vb->resets++;
+}
+
+/* Queue as much of the batch as fits, kick once, reap, repeat */
+static int virtio_blk_submit(BlockDevice *dev, BlockRequest *requests, unsigned int count)
+{
+	VirtioBlk *vb = (VirtioBlk*)dev->driver_data;
+	unsigned int queued = 0;
+	unsigned int done = 0;
+	unsigned int i;
+	int timed_out = 0;
+	int result;
+
+	virtio_blk_acquire(vb);
+	while (done < count) {
+		while (queued < count) {
+			result = virtio_blk_queue(vb, &requests[queued]);
+			if (result > 0) {
+				break;
+			}
+			if (result < 0) {
+				TRACE(TRACE_BLOCK_COMPLETE, (unsigned int)requests[queued].lba);
+				requests[queued].status = -1;
+				done++;
+			}
+			queued++;
+		}
+		virtq_kick(&vb->queue);
+		vb->batches++;
+
+		if (done < queued) {
+			if (virtio_blk_wait(vb) != 0) {
+				timed_out = 1;
+				break;
+			}
+			done += virtio_blk_reap(vb);
+		}
+	}
+
+	/* The rest of the batch fails; the disk is usable again afterwards */
+	if (timed_out) {
+		virtio_blk_reset(vb);
+		for (i = queued; i < count; i++) {
+			TRACE(TRACE_BLOCK_COMPLETE, (unsigned int)requests[i].lba);
+			requests[i].status = -1;
+		}
+	}
+	virtio_blk_release(vb);
+	return timed_out ? -1 : 0;
+}
+
+static int virtio_blk_read(BlockDevice *dev, unsigned long long lba,
+                           unsigned int count, void *buffer)
+{
+	BlockRequest req = {lba, count, buffer, 0, 0};
+
+	virtio_blk_submit(dev, &req, 1);
+	return req.status;
+}
+
+static int virtio_blk_write(BlockDevice *dev, unsigned long long lba,
+                            unsigned int count, const void *buffer)
+{
+	BlockRequest req = {lba, count, (void*)buffer, 1, 0};
+
+	virtio_blk_submit(dev, &req, 1);
+	return req.status;
+}
+
+/* Bring up one device - returns 0 on success */
+static int virtio_blk_probe(VirtioBlk *vb, PciDevice *pci)
+{
+	unsigned int features;
+	unsigned int slots;
+
+	vb->pci = pci;
+	vb->io_base = pci_bar_io(pci, 0);
+	if (!vb->io_base) {
+		return -1;
+	}
+	pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+	virtio_begin_init(vb->io_base);
+	features = virtio_host_features(vb->io_base);
+	virtio_set_features(vb->io_base, features & VIRTIO_BLK_F_RO);
+	vb->read_only = (features & VIRTIO_BLK_F_RO) != 0;
+
+	if (virtq_init(&vb->queue, vb->io_base, 0) != 0) {
+		virtio_failed(vb->io_base);
+		return -1;
+	}
+	/* A request of VIRTIO_BLK_MAX_SEGMENTS pages must fit an empty ring */
+	if (vb->queue.size < VIRTIO_BLK_MAX_SEGMENTS + 2) {
+		kprint("virtio-blk: queue too small\n");
+		virtio_failed(vb->io_base);
+		return -1;
+	}
+	/* Completions are polled until a waiter asks for the interrupt */
+	virtq_interrupts(&vb->queue, 0);
+
+	/* Per-slot header and status byte, identity mapped for the device */
+	slots = vb->queue.size;
+	vb->headers = (VirtioBlkHeader*)page_alloc_contig(
+		PAGE_ALIGN_UP(slots * (sizeof(VirtioBlkHeader) + 1)) / PAGE_SIZE);
+	vb->inflight = (BlockRequest**)kzalloc(slots * sizeof(BlockRequest*));
+	if (!vb->headers || !vb->inflight) {
+		virtio_failed(vb->io_base);
+		return -1;
+	}
+	vb->status = (unsigned char*)(vb->headers + slots);
+
+	/* Capacity in 512-byte sectors */
+	vb->block.sectors = read_port_long(vb->io_base + VIRTIO_PCI_CONFIG) |
+		((unsigned long long)read_port_long(vb->io_base + VIRTIO_PCI_CONFIG + 4) << 32);
+
+	vb->irq = (pci->irq > 0 && pci->irq < NR_IRQS) ? pci->irq : 0;
+	vb->wait.head = 0;
+	/* A line another driver owns is left alone; the disk is polled instead */
+	if (vb->irq && irq_register(vb->irq, virtio_blk_irq) != 0) {
+		vb->irq = 0;
+	}
+	if (vb->irq) {
+		irq_unmask(vb->irq);
+	}
+	virtio_driver_ok(vb->io_base);
+
+	vb->block.name[0] = 'v';
+	vb->block.name[1] = 'd';
+	vb->block.name[2] = 'a' + disk_count;
+	vb->block.name[3] = '\0';
+	vb->block.max_transfer = VIRTIO_BLK_MAX_SECTORS;
+	vb->block.read = virtio_blk_read;
+	vb->block.write = virtio_blk_write;
+	vb->block.submit = virtio_blk_submit;
+	vb->block.driver_data = vb;
+	return block_register(&vb->block);
+}
+
+/* Find every virtio-blk function on the PCI bus */
+__init void virtio_blk_init(void)
+{
+	PciDevice *pci;
+	int index;
+
+	for (index = 0; disk_count < VIRTIO_BLK_MAX_DISKS; index++) {
+		pci = pci_find_device(VIRTIO_VENDOR, VIRTIO_DEVICE_BLK_LEGACY, index);
+		if (!pci) {
+			break;
+		}
+		if (virtio_blk_probe(&disks[disk_count], pci) == 0) {
+			disk_count++;
+		}
+	}
+}
+
+/* Queue size, doorbells and how completions were noticed */
+void virtio_blk_print(void)
+{
+	int i;
+	VirtioBlk *vb;
+
+	for (i = 0; i < disk_count; i++) {
+		vb = &disks[i];
+		kprint(vb->block.name);
+		kprint(": virtio, ");
+		kprint_dec64(vb->block.sectors >> 11);
+		kprint(" MB, queue ");
+		kprint_dec(vb->queue.size);
+		kprint(vb->read_only ? ", read-only" : "");
+		kprint_newline();
+		kprint("  batches ");
+		kprint_dec(vb->batches);
+		kprint(", notifications ");
+		kprint_dec(vb->queue.kicks);
+		kprint(" (");
+		kprint_dec(vb->queue.kicks_suppressed);
+		kprint(" suppressed), polled ");
+		kprint_dec(vb->polled);
+		kprint(", slept ");
+		kprint_dec(vb->sleeps);
+		kprint(", IRQs ");
+		kprint_dec(vb->interrupts);
+		kprint(", resets ");
+		kprint_dec(vb->resets);
+		kprint_newline();
+	}
+}
+
+/* Requests/s and latency on the first virtio disk, one request per notify and batched */
+void virtio_blk_bench(void)
+{
+	static const unsigned int batches[] = {1, 4, 32};
+	VirtioBlk *vb;
+	unsigned int kicks;
+	unsigned int i;
+
+	if (disk_count == 0) {
+		kprint("No virtio disk (run QEMU with -drive if=virtio)\n");
+		return;
+	}
+	vb = &disks[0];
+	kprint(vb->block.name);
+	kprint(", random 4 KB reads\n");
+
+	for (i = 0; i < sizeof(batches) / sizeof(batches[0]); i++) {
+		kicks = vb->queue.kicks;
+		block_bench_requests(&vb->block, batches[i]);
+		kprint("    notifications: ");
+		kprint_dec(vb->queue.kicks - kicks);
+		kprint_newline();
+	}
+}
@@ -0,0 +1,67 @@
+/*
+ * Virtio Block Driver - Paravirtual disks (QEMU -drive if=virtio)
+ */
+
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include "virtio.h"
+#include "pci.h"
+#include "../block/block.h"
+#include "../task/task.h"
+
+#define VIRTIO_BLK_MAX_DISKS 4
+
+/* Sectors per request: 128 KB, at most 33 pages of data */
+#define VIRTIO_BLK_MAX_SECTORS 256
+#define VIRTIO_BLK_MAX_SEGMENTS 34
+
+/* Feature bits */
+#define VIRTIO_BLK_F_RO (1 << 5)
+
+/* Request types and status */
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_S_OK 0
+
+/* Spin this long on the used ring before falling back to the interrupt */
+#define VIRTIO_BLK_POLL_SPINS 20000
+#define VIRTIO_BLK_TIMEOUT_TICKS 2000
+
+/* Request header, read by the device */
+typedef struct {
+	unsigned int type;
+	unsigned int reserved;
+	unsigned long long sector;
+} __attribute__((packed)) VirtioBlkHeader;
+
+typedef struct {
+	PciDevice *pci;
+	unsigned short io_base;
+	unsigned char irq;              /* 0 if the device has no usable line */
+	int read_only;
+	int busy;
+	VirtQueue queue;
+	WaitQueue wait;
+
+	/* Indexed by the head descriptor of each in-flight chain */
+	VirtioBlkHeader *headers;
+	unsigned char *status;
+	BlockRequest **inflight;
+
+	/* Statistics */
+	unsigned int batches;
+	unsigned int polled;            /* Completions found while spinning */
+	unsigned int sleeps;            /* Waits that needed the interrupt */
+	unsigned int interrupts;
+	unsigned int resets;            /* Device reset after a timed-out request */
+
+	BlockDevice block;
+} VirtioBlk;
+
+/* Driver functions */
+void virtio_blk_init(void);
+void virtio_blk_print(void);
+void virtio_blk_bench(void);
+
+#endif /* VIRTIO_BLK_H */
@@ -0,0 +1,17 @@
+/*
+ * Sections - Where link.ld places code, by how often it runs
+ */
+
+#ifndef SECTIONS_H
+#define SECTIONS_H
+
+/* Boot-only code; kmain gives its pages back before starting the shell */
+#define __init __attribute__((section(".init.text")))
+
+/* Interrupt, console and scheduling paths, packed together in .text.hot */
+#define __hot __attribute__((hot))
+
+/* Reports and error paths, moved out of the way into .text.unlikely */
+#define __cold __attribute__((cold))
+
+#endif /* SECTIONS_H */
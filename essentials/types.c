@@ -1,7 +1,6 @@
-#include <stdlib.h>
-#include <string.h>
-#include <ctype.h>
-#include <limits.h>
+#include "types.h"
+
+#define INT_MAX_VALUE 2147483647
 
 /**
  * Converts a char* string to int with error checking.
@@ -9,28 +8,48 @@
  * The converted value is stored in the output parameter.
  */
 int int_(const char *str, int *output) {
-    if (str == NULL || output == NULL) {
+    const char *p;
+    unsigned int val = 0;
+    unsigned int limit = INT_MAX_VALUE;
+    int negative = 0;
+
+    if (str == 0 || output == 0) {
         return -1;
     }
 
-    char *endptr;
-    long val = strtol(str, &endptr, 10);
+    p = str;
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    if (*p == '+' || *p == '-') {
+        negative = (*p == '-');
+        p++;
+    }
+    if (negative) {
+        limit = (unsigned int)INT_MAX_VALUE + 1;
+    }
 
     // Check for no conversion
-    if (endptr == str) {
+    if (*p < '0' || *p > '9') {
         return -1;
     }
 
-    // Check for trailing non-numeric characters
-    if (*endptr != '\0') {
-        return -1;
+    while (*p >= '0' && *p <= '9') {
+        unsigned int digit = *p - '0';
+
+        // Check for overflow/underflow
+        if (val > (limit - digit) / 10) {
+            return -1;
+        }
+        val = val * 10 + digit;
+        p++;
     }
 
-    // Check for overflow/underflow
-    if (val < INT_MIN || val > INT_MAX) {
+    // Check for trailing non-numeric characters
+    if (*p != '\0') {
         return -1;
     }
 
-    *output = (int)val;
+    *output = negative ? (int)(0u - val) : (int)val;
     return 0;
-}
\ No newline at end of file
+}
@@ -1,6 +1,6 @@
 #ifndef TYPES_H
 #define TYPES_H
 
-int int_(char* str);
+int int_(const char *str, int *output);
 
-#endif 
\ No newline at end of file
+#endif
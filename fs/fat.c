@@ -0,0 +1,1063 @@
+/*
+ * FAT16 Filesystem Implementation
+ * The whole FAT is kept in memory and written back sector by sector as it
+ * changes. Cluster chains are turned into extent lists (runs of adjacent
+ * clusters) and cached, so a seek is a binary search instead of a walk
+ * from the first cluster. New clusters go right after the file's last
+ * cluster when possible, otherwise into the first free run big enough,
+ * so files stay sequential on disk. All sector I/O goes through the
+ * block cache.
+ *
+ * Only 8.3 names are understood; long-name entries are skipped.
+ */
+
+#include "fat.h"
+#include "../block/bcache.h"
+#include "../memory/slab.h"
+#include "../output/output.h"
+#include "../lib/string.h"
+#include "../cpu/cpu.h"
+#include "../bench/bench.h"
+#include "../drivers/pit.h"
+#include "../essentials/sections.h"
+
+#define FAT_ENTRY_SIZE 32
+#define FAT_ENTRIES_PER_SECTOR (BLOCK_SECTOR_SIZE / 2)
+#define FAT_DELETED 0xE5
+
+/* Boot sector (BPB) fields */
+#define BPB_BYTES_PER_SECTOR 0x0B
+#define BPB_SECTORS_PER_CLUSTER 0x0D
+#define BPB_RESERVED_SECTORS 0x0E
+#define BPB_FAT_COPIES 0x10
+#define BPB_ROOT_ENTRIES 0x11
+#define BPB_TOTAL_SECTORS 0x13
+#define BPB_FAT_SECTORS 0x16
+#define BPB_TOTAL_SECTORS_32 0x20
+#define BPB_SIGNATURE 0x26
+#define BPB_LABEL 0x2B
+#define MBR_PARTITIONS 0x1BE
+
+/* FAT16 cluster count limits */
+#define FAT16_MIN_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
+/* Benchmark shape */
+#define FAT_BENCH_BYTES (4 * 1024 * 1024)
+#define FAT_BENCH_CHUNK (64 * 1024)
+#define FAT_BENCH_SEEKS 256
+#define FAT_BENCH_SEEK_BYTES 4096
+
+static FatVolume *volumes[FAT_MAX_VOLUMES];
+static int volume_count = 0;
+
+static unsigned short get16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned int get32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static unsigned long long fat_cluster_lba(FatVolume *vol, unsigned short cluster)
+{
+	return vol->start + vol->data_start + (unsigned long long)(cluster - 2) * vol->sectors_per_cluster;
+}
+
+static int fat_valid_cluster(FatVolume *vol, unsigned int cluster)
+{
+	return cluster >= 2 && cluster < vol->cluster_count + 2;
+}
+
+/* Move bytes between buf and the disk, starting offset bytes into sector lba */
+static int fat_transfer(FatVolume *vol, unsigned long long lba, unsigned int offset,
+                        char *buf, unsigned int length, int write)
+{
+	unsigned long long pos = (lba << 9) + offset;
+	unsigned long long block;
+	unsigned int block_offset;
+	unsigned int chunk;
+	CacheBlock *b;
+
+	while (length > 0) {
+		block = pos >> 12;
+		block_offset = pos & (BCACHE_BLOCK_SIZE - 1);
+		chunk = BCACHE_BLOCK_SIZE - block_offset;
+		if (chunk > length) {
+			chunk = length;
+		}
+
+		if (write && chunk == BCACHE_BLOCK_SIZE) {
+			/* Whole block: no need to read it first */
+			if (bcache_write(vol->dev, block << BCACHE_BLOCK_SHIFT, BCACHE_BLOCK_SECTORS, buf) != 0) {
+				return -1;
+			}
+		} else {
+			b = bcache_get(vol->dev, block);
+			if (!b) {
+				return -1;
+			}
+			if (write) {
+				memcpy(b->data + block_offset, buf, chunk);
+				bcache_mark_dirty(b);
+			} else {
+				memcpy(buf, b->data + block_offset, chunk);
+			}
+			bcache_put(b);
+		}
+		pos += chunk;
+		buf += chunk;
+		length -= chunk;
+	}
+	return 0;
+}
+
+/* Change one FAT entry and remember which sector to write back */
+static void fat_set(FatVolume *vol, unsigned short cluster, unsigned short value)
+{
+	if (vol->fat[cluster] == FAT_FREE && value != FAT_FREE) {
+		vol->free_clusters--;
+	} else if (vol->fat[cluster] != FAT_FREE && value == FAT_FREE) {
+		vol->free_clusters++;
+	}
+	vol->fat[cluster] = value;
+	vol->fat_dirty[cluster / FAT_ENTRIES_PER_SECTOR] = 1;
+	vol->generation++;
+}
+
+/* Write dirty FAT sectors to every FAT copy, merging adjacent sectors */
+int fat_flush(FatVolume *vol)
+{
+	unsigned int first;
+	unsigned int end;
+	unsigned int copy;
+	int result = 0;
+
+	for (first = 0; first < vol->fat_sectors; first = end) {
+		if (!vol->fat_dirty[first]) {
+			end = first + 1;
+			continue;
+		}
+		for (end = first; end < vol->fat_sectors && vol->fat_dirty[end]; end++) {
+			vol->fat_dirty[end] = 0;
+		}
+		for (copy = 0; copy < vol->fat_copies; copy++) {
+			if (bcache_write(vol->dev, vol->start + vol->fat_start + copy * vol->fat_sectors + first,
+			                 end - first, &vol->fat[first * FAT_ENTRIES_PER_SECTOR]) != 0) {
+				result = -1;
+			}
+		}
+	}
+	return result;
+}
+
+/* Extent list for the chain starting at first - cached until the FAT changes */
+static FatChain* fat_chain(FatVolume *vol, unsigned short first)
+{
+	FatChain *chain = 0;
+	FatChain *victim = &vol->chains[0];
+	FatExtent *extents;
+	FatExtent *last = 0;
+	unsigned int cluster = first;
+	unsigned int steps = 0;
+	int i;
+
+	for (i = 0; i < FAT_CHAIN_CACHE_SIZE; i++) {
+		if (vol->chains[i].first_cluster == first && vol->chains[i].extents) {
+			chain = &vol->chains[i];
+			break;
+		}
+		if (vol->chains[i].last_use < victim->last_use) {
+			victim = &vol->chains[i];
+		}
+	}
+	if (chain && chain->generation == vol->generation) {
+		chain->last_use = ++vol->chain_clock;
+		vol->chain_hits++;
+		return chain;
+	}
+	vol->chain_misses++;
+	if (!chain) {
+		chain = victim;
+	}
+
+	chain->first_cluster = first;
+	chain->generation = vol->generation;
+	chain->last_use = ++vol->chain_clock;
+	chain->clusters = 0;
+	chain->extent_count = 0;
+
+	/* The step bound stops a corrupted, looping chain */
+	while (fat_valid_cluster(vol, cluster) && steps++ <= vol->cluster_count) {
+		if (last && last->disk_cluster + last->length == cluster && last->length < 0xFFFF) {
+			last->length++;
+		} else {
+			if (chain->extent_count == chain->extent_capacity) {
+				extents = (FatExtent*)kmalloc((chain->extent_capacity ? chain->extent_capacity * 2 : 8) *
+				                              sizeof(FatExtent));
+				if (!extents) {
+					break;
+				}
+				if (chain->extents) {
+					memcpy(extents, chain->extents, chain->extent_count * sizeof(FatExtent));
+					kfree(chain->extents);
+				}
+				chain->extents = extents;
+				chain->extent_capacity = chain->extent_capacity ? chain->extent_capacity * 2 : 8;
+			}
+			last = &chain->extents[chain->extent_count++];
+			last->file_cluster = chain->clusters;
+			last->disk_cluster = cluster;
+			last->length = 1;
+		}
+		chain->clusters++;
+		cluster = vol->fat[cluster];
+	}
+	return chain;
+}
+
+/* Disk cluster holding file cluster index, and how many adjacent clusters follow it */
+static unsigned short fat_cluster_of(FatVolume *vol, unsigned short first, unsigned int index,
+                                     unsigned int *run)
+{
+	FatChain *chain = fat_chain(vol, first);
+	FatExtent *e;
+	unsigned int low = 0;
+	unsigned int high = chain->extent_count;
+	unsigned int mid;
+
+	if (index >= chain->clusters) {
+		return 0;
+	}
+	while (high - low > 1) {
+		mid = (low + high) / 2;
+		if (chain->extents[mid].file_cluster <= index) {
+			low = mid;
+		} else {
+			high = mid;
+		}
+	}
+	e = &chain->extents[low];
+	if (run) {
+		*run = e->length - (index - e->file_cluster);
+	}
+	return e->disk_cluster + (index - e->file_cluster);
+}
+
+static unsigned short fat_last_cluster(FatVolume *vol, unsigned short first)
+{
+	FatChain *chain = fat_chain(vol, first);
+	FatExtent *e;
+
+	if (chain->extent_count == 0) {
+		return 0;
+	}
+	e = &chain->extents[chain->extent_count - 1];
+	return e->disk_cluster + e->length - 1;
+}
+
+/* First free run of at least count clusters from the hint, else the longest one */
+static unsigned short fat_find_run(FatVolume *vol, unsigned int count, unsigned int *length)
+{
+	unsigned int end = vol->cluster_count + 2;
+	unsigned int best = 0;
+	unsigned int best_length = 0;
+	unsigned int start;
+	unsigned int c;
+	unsigned int pass;
+
+	for (pass = 0; pass < 2; pass++) {
+		c = pass == 0 ? vol->next_free : 2;
+		end = pass == 0 ? vol->cluster_count + 2 : vol->next_free;
+		while (c < end) {
+			if (vol->fat[c] != FAT_FREE) {
+				c++;
+				continue;
+			}
+			start = c;
+			while (c < end && vol->fat[c] == FAT_FREE && c - start < count) {
+				c++;
+			}
+			if (c - start >= count) {
+				*length = count;
+				return start;
+			}
+			if (c - start > best_length) {
+				best = start;
+				best_length = c - start;
+			}
+		}
+	}
+	*length = best_length;
+	return best;
+}
+
+/*
+ * Allocate count clusters as one chain appended to after (0: a new chain).
+ * Extends in place when the clusters after `after` are free. Returns the
+ * first new cluster, or 0 if the volume does not have count free clusters.
+ */
+static unsigned short fat_alloc(FatVolume *vol, unsigned short after, unsigned int count)
+{
+	unsigned short first = 0;
+	unsigned short prev = after;
+	unsigned int start;
+	unsigned int length;
+	unsigned int c;
+
+	if (count == 0 || count > vol->free_clusters) {
+		return 0;
+	}
+
+	while (count > 0) {
+		/* Grow in place first, then take the best free run */
+		if (prev && fat_valid_cluster(vol, prev + 1) && vol->fat[prev + 1] == FAT_FREE) {
+			start = prev + 1;
+			for (length = 0; length < count && fat_valid_cluster(vol, start + length) &&
+			     vol->fat[start + length] == FAT_FREE; length++) {
+			}
+		} else {
+			start = fat_find_run(vol, count, &length);
+			if (length == 0) {
+				return 0;
+			}
+		}
+
+		for (c = start; c < start + length; c++) {
+			if (prev) {
+				fat_set(vol, prev, c);
+			}
+			if (!first) {
+				first = c;
+			}
+			prev = c;
+		}
+		fat_set(vol, prev, 0xFFFF);
+		vol->next_free = fat_valid_cluster(vol, prev + 1) ? prev + 1 : 2;
+		count -= length;
+	}
+	return first;
+}
+
+static void fat_free_chain(FatVolume *vol, unsigned short first)
+{
+	unsigned short cluster = first;
+	unsigned short next;
+	unsigned int steps = 0;
+
+	while (fat_valid_cluster(vol, cluster) && steps++ <= vol->cluster_count) {
+		next = vol->fat[cluster];
+		fat_set(vol, cluster, FAT_FREE);
+		if (cluster < vol->next_free) {
+			vol->next_free = cluster;
+		}
+		cluster = next;
+	}
+}
+
+/* Sector and offset of directory entry index - -1 past the end of the directory */
+static int fat_entry_position(FatVolume *vol, unsigned short dir, unsigned int index,
+                              unsigned long long *lba, unsigned int *offset)
+{
+	unsigned int byte = index * FAT_ENTRY_SIZE;
+	unsigned short cluster;
+
+	if (dir == 0) {
+		if (index >= vol->root_entries) {
+			return -1;
+		}
+		*lba = vol->start + vol->root_start;
+		*offset = byte;
+		return 0;
+	}
+	cluster = fat_cluster_of(vol, dir, byte / vol->cluster_size, 0);
+	if (!cluster) {
+		return -1;
+	}
+	*lba = fat_cluster_lba(vol, cluster);
+	*offset = byte % vol->cluster_size;
+	return 0;
+}
+
+static int fat_entry_io(FatVolume *vol, unsigned short dir, unsigned int index,
+                        FatDirEntry *entry, int write)
+{
+	unsigned long long lba;
+	unsigned int offset;
+
+	if (fat_entry_position(vol, dir, index, &lba, &offset) != 0) {
+		return -1;
+	}
+	return fat_transfer(vol, lba, offset, (char*)entry, sizeof(FatDirEntry), write);
+}
+
+/* "readme.txt" from "README  TXT" */
+static void fat_name_from_83(const char *raw, char *name)
+{
+	int i;
+	int n = 0;
+
+	for (i = 0; i < 8 && raw[i] != ' '; i++) {
+		name[n++] = (raw[i] >= 'A' && raw[i] <= 'Z') ? raw[i] + 32 : raw[i];
+	}
+	if (raw[8] != ' ') {
+		name[n++] = '.';
+		for (i = 8; i < 11 && raw[i] != ' '; i++) {
+			name[n++] = (raw[i] >= 'A' && raw[i] <= 'Z') ? raw[i] + 32 : raw[i];
+		}
+	}
+	name[n] = '\0';
+}
+
+/* Padded upper-case 8.3 form of the length-byte component name - -1 if it has no such form */
+static int fat_name_to_83(const char *name, unsigned int length, char *raw)
+{
+	unsigned int i;
+	unsigned int n = 0;
+	unsigned int limit = 8;
+	char c;
+
+	memset(raw, ' ', 11);
+	if ((length == 1 && name[0] == '.') || (length == 2 && name[0] == '.' && name[1] == '.')) {
+		memcpy(raw, name, length);
+		return 0;
+	}
+	if (length == 0) {
+		return -1;
+	}
+
+	for (i = 0; i < length; i++) {
+		c = name[i];
+		if (c == '.') {
+			if (limit == 11 || i == 0) {
+				return -1;
+			}
+			n = 8;
+			limit = 11;
+			continue;
+		}
+		if (c <= ' ' || strchr("\"*+,/:;<=>?[\\]|", c)) {
+			return -1;
+		}
+		if (n == limit) {
+			return -1;
+		}
+		raw[n++] = (c >= 'a' && c <= 'z') ? c - 32 : c;
+	}
+	return 0;
+}
+
+static void fat_fill_dirent(FatDirent *out, const FatDirEntry *entry, unsigned short dir,
+                            unsigned int index)
+{
+	fat_name_from_83(entry->name, out->name);
+	out->attributes = entry->attributes;
+	out->size = entry->size;
+	out->cluster = entry->cluster;
+	out->location.dir_cluster = dir;
+	out->location.index = index;
+}
+
+/* Next real entry at or after *index - 0, or -1 at the end of the directory */
+int fat_readdir(FatVolume *vol, unsigned short dir, unsigned int *index, FatDirent *out)
+{
+	FatDirEntry entry;
+
+	for (;; (*index)++) {
+		if (fat_entry_io(vol, dir, *index, &entry, 0) != 0 || entry.name[0] == 0) {
+			return -1;
+		}
+		if ((unsigned char)entry.name[0] == FAT_DELETED ||
+		    (entry.attributes & FAT_ATTR_LONG_NAME) == FAT_ATTR_LONG_NAME ||
+		    (entry.attributes & FAT_ATTR_VOLUME_LABEL)) {
+			continue;
+		}
+		fat_fill_dirent(out, &entry, dir, *index);
+		(*index)++;
+		return 0;
+	}
+}
+
+/* Find a component in a directory by its 8.3 form */
+static int fat_find(FatVolume *vol, unsigned short dir, const char *raw, FatDirent *out)
+{
+	FatDirEntry entry;
+	unsigned int index;
+
+	for (index = 0; fat_entry_io(vol, dir, index, &entry, 0) == 0 && entry.name[0] != 0; index++) {
+		if ((entry.attributes & FAT_ATTR_LONG_NAME) == FAT_ATTR_LONG_NAME ||
+		    (entry.attributes & FAT_ATTR_VOLUME_LABEL)) {
+			continue;
+		}
+		if (memcmp(entry.name, raw, 11) == 0) {
+			fat_fill_dirent(out, &entry, dir, index);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static void fat_root_dirent(FatDirent *out)
+{
+	memset(out, 0, sizeof(FatDirent));
+	out->name[0] = '/';
+	out->attributes = FAT_ATTR_DIRECTORY;
+}
+
+/*
+ * Walk path from dir (or from the root if it starts with '/'). With
+ * last set, stops before the final component and returns its name.
+ */
+static int fat_walk(FatVolume *vol, unsigned short dir, const char *path, FatDirent *out,
+                    const char **last)
+{
+	char raw[11];
+	const char *end;
+	unsigned int length;
+
+	fat_root_dirent(out);
+	if (*path == '/') {
+		dir = 0;
+	} else if (dir != 0) {
+		out->cluster = dir;
+		out->name[0] = '.';
+	}
+
+	for (;;) {
+		while (*path == '/') {
+			path++;
+		}
+		if (*path == '\0') {
+			return last ? -1 : 0;
+		}
+		end = path;
+		while (*end && *end != '/') {
+			end++;
+		}
+		length = end - path;
+
+		if (last) {
+			const char *rest = end;
+			while (*rest == '/') {
+				rest++;
+			}
+			if (*rest == '\0') {
+				*last = path;
+				return 0;
+			}
+		}
+
+		if (!(out->attributes & FAT_ATTR_DIRECTORY) || fat_name_to_83(path, length, raw) != 0) {
+			return -1;
+		}
+		/* The root has no "." and ".." entries */
+		if (dir == 0 && raw[0] == '.') {
+			fat_root_dirent(out);
+		} else if (fat_find(vol, dir, raw, out) != 0) {
+			return -1;
+		}
+		if (out->attributes & FAT_ATTR_DIRECTORY) {
+			dir = out->cluster;
+			if (dir == 0) {
+				fat_root_dirent(out);
+			}
+		}
+		path = end;
+	}
+}
+
+int fat_lookup(FatVolume *vol, unsigned short dir, const char *path, FatDirent *out)
+{
+	return fat_walk(vol, dir, path, out, 0);
+}
+
+/* Zero a freshly allocated directory cluster */
+static int fat_clear_cluster(FatVolume *vol, unsigned short cluster)
+{
+	char zero[BLOCK_SECTOR_SIZE];
+	unsigned int i;
+
+	memset(zero, 0, sizeof(zero));
+	for (i = 0; i < vol->sectors_per_cluster; i++) {
+		if (fat_transfer(vol, fat_cluster_lba(vol, cluster) + i, 0, zero, sizeof(zero), 1) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Index of a free entry in dir, growing a subdirectory by a cluster if needed */
+static int fat_free_entry(FatVolume *vol, unsigned short dir, unsigned int *index)
+{
+	FatDirEntry entry;
+	unsigned short cluster;
+
+	for (*index = 0; fat_entry_io(vol, dir, *index, &entry, 0) == 0; (*index)++) {
+		if (entry.name[0] == 0 || (unsigned char)entry.name[0] == FAT_DELETED) {
+			return 0;
+		}
+	}
+	if (dir == 0) {
+		return -1;
+	}
+	cluster = fat_alloc(vol, fat_last_cluster(vol, dir), 1);
+	if (!cluster || fat_clear_cluster(vol, cluster) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+int fat_open(FatVolume *vol, unsigned short dir, const char *path, FatFile *file)
+{
+	if (fat_lookup(vol, dir, path, &file->entry) != 0 ||
+	    (file->entry.attributes & FAT_ATTR_DIRECTORY)) {
+		return -1;
+	}
+	file->vol = vol;
+	file->position = 0;
+	file->dirty = 0;
+	return 0;
+}
+
+/* New empty file - fails if the name exists */
+int fat_create(FatVolume *vol, unsigned short dir, const char *path, FatFile *file)
+{
+	FatDirEntry entry;
+	FatDirent parent;
+	FatDirent existing;
+	const char *name;
+	unsigned int index;
+
+	if (fat_walk(vol, dir, path, &parent, &name) != 0 || !(parent.attributes & FAT_ATTR_DIRECTORY)) {
+		return -1;
+	}
+	memset(&entry, 0, sizeof(entry));
+	if (fat_name_to_83(name, strlen(name), entry.name) != 0 || entry.name[0] == '.' ||
+	    fat_find(vol, parent.cluster, entry.name, &existing) == 0) {
+		return -1;
+	}
+	if (fat_free_entry(vol, parent.cluster, &index) != 0) {
+		return -1;
+	}
+
+	entry.attributes = FAT_ATTR_ARCHIVE;
+	if (fat_entry_io(vol, parent.cluster, index, &entry, 1) != 0) {
+		return -1;
+	}
+	fat_fill_dirent(&file->entry, &entry, parent.cluster, index);
+	file->vol = vol;
+	file->position = 0;
+	file->dirty = 0;
+	return fat_flush(vol);
+}
+
+/* Read or write from the current position, one transfer per extent */
+static int fat_file_io(FatFile *file, char *buf, unsigned int length, int write)
+{
+	FatVolume *vol = file->vol;
+	unsigned int done = 0;
+	unsigned int offset;
+	unsigned int bytes;
+	unsigned int run;
+	unsigned short cluster;
+
+	while (done < length) {
+		offset = file->position % vol->cluster_size;
+		cluster = fat_cluster_of(vol, file->entry.cluster, file->position / vol->cluster_size, &run);
+		if (!cluster) {
+			break;
+		}
+		bytes = run * vol->cluster_size - offset;
+		if (bytes > length - done) {
+			bytes = length - done;
+		}
+		if (fat_transfer(vol, fat_cluster_lba(vol, cluster), offset, buf + done, bytes, write) != 0) {
+			break;
+		}
+		file->position += bytes;
+		done += bytes;
+	}
+	return done;
+}
+
+int fat_read(FatFile *file, void *buffer, unsigned int length)
+{
+	if (file->position >= file->entry.size) {
+		return 0;
+	}
+	if (length > file->entry.size - file->position) {
+		length = file->entry.size - file->position;
+	}
+	return fat_file_io(file, (char*)buffer, length, 0);
+}
+
+/* Write at the position, allocating every missing cluster in one go */
+int fat_write(FatFile *file, const void *buffer, unsigned int length)
+{
+	FatVolume *vol = file->vol;
+	unsigned int end = file->position + length;
+	unsigned int have = 0;
+	unsigned int need;
+	unsigned short first;
+	int done;
+
+	if (end < file->position) {
+		return -1;
+	}
+	if (file->entry.cluster) {
+		have = fat_chain(vol, file->entry.cluster)->clusters;
+	}
+	need = (end + vol->cluster_size - 1) / vol->cluster_size;
+	if (need > have) {
+		first = fat_alloc(vol, file->entry.cluster ? fat_last_cluster(vol, file->entry.cluster) : 0,
+		                  need - have);
+		if (!first) {
+			return -1;
+		}
+		if (!file->entry.cluster) {
+			file->entry.cluster = first;
+			file->dirty = 1;
+		}
+	}
+
+	done = fat_file_io(file, (char*)buffer, length, 1);
+	if (file->position > file->entry.size) {
+		file->entry.size = file->position;
+		file->dirty = 1;
+	}
+	return done;
+}
+
+/* Positions past the end are refused, so files have no unwritten holes */
+int fat_seek(FatFile *file, unsigned int position)
+{
+	if (position > file->entry.size) {
+		return -1;
+	}
+	file->position = position;
+	return 0;
+}
+
+int fat_truncate(FatFile *file)
+{
+	fat_free_chain(file->vol, file->entry.cluster);
+	file->entry.cluster = 0;
+	file->entry.size = 0;
+	file->position = 0;
+	file->dirty = 1;
+	return 0;
+}
+
+/* Store size and first cluster in the directory entry, then write the FAT */
+int fat_close(FatFile *file)
+{
+	FatVolume *vol = file->vol;
+	FatLocation *loc = &file->entry.location;
+	FatDirEntry entry;
+
+	if (file->dirty) {
+		if (fat_entry_io(vol, loc->dir_cluster, loc->index, &entry, 0) != 0) {
+			return -1;
+		}
+		entry.cluster = file->entry.cluster;
+		entry.size = file->entry.size;
+		if (fat_entry_io(vol, loc->dir_cluster, loc->index, &entry, 1) != 0) {
+			return -1;
+		}
+		file->dirty = 0;
+	}
+	return fat_flush(vol);
+}
+
+/* Remove a file or an empty directory */
+int fat_remove(FatVolume *vol, unsigned short dir, const char *path)
+{
+	FatDirent target;
+	FatDirent child;
+	FatDirEntry entry;
+	unsigned int index = 0;
+
+	if (fat_lookup(vol, dir, path, &target) != 0 || target.name[0] == '/' ||
+	    target.name[0] == '.') {
+		return -1;
+	}
+	if (target.attributes & FAT_ATTR_DIRECTORY) {
+		while (fat_readdir(vol, target.cluster, &index, &child) == 0) {
+			if (child.name[0] != '.') {
+				return -1;
+			}
+		}
+	}
+
+	if (fat_entry_io(vol, target.location.dir_cluster, target.location.index, &entry, 0) != 0) {
+		return -1;
+	}
+	entry.name[0] = (char)FAT_DELETED;
+	if (fat_entry_io(vol, target.location.dir_cluster, target.location.index, &entry, 1) != 0) {
+		return -1;
+	}
+	fat_free_chain(vol, target.cluster);
+	return fat_flush(vol);
+}
+
+/* Sector 0 is either our boot sector or an MBR whose first FAT partition we use */
+static unsigned long long fat_find_start(BlockDevice *dev, unsigned char *sector)
+{
+	unsigned char *part;
+	unsigned char type;
+	int i;
+
+	if (get16(sector + BPB_BYTES_PER_SECTOR) == BLOCK_SECTOR_SIZE && sector[BPB_FAT_COPIES] != 0) {
+		return 0;
+	}
+	for (i = 0; i < 4; i++) {
+		part = sector + MBR_PARTITIONS + i * 16;
+		type = part[4];
+		if ((type == 0x04 || type == 0x06 || type == 0x0E) &&
+		    bcache_read(dev, get32(part + 8), 1, sector) == 0) {
+			return get32(part + 8);
+		}
+	}
+	return ~0ull;
+}
+
+FatVolume* fat_mount(BlockDevice *dev)
+{
+	unsigned char sector[BLOCK_SECTOR_SIZE];
+	unsigned long long start;
+	unsigned int total;
+	unsigned int c;
+	FatVolume *vol;
+
+	if (bcache_read(dev, 0, 1, sector) != 0 || sector[510] != 0x55 || sector[511] != 0xAA) {
+		return 0;
+	}
+	start = fat_find_start(dev, sector);
+	if (start == ~0ull || get16(sector + BPB_BYTES_PER_SECTOR) != BLOCK_SECTOR_SIZE ||
+	    sector[BPB_SECTORS_PER_CLUSTER] == 0 || get16(sector + BPB_FAT_SECTORS) == 0) {
+		return 0;
+	}
+
+	vol = (FatVolume*)kzalloc(sizeof(FatVolume));
+	if (!vol) {
+		return 0;
+	}
+	vol->dev = dev;
+	vol->start = start;
+	vol->sectors_per_cluster = sector[BPB_SECTORS_PER_CLUSTER];
+	vol->cluster_size = vol->sectors_per_cluster * BLOCK_SECTOR_SIZE;
+	vol->fat_start = get16(sector + BPB_RESERVED_SECTORS);
+	vol->fat_copies = sector[BPB_FAT_COPIES];
+	vol->fat_sectors = get16(sector + BPB_FAT_SECTORS);
+	vol->root_entries = get16(sector + BPB_ROOT_ENTRIES);
+	vol->root_start = vol->fat_start + vol->fat_copies * vol->fat_sectors;
+	vol->data_start = vol->root_start + (vol->root_entries * FAT_ENTRY_SIZE + BLOCK_SECTOR_SIZE - 1) /
+	                  BLOCK_SECTOR_SIZE;
+
+	total = get16(sector + BPB_TOTAL_SECTORS);
+	if (total == 0) {
+		total = get32(sector + BPB_TOTAL_SECTORS_32);
+	}
+	if (total <= vol->data_start) {
+		kfree(vol);
+		return 0;
+	}
+	vol->cluster_count = (total - vol->data_start) / vol->sectors_per_cluster;
+	if (vol->cluster_count < FAT16_MIN_CLUSTERS || vol->cluster_count >= FAT16_MAX_CLUSTERS ||
+	    vol->fat_sectors * FAT_ENTRIES_PER_SECTOR < vol->cluster_count + 2) {
+		kfree(vol);
+		return 0;
+	}
+
+	memset(vol->label, 0, sizeof(vol->label));
+	if (sector[BPB_SIGNATURE] == 0x29) {
+		memcpy(vol->label, sector + BPB_LABEL, 11);
+		for (c = 11; c > 0 && vol->label[c - 1] == ' '; c--) {
+			vol->label[c - 1] = '\0';
+		}
+	}
+
+	vol->fat = (unsigned short*)kmalloc(vol->fat_sectors * BLOCK_SECTOR_SIZE);
+	vol->fat_dirty = (unsigned char*)kzalloc(vol->fat_sectors);
+	if (!vol->fat || !vol->fat_dirty ||
+	    bcache_read(dev, start + vol->fat_start, vol->fat_sectors, vol->fat) != 0) {
+		kfree(vol->fat);
+		kfree(vol->fat_dirty);
+		kfree(vol);
+		return 0;
+	}
+
+	vol->next_free = 2;
+	for (c = 2; c < vol->cluster_count + 2; c++) {
+		if (vol->fat[c] == FAT_FREE) {
+			vol->free_clusters++;
+		}
+	}
+	return vol;
+}
+
+/* Mount every FAT16 block device */
+__init void fat_init(void)
+{
+	BlockDevice *dev;
+	FatVolume *vol;
+	int i;
+
+	for (i = 0; (dev = block_get(i)) != 0 && volume_count < FAT_MAX_VOLUMES; i++) {
+		vol = fat_mount(dev);
+		if (vol) {
+			volumes[volume_count++] = vol;
+		}
+	}
+}
+
+FatVolume* fat_get_volume(int index)
+{
+	if (index < 0 || index >= volume_count) {
+		return 0;
+	}
+	return volumes[index];
+}
+
+void fat_print_volumes(void)
+{
+	FatVolume *vol;
+	int i;
+
+	for (i = 0; i < volume_count; i++) {
+		vol = volumes[i];
+		kprint(vol->dev->name);
+		kprint(": FAT16 \"");
+		kprint(vol->label);
+		kprint("\", ");
+		kprint_dec(vol->cluster_count);
+		kprint(" clusters of ");
+		kprint_dec(vol->cluster_size);
+		kprint(" bytes, ");
+		kprint_dec(vol->free_clusters * (vol->cluster_size / 1024));
+		kprint(" KB free\n");
+		kprint("  chain cache hits ");
+		kprint_dec(vol->chain_hits);
+		kprint(", misses ");
+		kprint_dec(vol->chain_misses);
+		kprint_newline();
+	}
+}
+
+/* KB/s for bytes moved in cycles */
+static void fat_report(const char *label, unsigned int bytes, unsigned long long cycles)
+{
+	unsigned long long us = bench_div64(cycles * 1000, pit_tsc_khz());
+
+	if (us == 0) {
+		us = 1;
+	}
+	kprint("  ");
+	kprint(label);
+	kprint(": ");
+	kprint_dec64(bench_div64((unsigned long long)bytes * 1000000 / 1024, (unsigned int)us));
+	kprint(" KB/s\n");
+}
+
+/* Sequential read of the whole file in bench-sized chunks */
+static int fat_bench_read(FatFile *file, char *buffer)
+{
+	fat_seek(file, 0);
+	while (fat_read(file, buffer, FAT_BENCH_CHUNK) > 0) {
+	}
+	return file->position == file->entry.size ? 0 : -1;
+}
+
+/* Write, cold read, warm read and random seeks over a multi-megabyte file */
+void fat_bench(void)
+{
+	static const char *path = "/FATBENCH.DAT";
+	FatVolume *vol = fat_get_volume(0);
+	FatFile file;
+	char *buffer;
+	unsigned long long start;
+	unsigned long long cycles;
+	unsigned int bytes = FAT_BENCH_BYTES;
+	unsigned int available;
+	unsigned int seed = 12345;
+	unsigned int written;
+	int i;
+
+	if (!vol) {
+		kprint("No FAT16 volume\n");
+		return;
+	}
+	/* Leave at least half of the free space alone */
+	available = (vol->free_clusters / 2) * vol->cluster_size;
+	if (bytes > available) {
+		bytes = available & ~(FAT_BENCH_CHUNK - 1);
+	}
+	if (bytes < FAT_BENCH_CHUNK * 4) {
+		kprint("Not enough free space\n");
+		return;
+	}
+	buffer = (char*)kmalloc(FAT_BENCH_CHUNK);
+	if (!buffer) {
+		kprint("Out of memory\n");
+		return;
+	}
+	memset(buffer, 0x5A, FAT_BENCH_CHUNK);
+	fat_remove(vol, 0, path);
+	if (fat_create(vol, 0, path, &file) != 0) {
+		kprint("Cannot create ");
+		kprint(path);
+		kprint_newline();
+		kfree(buffer);
+		return;
+	}
+
+	kprint(vol->dev->name);
+	kprint(", ");
+	kprint_dec(bytes / 1024);
+	kprint(" KB file\n");
+
+	/* Write includes getting it onto the disk */
+	start = cpu_rdtsc();
+	for (written = 0; written < bytes; written += FAT_BENCH_CHUNK) {
+		if (fat_write(&file, buffer, FAT_BENCH_CHUNK) != FAT_BENCH_CHUNK) {
+			break;
+		}
+	}
+	fat_close(&file);
+	bcache_sync(vol->dev);
+	cycles = cpu_rdtsc() - start;
+	if (written < bytes) {
+		kprint("Write error\n");
+	} else {
+		fat_report("write", bytes, cycles);
+		kprint("  extents: ");
+		kprint_dec(fat_chain(vol, file.entry.cluster)->extent_count);
+		kprint_newline();
+
+		bcache_invalidate(vol->dev);
+		start = cpu_rdtsc();
+		if (fat_bench_read(&file, buffer) != 0) {
+			kprint("Read error\n");
+		}
+		fat_report("cold read", bytes, cpu_rdtsc() - start);
+
+		start = cpu_rdtsc();
+		fat_bench_read(&file, buffer);
+		fat_report("warm read", bytes, cpu_rdtsc() - start);
+
+		/* Random 4 KB reads - each one a seek through the cached chain */
+		start = cpu_rdtsc();
+		for (i = 0; i < FAT_BENCH_SEEKS; i++) {
+			seed = seed * 1103515245 + 12345;
+			fat_seek(&file, ((seed >> 8) % (bytes / FAT_BENCH_SEEK_BYTES)) * FAT_BENCH_SEEK_BYTES);
+			fat_read(&file, buffer, FAT_BENCH_SEEK_BYTES);
+		}
+		bench_report("seek + 4 KB read", cpu_rdtsc() - start, FAT_BENCH_SEEKS);
+	}
+
+	fat_remove(vol, 0, path);
+	bcache_sync(vol->dev);
+	kfree(buffer);
+}
@@ -0,0 +1,138 @@
+/*
+ * FAT16 Filesystem - Disk images made by mkfs.fat -F 16
+ */
+
+#ifndef FAT_H
+#define FAT_H
+
+#include "../block/block.h"
+
+#define FAT_MAX_VOLUMES 4
+#define FAT_NAME_LENGTH 13              /* "NAME.EXT" plus terminator */
+
+/* Directory entry attributes */
+#define FAT_ATTR_READ_ONLY 0x01
+#define FAT_ATTR_HIDDEN 0x02
+#define FAT_ATTR_SYSTEM 0x04
+#define FAT_ATTR_VOLUME_LABEL 0x08
+#define FAT_ATTR_DIRECTORY 0x10
+#define FAT_ATTR_ARCHIVE 0x20
+#define FAT_ATTR_LONG_NAME 0x0F
+
+/* FAT16 entry values */
+#define FAT_FREE 0x0000
+#define FAT_BAD 0xFFF7
+#define FAT_END 0xFFF8                  /* >= this ends a chain */
+
+/* Clusters whose chains are remembered as extent lists */
+#define FAT_CHAIN_CACHE_SIZE 8
+
+/* On-disk directory entry */
+typedef struct {
+	char name[11];
+	unsigned char attributes;
+	unsigned char reserved;
+	unsigned char create_tenths;
+	unsigned short create_time;
+	unsigned short create_date;
+	unsigned short access_date;
+	unsigned short cluster_high;
+	unsigned short modify_time;
+	unsigned short modify_date;
+	unsigned short cluster;
+	unsigned int size;
+} __attribute__((packed)) FatDirEntry;
+
+/* A run of clusters that are adjacent on disk */
+typedef struct {
+	unsigned int file_cluster;      /* Index of the first cluster in the file */
+	unsigned short disk_cluster;
+	unsigned short length;
+} FatExtent;
+
+/* A cluster chain as extents; rebuilt when the FAT generation moves on */
+typedef struct {
+	unsigned short first_cluster;
+	unsigned int generation;
+	unsigned int last_use;
+	unsigned int clusters;
+	unsigned int extent_count;
+	unsigned int extent_capacity;
+	FatExtent *extents;
+} FatChain;
+
+typedef struct {
+	BlockDevice *dev;
+	unsigned long long start;       /* First sector of the filesystem */
+	unsigned int sectors_per_cluster;
+	unsigned int cluster_size;      /* Bytes */
+	unsigned int fat_start;         /* Sectors, relative to start */
+	unsigned int fat_sectors;
+	unsigned int fat_copies;
+	unsigned int root_start;
+	unsigned int root_entries;
+	unsigned int data_start;
+	unsigned int cluster_count;     /* Data clusters: 2 .. cluster_count + 1 */
+	char label[12];
+
+	/* The whole FAT lives in memory; dirty sectors are written on flush */
+	unsigned short *fat;
+	unsigned char *fat_dirty;       /* One flag per FAT sector */
+	unsigned int free_clusters;
+	unsigned int next_free;         /* Allocation hint */
+	unsigned int generation;        /* Bumped on every FAT change */
+
+	FatChain chains[FAT_CHAIN_CACHE_SIZE];
+	unsigned int chain_clock;
+	unsigned int chain_hits;
+	unsigned int chain_misses;
+} FatVolume;
+
+/* Where a directory entry lives: directory (0 = root) and entry index */
+typedef struct {
+	unsigned short dir_cluster;
+	unsigned int index;
+} FatLocation;
+
+/* Directory listing entry */
+typedef struct {
+	char name[FAT_NAME_LENGTH];
+	unsigned char attributes;
+	unsigned int size;
+	unsigned short cluster;
+	FatLocation location;
+} FatDirent;
+
+/* Open file */
+typedef struct {
+	FatVolume *vol;
+	FatDirent entry;
+	unsigned int position;
+	int dirty;                      /* Size or first cluster changed */
+} FatFile;
+
+/* Volumes */
+void fat_init(void);
+FatVolume* fat_mount(BlockDevice *dev);
+FatVolume* fat_get_volume(int index);
+int fat_flush(FatVolume *vol);
+
+/* Names and paths - directories are identified by cluster (0 = root) */
+int fat_lookup(FatVolume *vol, unsigned short dir, const char *path, FatDirent *out);
+int fat_readdir(FatVolume *vol, unsigned short dir, unsigned int *index, FatDirent *out);
+
+/* Files - 0 on success, -1 on error; read/write return bytes moved */
+int fat_open(FatVolume *vol, unsigned short dir, const char *path, FatFile *file);
+int fat_create(FatVolume *vol, unsigned short dir, const char *path, FatFile *file);
+int fat_read(FatFile *file, void *buffer, unsigned int length);
+int fat_write(FatFile *file, const void *buffer, unsigned int length);
+int fat_seek(FatFile *file, unsigned int position);
+int fat_truncate(FatFile *file);
+int fat_close(FatFile *file);
+int fat_remove(FatVolume *vol, unsigned short dir, const char *path);
+
+/* Information */
+void fat_print_volumes(void);
+void fat_bench(void);
+
+#endif /* FAT_H */
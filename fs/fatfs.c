@@ -0,0 +1,206 @@
+/*
+ * fatfs Implementation
+ * Each inode carries a copy of the file's FatDirent. Reads and writes
+ * go through a short-lived FatFile built from it, so the FAT driver's
+ * chain cache and the block cache do the real work; after a write the
+ * directory entry is updated and the FAT flushed, as fat_close does.
+ */
+
+#include "fatfs.h"
+#include "../memory/slab.h"
+#include "../lib/string.h"
+#include "../essentials/sections.h"
+
+static const InodeOps fatfs_ops;
+
+static Inode* fatfs_inode(SuperBlock *sb, const FatDirent *entry)
+{
+	FatDirent *copy = (FatDirent*)kmalloc(sizeof(FatDirent));
+	Inode *inode;
+
+	if (!copy) {
+		return 0;
+	}
+	memcpy(copy, entry, sizeof(FatDirent));
+	inode = vfs_inode_alloc(sb, &fatfs_ops,
+	                        (entry->attributes & FAT_ATTR_DIRECTORY) ? VFS_DIR : VFS_FILE, copy);
+	if (!inode) {
+		kfree(copy);
+		return 0;
+	}
+	/* The entry's position on disk identifies the file; the root is 1 */
+	inode->ino = entry->name[0] == '/' ? 1 :
+	             ((unsigned int)entry->location.dir_cluster << 16) + entry->location.index + 2;
+	inode->size = entry->size;
+	return inode;
+}
+
+static void fatfs_file(Inode *inode, unsigned int offset, FatFile *file)
+{
+	file->vol = (FatVolume*)inode->sb->data;
+	memcpy(&file->entry, inode->data, sizeof(FatDirent));
+	file->position = offset;
+	file->dirty = 0;
+}
+
+/* Write back what the driver changed in the entry */
+static int fatfs_update(Inode *inode, FatFile *file)
+{
+	memcpy(inode->data, &file->entry, sizeof(FatDirent));
+	inode->size = file->entry.size;
+	return fat_close(file);
+}
+
+static int fatfs_lookup(Inode *dir, const char *name, Inode **out)
+{
+	FatDirent *entry = (FatDirent*)dir->data;
+	FatDirent found;
+
+	if (fat_lookup((FatVolume*)dir->sb->data, entry->cluster, name, &found) != 0) {
+		return -1;
+	}
+	*out = fatfs_inode(dir->sb, &found);
+	return *out ? 0 : -1;
+}
+
+/* "." and ".." are the VFS's business */
+static int fatfs_readdir(Inode *dir, unsigned int *cookie, VfsDirent *out)
+{
+	FatDirent *entry = (FatDirent*)dir->data;
+	FatDirent found;
+
+	do {
+		if (fat_readdir((FatVolume*)dir->sb->data, entry->cluster, cookie, &found) != 0) {
+			return -1;
+		}
+	} while (found.name[0] == '.');
+
+	strcpy(out->name, found.name);
+	out->type = (found.attributes & FAT_ATTR_DIRECTORY) ? VFS_DIR : VFS_FILE;
+	out->size = found.size;
+	return 0;
+}
+
+/* Files only: the FAT driver does not make directories */
+static int fatfs_create_file(Inode *dir, const char *name, int type, Inode **out)
+{
+	FatDirent *entry = (FatDirent*)dir->data;
+	FatFile file;
+
+	if (type != VFS_FILE ||
+	    fat_create((FatVolume*)dir->sb->data, entry->cluster, name, &file) != 0) {
+		return -1;
+	}
+	fat_close(&file);
+	*out = fatfs_inode(dir->sb, &file.entry);
+	return *out ? 0 : -1;
+}
+
+/*
+ * fat_remove frees the cluster chain at once, so a file still open or
+ * mapped by a program (any ref beyond the dentry's) can't be removed:
+ * its reads would follow freed clusters and its writes would land in
+ * the dead directory slot.
+ */
+static int fatfs_unlink(Inode *dir, const char *name, Inode *inode)
+{
+	FatDirent *entry = (FatDirent*)dir->data;
+
+	if (inode->refs > 1) {
+		return -1;
+	}
+	return fat_remove((FatVolume*)dir->sb->data, entry->cluster, name);
+}
+
+static int fatfs_read(Inode *inode, unsigned int offset, void *buffer, unsigned int length)
+{
+	FatFile file;
+
+	fatfs_file(inode, offset, &file);
+	return fat_read(&file, buffer, length);
+}
+
+static int fatfs_write(Inode *inode, unsigned int offset, const void *buffer, unsigned int length)
+{
+	FatFile file;
+	int bytes;
+
+	fatfs_file(inode, offset, &file);
+	bytes = fat_write(&file, buffer, length);
+	if (fatfs_update(inode, &file) != 0) {
+		return -1;
+	}
+	return bytes;
+}
+
+static int fatfs_truncate(Inode *inode)
+{
+	FatFile file;
+
+	fatfs_file(inode, 0, &file);
+	if (fat_truncate(&file) != 0) {
+		return -1;
+	}
+	return fatfs_update(inode, &file);
+}
+
+static void fatfs_release(Inode *inode)
+{
+	kfree(inode->data);
+}
+
+static const InodeOps fatfs_ops = {
+	fatfs_lookup,
+	fatfs_readdir,
+	fatfs_create_file,
+	fatfs_unlink,
+	fatfs_read,
+	fatfs_write,
+	fatfs_truncate,
+	fatfs_release
+};
+
+SuperBlock* fatfs_create(FatVolume *vol)
+{
+	SuperBlock *sb = (SuperBlock*)kzalloc(sizeof(SuperBlock));
+	FatDirent top;
+
+	if (!sb) {
+		return 0;
+	}
+	memset(&top, 0, sizeof(FatDirent));
+	top.name[0] = '/';
+	top.attributes = FAT_ATTR_DIRECTORY;
+
+	sb->type = "fat16";
+	strlcpy(sb->source, vol->dev->name, sizeof(sb->source));
+	sb->flags = VFS_SB_CASE_FOLD;
+	sb->data = vol;
+	sb->root = fatfs_inode(sb, &top);
+	if (!sb->root) {
+		kfree(sb);
+		return 0;
+	}
+	return sb;
+}
+
+__init void fatfs_mount_all(void)
+{
+	char path[8] = "/disk";
+	FatVolume *vol;
+	SuperBlock *sb;
+	int i;
+
+	for (i = 0; (vol = fat_get_volume(i)) != 0; i++) {
+		if (i > 0) {
+			path[5] = '0' + i;
+			path[6] = '\0';
+		}
+		sb = fatfs_create(vol);
+		vfs_mkdir(path);
+		if (sb && vfs_mount(path, sb) != 0) {
+			vfs_iput(sb->root);
+			kfree(sb);
+		}
+	}
+}
@@ -0,0 +1,16 @@
+/*
+ * fatfs - FAT16 volumes under the VFS
+ */
+
+#ifndef FATFS_H
+#define FATFS_H
+
+#include "vfs.h"
+#include "fat.h"
+
+SuperBlock* fatfs_create(FatVolume *vol);
+
+/* Mount every FAT volume: /disk, /disk1, ... */
+void fatfs_mount_all(void);
+
+#endif /* FATFS_H */
@@ -0,0 +1,316 @@
+/*
+ * initrd Implementation
+ * The archive is parsed once where the boot loader put it. Each member
+ * becomes a small node pointing at its data inside the module, so file
+ * reads copy straight out of the module - there is no ramdisk copy.
+ * Directories a path implies are made up if the archive lacks them.
+ * Formats: POSIX ustar (as made by tar --format=ustar) and cpio newc.
+ */
+
+#include "initrd.h"
+#include "../boot/multiboot.h"
+#include "../memory/slab.h"
+#include "../lib/string.h"
+#include "../essentials/sections.h"
+
+#define TAR_BLOCK 512
+#define CPIO_HEADER 110
+
+typedef struct InitrdNode {
+	char name[VFS_NAME_LENGTH];
+	int type;
+	const char *data;               /* Inside the module */
+	unsigned int size;
+	unsigned int ino;
+	struct InitrdNode *children;
+	struct InitrdNode *next;
+} InitrdNode;
+
+typedef struct {
+	InitrdNode *top;
+	unsigned int nodes;
+} InitrdInfo;
+
+static const InodeOps initrd_ops;
+
+static unsigned int parse_octal(const char *field, unsigned int length)
+{
+	unsigned int value = 0;
+
+	while (length-- > 0 && *field == ' ') {
+		field++;
+	}
+	for (; length > 0 && *field >= '0' && *field <= '7'; length--) {
+		value = (value << 3) + (*field++ - '0');
+	}
+	return value;
+}
+
+static unsigned int parse_hex(const char *field)
+{
+	unsigned int value = 0;
+	int i;
+	char c;
+
+	for (i = 0; i < 8; i++) {
+		c = field[i];
+		value <<= 4;
+		if (c >= '0' && c <= '9') {
+			value += c - '0';
+		} else if (c >= 'a' && c <= 'f') {
+			value += c - 'a' + 10;
+		} else if (c >= 'A' && c <= 'F') {
+			value += c - 'A' + 10;
+		}
+	}
+	return value;
+}
+
+/* Child of dir called name[0..length), made as a directory if missing */
+static InitrdNode* initrd_child(InitrdInfo *info, InitrdNode *dir, const char *name, unsigned int length)
+{
+	InitrdNode **link = &dir->children;
+	InitrdNode *node;
+
+	while (*link) {
+		if (strncmp((*link)->name, name, length) == 0 && (*link)->name[length] == '\0') {
+			return *link;
+		}
+		link = &(*link)->next;
+	}
+	node = (InitrdNode*)kzalloc(sizeof(InitrdNode));
+	if (!node) {
+		return 0;
+	}
+	memcpy(node->name, name, length);
+	node->type = VFS_DIR;
+	node->ino = ++info->nodes + 1;
+	*link = node;
+	return node;
+}
+
+/* Add a member; the path is split on '/', "." components dropped */
+static void initrd_add(InitrdInfo *info, const char *path, unsigned int path_length,
+                       int type, const char *data, unsigned int size)
+{
+	InitrdNode *node = info->top;
+	const char *end = path + path_length;
+	const char *part;
+
+	while (path < end && node) {
+		while (path < end && *path == '/') {
+			path++;
+		}
+		for (part = path; path < end && *path != '/'; path++) {
+		}
+		if (path == part || (path - part == 1 && *part == '.')) {
+			continue;
+		}
+		if (path - part >= VFS_NAME_LENGTH) {
+			return;
+		}
+		node = initrd_child(info, node, part, path - part);
+	}
+	if (node && node != info->top) {
+		node->type = type;
+		node->data = data;
+		node->size = size;
+	}
+}
+
+/* Prefix and name fields joined into buffer */
+static unsigned int tar_path(const char *header, char *buffer)
+{
+	unsigned int n = 0;
+	unsigned int i;
+
+	if (memcmp(header + 257, "ustar", 5) == 0 && header[345]) {
+		for (i = 0; i < 155 && header[345 + i]; i++) {
+			buffer[n++] = header[345 + i];
+		}
+		buffer[n++] = '/';
+	}
+	for (i = 0; i < 100 && header[i]; i++) {
+		buffer[n++] = header[i];
+	}
+	return n;
+}
+
+static int initrd_parse_tar(InitrdInfo *info, const char *p, const char *end)
+{
+	char path[256 + 2];
+	unsigned int size;
+	char type;
+
+	if (end - p < TAR_BLOCK || memcmp(p + 257, "ustar", 5) != 0) {
+		return -1;
+	}
+	while (end - p >= TAR_BLOCK && p[0] != '\0') {
+		size = parse_octal(p + 124, 12);
+		type = p[156];
+		if ((unsigned int)(end - p - TAR_BLOCK) < size) {
+			break;
+		}
+		/* Links, devices and extended headers are skipped */
+		if (type == '0' || type == '\0' || type == '5') {
+			initrd_add(info, path, tar_path(p, path), type == '5' ? VFS_DIR : VFS_FILE,
+			           p + TAR_BLOCK, type == '5' ? 0 : size);
+		}
+		p += TAR_BLOCK + ((size + TAR_BLOCK - 1) & ~(TAR_BLOCK - 1));
+	}
+	return 0;
+}
+
+static int initrd_parse_cpio(InitrdInfo *info, const char *p, const char *end)
+{
+	const char *name;
+	unsigned int name_size;
+	unsigned int size;
+	unsigned int mode;
+
+	if (end - p < CPIO_HEADER || memcmp(p, "070701", 6) != 0) {
+		return -1;
+	}
+	while (end - p >= CPIO_HEADER && memcmp(p, "070701", 6) == 0) {
+		mode = parse_hex(p + 14);
+		size = parse_hex(p + 54);
+		name_size = parse_hex(p + 94);
+		name = p + CPIO_HEADER;
+		if ((unsigned int)(end - name) < name_size) {
+			break;
+		}
+		if (name_size == 11 && memcmp(name, "TRAILER!!!", 10) == 0) {
+			break;
+		}
+		/* Name and data each start 4-byte aligned */
+		p = (const char*)(((unsigned long)name + name_size + 3) & ~3ul);
+		if ((unsigned int)(end - p) < size) {
+			break;
+		}
+		if ((mode & 0170000) == 0040000 || (mode & 0170000) == 0100000) {
+			initrd_add(info, name, name_size - 1,
+			           (mode & 0170000) == 0040000 ? VFS_DIR : VFS_FILE, p, size);
+		}
+		p = (const char*)(((unsigned long)p + size + 3) & ~3ul);
+	}
+	return 0;
+}
+
+static int initrd_lookup(Inode *dir, const char *name, Inode **out)
+{
+	InitrdNode *node = ((InitrdNode*)dir->data)->children;
+
+	while (node && strcmp(node->name, name) != 0) {
+		node = node->next;
+	}
+	if (!node) {
+		return -1;
+	}
+	*out = vfs_inode_alloc(dir->sb, &initrd_ops, node->type, node);
+	if (!*out) {
+		return -1;
+	}
+	(*out)->ino = node->ino;
+	(*out)->size = node->size;
+	return 0;
+}
+
+static int initrd_readdir(Inode *dir, unsigned int *cookie, VfsDirent *out)
+{
+	InitrdNode *node = ((InitrdNode*)dir->data)->children;
+	unsigned int i;
+
+	for (i = 0; node && i < *cookie; i++) {
+		node = node->next;
+	}
+	if (!node) {
+		return -1;
+	}
+	strcpy(out->name, node->name);
+	out->type = node->type;
+	out->size = node->size;
+	(*cookie)++;
+	return 0;
+}
+
+static int initrd_read(Inode *inode, unsigned int offset, void *buffer, unsigned int length)
+{
+	InitrdNode *node = (InitrdNode*)inode->data;
+
+	if (offset >= node->size) {
+		return 0;
+	}
+	if (length > node->size - offset) {
+		length = node->size - offset;
+	}
+	memcpy(buffer, node->data + offset, length);
+	return length;
+}
+
+static const InodeOps initrd_ops = {
+	initrd_lookup,
+	initrd_readdir,
+	0,
+	0,
+	initrd_read,
+	0,
+	0,
+	0
+};
+
+SuperBlock* initrd_create(const char *start, unsigned int size, const char *source)
+{
+	SuperBlock *sb = (SuperBlock*)kzalloc(sizeof(SuperBlock));
+	InitrdInfo *info = (InitrdInfo*)kzalloc(sizeof(InitrdInfo));
+
+	if (!sb || !info || !(info->top = (InitrdNode*)kzalloc(sizeof(InitrdNode)))) {
+		kfree(sb);
+		kfree(info);
+		return 0;
+	}
+	info->top->type = VFS_DIR;
+	info->top->ino = 1;
+	if (initrd_parse_tar(info, start, start + size) != 0 &&
+	    initrd_parse_cpio(info, start, start + size) != 0) {
+		kfree(info->top);
+		kfree(info);
+		kfree(sb);
+		return 0;
+	}
+
+	sb->type = "initrd";
+	strlcpy(sb->source, source, sizeof(sb->source));
+	sb->flags = VFS_SB_READ_ONLY;
+	sb->data = info;
+	sb->root = vfs_inode_alloc(sb, &initrd_ops, VFS_DIR, info->top);
+	if (sb->root) {
+		sb->root->ino = 1;
+	}
+	return sb;
+}
+
+__init void initrd_init(void)
+{
+	char path[16] = "/initrd";
+	char source[8] = "module0";
+	const BootModule *mod;
+	SuperBlock *sb;
+	int mounted = 0;
+	int i;
+
+	for (i = 0; (mod = multiboot_module(i)) != 0; i++) {
+		source[6] = '0' + i;
+		sb = initrd_create((const char*)mod->start, mod->end - mod->start, source);
+		if (!sb) {
+			continue;
+		}
+		if (mounted > 0) {
+			path[7] = '0' + mounted;
+			path[8] = '\0';
+		}
+		vfs_mkdir(path);
+		if (vfs_mount(path, sb) == 0) {
+			mounted++;
+		}
+	}
+}
@@ -0,0 +1,16 @@
+/*
+ * initrd - Read-only tar or cpio archives from multiboot modules
+ */
+
+#ifndef INITRD_H
+#define INITRD_H
+
+#include "vfs.h"
+
+/* Index an archive in place; 0 if it is neither ustar nor cpio newc */
+SuperBlock* initrd_create(const char *start, unsigned int size, const char *source);
+
+/* Mount every archive module: /initrd, /initrd1, ... */
+void initrd_init(void);
+
+#endif /* INITRD_H */
@@ -0,0 +1,230 @@
+/*
+ * ramfs Implementation
+ * A tree of nodes on the kernel heap. File data is one buffer that
+ * doubles as it grows. A node has at most one inode, cached in the node;
+ * an unlinked node lives on until that inode is released.
+ */
+
+#include "ramfs.h"
+#include "../memory/slab.h"
+#include "../lib/string.h"
+
+#define RAMFS_MIN_CAPACITY 256
+
+typedef struct RamNode {
+	char name[VFS_NAME_LENGTH];
+	int type;
+	char *data;
+	unsigned int size;
+	unsigned int capacity;
+	struct RamNode *children;
+	struct RamNode *next;
+	Inode *inode;
+	int unlinked;
+} RamNode;
+
+static const InodeOps ramfs_ops;
+
+static void ramfs_free(RamNode *node)
+{
+	kfree(node->data);
+	kfree(node);
+}
+
+static Inode* ramfs_inode(SuperBlock *sb, RamNode *node)
+{
+	if (node->inode) {
+		node->inode->refs++;
+	} else {
+		node->inode = vfs_inode_alloc(sb, &ramfs_ops, node->type, node);
+		if (node->inode) {
+			node->inode->size = node->size;
+		}
+	}
+	return node->inode;
+}
+
+static RamNode* ramfs_find(RamNode *dir, const char *name)
+{
+	RamNode *node = dir->children;
+
+	while (node && strcmp(node->name, name) != 0) {
+		node = node->next;
+	}
+	return node;
+}
+
+static int ramfs_lookup(Inode *dir, const char *name, Inode **out)
+{
+	RamNode *node = ramfs_find((RamNode*)dir->data, name);
+
+	if (!node) {
+		return -1;
+	}
+	*out = ramfs_inode(dir->sb, node);
+	return *out ? 0 : -1;
+}
+
+static int ramfs_readdir(Inode *dir, unsigned int *cookie, VfsDirent *out)
+{
+	RamNode *node = ((RamNode*)dir->data)->children;
+	unsigned int i;
+
+	for (i = 0; node && i < *cookie; i++) {
+		node = node->next;
+	}
+	if (!node) {
+		return -1;
+	}
+	strcpy(out->name, node->name);
+	out->type = node->type;
+	out->size = node->size;
+	(*cookie)++;
+	return 0;
+}
+
+/* New entries go at the end, so listings come out in creation order */
+static int ramfs_create_node(Inode *dir, const char *name, int type, Inode **out)
+{
+	RamNode *parent = (RamNode*)dir->data;
+	RamNode **link = &parent->children;
+	RamNode *node;
+
+	if (ramfs_find(parent, name)) {
+		return -1;
+	}
+	node = (RamNode*)kzalloc(sizeof(RamNode));
+	if (!node) {
+		return -1;
+	}
+	strcpy(node->name, name);
+	node->type = type;
+	*out = ramfs_inode(dir->sb, node);
+	if (!*out) {
+		kfree(node);
+		return -1;
+	}
+	while (*link) {
+		link = &(*link)->next;
+	}
+	*link = node;
+	return 0;
+}
+
+static int ramfs_unlink(Inode *dir, const char *name, Inode *inode)
+{
+	RamNode **link = &((RamNode*)dir->data)->children;
+	RamNode *node;
+
+	while (*link && strcmp((*link)->name, name) != 0) {
+		link = &(*link)->next;
+	}
+	node = *link;
+	if (!node || (node->type == VFS_DIR && node->children)) {
+		return -1;
+	}
+	*link = node->next;
+	if (node->inode) {
+		node->unlinked = 1;
+	} else {
+		ramfs_free(node);
+	}
+	(void)inode;
+	return 0;
+}
+
+static int ramfs_read(Inode *inode, unsigned int offset, void *buffer, unsigned int length)
+{
+	RamNode *node = (RamNode*)inode->data;
+
+	if (offset >= node->size) {
+		return 0;
+	}
+	if (length > node->size - offset) {
+		length = node->size - offset;
+	}
+	memcpy(buffer, node->data + offset, length);
+	return length;
+}
+
+static int ramfs_write(Inode *inode, unsigned int offset, const void *buffer, unsigned int length)
+{
+	RamNode *node = (RamNode*)inode->data;
+	unsigned int end = offset + length;
+	unsigned int capacity;
+	char *data;
+
+	if (offset > node->size || end < offset) {
+		return -1;
+	}
+	if (end > node->capacity) {
+		capacity = node->capacity ? node->capacity : RAMFS_MIN_CAPACITY;
+		while (capacity < end) {
+			capacity *= 2;
+		}
+		data = (char*)kmalloc(capacity);
+		if (!data) {
+			return -1;
+		}
+		memcpy(data, node->data, node->size);
+		kfree(node->data);
+		node->data = data;
+		node->capacity = capacity;
+	}
+	memcpy(node->data + offset, buffer, length);
+	if (end > node->size) {
+		node->size = end;
+		inode->size = end;
+	}
+	return length;
+}
+
+static int ramfs_truncate(Inode *inode)
+{
+	RamNode *node = (RamNode*)inode->data;
+
+	kfree(node->data);
+	node->data = 0;
+	node->size = 0;
+	node->capacity = 0;
+	inode->size = 0;
+	return 0;
+}
+
+static void ramfs_release(Inode *inode)
+{
+	RamNode *node = (RamNode*)inode->data;
+
+	node->inode = 0;
+	if (node->unlinked) {
+		ramfs_free(node);
+	}
+}
+
+static const InodeOps ramfs_ops = {
+	ramfs_lookup,
+	ramfs_readdir,
+	ramfs_create_node,
+	ramfs_unlink,
+	ramfs_read,
+	ramfs_write,
+	ramfs_truncate,
+	ramfs_release
+};
+
+SuperBlock* ramfs_create(const char *source)
+{
+	SuperBlock *sb = (SuperBlock*)kzalloc(sizeof(SuperBlock));
+	RamNode *top = (RamNode*)kzalloc(sizeof(RamNode));
+
+	if (!sb || !top) {
+		kfree(sb);
+		kfree(top);
+		return 0;
+	}
+	top->type = VFS_DIR;
+	sb->type = "ramfs";
+	strlcpy(sb->source, source, sizeof(sb->source));
+	sb->root = ramfs_inode(sb, top);
+	return sb;
+}
@@ -0,0 +1,13 @@
+/*
+ * ramfs - Files and directories in kernel memory
+ */
+
+#ifndef RAMFS_H
+#define RAMFS_H
+
+#include "vfs.h"
+
+/* An empty filesystem, ready to mount */
+SuperBlock* ramfs_create(const char *source);
+
+#endif /* RAMFS_H */
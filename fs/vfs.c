@@ -0,0 +1,721 @@
+/*
+ * VFS Implementation
+ * Every name the kernel has resolved stays in a hashed dentry cache,
+ * keyed by (parent dentry, name). Names that turned out not to exist are
+ * kept too, as negative entries, so asking again for a missing file does
+ * not rescan the directory. Unused dentries sit on an LRU list and are
+ * recycled from its tail; a dentry in use (by a child, a mount, an open
+ * file or the current directory) is never evicted.
+ *
+ * Mounting hangs the new filesystem's root dentry off the mountpoint.
+ * That root takes the mountpoint's name and parent, so ".." and getcwd
+ * walk out of a mounted filesystem without special cases.
+ */
+
+#include "vfs.h"
+#include "ramfs.h"
+#include "../memory/slab.h"
+#include "../output/output.h"
+#include "../lib/string.h"
+#include "../bench/bench.h"
+#include "../essentials/sections.h"
+
+typedef struct {
+	char path[VFS_PATH_LENGTH];
+	SuperBlock *sb;
+} VfsMount;
+
+static Dentry *free_dentries = 0;
+static Dentry *hash_table[VFS_DCACHE_BUCKETS];
+static Dentry *lru_head = 0;
+static Dentry *lru_tail = 0;
+static unsigned int dentries_used = 0;
+static Dentry *root = 0;
+static Dentry *cwd = 0;
+static File files[VFS_MAX_FILES];
+static VfsMount mounts[VFS_MAX_MOUNTS];
+static int mount_count = 0;
+static unsigned int next_ino = 1;
+static VfsStats stats;
+
+Inode* vfs_inode_alloc(SuperBlock *sb, const InodeOps *ops, int type, void *data)
+{
+	Inode *inode = (Inode*)kzalloc(sizeof(Inode));
+
+	if (inode) {
+		inode->ino = next_ino++;
+		inode->type = type;
+		inode->refs = 1;
+		inode->sb = sb;
+		inode->ops = ops;
+		inode->data = data;
+	}
+	return inode;
+}
+
+void vfs_iput(Inode *inode)
+{
+	if (inode && --inode->refs == 0) {
+		if (inode->ops->release) {
+			inode->ops->release(inode);
+		}
+		kfree(inode);
+	}
+}
+
+/* FNV-1a over the name, mixed with the parent */
+static unsigned int vfs_hash(Dentry *parent, const char *name)
+{
+	unsigned int hash = 2166136261u ^ ((unsigned long)parent >> 4);
+
+	while (*name) {
+		hash = (hash ^ (unsigned char)*name++) * 16777619u;
+	}
+	return hash & (VFS_DCACHE_BUCKETS - 1);
+}
+
+static void lru_remove(Dentry *d)
+{
+	if (d->lru_prev) {
+		d->lru_prev->lru_next = d->lru_next;
+	} else {
+		lru_head = d->lru_next;
+	}
+	if (d->lru_next) {
+		d->lru_next->lru_prev = d->lru_prev;
+	} else {
+		lru_tail = d->lru_prev;
+	}
+	d->lru_prev = 0;
+	d->lru_next = 0;
+}
+
+static void lru_add(Dentry *d)
+{
+	d->lru_prev = 0;
+	d->lru_next = lru_head;
+	if (lru_head) {
+		lru_head->lru_prev = d;
+	} else {
+		lru_tail = d;
+	}
+	lru_head = d;
+}
+
+static void d_put(Dentry *d)
+{
+	if (d && d->refs > 0) {
+		d->refs--;
+	}
+}
+
+/* Drop a cached dentry: unhash it and release its inode and parent */
+static void d_evict(Dentry *d)
+{
+	Dentry **link = &hash_table[vfs_hash(d->parent, d->name)];
+
+	while (*link && *link != d) {
+		link = &(*link)->hash_next;
+	}
+	if (*link) {
+		*link = d->hash_next;
+	}
+	lru_remove(d);
+	vfs_iput(d->inode);
+	d_put(d->parent);
+
+	memset(d, 0, sizeof(Dentry));
+	d->hash_next = free_dentries;
+	free_dentries = d;
+	dentries_used--;
+	stats.evictions++;
+}
+
+/* A blank dentry from the free list, or the least recently used idle one */
+static Dentry* d_alloc(void)
+{
+	Dentry *d = free_dentries;
+
+	if (!d) {
+		for (d = lru_tail; d && d->refs > 0; d = d->lru_prev) {
+		}
+		if (!d) {
+			return 0;
+		}
+		d_evict(d);
+		d = free_dentries;
+	}
+	free_dentries = d->hash_next;
+	d->hash_next = 0;
+	dentries_used++;
+	return d;
+}
+
+static Dentry* d_find(Dentry *parent, const char *name)
+{
+	Dentry *d = hash_table[vfs_hash(parent, name)];
+
+	while (d && (d->parent != parent || strcmp(d->name, name) != 0)) {
+		d = d->hash_next;
+	}
+	return d;
+}
+
+/* Referenced child of parent called name - positive or negative, 0 on error */
+static Dentry* d_lookup(Dentry *parent, const char *name)
+{
+	Inode *dir = parent->inode;
+	Inode *inode = 0;
+	Dentry *d;
+
+	stats.lookups++;
+	d = d_find(parent, name);
+	if (d) {
+		if (d->inode) {
+			stats.hits++;
+		} else {
+			stats.negative_hits++;
+		}
+		lru_remove(d);
+		lru_add(d);
+		d->refs++;
+		return d;
+	}
+
+	stats.misses++;
+	if (!dir->ops->lookup || dir->ops->lookup(dir, name, &inode) != 0) {
+		inode = 0;
+	}
+
+	/* The filesystem may have slept; someone else may have added the name */
+	d = d_find(parent, name);
+	if (d) {
+		vfs_iput(inode);
+		d->refs++;
+		return d;
+	}
+	d = d_alloc();
+	if (!d) {
+		vfs_iput(inode);
+		return 0;
+	}
+	strcpy(d->name, name);
+	d->parent = parent;
+	parent->refs++;
+	d->inode = inode;
+	d->refs = 1;
+	d->hashed = 1;
+	d->hash_next = hash_table[vfs_hash(parent, name)];
+	hash_table[vfs_hash(parent, name)] = d;
+	lru_add(d);
+	return d;
+}
+
+/* Step onto whatever is mounted on d */
+static Dentry* d_follow(Dentry *d)
+{
+	Dentry *m;
+
+	while (d->mounted) {
+		m = d->mounted;
+		m->refs++;
+		d_put(d);
+		d = m;
+	}
+	return d;
+}
+
+/*
+ * Resolve path to a referenced dentry, 0 on error. The final component
+ * may come back negative. With last set, stop before the final
+ * component, copy its (folded) name there and return its directory.
+ */
+static Dentry* vfs_walk(const char *path, char *last)
+{
+	Dentry *d = (*path == '/') ? root : cwd;
+	Dentry *next;
+	char name[VFS_NAME_LENGTH];
+	const char *end;
+	const char *rest;
+	unsigned int length;
+	unsigned int i;
+	int fold;
+
+	stats.walks++;
+	d->refs++;
+	for (;;) {
+		while (*path == '/') {
+			path++;
+		}
+		if (*path == '\0') {
+			if (last) {
+				d_put(d);
+				return 0;
+			}
+			return d;
+		}
+		for (end = path; *end && *end != '/'; end++) {
+		}
+		for (rest = end; *rest == '/'; rest++) {
+		}
+		length = end - path;
+		if (length >= VFS_NAME_LENGTH || !d->inode || d->inode->type != VFS_DIR) {
+			d_put(d);
+			return 0;
+		}
+
+		fold = d->inode->sb->flags & VFS_SB_CASE_FOLD;
+		for (i = 0; i < length; i++) {
+			name[i] = (fold && path[i] >= 'A' && path[i] <= 'Z') ? path[i] + 32 : path[i];
+		}
+		name[length] = '\0';
+		path = end;
+
+		if (last && *rest == '\0') {
+			strcpy(last, name);
+			return d;
+		}
+		if (strcmp(name, ".") == 0) {
+			continue;
+		}
+		if (strcmp(name, "..") == 0) {
+			next = d->parent ? d->parent : d;
+			next->refs++;
+			d_put(d);
+			d = next;
+			continue;
+		}
+
+		next = d_lookup(d, name);
+		d_put(d);
+		if (!next) {
+			return 0;
+		}
+		if (!next->inode) {
+			if (*rest == '\0') {
+				return next;
+			}
+			d_put(next);
+			return 0;
+		}
+		d = d_follow(next);
+	}
+}
+
+/* Referenced, existing dentry for path, or 0 */
+static Dentry* vfs_resolve(const char *path)
+{
+	Dentry *d = vfs_walk(path, 0);
+
+	if (d && !d->inode) {
+		d_put(d);
+		return 0;
+	}
+	return d;
+}
+
+/* Look up, and if missing create, the last component of path */
+static Dentry* vfs_create(const char *path, int type, int *created)
+{
+	char name[VFS_NAME_LENGTH];
+	Dentry *parent = vfs_walk(path, name);
+	Inode *dir;
+	Inode *inode;
+	Dentry *d;
+
+	*created = 0;
+	if (!parent) {
+		return 0;
+	}
+	if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+		d_put(parent);
+		return vfs_resolve(path);
+	}
+	d = d_lookup(parent, name);
+	dir = parent->inode;
+	if (d && !d->inode) {
+		if ((dir->sb->flags & VFS_SB_READ_ONLY) || !dir->ops->create ||
+		    dir->ops->create(dir, name, type, &inode) != 0) {
+			d_put(d);
+			d = 0;
+		} else {
+			d->inode = inode;
+			*created = 1;
+		}
+	}
+	d_put(parent);
+	return d ? d_follow(d) : 0;
+}
+
+/* ramfs root with /tmp */
+__init void vfs_init(void)
+{
+	Dentry *pool = (Dentry*)kzalloc(VFS_DCACHE_ENTRIES * sizeof(Dentry));
+	SuperBlock *sb = ramfs_create("ram");
+	int i;
+
+	if (!pool || !sb) {
+		return;
+	}
+	for (i = VFS_DCACHE_ENTRIES - 1; i >= 0; i--) {
+		pool[i].hash_next = free_dentries;
+		free_dentries = &pool[i];
+	}
+
+	/* The root is never hashed, so it is never evicted */
+	root = d_alloc();
+	root->name[0] = '/';
+	root->inode = sb->root;
+	root->refs = 2;                 /* Pinned, and the current directory */
+	cwd = root;
+
+	sb->id = 0;
+	strcpy(mounts[0].path, "/");
+	mounts[0].sb = sb;
+	mount_count = 1;
+
+	vfs_mkdir("/tmp");
+}
+
+int vfs_mount(const char *path, SuperBlock *sb)
+{
+	Dentry *mp;
+	Dentry *top;
+	unsigned int length = strlen(path);
+
+	if (!root || !sb || mount_count == VFS_MAX_MOUNTS || length >= VFS_PATH_LENGTH) {
+		return -1;
+	}
+	mp = vfs_resolve(path);
+	if (!mp) {
+		return -1;
+	}
+	if (mp->inode->type != VFS_DIR || mp->mounted || !mp->hashed) {
+		d_put(mp);
+		return -1;
+	}
+	top = d_alloc();
+	if (!top) {
+		d_put(mp);
+		return -1;
+	}
+
+	/* The walk's reference on mp pins the mountpoint; top is pinned by the mount */
+	strcpy(top->name, mp->name);
+	top->parent = mp->parent;
+	top->parent->refs++;
+	top->inode = sb->root;
+	top->refs = 1;
+	mp->mounted = top;
+
+	sb->id = mount_count;
+	strcpy(mounts[mount_count].path, path);
+	mounts[mount_count].sb = sb;
+	mount_count++;
+	return 0;
+}
+
+static File* vfs_file(int fd)
+{
+	if (fd < 0 || fd >= VFS_MAX_FILES || files[fd].refs == 0) {
+		return 0;
+	}
+	return &files[fd];
+}
+
+int vfs_open(const char *path, int flags)
+{
+	Dentry *d;
+	Inode *inode;
+	File *file;
+	int writing = flags & (VFS_O_WRITE | VFS_O_APPEND | VFS_O_TRUNC);
+	int created;
+	int fd;
+
+	for (fd = 0; fd < VFS_MAX_FILES && files[fd].refs > 0; fd++) {
+	}
+	if (fd == VFS_MAX_FILES) {
+		return -1;
+	}
+
+	d = (flags & VFS_O_CREATE) ? vfs_create(path, VFS_FILE, &created) : vfs_resolve(path);
+	if (!d) {
+		return -1;
+	}
+	inode = d->inode;
+	if (writing && (inode->type == VFS_DIR || (inode->sb->flags & VFS_SB_READ_ONLY) ||
+	                !inode->ops->write)) {
+		d_put(d);
+		return -1;
+	}
+	if ((flags & VFS_O_TRUNC) && inode->size > 0 &&
+	    (!inode->ops->truncate || inode->ops->truncate(inode) != 0)) {
+		d_put(d);
+		return -1;
+	}
+
+	file = &files[fd];
+	file->dentry = d;
+	file->inode = inode;
+	inode->refs++;
+	file->position = 0;
+	file->flags = flags;
+	file->refs = 1;
+	return fd;
+}
+
+int vfs_read(int fd, void *buffer, unsigned int length)
+{
+	File *file = vfs_file(fd);
+	int bytes;
+
+	if (!file || file->inode->type != VFS_FILE || !file->inode->ops->read) {
+		return -1;
+	}
+	bytes = file->inode->ops->read(file->inode, file->position, buffer, length);
+	if (bytes > 0) {
+		file->position += bytes;
+	}
+	return bytes;
+}
+
+int vfs_write(int fd, const void *buffer, unsigned int length)
+{
+	File *file = vfs_file(fd);
+	int bytes;
+
+	if (!file || !(file->flags & (VFS_O_WRITE | VFS_O_APPEND))) {
+		return -1;
+	}
+	if (file->flags & VFS_O_APPEND) {
+		file->position = file->inode->size;
+	}
+	bytes = file->inode->ops->write(file->inode, file->position, buffer, length);
+	if (bytes > 0) {
+		file->position += bytes;
+	}
+	return bytes;
+}
+
+/* No holes: positions past the end are refused */
+int vfs_seek(int fd, unsigned int position)
+{
+	File *file = vfs_file(fd);
+
+	if (!file || position > file->inode->size) {
+		return -1;
+	}
+	file->position = position;
+	return 0;
+}
+
+/* Next entry of an open directory - 0, or -1 at the end */
+int vfs_readdir(int fd, VfsDirent *out)
+{
+	File *file = vfs_file(fd);
+
+	if (!file || file->inode->type != VFS_DIR || !file->inode->ops->readdir) {
+		return -1;
+	}
+	return file->inode->ops->readdir(file->inode, &file->position, out);
+}
+
+int vfs_close(int fd)
+{
+	File *file = vfs_file(fd);
+
+	if (!file) {
+		return -1;
+	}
+	if (--file->refs == 0) {
+		vfs_iput(file->inode);
+		d_put(file->dentry);
+		file->inode = 0;
+		file->dentry = 0;
+	}
+	return 0;
+}
+
+/* Referenced inode of the regular file at path, or 0 - release with vfs_iput() */
+Inode* vfs_iget_path(const char *path)
+{
+	Dentry *d = vfs_resolve(path);
+	Inode *inode = 0;
+
+	if (!d) {
+		return 0;
+	}
+	if (d->inode->type == VFS_FILE && d->inode->ops->read) {
+		inode = d->inode;
+		inode->refs++;
+	}
+	d_put(d);
+	return inode;
+}
+
+/* Read at an offset without an open file - bytes read, or -1 */
+int vfs_iread(Inode *inode, unsigned int offset, void *buffer, unsigned int length)
+{
+	if (!inode->ops->read) {
+		return -1;
+	}
+	return inode->ops->read(inode, offset, buffer, length);
+}
+
+int vfs_stat(const char *path, VfsStat *st)
+{
+	Dentry *d = vfs_resolve(path);
+
+	if (!d) {
+		return -1;
+	}
+	st->dev = d->inode->sb->id;
+	st->ino = d->inode->ino;
+	st->type = d->inode->type;
+	st->size = d->inode->size;
+	st->fs_type = d->inode->sb->type;
+	d_put(d);
+	return 0;
+}
+
+int vfs_mkdir(const char *path)
+{
+	int created;
+	Dentry *d = vfs_create(path, VFS_DIR, &created);
+
+	d_put(d);
+	return (d && created) ? 0 : -1;
+}
+
+/* Evict idle cached children of d (negative entries, mostly) */
+static void d_prune_children(Dentry *d)
+{
+	Dentry *child;
+	Dentry *prev;
+
+	for (child = lru_tail; child; child = prev) {
+		prev = child->lru_prev;
+		if (child->parent == d && child->refs == 0) {
+			d_evict(child);
+		}
+	}
+}
+
+/* Remove a file or an empty directory that nothing is using */
+int vfs_unlink(const char *path)
+{
+	char name[VFS_NAME_LENGTH];
+	Dentry *parent = vfs_walk(path, name);
+	Dentry *d;
+	Inode *dir;
+	int result = -1;
+
+	if (!parent) {
+		return -1;
+	}
+	dir = parent->inode;
+	d = (strcmp(name, ".") && strcmp(name, "..")) ? d_lookup(parent, name) : 0;
+	if (d && d->inode && !d->mounted && !(dir->sb->flags & VFS_SB_READ_ONLY) && dir->ops->unlink) {
+		if (d->inode->type == VFS_DIR) {
+			d_prune_children(d);
+		}
+		/* A directory still referenced is someone's cwd or has live children */
+		if ((d->inode->type != VFS_DIR || d->refs == 1) &&
+		    dir->ops->unlink(dir, name, d->inode) == 0) {
+			vfs_iput(d->inode);
+			d->inode = 0;
+			result = 0;
+		}
+	}
+	d_put(d);
+	d_put(parent);
+	return result;
+}
+
+int vfs_chdir(const char *path)
+{
+	Dentry *d = vfs_resolve(path);
+
+	if (!d) {
+		return -1;
+	}
+	if (d->inode->type != VFS_DIR) {
+		d_put(d);
+		return -1;
+	}
+	d_put(cwd);
+	cwd = d;
+	return 0;
+}
+
+/* Path of the current directory, built from the dentry parents */
+void vfs_getcwd(char *buffer, unsigned int length)
+{
+	Dentry *chain[VFS_PATH_LENGTH / 2];
+	Dentry *d;
+	unsigned int depth = 0;
+	unsigned int n = 0;
+	unsigned int size;
+
+	for (d = cwd; d && d != root && depth < VFS_PATH_LENGTH / 2; d = d->parent) {
+		chain[depth++] = d;
+	}
+	if (length < 2) {
+		return;
+	}
+	buffer[n++] = '/';
+	while (depth > 0) {
+		d = chain[--depth];
+		size = strlen(d->name);
+		if (n + size + 2 > length) {
+			break;
+		}
+		memcpy(buffer + n, d->name, size);
+		n += size;
+		if (depth > 0) {
+			buffer[n++] = '/';
+		}
+	}
+	buffer[n] = '\0';
+}
+
+void vfs_print_mounts(void)
+{
+	int i;
+
+	for (i = 0; i < mount_count; i++) {
+		kprint(mounts[i].path);
+		kprint(" type ");
+		kprint(mounts[i].sb->type);
+		kprint(" (");
+		kprint(mounts[i].sb->source);
+		kprint((mounts[i].sb->flags & VFS_SB_READ_ONLY) ? ", ro)\n" : ", rw)\n");
+	}
+}
+
+void vfs_print_stats(void)
+{
+	unsigned int answered = stats.hits + stats.negative_hits;
+
+	kprint("Dentry cache: ");
+	kprint_dec(dentries_used);
+	kprint(" of ");
+	kprint_dec(VFS_DCACHE_ENTRIES);
+	kprint(" entries, ");
+	kprint_dec(stats.evictions);
+	kprint(" evictions\n");
+
+	kprint("  paths ");
+	kprint_dec(stats.walks);
+	kprint(", lookups ");
+	kprint_dec(stats.lookups);
+	kprint(": hits ");
+	kprint_dec(stats.hits);
+	kprint(", negative hits ");
+	kprint_dec(stats.negative_hits);
+	kprint(", misses ");
+	kprint_dec(stats.misses);
+	kprint(" (");
+	kprint_dec(stats.lookups ? (unsigned int)bench_div64((unsigned long long)answered * 100, stats.lookups) : 0);
+	kprint("% hit rate)\n");
+}
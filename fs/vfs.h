@@ -0,0 +1,148 @@
+/*
+ * VFS - One namespace over ramfs, FAT16 volumes and the initrd
+ */
+
+#ifndef VFS_H
+#define VFS_H
+
+#define VFS_NAME_LENGTH 32
+#define VFS_PATH_LENGTH 256
+#define VFS_MAX_MOUNTS 8
+#define VFS_MAX_FILES 32
+
+/* Dentry cache: pool size and hash buckets (power of two) */
+#define VFS_DCACHE_ENTRIES 512
+#define VFS_DCACHE_BUCKETS 256
+
+/* Inode types */
+#define VFS_FILE 1
+#define VFS_DIR 2
+
+/* Open flags */
+#define VFS_O_READ 0x01
+#define VFS_O_WRITE 0x02
+#define VFS_O_CREATE 0x04
+#define VFS_O_TRUNC 0x08
+#define VFS_O_APPEND 0x10
+
+/* Superblock flags */
+#define VFS_SB_READ_ONLY 0x01
+#define VFS_SB_CASE_FOLD 0x02           /* Names compare case-insensitively */
+
+struct Inode;
+struct SuperBlock;
+
+/* One directory entry as returned by readdir */
+typedef struct {
+	char name[VFS_NAME_LENGTH];
+	int type;
+	unsigned int size;
+} VfsDirent;
+
+/* Filesystem operations; any may be 0 if the filesystem can't do it */
+typedef struct {
+	/* 0 and a new inode reference in *out, or -1 if name does not exist */
+	int (*lookup)(struct Inode *dir, const char *name, struct Inode **out);
+	/* Next entry from *cookie (0 to start) - -1 at the end */
+	int (*readdir)(struct Inode *dir, unsigned int *cookie, VfsDirent *out);
+	int (*create)(struct Inode *dir, const char *name, int type, struct Inode **out);
+	int (*unlink)(struct Inode *dir, const char *name, struct Inode *inode);
+	/* Bytes moved, or -1 */
+	int (*read)(struct Inode *inode, unsigned int offset, void *buffer, unsigned int length);
+	int (*write)(struct Inode *inode, unsigned int offset, const void *buffer, unsigned int length);
+	int (*truncate)(struct Inode *inode);
+	/* Last reference gone: free the filesystem's private data */
+	void (*release)(struct Inode *inode);
+} InodeOps;
+
+typedef struct Inode {
+	unsigned int ino;
+	int type;
+	unsigned int size;
+	unsigned int refs;
+	struct SuperBlock *sb;
+	const InodeOps *ops;
+	void *data;
+} Inode;
+
+typedef struct SuperBlock {
+	unsigned int id;                /* Assigned at mount */
+	const char *type;
+	char source[16];
+	unsigned int flags;
+	Inode *root;
+	void *data;
+} SuperBlock;
+
+/* A name in a directory; inode 0 makes it a negative entry */
+typedef struct Dentry {
+	char name[VFS_NAME_LENGTH];
+	struct Dentry *parent;          /* A mounted root points at the mountpoint's parent */
+	Inode *inode;
+	struct Dentry *mounted;         /* Root of a filesystem mounted here */
+	unsigned int refs;              /* Children, mounts, open files, cwd, callers */
+	int hashed;
+	struct Dentry *hash_next;
+	struct Dentry *lru_prev;
+	struct Dentry *lru_next;
+} Dentry;
+
+/* Open file */
+typedef struct {
+	Dentry *dentry;
+	Inode *inode;
+	unsigned int position;
+	int flags;
+	unsigned int refs;
+} File;
+
+typedef struct {
+	unsigned int dev;               /* Superblock id - with ino, identifies the file */
+	unsigned int ino;
+	int type;
+	unsigned int size;
+	const char *fs_type;
+} VfsStat;
+
+/* Path lookup counters shown by vfsstat */
+typedef struct {
+	unsigned int walks;             /* Paths resolved */
+	unsigned int lookups;           /* Components looked up */
+	unsigned int hits;
+	unsigned int negative_hits;     /* Known not to exist, no directory scan */
+	unsigned int misses;            /* Asked the filesystem */
+	unsigned int evictions;
+} VfsStats;
+
+/* Setup: ramfs root with /tmp */
+void vfs_init(void);
+int vfs_mount(const char *path, SuperBlock *sb);
+
+/* Inodes - for filesystems */
+Inode* vfs_inode_alloc(SuperBlock *sb, const InodeOps *ops, int type, void *data);
+void vfs_iput(Inode *inode);
+
+/* Files - functions return -1 on error */
+int vfs_open(const char *path, int flags);
+int vfs_read(int fd, void *buffer, unsigned int length);
+int vfs_write(int fd, const void *buffer, unsigned int length);
+int vfs_seek(int fd, unsigned int position);
+int vfs_readdir(int fd, VfsDirent *out);
+int vfs_close(int fd);
+
+/* Inodes of regular files by path, for mappings that outlive an open file */
+Inode* vfs_iget_path(const char *path);
+int vfs_iread(Inode *inode, unsigned int offset, void *buffer, unsigned int length);
+
+/* Names */
+int vfs_stat(const char *path, VfsStat *st);
+int vfs_mkdir(const char *path);
+int vfs_unlink(const char *path);
+int vfs_chdir(const char *path);
+void vfs_getcwd(char *buffer, unsigned int length);
+
+/* Information */
+void vfs_print_mounts(void);
+void vfs_print_stats(void);
+
+#endif /* VFS_H */
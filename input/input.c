@@ -5,6 +5,10 @@
 
 #include "input.h"
 #include "../output/output.h"
+#include "../memory/slab.h"
+#include "../lib/string.h"
+#include "../task/task.h"
+#include "../debug/trace.h"
 
 /* External references */
 extern unsigned int current_loc;
@@ -16,9 +20,12 @@ extern void kprint_newline(void);
 extern void update_hardware_cursor(void);
 extern void scroll_screen(void);
 
-/* Global input buffer */
-static InputBuffer global_input;
-static CommandHistory global_history;
+/* Buffer of the input_getline() in progress, 0 when nobody is reading */
+static InputBuffer *active_input = 0;
+
+/* History shared with the shell; empty until the shell registers its own */
+static CommandHistory empty_history;
+static CommandHistory *global_history = &empty_history;
 
 /* Keyboard state */
 static int shift_pressed = 0;
@@ -31,67 +38,18 @@ static int is_shift_pressed(void)
 	return shift_pressed;
 }
 
-/* String utility functions */
-int strcmp_custom(const char *s1, const char *s2)
-{
-	while (*s1 && (*s1 == *s2)) {
-		s1++;
-		s2++;
-	}
-	return (unsigned char)*s1 - (unsigned char)*s2;
-}
-
-int strncmp_custom(const char *s1, const char *s2, int n)
-{
-	int i;
-	for (i = 0; i < n; i++) {
-		if (s1[i] != s2[i] || s1[i] == '\0' || s2[i] == '\0') {
-			return (unsigned char)s1[i] - (unsigned char)s2[i];
-		}
-	}
-	return 0;
-}
-
-int strlen_custom(const char *str)
+/* Initialize input buffer - returns -1 if the line can't be allocated */
+int input_init(InputBuffer *inp, char *prompt)
 {
-	int len = 0;
-	while (str[len] != '\0') {
-		len++;
+	inp->buffer = (char*)kmalloc(MAX_INPUT_LENGTH);
+	if (!inp->buffer) {
+		return -1;
 	}
-	return len;
-}
-
-void strcpy_custom(char *dest, const char *src)
-{
-	int i = 0;
-	while (src[i] != '\0') {
-		dest[i] = src[i];
-		i++;
-	}
-	dest[i] = '\0';
-}
-
-/* Custom memcpy implementation */
-void* memcpy_custom(void *dest, const void *src, int n)
-{
-	int i;
-	char *d = (char*)dest;
-	const char *s = (const char*)src;
-	
-	for (i = 0; i < n; i++) {
-		d[i] = s[i];
-	}
-	
-	return dest;
-}
-
-/* Initialize input buffer */
-void input_init(InputBuffer *inp, char *prompt)
-{
 	inp->position = 0;
 	inp->buffer[0] = '\0';
 	inp->ready = 0;
 	inp->prompt = prompt;
+	return 0;
 }
 
 /* Reset input buffer for new input */
@@ -110,48 +68,37 @@ void input_print_prompt(InputBuffer *inp)
 	}
 }
 
-/* Set the command history for input system */
+/* Set the command history for input system (shared, not copied) */
 void input_set_history(CommandHistory *hist)
 {
-	int i, j;
-	
-	/* Copy history data field by field to avoid memcpy */
-	global_history.count = hist->count;
-	global_history.current = hist->current;
-	
-	for (i = 0; i < MAX_HISTORY; i++) {
-		global_history.valid[i] = hist->valid[i];
-		for (j = 0; j < MAX_INPUT_LENGTH; j++) {
-			global_history.commands[i][j] = hist->commands[i][j];
-		}
-	}
+	global_history = hist;
 }
 
-/* Get the updated history back */
+/* Get the history used by the input system */
 CommandHistory* input_get_history(void)
 {
-	return &global_history;
+	return global_history;
 }
 
 /* Get input line (blocking) - waits for Enter key */
 char* input_getline(InputBuffer *inp)
 {
-	/* Store pointer to use */
-	global_input = *inp;
-	
 	/* Print prompt */
-	input_print_prompt(&global_input);
+	input_print_prompt(inp);
 	
-	/* Reset for new input */
-	input_reset(&global_input);
+	/* Reset for new input, then let the keyboard handler edit it */
+	input_reset(inp);
+	active_input = inp;
 	
 	/* Wait for input to be ready */
-	while (!global_input.ready) {
-		/* Spin wait - keyboard handler will set ready flag */
+	while (!inp->ready) {
+		/* Let kernel threads run - keyboard handler will set ready flag */
+		task_yield();
+		__asm__ volatile("pause" : : : "memory");
 	}
 	
-	/* Copy back to caller's buffer */
-	*inp = global_input;
+	/* Keys pressed from here on must not touch the returned line */
+	active_input = 0;
 	
 	/* Reset ready flag for next call */
 	inp->ready = 0;
@@ -199,6 +146,7 @@ void input_backspace(InputBuffer *inp)
 void input_complete(InputBuffer *inp)
 {
 	inp->buffer[inp->position] = '\0';
+	TRACE(TRACE_INPUT_COMPLETE, inp->position);
 	inp->ready = 1;
 	kprint_newline();
 }
@@ -284,6 +232,7 @@ static char get_char_with_modifiers(unsigned char keycode)
 void input_handle_keyboard(char keycode)
 {
 	unsigned char ukey = (unsigned char)keycode;
+	InputBuffer *inp = active_input;
 	char *history_cmd;
 	char ch;
 	
@@ -316,53 +265,58 @@ void input_handle_keyboard(char keycode)
 		return;
 	}
 	
+	/* Line editing only while a line is being read */
+	if (!inp || inp->ready) {
+		return;
+	}
+	
 	/* Handle Enter key */
 	if (keycode == ENTER_KEY_CODE) {
-		input_complete(&global_input);
+		input_complete(inp);
 		return;
 	}
 	
 	/* Handle Backspace key */
 	if (keycode == BACKSPACE_KEY_CODE) {
-		input_backspace(&global_input);
+		input_backspace(inp);
 		return;
 	}
 	
 	/* Handle Up Arrow - previous command in history */
 	if (keycode == UP_ARROW_KEY_CODE) {
-		history_cmd = history_previous(&global_history);
+		history_cmd = history_previous(global_history);
 		if (history_cmd) {
-			input_load_from_history(&global_input, history_cmd);
+			input_load_from_history(inp, history_cmd);
 		}
 		return;
 	}
 	
 	/* Handle Down Arrow - next command in history */
 	if (keycode == DOWN_ARROW_KEY_CODE) {
-		history_cmd = history_next(&global_history);
+		history_cmd = history_next(global_history);
 		if (history_cmd) {
-			input_load_from_history(&global_input, history_cmd);
+			input_load_from_history(inp, history_cmd);
 		} else {
 			/* Clear input if at the end of history */
-			input_load_from_history(&global_input, 0);
+			input_load_from_history(inp, 0);
 		}
 		return;
 	}
 	
 	/* Handle Page Up - jump to first (oldest) command */
 	if (keycode == PAGE_UP_KEY_CODE) {
-		if (global_history.count > 0) {
-			global_history.current = 0;
-			history_cmd = global_history.commands[0];
-			input_load_from_history(&global_input, history_cmd);
+		if (global_history->count > 0) {
+			global_history->current = 0;
+			history_cmd = global_history->commands[0];
+			input_load_from_history(inp, history_cmd);
 		}
 		return;
 	}
 	
 	/* Handle Page Down - clear input field */
 	if (keycode == PAGE_DOWN_KEY_CODE) {
-		global_history.current = -1;
-		input_load_from_history(&global_input, 0);
+		global_history->current = -1;
+		input_load_from_history(inp, 0);
 		return;
 	}
 	
@@ -371,7 +325,7 @@ void input_handle_keyboard(char keycode)
 		ch = get_char_with_modifiers((unsigned char)keycode);
 		/* Only accept printable ASCII */
 		if (ch >= 32 && ch <= 126) {
-			input_add_char(&global_input, ch);
+			input_add_char(inp, ch);
 		}
 	}
 }
@@ -379,38 +333,41 @@ void input_handle_keyboard(char keycode)
 /* Initialize command history */
 void history_init(CommandHistory *hist)
 {
-	int i, j;
+	int i;
+	for (i = 0; i < hist->count; i++) {
+		kfree(hist->commands[i]);
+		hist->commands[i] = 0;
+	}
 	hist->count = 0;
 	hist->current = -1;
-	
-	for (i = 0; i < MAX_HISTORY; i++) {
-		hist->valid[i] = 1;
-		for (j = 0; j < MAX_INPUT_LENGTH; j++) {
-			hist->commands[i][j] = '\0';
-		}
-	}
 }
 
 /* Add command to history */
 void history_add(CommandHistory *hist, const char *command, int is_valid)
 {
+	char *copy;
+	
 	/* Don't add empty commands */
 	if (command[0] == '\0') {
 		return;
 	}
 	
-	/* Shift older commands if history is full */
+	copy = (char*)kmalloc(strlen(command) + 1);
+	if (!copy) {
+		return;
+	}
+	strcpy(copy, command);
+	
+	/* Drop the oldest command if history is full */
 	if (hist->count >= MAX_HISTORY) {
-		int i;
-		for (i = 0; i < MAX_HISTORY - 1; i++) {
-			strcpy_custom(hist->commands[i], hist->commands[i + 1]);
-			hist->valid[i] = hist->valid[i + 1];
-		}
+		kfree(hist->commands[0]);
+		memmove(&hist->commands[0], &hist->commands[1], (MAX_HISTORY - 1) * sizeof(char*));
+		memmove(&hist->valid[0], &hist->valid[1], (MAX_HISTORY - 1) * sizeof(int));
 		hist->count = MAX_HISTORY - 1;
 	}
 	
 	/* Add new command to end */
-	strcpy_custom(hist->commands[hist->count], command);
+	hist->commands[hist->count] = copy;
 	hist->valid[hist->count] = is_valid;
 	hist->count++;
 	hist->current = -1;  /* Reset position after adding new command */
@@ -19,29 +19,22 @@
 
 /* Input buffer structure for line input */
 typedef struct {
-	char buffer[MAX_INPUT_LENGTH];
+	char *buffer;        /* kmalloc'd, MAX_INPUT_LENGTH bytes */
 	int position;
-	int ready;
+	volatile int ready;  /* Set by the keyboard interrupt */
 	char *prompt;
 } InputBuffer;
 
-/* Command history structure */
+/* Command history structure - commands are kmalloc'd to their actual length */
 typedef struct {
-	char commands[MAX_HISTORY][MAX_INPUT_LENGTH];
+	char *commands[MAX_HISTORY];
 	int valid[MAX_HISTORY];  /* 1 if command was valid, 0 if invalid */
 	int count;
 	int current;  /* Current position in history (-1 = no history selected) */
 } CommandHistory;
 
-/* String utility functions */
-int strcmp_custom(const char *s1, const char *s2);
-static int strlen_custom(const char *str);
-void strcpy_custom(char *dest, const char *src);
-int strncmp_custom(const char *s1, const char *s2, int n);
-void* memcpy_custom(void *dest, const void *src, int n);
-
 /* Input system functions */
-void input_init(InputBuffer *inp, char *prompt);
+int input_init(InputBuffer *inp, char *prompt);
 void input_reset(InputBuffer *inp);
 void input_print_prompt(InputBuffer *inp);
 char* input_getline(InputBuffer *inp);
@@ -2,21 +2,37 @@
 ; License: GPL version 2 or higher http://www.gnu.org/licenses/gpl.html
 
 bits 32
-section .text
-        ;multiboot spec
-        align 4
+section .multiboot progbits alloc noexec nowrite align=4
+        ;multiboot spec - link.ld puts this section first
         dd 0x1BADB002              ;magic
-        dd 0x00                    ;flags
-        dd - (0x1BADB002 + 0x00)   ;checksum. m+f+c should be zero
+        dd 0x03                    ;flags: page-aligned modules, memory info
+        dd - (0x1BADB002 + 0x03)   ;checksum. m+f+c should be zero
+
+section .text
 
 global start
-global keyboard_handler
+global irq_stub_table
 global read_port
 global write_port
+global read_port_word
+global write_port_word
+global read_port_long
+global write_port_long
+global read_port_words
+global write_port_words
 global load_idt
+global page_fault_handler
+global device_not_available_handler
+global divide_error_handler
+global invalid_opcode_handler
+global stack_fault_handler
+global general_protection_handler
 
 extern kmain 		;this is defined in the c file
-extern keyboard_handler_main
+extern irq_handler_main
+extern page_fault_handler_main
+extern device_not_available_main
+extern exception_handler_main
 
 read_port:
 	mov edx, [esp + 4]
@@ -30,22 +46,157 @@ write_port:
 	out   dx, al  
 	ret
 
+read_port_word:
+	mov edx, [esp + 4]
+	in ax, dx
+	ret
+
+write_port_word:
+	mov edx, [esp + 4]
+	mov eax, [esp + 4 + 4]
+	out dx, ax
+	ret
+
+read_port_long:
+	mov edx, [esp + 4]
+	in eax, dx
+	ret
+
+write_port_long:
+	mov edx, [esp + 4]
+	mov eax, [esp + 4 + 4]
+	out dx, eax
+	ret
+
+read_port_words:			;read_port_words(port, buffer, count)
+	push edi
+	mov edx, [esp + 8]
+	mov edi, [esp + 12]
+	mov ecx, [esp + 16]
+	cld
+	rep insw
+	pop edi
+	ret
+
+write_port_words:			;write_port_words(port, buffer, count)
+	push esi
+	mov edx, [esp + 8]
+	mov esi, [esp + 12]
+	mov ecx, [esp + 16]
+	cld
+	rep outsw
+	pop esi
+	ret
+
 load_idt:
 	mov edx, [esp + 4]
 	lidt [edx]
 	sti 				;turn on interrupts
 	ret
 
-keyboard_handler:                 
-	call    keyboard_handler_main
+; hardware interrupt stubs: irq_handler_main(irq, frame) where frame
+; points at the pushad registers followed by the CPU's eip/cs/eflags
+%macro IRQ_STUB 1
+irq_stub_%1:
+	pushad				;preserve the interrupted code's registers
+	cld
+	push esp			;IrqFrame *
+	push dword %1			;IRQ number
+	call irq_handler_main
+	add esp, 8
+	popad
+	iretd
+%endmacro
+
+IRQ_STUB 0
+IRQ_STUB 1
+IRQ_STUB 2
+IRQ_STUB 3
+IRQ_STUB 4
+IRQ_STUB 5
+IRQ_STUB 6
+IRQ_STUB 7
+IRQ_STUB 8
+IRQ_STUB 9
+IRQ_STUB 10
+IRQ_STUB 11
+IRQ_STUB 12
+IRQ_STUB 13
+IRQ_STUB 14
+IRQ_STUB 15
+
+page_fault_handler:
+	pushad
+	cld
+	push dword [esp + 44]		;EFLAGS of the faulting code
+	push dword [esp + 40]		;faulting EIP (shifted by the push above)
+	push dword [esp + 40]		;error code
+	mov eax, cr2
+	push eax			;faulting address
+	call page_fault_handler_main
+	add esp, 16
+	popad
+	add esp, 4			;drop the error code
+	iretd
+
+device_not_available_handler:
+	pushad
+	cld
+	call device_not_available_main
+	popad
 	iretd
 
+; other CPU exceptions: exception_handler_main(vector, error, eip, cs)
+%macro EXCEPTION_STUB 3			;vector, name, CPU pushes an error code
+%{2}_handler:
+%if %3 == 0
+	push dword 0			;same frame layout as with an error code
+%endif
+	pushad
+	cld
+	push dword [esp + 40]		;cs
+	push dword [esp + 40]		;eip
+	push dword [esp + 40]		;error code
+	push dword %1
+	call exception_handler_main
+	add esp, 16
+	popad
+	add esp, 4			;drop the error code
+	iretd
+%endmacro
+
+EXCEPTION_STUB 0, divide_error, 0
+EXCEPTION_STUB 6, invalid_opcode, 0
+EXCEPTION_STUB 12, stack_fault, 1
+EXCEPTION_STUB 13, general_protection, 1
+
 start:
 	cli 				;block interrupts
 	mov esp, stack_space
+	push ebx			;MultibootInfo *
+	push eax			;boot loader magic
 	call kmain
 	hlt 				;halt the CPU
 
+section .data
+irq_stub_table:
+	dd irq_stub_0
+	dd irq_stub_1
+	dd irq_stub_2
+	dd irq_stub_3
+	dd irq_stub_4
+	dd irq_stub_5
+	dd irq_stub_6
+	dd irq_stub_7
+	dd irq_stub_8
+	dd irq_stub_9
+	dd irq_stub_10
+	dd irq_stub_11
+	dd irq_stub_12
+	dd irq_stub_13
+	dd irq_stub_14
+	dd irq_stub_15
+
 section .bss
 resb 8192; 8KB for stack
 stack_space:
\ No newline at end of file
@@ -3,9 +3,35 @@
 * License: GPL version 2 or higher http://www.gnu.org/licenses/gpl.html
 */
 #include "keyboard_map.h"
+#include "kernel.h"
 #include "shell/shell.h"
 #include "output/output.h"
 #include "input/input.h"
+#include "memory/page.h"
+#include "memory/slab.h"
+#include "memory/paging.h"
+#include "cpu/cpu.h"
+#include "cpu/gdt.h"
+#include "cpu/fpu.h"
+#include "task/task.h"
+#include "task/user.h"
+#include "task/syscall.h"
+#include "task/softirq.h"
+#include "debug/trace.h"
+#include "drivers/serial.h"
+#include "drivers/pit.h"
+#include "drivers/ata.h"
+#include "drivers/virtio_blk.h"
+#include "block/bcache.h"
+#include "fs/fat.h"
+#include "fs/vfs.h"
+#include "fs/fatfs.h"
+#include "fs/initrd.h"
+#include "boot/multiboot.h"
+#include "drivers/pci.h"
+#include "debug/bootlog.h"
+#include "lib/string.h"
+#include "essentials/sections.h"
 
 /* there are 25 lines each of 80 columns; each element takes 2 bytes */
 #define LINES 25
@@ -15,19 +41,23 @@
 
 #define KEYBOARD_DATA_PORT 0x60
 #define KEYBOARD_STATUS_PORT 0x64
-#define IDT_SIZE 256
-#define INTERRUPT_GATE 0x8e
-#define KERNEL_CODE_SEGMENT_OFFSET 0x08
+
+/* Scancodes buffered between the IRQ and the keyboard tasklet */
+#define KEYBOARD_QUEUE_SIZE 64
 
 #define ENTER_KEY_CODE 0x1C
 #define SIGUSR1 10
 
 extern unsigned char keyboard_map[128];
-extern void keyboard_handler(void);
-extern char read_port(unsigned short port);
-extern void write_port(unsigned short port, unsigned char data);
+extern void (*irq_stub_table[NR_IRQS])(void);
 extern void load_idt(unsigned long *idt_ptr);
 
+/* CPU exception stubs without a subsystem of their own (kernel.asm) */
+extern void divide_error_handler(void);
+extern void invalid_opcode_handler(void);
+extern void stack_fault_handler(void);
+extern void general_protection_handler(void);
+
 /* current cursor location */
 unsigned int current_loc = 0;
 /* video memory begins at address 0xb8000 */
@@ -43,20 +73,137 @@ struct IDT_entry {
 
 struct IDT_entry IDT[IDT_SIZE];
 
+/* Registered IRQ handlers and the PIC mask (bit set = masked) */
+static IrqHandler irq_handlers[NR_IRQS];
+static unsigned short irq_mask_bits = 0xFFFF;
+
+/* Scancode ring - written by the IRQ, drained by the tasklet */
+static volatile unsigned char keyboard_queue[KEYBOARD_QUEUE_SIZE];
+static volatile unsigned int keyboard_head = 0;
+static volatile unsigned int keyboard_tail = 0;
+
+/* Install an interrupt handler in the IDT */
+void idt_set_gate(int vector, void (*handler)(void), unsigned char type_attr)
+{
+	unsigned long address = (unsigned long)handler;
+
+	IDT[vector].offset_lowerbits = address & 0xffff;
+	IDT[vector].selector = GDT_KERNEL_CODE;
+	IDT[vector].zero = 0;
+	IDT[vector].type_attr = type_attr;
+	IDT[vector].offset_higherbits = (address & 0xffff0000) >> 16;
+}
+
+/* Set a handler for a hardware interrupt line - -1 if another handler owns it */
+int irq_register(int irq, IrqHandler handler)
+{
+	if (irq_handlers[irq] && irq_handlers[irq] != handler) {
+		return -1;
+	}
+	irq_handlers[irq] = handler;
+	return 0;
+}
+
+/* Program both PIC masks from irq_mask_bits */
+static void irq_write_masks(void)
+{
+	write_port(0x21, irq_mask_bits & 0xFF);
+	write_port(0xA1, irq_mask_bits >> 8);
+}
 
-void idt_init(void)
+/* Enable an interrupt line (the cascade line too for the slave PIC) */
+void irq_unmask(int irq)
+{
+	unsigned long flags = irq_save();
+
+	irq_mask_bits &= ~(1 << irq);
+	if (irq >= 8) {
+		irq_mask_bits &= ~(1 << IRQ_CASCADE);
+	}
+	irq_write_masks();
+	irq_restore(flags);
+}
+
+void irq_mask(int irq)
+{
+	unsigned long flags = irq_save();
+
+	irq_mask_bits |= 1 << irq;
+	irq_write_masks();
+	irq_restore(flags);
+}
+
+/* Common entry for every hardware interrupt (called from the IRQ stubs) */
+__hot void irq_handler_main(unsigned int irq, IrqFrame *frame)
+{
+	irq_enter();
+	TRACE(TRACE_IRQ_ENTRY, irq);
+
+	/* write EOI - to the slave as well for IRQ 8-15 */
+	if (irq >= 8) {
+		write_port(0xA0, 0x20);
+	}
+	write_port(0x20, 0x20);
+
+	if (irq_handlers[irq]) {
+		irq_handlers[irq](frame);
+	}
+
+	TRACE(TRACE_IRQ_EXIT, irq);
+
+	/* Deferred work runs once, as the outermost interrupt returns */
+	if (irq_nesting == 1) {
+		softirq_irq_exit();
+	}
+	irq_exit();
+
+	/* Kernel code is cooperative, but ring 3 holds nothing - share the CPU */
+	if (irq == IRQ_TIMER && IRQ_FROM_USER(frame)) {
+		task_yield();
+	}
+}
+
+/* Faults other than #PF and #NM: kill a user task, halt on a kernel bug */
+__cold void exception_handler_main(unsigned int vector, unsigned long error, unsigned long eip, unsigned long cs)
+{
+	static const char *names[] = {
+		[VECTOR_DIVIDE_ERROR] = "divide error",
+		[VECTOR_INVALID_OPCODE] = "invalid opcode",
+		[VECTOR_STACK_FAULT] = "stack fault",
+		[VECTOR_GENERAL_PROTECTION] = "general protection fault",
+	};
+
+	if ((cs & 3) == 3) {
+		user_fault(names[vector], eip);
+		return;
+	}
+
+	kprint_colored("\nKernel ", 0x04);
+	kprint_colored(names[vector], 0x04);
+	kprint(" eip ");
+	kprint_hex(eip);
+	kprint(" error ");
+	kprint_hex(error);
+	kprint_newline();
+	while (1) {
+		__asm__ volatile("cli; hlt");
+	}
+}
+
+__init void idt_init(void)
 {
-	unsigned long keyboard_address;
 	unsigned long idt_address;
 	unsigned long idt_ptr[2];
+	int irq;
 
-	/* populate IDT entry of keyboard's interrupt */
-	keyboard_address = (unsigned long)keyboard_handler;
-	IDT[0x21].offset_lowerbits = keyboard_address & 0xffff;
-	IDT[0x21].selector = KERNEL_CODE_SEGMENT_OFFSET;
-	IDT[0x21].zero = 0;
-	IDT[0x21].type_attr = INTERRUPT_GATE;
-	IDT[0x21].offset_higherbits = (keyboard_address & 0xffff0000) >> 16;
+	/* populate IDT entries of the hardware interrupts */
+	for (irq = 0; irq < NR_IRQS; irq++) {
+		idt_set_gate(IRQ_BASE + irq, irq_stub_table[irq], INTERRUPT_GATE);
+	}
+	idt_set_gate(VECTOR_DIVIDE_ERROR, divide_error_handler, INTERRUPT_GATE);
+	idt_set_gate(VECTOR_INVALID_OPCODE, invalid_opcode_handler, INTERRUPT_GATE);
+	idt_set_gate(VECTOR_STACK_FAULT, stack_fault_handler, INTERRUPT_GATE);
+	idt_set_gate(VECTOR_GENERAL_PROTECTION, general_protection_handler, INTERRUPT_GATE);
 
 	/*     Ports
 	*	 PIC1	PIC2
@@ -97,40 +244,102 @@ void idt_init(void)
 	load_idt(idt_ptr);
 }
 
-void kb_init(void)
+/* Keyboard tasklet: hand buffered scancodes to the shell */
+__hot static void keyboard_tasklet_run(unsigned long data)
 {
-	/* 0xFD is 11111101 - enables only IRQ1 (keyboard)*/
-	write_port(0x21 , 0xFD);
+	char keycode;
+
+	(void)data;
+	while (keyboard_tail != keyboard_head) {
+		keycode = keyboard_queue[keyboard_tail % KEYBOARD_QUEUE_SIZE];
+		keyboard_tail++;
+		/* Key releases are ignored */
+		if (keycode >= 0)
+			shell_handle_keyboard(keycode);
+	}
 }
 
-void keyboard_handler_main(void)
+static Tasklet keyboard_tasklet = TASKLET_INIT("keyboard", keyboard_tasklet_run, 0);
+
+/* Hard IRQ half: only read the scancode and queue the tasklet */
+__hot void keyboard_handler_main(IrqFrame *frame)
 {
 	unsigned char status;
-	char keycode;
+	unsigned char keycode;
 
-	/* write EOI */
-	write_port(0x20, 0x20);
+	(void)frame;
 
 	status = read_port(KEYBOARD_STATUS_PORT);
 	/* Lowest bit of status will be set if buffer is not empty */
 	if (status & 0x01) {
 		keycode = read_port(KEYBOARD_DATA_PORT);
-		if(keycode < 0)
-			return;
-
-		/* Delegate to shell keyboard handler */
-		shell_handle_keyboard(keycode);
+		TRACE(TRACE_KEYBOARD, keycode);
+		/* A full ring drops the key */
+		if (keyboard_head - keyboard_tail < KEYBOARD_QUEUE_SIZE) {
+			keyboard_queue[keyboard_head % KEYBOARD_QUEUE_SIZE] = keycode;
+			keyboard_head++;
+		}
+		tasklet_schedule(&keyboard_tasklet);
 	}
 }
 
-void kmain(void)
+__init void kb_init(void)
 {
+	irq_register(IRQ_KEYBOARD, keyboard_handler_main);
+	irq_unmask(IRQ_KEYBOARD);
+}
+
+void kmain(unsigned int magic, const MultibootInfo *info)
+{
+	bootlog_mark("kmain");
+
+	/* Heap first - output and history allocate their lines */
+	cpu_init();
+	string_init();
+	bootlog_mark("cpu");
+	multiboot_init(magic, info);    /* Reserves modules before page_init */
+	page_init();
+	slab_init();
+	bootlog_mark("heap");
+	serial_init();
+
 	clear_screen();
 	kprint("NaoKernel - Initializing...");
 	kprint_newline();
+	bootlog_mark("console");
 
+	gdt_init();
 	idt_init();
+	paging_init();
+	output_init_video();
+	bootlog_mark("paging");
+
+	/* Boot context becomes the shell task; SSE2 is usable once the FPU is up */
+	task_init();
+	fpu_init();
+	string_init();
+	softirq_init();
+	syscall_init();
+	bootlog_mark("tasks");
+
 	kb_init();
+	pit_init();
+	bootlog_mark("devices");
+	pci_init();
+	ata_init();
+	virtio_blk_init();
+	bcache_init();
+	fat_init();
+	bootlog_mark("disks");
+	vfs_init();
+	fatfs_mount_all();
+	initrd_init();
+
+	/* Nothing calls __init code past this point */
+	kprint("Freed ");
+	kprint_dec(page_free_init() * (PAGE_SIZE / 1024));
+	kprint(" KB of boot-only code");
+	kprint_newline();
 
 	/* Start shell */
 	nano_shell();
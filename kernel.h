@@ -0,0 +1,55 @@
+/*
+ * Kernel Core - Port I/O and interrupt descriptor table
+ */
+
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#define IDT_SIZE 256
+#define INTERRUPT_GATE 0x8e
+#define USER_INTERRUPT_GATE 0xee  /* DPL 3: ring 3 may raise it with int */
+
+/* Hardware interrupts - the PICs are remapped to vectors 0x20-0x2F */
+#define IRQ_BASE 0x20
+#define NR_IRQS 16
+#define IRQ_TIMER 0
+#define IRQ_KEYBOARD 1
+#define IRQ_CASCADE 2
+
+/* CPU exception vectors */
+#define VECTOR_DIVIDE_ERROR 0
+#define VECTOR_INVALID_OPCODE 6
+#define VECTOR_STACK_FAULT 12
+#define VECTOR_GENERAL_PROTECTION 13
+#define VECTOR_PAGE_FAULT 14
+
+/* Port I/O (kernel.asm) */
+char read_port(unsigned short port);
+void write_port(unsigned short port, unsigned char data);
+unsigned short read_port_word(unsigned short port);
+void write_port_word(unsigned short port, unsigned short data);
+unsigned int read_port_long(unsigned short port);
+void write_port_long(unsigned short port, unsigned int data);
+void read_port_words(unsigned short port, void *buffer, unsigned int count);
+void write_port_words(unsigned short port, const void *buffer, unsigned int count);
+
+/* Registers saved by the IRQ stubs (pushad order) and the CPU */
+typedef struct {
+	unsigned long edi, esi, ebp, esp, ebx, edx, ecx, eax;
+	unsigned long eip, cs, eflags;
+} IrqFrame;
+
+/* Interrupted code was running in ring 3 */
+#define IRQ_FROM_USER(frame) (((frame)->cs & 3) == 3)
+
+typedef void (*IrqHandler)(IrqFrame *frame);
+
+/* Hardware interrupt dispatch */
+int irq_register(int irq, IrqHandler handler);
+void irq_unmask(int irq);
+void irq_mask(int irq);
+
+/* Install an interrupt handler in the IDT */
+void idt_set_gate(int vector, void (*handler)(void), unsigned char type_attr);
+
+#endif /* KERNEL_H */
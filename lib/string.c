@@ -0,0 +1,432 @@
+/*
+ * String Library Implementation
+ * memcpy, memset and strlen come in byte, rep/word and SSE2 flavours;
+ * string_init() picks one through CPUID and everything else calls the
+ * selected function pointer.
+ */
+
+#include "string.h"
+#include "../cpu/cpu.h"
+#include "../output/output.h"
+#include "../memory/slab.h"
+#include "../bench/bench.h"
+#include "../essentials/sections.h"
+
+/* Copies shorter than this are not worth the SSE2 setup */
+#define SSE2_THRESHOLD 256
+
+/* Microbenchmark sizes */
+#define BENCH_COPY_SIZE 4096
+#define BENCH_STRING_SIZE 1024
+#define BENCH_ROUNDS 256
+
+typedef void* (*MemcpyFunc)(void *dest, const void *src, unsigned int n);
+typedef void* (*MemsetFunc)(void *dest, int c, unsigned int n);
+typedef unsigned int (*StrlenFunc)(const char *str);
+
+/* One implementation of the bulk routines */
+typedef struct {
+	const char *name;
+	MemcpyFunc copy;
+	MemsetFunc set;
+	StrlenFunc length;
+	int available;
+} StringImpl;
+
+/* Byte-at-a-time versions - always available */
+static void* memcpy_byte(void *dest, const void *src, unsigned int n)
+{
+	char *d = (char*)dest;
+	const char *s = (const char*)src;
+	while (n--) {
+		*d++ = *s++;
+	}
+	return dest;
+}
+
+static void* memset_byte(void *dest, int c, unsigned int n)
+{
+	char *d = (char*)dest;
+	while (n--) {
+		*d++ = (char)c;
+	}
+	return dest;
+}
+
+static unsigned int strlen_byte(const char *str)
+{
+	unsigned int len = 0;
+	while (str[len] != '\0') {
+		len++;
+	}
+	return len;
+}
+
+/* String instruction versions - rep movsd/stosd plus a byte tail */
+static void* memcpy_rep(void *dest, const void *src, unsigned int n)
+{
+	int d0, d1, d2;
+	__asm__ volatile("rep movsl\n\t"
+	                 "movl %4, %%ecx\n\t"
+	                 "rep movsb"
+	                 : "=&c"(d0), "=&D"(d1), "=&S"(d2)
+	                 : "0"(n / 4), "g"(n & 3), "1"(dest), "2"(src)
+	                 : "memory");
+	return dest;
+}
+
+static void* memset_rep(void *dest, int c, unsigned int n)
+{
+	unsigned int pattern = (unsigned char)c * 0x01010101u;
+	int d0, d1;
+	__asm__ volatile("rep stosl\n\t"
+	                 "movl %3, %%ecx\n\t"
+	                 "rep stosb"
+	                 : "=&c"(d0), "=&D"(d1)
+	                 : "0"(n / 4), "g"(n & 3), "1"(dest), "a"(pattern)
+	                 : "memory");
+	return dest;
+}
+
+/* Word-at-a-time strlen: aligned 4-byte loads never cross a page */
+static unsigned int strlen_word(const char *str)
+{
+	const char *p = str;
+	const unsigned int *w;
+	unsigned int v;
+
+	while ((unsigned long)p & 3) {
+		if (*p == '\0') {
+			return p - str;
+		}
+		p++;
+	}
+	w = (const unsigned int*)p;
+	for (;;) {
+		v = *w;
+		if ((v - 0x01010101u) & ~v & 0x80808080u) {
+			break;
+		}
+		w++;
+	}
+	p = (const char*)w;
+	while (*p != '\0') {
+		p++;
+	}
+	return p - str;
+}
+
+/*
+ * SSE2 versions - used only once the FPU code has enabled CR4.OSFXSR.
+ * Interrupt handlers fall back to the integer versions: the XMM registers
+ * belong to whichever task was interrupted and are saved lazily.
+ */
+static void* memcpy_sse2(void *dest, const void *src, unsigned int n)
+{
+	char *d = (char*)dest;
+	const char *s = (const char*)src;
+	unsigned int head;
+	unsigned int blocks;
+
+	if (n < SSE2_THRESHOLD || cpu_in_irq()) {
+		return memcpy_rep(dest, src, n);
+	}
+
+	/* Align the destination so the stores can be movdqa */
+	head = (16 - ((unsigned long)d & 15)) & 15;
+	memcpy_rep(d, s, head);
+	d += head;
+	s += head;
+	n -= head;
+
+	blocks = n / 64;
+	if (blocks) {
+		__asm__ volatile("1:\n\t"
+		                 "movdqu (%1), %%xmm0\n\t"
+		                 "movdqu 16(%1), %%xmm1\n\t"
+		                 "movdqu 32(%1), %%xmm2\n\t"
+		                 "movdqu 48(%1), %%xmm3\n\t"
+		                 "movdqa %%xmm0, (%0)\n\t"
+		                 "movdqa %%xmm1, 16(%0)\n\t"
+		                 "movdqa %%xmm2, 32(%0)\n\t"
+		                 "movdqa %%xmm3, 48(%0)\n\t"
+		                 "addl $64, %1\n\t"
+		                 "addl $64, %0\n\t"
+		                 "decl %2\n\t"
+		                 "jnz 1b"
+		                 : "+r"(d), "+r"(s), "+r"(blocks)
+		                 :
+		                 : "memory", "cc");
+	}
+	memcpy_rep(d, s, n & 63);
+	return dest;
+}
+
+static void* memset_sse2(void *dest, int c, unsigned int n)
+{
+	char *d = (char*)dest;
+	unsigned int pattern = (unsigned char)c * 0x01010101u;
+	unsigned int head;
+	unsigned int blocks;
+
+	if (n < SSE2_THRESHOLD || cpu_in_irq()) {
+		return memset_rep(dest, c, n);
+	}
+
+	head = (16 - ((unsigned long)d & 15)) & 15;
+	memset_rep(d, c, head);
+	d += head;
+	n -= head;
+
+	blocks = n / 64;
+	__asm__ volatile("movd %2, %%xmm0\n\t"
+	                 "pshufd $0, %%xmm0, %%xmm0\n\t"
+	                 "1:\n\t"
+	                 "movdqa %%xmm0, (%0)\n\t"
+	                 "movdqa %%xmm0, 16(%0)\n\t"
+	                 "movdqa %%xmm0, 32(%0)\n\t"
+	                 "movdqa %%xmm0, 48(%0)\n\t"
+	                 "addl $64, %0\n\t"
+	                 "decl %1\n\t"
+	                 "jnz 1b"
+	                 : "+r"(d), "+r"(blocks)
+	                 : "r"(pattern)
+	                 : "memory", "cc");
+	memset_rep(d, c, n & 63);
+	return dest;
+}
+
+static unsigned int strlen_sse2(const char *str)
+{
+	const char *p = (const char*)((unsigned long)str & ~15);
+	unsigned int mask;
+
+	if (cpu_in_irq()) {
+		return strlen_word(str);
+	}
+
+	/* First aligned block: ignore bytes before the string starts */
+	__asm__ volatile("pxor %%xmm0, %%xmm0\n\t"
+	                 "movdqa (%1), %%xmm1\n\t"
+	                 "pcmpeqb %%xmm0, %%xmm1\n\t"
+	                 "pmovmskb %%xmm1, %0"
+	                 : "=r"(mask) : "r"(p) : "memory");
+	mask &= 0xFFFFu << ((unsigned long)str & 15);
+
+	while (mask == 0) {
+		p += 16;
+		__asm__ volatile("pxor %%xmm0, %%xmm0\n\t"
+		                 "movdqa (%1), %%xmm1\n\t"
+		                 "pcmpeqb %%xmm0, %%xmm1\n\t"
+		                 "pmovmskb %%xmm1, %0"
+		                 : "=r"(mask) : "r"(p) : "memory");
+	}
+	return (p + __builtin_ctz(mask)) - str;
+}
+
+/* Implementations, slowest first */
+static StringImpl string_impls[] = {
+	{"byte", memcpy_byte, memset_byte, strlen_byte, 1},
+	{"rep", memcpy_rep, memset_rep, strlen_word, 1},
+	{"sse2", memcpy_sse2, memset_sse2, strlen_sse2, 0},
+	{0, 0, 0, 0, 0}  /* Sentinel entry */
+};
+
+/* Selected implementation - safe defaults until string_init() runs */
+static StringImpl *active_impl = &string_impls[1];
+
+/* Choose the fastest usable implementation */
+__init void string_init(void)
+{
+	int i;
+
+	string_impls[2].available = cpu_has_feature(CPU_FEATURE_SSE2) &&
+	                            (cpu_read_cr4() & CR4_OSFXSR);
+
+	for (i = 0; string_impls[i].name != 0; i++) {
+		if (string_impls[i].available) {
+			active_impl = &string_impls[i];
+		}
+	}
+}
+
+/* Name of the selected implementation */
+const char* string_impl_name(void)
+{
+	return active_impl->name;
+}
+
+void* memcpy(void *dest, const void *src, unsigned int n)
+{
+	return active_impl->copy(dest, src, n);
+}
+
+void* memset(void *dest, int c, unsigned int n)
+{
+	return active_impl->set(dest, c, n);
+}
+
+unsigned int strlen(const char *str)
+{
+	return active_impl->length(str);
+}
+
+/* Overlap-safe copy: forward copies are safe when dest is below src */
+void* memmove(void *dest, const void *src, unsigned int n)
+{
+	char *d = (char*)dest;
+	const char *s = (const char*)src;
+	int d0, d1, d2;
+
+	if (d <= s || d >= s + n) {
+		return memcpy_rep(dest, src, n);
+	}
+
+	/* Backwards copy for an overlapping destination above the source */
+	__asm__ volatile("std\n\t"
+	                 "rep movsb\n\t"
+	                 "cld"
+	                 : "=&c"(d0), "=&D"(d1), "=&S"(d2)
+	                 : "0"(n), "1"(d + n - 1), "2"(s + n - 1)
+	                 : "memory");
+	return dest;
+}
+
+/* Fill count 32-bit words - e.g. VGA cells two at a time */
+void* memset32(void *dest, unsigned int value, unsigned int count)
+{
+	int d0, d1;
+	__asm__ volatile("rep stosl"
+	                 : "=&c"(d0), "=&D"(d1)
+	                 : "0"(count), "1"(dest), "a"(value)
+	                 : "memory");
+	return dest;
+}
+
+int memcmp(const void *s1, const void *s2, unsigned int n)
+{
+	const unsigned char *a = (const unsigned char*)s1;
+	const unsigned char *b = (const unsigned char*)s2;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		if (a[i] != b[i]) {
+			return a[i] - b[i];
+		}
+	}
+	return 0;
+}
+
+int strcmp(const char *s1, const char *s2)
+{
+	while (*s1 && (*s1 == *s2)) {
+		s1++;
+		s2++;
+	}
+	return (unsigned char)*s1 - (unsigned char)*s2;
+}
+
+int strncmp(const char *s1, const char *s2, unsigned int n)
+{
+	unsigned int i;
+	for (i = 0; i < n; i++) {
+		if (s1[i] != s2[i] || s1[i] == '\0') {
+			return (unsigned char)s1[i] - (unsigned char)s2[i];
+		}
+	}
+	return 0;
+}
+
+char* strcpy(char *dest, const char *src)
+{
+	return (char*)memcpy(dest, src, strlen(src) + 1);
+}
+
+/* Copy with truncation; always terminates when size > 0 - returns strlen(src) */
+unsigned int strlcpy(char *dest, const char *src, unsigned int size)
+{
+	unsigned int len = strlen(src);
+	unsigned int copy;
+
+	if (size > 0) {
+		copy = len < size - 1 ? len : size - 1;
+		memcpy(dest, src, copy);
+		dest[copy] = '\0';
+	}
+	return len;
+}
+
+char* strchr(const char *str, int c)
+{
+	while (*str != (char)c) {
+		if (*str == '\0') {
+			return 0;
+		}
+		str++;
+	}
+	return (char*)str;
+}
+
+/* Time BENCH_ROUNDS calls of each routine for one implementation */
+static void bench_impl(StringImpl *impl, char *dest, char *src)
+{
+	unsigned long long start;
+	unsigned long long copy_cycles;
+	unsigned long long set_cycles;
+	unsigned long long length_cycles;
+	int i;
+
+	start = cpu_rdtsc();
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		impl->copy(dest, src, BENCH_COPY_SIZE);
+	}
+	copy_cycles = cpu_rdtsc() - start;
+
+	start = cpu_rdtsc();
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		impl->set(dest, i, BENCH_COPY_SIZE);
+	}
+	set_cycles = cpu_rdtsc() - start;
+
+	start = cpu_rdtsc();
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		impl->length(src + (i & 15));
+	}
+	length_cycles = cpu_rdtsc() - start;
+
+	kprint(impl == active_impl ? " * " : "   ");
+	kprint(impl->name);
+	kprint_newline();
+	bench_report("memcpy 4 KB", copy_cycles, BENCH_ROUNDS);
+	bench_report("memset 4 KB", set_cycles, BENCH_ROUNDS);
+	bench_report("strlen 1 KB", length_cycles, BENCH_ROUNDS);
+}
+
+/* Microbenchmark of every available implementation (* = selected) */
+void string_bench(void)
+{
+	char *src;
+	char *dest;
+	int i;
+
+	src = (char*)kmalloc(BENCH_COPY_SIZE);
+	dest = (char*)kmalloc(BENCH_COPY_SIZE);
+	if (!src || !dest) {
+		kprint("  out of memory\n");
+		kfree(src);
+		kfree(dest);
+		return;
+	}
+
+	memset(src, 'x', BENCH_COPY_SIZE);
+	src[BENCH_STRING_SIZE + 16] = '\0';
+
+	for (i = 0; string_impls[i].name != 0; i++) {
+		if (string_impls[i].available) {
+			bench_impl(&string_impls[i], dest, src);
+		}
+	}
+
+	kfree(src);
+	kfree(dest);
+}
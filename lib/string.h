@@ -0,0 +1,30 @@
+/*
+ * String Library - Freestanding memory and string routines
+ */
+
+#ifndef STRING_H
+#define STRING_H
+
+/* Memory functions (also satisfy compiler-generated calls) */
+void* memcpy(void *dest, const void *src, unsigned int n);
+void* memmove(void *dest, const void *src, unsigned int n);
+void* memset(void *dest, int c, unsigned int n);
+int memcmp(const void *s1, const void *s2, unsigned int n);
+void* memset32(void *dest, unsigned int value, unsigned int count);
+
+/* String functions */
+unsigned int strlen(const char *str);
+int strcmp(const char *s1, const char *s2);
+int strncmp(const char *s1, const char *s2, unsigned int n);
+char* strcpy(char *dest, const char *src);
+unsigned int strlcpy(char *dest, const char *src, unsigned int size);
+char* strchr(const char *str, int c);
+
+/* Pick the fastest implementation for this CPU (once, at boot) */
+void string_init(void);
+const char* string_impl_name(void);
+
+/* Microbenchmark of every available implementation */
+void string_bench(void);
+
+#endif /* STRING_H */
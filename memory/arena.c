@@ -0,0 +1,54 @@
+/*
+ * Arena Allocator Implementation
+ * Allocation is a pointer bump, reset is O(1)
+ */
+
+#include "arena.h"
+#include "page.h"
+
+/* Back an arena with contiguous pages - returns 0 on success, -1 on failure */
+int arena_init(Arena *arena, unsigned int size)
+{
+	unsigned int pages = PAGE_ALIGN_UP(size) >> PAGE_SHIFT;
+
+	arena->base = (char*)page_alloc_contig(pages);
+	arena->size = arena->base ? pages * PAGE_SIZE : 0;
+	arena->used = 0;
+	arena->peak = 0;
+	arena->overflows = 0;
+	return arena->base ? 0 : -1;
+}
+
+/* Allocate from the arena - returns 0 (and counts an overflow) if full */
+void* arena_alloc(Arena *arena, unsigned int size)
+{
+	unsigned int aligned = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	void *ptr;
+
+	if (aligned > arena->size - arena->used) {
+		arena->overflows++;
+		return 0;
+	}
+
+	ptr = arena->base + arena->used;
+	arena->used += aligned;
+	if (arena->used > arena->peak) {
+		arena->peak = arena->used;
+	}
+	return ptr;
+}
+
+/* Release everything allocated since the last reset */
+void arena_reset(Arena *arena)
+{
+	arena->used = 0;
+	arena->peak = 0;
+}
+
+/* Release what was allocated after mark (an earlier value of used); the peak stays */
+void arena_release(Arena *arena, unsigned int mark)
+{
+	if (mark < arena->used) {
+		arena->used = mark;
+	}
+}
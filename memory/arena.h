@@ -0,0 +1,26 @@
+/*
+ * Arena Allocator - Bump-pointer scratch memory
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+/* Every allocation is rounded up to this alignment */
+#define ARENA_ALIGN 8
+
+/* Scratch arena - everything is released at once by arena_reset() */
+typedef struct {
+	char *base;
+	unsigned int size;
+	unsigned int used;
+	unsigned int peak;       /* Highest usage since the last reset */
+	unsigned int overflows;  /* Allocations refused since boot */
+} Arena;
+
+/* Arena functions */
+int arena_init(Arena *arena, unsigned int size);
+void* arena_alloc(Arena *arena, unsigned int size);
+void arena_reset(Arena *arena);
+void arena_release(Arena *arena, unsigned int mark);
+
+#endif /* ARENA_H */
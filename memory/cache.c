@@ -0,0 +1,136 @@
+/*
+ * Memory Types Implementation
+ * PAT entry 1 (selected by PWT alone) is switched from WT to WC. Without
+ * PAT, the fixed-range MTRRs can still make the legacy VGA window WC.
+ */
+
+#include "cache.h"
+#include "paging.h"
+#include "../cpu/cpu.h"
+
+#define MSR_MTRRCAP 0xFE
+#define MSR_PAT 0x277
+#define MSR_MTRR_FIX16K_A0000 0x259
+#define MSR_MTRR_DEF_TYPE 0x2FF
+
+#define MTRRCAP_FIX 0x100
+#define MTRRCAP_WC 0x400
+#define MTRR_DEF_FE 0x400
+#define MTRR_DEF_E 0x800
+
+#define MEMTYPE_UC 0x00
+#define MEMTYPE_WC 0x01
+
+/* The 16 KB fixed-range MTRR MSR covers 0xA0000 - 0xBFFFF */
+#define FIX16K_BASE 0xA0000
+#define FIX16K_END 0xC0000
+#define FIX16K_CHUNK 0x4000
+
+static int wc_method = CACHE_WC_NONE;
+
+/* Set the fixed-range MTRR chunks covering [start, end) to WC */
+static int mtrr_set_fixed_wc(unsigned long start, unsigned long end)
+{
+	unsigned long long value;
+	unsigned long flags;
+	unsigned long cr0;
+	unsigned long addr;
+	int chunk;
+
+	if (start < FIX16K_BASE || end > FIX16K_END) {
+		return -1;
+	}
+
+	/* Intel SDM MTRR update sequence: caches off, flush, MTRRs off */
+	flags = irq_save();
+	cr0 = cpu_read_cr0();
+	cpu_write_cr0((cr0 | CR0_CD) & ~CR0_NW);
+	cpu_wbinvd();
+	cpu_write_cr3(cpu_read_cr3());
+	cpu_wrmsr(MSR_MTRR_DEF_TYPE, cpu_rdmsr(MSR_MTRR_DEF_TYPE) & ~(unsigned long long)MTRR_DEF_E);
+
+	value = cpu_rdmsr(MSR_MTRR_FIX16K_A0000);
+	for (addr = start & ~(FIX16K_CHUNK - 1); addr < end; addr += FIX16K_CHUNK) {
+		chunk = (addr - FIX16K_BASE) / FIX16K_CHUNK;
+		value &= ~(0xFFULL << (chunk * 8));
+		value |= (unsigned long long)MEMTYPE_WC << (chunk * 8);
+	}
+	cpu_wrmsr(MSR_MTRR_FIX16K_A0000, value);
+
+	cpu_wrmsr(MSR_MTRR_DEF_TYPE, cpu_rdmsr(MSR_MTRR_DEF_TYPE) | MTRR_DEF_E);
+	cpu_wbinvd();
+	cpu_write_cr3(cpu_read_cr3());
+	cpu_write_cr0(cr0);
+	irq_restore(flags);
+	return 0;
+}
+
+/* Detect PAT/MTRR and make a write-combining type available */
+void cache_init(void)
+{
+	unsigned long long pat;
+	unsigned long long cap;
+	unsigned long long def_type;
+
+	if (!cpu_has_feature(CPU_FEATURE_MSR)) {
+		return;
+	}
+
+	if (cpu_has_feature(CPU_FEATURE_PAT)) {
+		/* PA1 (PWT=1, PCD=0, PAT=0) becomes WC; nothing maps WT */
+		pat = cpu_rdmsr(MSR_PAT);
+		pat &= ~(0xFFULL << 8);
+		pat |= (unsigned long long)MEMTYPE_WC << 8;
+		cpu_wbinvd();
+		cpu_wrmsr(MSR_PAT, pat);
+		cpu_wbinvd();
+		wc_method = CACHE_WC_PAT;
+		return;
+	}
+
+	if (cpu_has_feature(CPU_FEATURE_MTRR)) {
+		cap = cpu_rdmsr(MSR_MTRRCAP);
+		def_type = cpu_rdmsr(MSR_MTRR_DEF_TYPE);
+		if ((cap & MTRRCAP_FIX) && (cap & MTRRCAP_WC) &&
+		    (def_type & MTRR_DEF_E) && (def_type & MTRR_DEF_FE)) {
+			wc_method = CACHE_WC_MTRR;
+		}
+	}
+}
+
+/* How write-combining is provided */
+int cache_wc_method(void)
+{
+	return wc_method;
+}
+
+/* Short name of a cache mode */
+const char* cache_mode_name(int cache_mode)
+{
+	if (cache_mode == VM_CACHE_WC) {
+		return "WC";
+	}
+	if (cache_mode == VM_CACHE_UC) {
+		return "UC";
+	}
+	return "WB";
+}
+
+/* Page table bits giving [phys, phys + size) the requested type */
+unsigned int cache_pte_flags(int cache_mode, unsigned long phys, unsigned int size)
+{
+	if (cache_mode == VM_CACHE_WC) {
+		if (wc_method == CACHE_WC_PAT) {
+			return PTE_PWT;
+		}
+		/* WB page attributes let the WC MTRR type through */
+		if (wc_method == CACHE_WC_MTRR && mtrr_set_fixed_wc(phys, phys + size) == 0) {
+			return 0;
+		}
+		cache_mode = VM_CACHE_UC;
+	}
+	if (cache_mode == VM_CACHE_UC) {
+		return PTE_PCD | PTE_PWT;
+	}
+	return 0;
+}
@@ -0,0 +1,19 @@
+/*
+ * Memory Types - PAT and MTRR configuration
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+/* How write-combining is provided on this CPU */
+#define CACHE_WC_NONE 0   /* Falls back to uncached */
+#define CACHE_WC_PAT 1    /* PAT entry 1 reprogrammed to WC */
+#define CACHE_WC_MTRR 2   /* Fixed-range MTRRs for the legacy VGA window */
+
+/* Memory type functions */
+void cache_init(void);
+int cache_wc_method(void);
+const char* cache_mode_name(int cache_mode);
+unsigned int cache_pte_flags(int cache_mode, unsigned long phys, unsigned int size);
+
+#endif /* CACHE_H */
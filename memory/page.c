@@ -0,0 +1,294 @@
+/*
+ * Page Allocator Implementation
+ * Bitmap allocator over physical memory, sized from the CMOS
+ */
+
+#include "page.h"
+#include "../cpu/cpu.h"
+#include "../essentials/sections.h"
+
+/* CMOS registers holding the extended memory size */
+#define CMOS_ADDRESS_PORT 0x70
+#define CMOS_DATA_PORT 0x71
+#define CMOS_EXT_MEM_LOW 0x30   /* KB above 1 MB, low byte */
+#define CMOS_EXT_MEM_HIGH 0x31  /* KB above 1 MB, high byte */
+#define CMOS_HIGH_MEM_LOW 0x34  /* 64 KB blocks above 16 MB, low byte */
+#define CMOS_HIGH_MEM_HIGH 0x35 /* 64 KB blocks above 16 MB, high byte */
+
+#define BITMAP_WORDS (PAGE_MAX_FRAMES / 32)
+
+/* External references */
+extern char read_port(unsigned short port);
+extern void write_port(unsigned short port, unsigned char data);
+extern char _kernel_start[];
+extern char _kernel_end[];
+extern char _init_start[];
+extern char _init_end[];
+
+/* One bit per frame, set = in use */
+static unsigned int frame_bitmap[BITMAP_WORDS];
+static unsigned long *frame_owner;
+static unsigned int frame_count;
+static unsigned int free_frames;
+static unsigned int total_frames;
+static unsigned int next_word;
+static SpinLock page_lock = SPINLOCK_INIT;
+static unsigned long early_reserves[PAGE_EARLY_RESERVES][2];
+static unsigned int early_reserve_count = 0;
+
+/* Read a CMOS register */
+static unsigned char cmos_read(unsigned char reg)
+{
+	write_port(CMOS_ADDRESS_PORT, reg);
+	return (unsigned char)read_port(CMOS_DATA_PORT);
+}
+
+/* Detect the top of physical memory */
+__init static unsigned long detect_memory_top(void)
+{
+	unsigned long high_blocks;
+	unsigned long ext_kb;
+
+	high_blocks = cmos_read(CMOS_HIGH_MEM_LOW) | (cmos_read(CMOS_HIGH_MEM_HIGH) << 8);
+	if (high_blocks != 0) {
+		return 0x1000000 + high_blocks * 0x10000;
+	}
+
+	ext_kb = cmos_read(CMOS_EXT_MEM_LOW) | (cmos_read(CMOS_EXT_MEM_HIGH) << 8);
+	return PAGE_LOW_MEMORY_END + ext_kb * 1024;
+}
+
+static void frame_set(unsigned int frame)
+{
+	frame_bitmap[frame / 32] |= 1u << (frame % 32);
+}
+
+static void frame_clear(unsigned int frame)
+{
+	frame_bitmap[frame / 32] &= ~(1u << (frame % 32));
+}
+
+static int frame_test(unsigned int frame)
+{
+	return (frame_bitmap[frame / 32] >> (frame % 32)) & 1;
+}
+
+/* Mark a physical range as in use */
+void page_reserve_range(unsigned long start, unsigned long end)
+{
+	unsigned int frame;
+	unsigned int last;
+
+	frame = PAGE_ALIGN_DOWN(start) >> PAGE_SHIFT;
+	last = PAGE_ALIGN_UP(end) >> PAGE_SHIFT;
+	if (last > frame_count) {
+		last = frame_count;
+	}
+
+	for (; frame < last; frame++) {
+		if (!frame_test(frame)) {
+			frame_set(frame);
+			free_frames--;
+		}
+	}
+}
+
+/* Remember a range to keep out of the allocator; page_init applies it */
+void page_reserve_early(unsigned long start, unsigned long end)
+{
+	if (early_reserve_count < PAGE_EARLY_RESERVES) {
+		early_reserves[early_reserve_count][0] = start;
+		early_reserves[early_reserve_count][1] = end;
+		early_reserve_count++;
+	}
+}
+
+/* Initialize the page allocator */
+__init void page_init(void)
+{
+	unsigned long top;
+	unsigned int frame;
+	unsigned int owner_pages;
+
+	top = detect_memory_top();
+	if (top > PAGE_MAX_MEMORY) {
+		top = PAGE_MAX_MEMORY;
+	}
+	frame_count = top >> PAGE_SHIFT;
+
+	/* Everything starts reserved, then usable memory is released */
+	for (frame = 0; frame < BITMAP_WORDS; frame++) {
+		frame_bitmap[frame] = 0xFFFFFFFF;
+	}
+	for (frame = PAGE_LOW_MEMORY_END >> PAGE_SHIFT; frame < frame_count; frame++) {
+		frame_clear(frame);
+	}
+	free_frames = frame_count - (PAGE_LOW_MEMORY_END >> PAGE_SHIFT);
+
+	page_reserve_range((unsigned long)_kernel_start, (unsigned long)_kernel_end);
+	for (frame = 0; frame < early_reserve_count; frame++) {
+		page_reserve_range(early_reserves[frame][0], early_reserves[frame][1]);
+	}
+	total_frames = free_frames;
+	next_word = 0;
+
+	/* Owner words live in the first free frames after the kernel */
+	owner_pages = PAGE_ALIGN_UP(frame_count * sizeof(unsigned long)) >> PAGE_SHIFT;
+	frame_owner = (unsigned long*)page_alloc_contig(owner_pages);
+	for (frame = 0; frame < frame_count; frame++) {
+		frame_owner[frame] = 0;
+	}
+}
+
+/* Allocate a single page */
+void* page_alloc(void)
+{
+	unsigned long flags;
+	unsigned int word;
+	unsigned int scanned;
+	unsigned int bit;
+	unsigned int frame;
+	unsigned int words = (frame_count + 31) / 32;
+
+	flags = spin_lock_irqsave(&page_lock);
+	for (scanned = 0; scanned < words; scanned++) {
+		word = (next_word + scanned) % words;
+		if (frame_bitmap[word] == 0xFFFFFFFF) {
+			continue;
+		}
+
+		bit = __builtin_ctz(~frame_bitmap[word]);
+		frame = word * 32 + bit;
+		if (frame >= frame_count) {
+			continue;
+		}
+
+		frame_set(frame);
+		free_frames--;
+		next_word = word;
+		spin_unlock_irqrestore(&page_lock, flags);
+		return (void*)(frame << PAGE_SHIFT);
+	}
+	spin_unlock_irqrestore(&page_lock, flags);
+	return 0;
+}
+
+/* Allocate physically contiguous pages */
+void* page_alloc_contig(unsigned int count)
+{
+	unsigned long flags;
+	unsigned int frame;
+	unsigned int run = 0;
+	unsigned int i;
+
+	if (count == 0) {
+		return 0;
+	}
+	if (count == 1) {
+		return page_alloc();
+	}
+
+	flags = spin_lock_irqsave(&page_lock);
+	for (frame = 0; frame < frame_count; frame++) {
+		if (frame_test(frame)) {
+			run = 0;
+			continue;
+		}
+
+		run++;
+		if (run == count) {
+			frame = frame + 1 - count;
+			for (i = 0; i < count; i++) {
+				frame_set(frame + i);
+			}
+			free_frames -= count;
+			spin_unlock_irqrestore(&page_lock, flags);
+			return (void*)(frame << PAGE_SHIFT);
+		}
+	}
+	spin_unlock_irqrestore(&page_lock, flags);
+	return 0;
+}
+
+/* Free a single page */
+void page_free(void *page)
+{
+	page_free_contig(page, 1);
+}
+
+/* Free physically contiguous pages */
+void page_free_contig(void *page, unsigned int count)
+{
+	unsigned long flags;
+	unsigned int frame = (unsigned long)page >> PAGE_SHIFT;
+	unsigned int i;
+
+	flags = spin_lock_irqsave(&page_lock);
+	for (i = 0; i < count && frame + i < frame_count; i++) {
+		if (frame_test(frame + i)) {
+			frame_clear(frame + i);
+			frame_owner[frame + i] = 0;
+			free_frames++;
+		}
+	}
+	if ((frame / 32) < next_word) {
+		next_word = frame / 32;
+	}
+	spin_unlock_irqrestore(&page_lock, flags);
+}
+
+/* Give the __init pages (link.ld) to the allocator; returns the count */
+unsigned int page_free_init(void)
+{
+	unsigned long start = PAGE_ALIGN_UP(_init_start);
+	unsigned long end = PAGE_ALIGN_DOWN(_init_end);
+	unsigned int count;
+
+	if (end <= start) {
+		return 0;
+	}
+	count = (end - start) >> PAGE_SHIFT;
+	page_free_contig((void*)start, count);
+	total_frames += count;
+	return count;
+}
+
+/* Record an owner word for a run of pages */
+void page_set_owner(void *page, unsigned int count, unsigned long owner)
+{
+	unsigned int frame = (unsigned long)page >> PAGE_SHIFT;
+	unsigned int i;
+
+	for (i = 0; i < count && frame + i < frame_count; i++) {
+		frame_owner[frame + i] = owner;
+	}
+}
+
+/* Look up the owner word of the page containing addr */
+unsigned long page_get_owner(const void *addr)
+{
+	unsigned int frame = (unsigned long)addr >> PAGE_SHIFT;
+
+	if (frame >= frame_count) {
+		return 0;
+	}
+	return frame_owner[frame];
+}
+
+/* Number of pages managed by the allocator */
+unsigned int page_total_count(void)
+{
+	return total_frames;
+}
+
+/* Number of pages currently free */
+unsigned int page_free_count(void)
+{
+	return free_frames;
+}
+
+/* Top of usable physical memory */
+unsigned long page_memory_top(void)
+{
+	return (unsigned long)frame_count << PAGE_SHIFT;
+}
@@ -0,0 +1,46 @@
+/*
+ * Page Allocator - Physical page frame management
+ */
+
+#ifndef PAGE_H
+#define PAGE_H
+
+#define PAGE_SIZE 4096
+#define PAGE_SHIFT 12
+
+/* Highest physical address the allocator manages */
+#define PAGE_MAX_MEMORY (256 * 1024 * 1024)
+#define PAGE_MAX_FRAMES (PAGE_MAX_MEMORY / PAGE_SIZE)
+
+/* Ranges registered before page_init, e.g. boot modules */
+#define PAGE_EARLY_RESERVES 8
+
+/* Memory below 1 MB belongs to the BIOS, VGA and real mode */
+#define PAGE_LOW_MEMORY_END 0x100000
+
+/* Round an address up/down to a page boundary */
+#define PAGE_ALIGN_UP(addr) (((unsigned long)(addr) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+#define PAGE_ALIGN_DOWN(addr) ((unsigned long)(addr) & ~(PAGE_SIZE - 1))
+
+/* Page allocator functions */
+void page_init(void);
+void page_reserve_range(unsigned long start, unsigned long end);
+void page_reserve_early(unsigned long start, unsigned long end);
+void* page_alloc(void);
+void* page_alloc_contig(unsigned int count);
+void page_free(void *page);
+void page_free_contig(void *page, unsigned int count);
+
+/* Release boot-only code once nothing will call it again */
+unsigned int page_free_init(void);
+
+/* Per-page owner word, used by the slab layer to find a page's slab */
+void page_set_owner(void *page, unsigned int count, unsigned long owner);
+unsigned long page_get_owner(const void *addr);
+
+/* Statistics */
+unsigned int page_total_count(void);
+unsigned int page_free_count(void);
+unsigned long page_memory_top(void);
+
+#endif /* PAGE_H */
@@ -0,0 +1,577 @@
+/*
+ * Paging Implementation
+ * The kernel and the direct map of RAM use global 4 MB PSE pages so hot
+ * paths need only a handful of TLB entries; the heap and device regions
+ * are 4 KB-granular and get their page tables on demand.
+ *
+ * User tasks each get an address space whose directory copies the
+ * kernel's entries; kernel page tables created later are copied into
+ * every space, so kernel mappings look the same whichever one is loaded.
+ */
+
+#include "paging.h"
+#include "page.h"
+#include "cache.h"
+#include "slab.h"
+#include "vma.h"
+#include "../cpu/cpu.h"
+#include "../output/output.h"
+#include "../kernel.h"
+#include "../task/user.h"
+#include "../essentials/sections.h"
+
+#define PT_ENTRIES 1024
+#define REGION_PAGES ((VM_HEAP_END - VM_HEAP_BASE) >> PAGE_SHIFT)
+
+/* Page directory slots of the user range */
+#define USER_PDE_FIRST (VM_USER_BASE >> LARGE_PAGE_SHIFT)
+#define USER_PDE_END (VM_USER_END >> LARGE_PAGE_SHIFT)
+
+/* Page fault error code: the access came from ring 3 */
+#define PF_USER 0x004
+
+/* Legacy VGA/BIOS area inside the low 4 MB, mapped uncached */
+#define LEGACY_START 0xA0000
+#define LEGACY_END 0x100000
+
+/* A 4 KB-granular virtual region with a bitmap of used pages */
+typedef struct {
+	const char *name;
+	unsigned long base;
+	unsigned long end;
+	unsigned int bitmap[REGION_PAGES / 32];
+	unsigned int used;
+	unsigned int hint;
+} VmRegion;
+
+extern void page_fault_handler(void);
+extern char _kernel_start[];
+extern char _kernel_end[];
+
+static unsigned long page_directory[PT_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+static unsigned long low_page_table[PT_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+static unsigned long global_flag;
+static unsigned long direct_map_end;
+static int large_pages;
+static SpinLock vm_lock = SPINLOCK_INIT;
+static SpinLock page_table_lock = SPINLOCK_INIT;
+
+static VmRegion heap_region;
+static VmRegion device_region;
+
+/* User address spaces; 0 active = the kernel's own directory is loaded */
+static AddressSpace *spaces;
+static AddressSpace *active_space;
+
+static inline int is_user_address(unsigned long virt)
+{
+	return virt >= VM_USER_BASE && virt < VM_USER_END;
+}
+
+/* The directory that maps virt: user addresses belong to the active space */
+static unsigned long* directory_for(unsigned long virt)
+{
+	if (active_space && is_user_address(virt)) {
+		return active_space->directory;
+	}
+	return page_directory;
+}
+
+/* Find the page table covering virt, optionally creating it */
+static unsigned long* get_page_table(unsigned long virt, int create)
+{
+	unsigned long *directory = directory_for(virt);
+	unsigned int pd_index = virt >> LARGE_PAGE_SHIFT;
+	unsigned long *table;
+	AddressSpace *space;
+	int i;
+
+	if (directory[pd_index] & PTE_PRESENT) {
+		if (directory[pd_index] & PDE_LARGE) {
+			return 0;
+		}
+		return (unsigned long*)(directory[pd_index] & ~(PAGE_SIZE - 1));
+	}
+	if (!create) {
+		return 0;
+	}
+
+	table = (unsigned long*)page_alloc();
+	if (!table) {
+		return 0;
+	}
+	for (i = 0; i < PT_ENTRIES; i++) {
+		table[i] = 0;
+	}
+	if (is_user_address(virt)) {
+		directory[pd_index] = (unsigned long)table | PTE_PRESENT | PTE_WRITE | PTE_USER;
+		return table;
+	}
+
+	/* A new kernel page table: every space must see it */
+	directory[pd_index] = (unsigned long)table | PTE_PRESENT | PTE_WRITE;
+	for (space = spaces; space; space = space->next) {
+		space->directory[pd_index] = directory[pd_index];
+	}
+	return table;
+}
+
+/* Identity-map one 4 MB chunk, with a page table if PSE is missing */
+static void map_large(unsigned long addr)
+{
+	unsigned long *table;
+	int i;
+
+	if (large_pages) {
+		page_directory[addr >> LARGE_PAGE_SHIFT] =
+			addr | PTE_PRESENT | PTE_WRITE | PDE_LARGE | global_flag;
+		return;
+	}
+
+	table = get_page_table(addr, 1);
+	for (i = 0; table && i < PT_ENTRIES; i++) {
+		table[i] = (addr + i * PAGE_SIZE) | PTE_PRESENT | PTE_WRITE | global_flag;
+	}
+}
+
+/* Map one 4 KB page - returns 0 on success, -1 on failure */
+int paging_map_page(unsigned long virt, unsigned long phys, unsigned int flags)
+{
+	unsigned long lock_flags;
+	unsigned long *table;
+
+	lock_flags = spin_lock_irqsave(&page_table_lock);
+	table = get_page_table(virt, 1);
+	if (!table) {
+		spin_unlock_irqrestore(&page_table_lock, lock_flags);
+		return -1;
+	}
+	table[(virt >> PAGE_SHIFT) & (PT_ENTRIES - 1)] = (phys & ~(PAGE_SIZE - 1)) | flags | PTE_PRESENT;
+	cpu_invlpg(virt);
+	spin_unlock_irqrestore(&page_table_lock, lock_flags);
+	return 0;
+}
+
+/* Remove a 4 KB mapping */
+void paging_unmap_page(unsigned long virt)
+{
+	unsigned long lock_flags;
+	unsigned long *table;
+
+	lock_flags = spin_lock_irqsave(&page_table_lock);
+	table = get_page_table(virt, 0);
+	if (table) {
+		table[(virt >> PAGE_SHIFT) & (PT_ENTRIES - 1)] = 0;
+		cpu_invlpg(virt);
+	}
+	spin_unlock_irqrestore(&page_table_lock, lock_flags);
+}
+
+/*
+ * Unmap a page of the active user space that the space owns and hand
+ * its frame to the caller - returns the frame or 0 (unmapped, shared,
+ * or not a user address)
+ */
+unsigned long paging_take_page(unsigned long virt)
+{
+	unsigned long lock_flags;
+	unsigned long *table;
+	unsigned long *entry;
+	unsigned long frame = 0;
+
+	if (!active_space || !is_user_address(virt)) {
+		return 0;
+	}
+	lock_flags = spin_lock_irqsave(&page_table_lock);
+	table = get_page_table(virt, 0);
+	if (table) {
+		entry = &table[(virt >> PAGE_SHIFT) & (PT_ENTRIES - 1)];
+		if ((*entry & PTE_PRESENT) && !(*entry & PTE_SHARED)) {
+			frame = *entry & ~(PAGE_SIZE - 1);
+			*entry = 0;
+			cpu_invlpg(virt);
+		}
+	}
+	spin_unlock_irqrestore(&page_table_lock, lock_flags);
+	return frame;
+}
+
+/* Translate a virtual address - returns 0 if unmapped */
+unsigned long paging_virt_to_phys(unsigned long virt)
+{
+	unsigned long pde = directory_for(virt)[virt >> LARGE_PAGE_SHIFT];
+	unsigned long pte;
+
+	if (!(pde & PTE_PRESENT)) {
+		return 0;
+	}
+	if (pde & PDE_LARGE) {
+		return (pde & ~(LARGE_PAGE_SIZE - 1)) | (virt & (LARGE_PAGE_SIZE - 1));
+	}
+
+	pte = ((unsigned long*)(pde & ~(PAGE_SIZE - 1)))[(virt >> PAGE_SHIFT) & (PT_ENTRIES - 1)];
+	if (!(pte & PTE_PRESENT)) {
+		return 0;
+	}
+	return (pte & ~(PAGE_SIZE - 1)) | (virt & (PAGE_SIZE - 1));
+}
+
+/* New user address space with the kernel mapped - returns 0 when out of memory */
+AddressSpace* paging_space_create(void)
+{
+	AddressSpace *space;
+	unsigned long flags;
+	unsigned int i;
+
+	space = (AddressSpace*)kzalloc(sizeof(AddressSpace));
+	if (!space) {
+		return 0;
+	}
+	space->directory = (unsigned long*)page_alloc();
+	if (!space->directory) {
+		kfree(space);
+		return 0;
+	}
+
+	flags = spin_lock_irqsave(&page_table_lock);
+	for (i = 0; i < PT_ENTRIES; i++) {
+		space->directory[i] = (i >= USER_PDE_FIRST && i < USER_PDE_END) ? 0 : page_directory[i];
+	}
+	space->next = spaces;
+	spaces = space;
+	spin_unlock_irqrestore(&page_table_lock, flags);
+	return space;
+}
+
+/* Free a space's areas, user pages and page tables - it must not be active */
+void paging_space_destroy(AddressSpace *space)
+{
+	AddressSpace **link;
+	unsigned long *table;
+	unsigned long flags;
+	unsigned int i, j;
+
+	vma_destroy_all(space);
+
+	flags = spin_lock_irqsave(&page_table_lock);
+	for (link = &spaces; *link; link = &(*link)->next) {
+		if (*link == space) {
+			*link = space->next;
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&page_table_lock, flags);
+
+	for (i = USER_PDE_FIRST; i < USER_PDE_END; i++) {
+		if (!(space->directory[i] & PTE_PRESENT)) {
+			continue;
+		}
+		table = (unsigned long*)(space->directory[i] & ~(PAGE_SIZE - 1));
+		for (j = 0; j < PT_ENTRIES; j++) {
+			if ((table[j] & PTE_PRESENT) && !(table[j] & PTE_SHARED)) {
+				page_free((void*)(table[j] & ~(PAGE_SIZE - 1)));
+			}
+		}
+		page_free(table);
+	}
+	page_free(space->directory);
+	kfree(space);
+}
+
+/* Load a space's page directory, or the kernel's for 0 */
+void paging_space_switch(AddressSpace *space)
+{
+	if (space == active_space) {
+		return;
+	}
+	active_space = space;
+	cpu_write_cr3((unsigned long)(space ? space->directory : page_directory));
+}
+
+/* Reserve a run of free pages in a region - returns the virtual address or 0 */
+static unsigned long region_reserve(VmRegion *region, unsigned int pages)
+{
+	unsigned int total = (region->end - region->base) >> PAGE_SHIFT;
+	unsigned int start;
+	unsigned int run = 0;
+	unsigned int i;
+
+	for (i = region->hint; i < total; i++) {
+		if (region->bitmap[i / 32] & (1u << (i % 32))) {
+			run = 0;
+			continue;
+		}
+		if (++run == pages) {
+			start = i + 1 - pages;
+			for (i = start; i < start + pages; i++) {
+				region->bitmap[i / 32] |= 1u << (i % 32);
+			}
+			region->used += pages;
+			region->hint = start + pages;
+			return region->base + ((unsigned long)start << PAGE_SHIFT);
+		}
+	}
+
+	/* Wrap around once if the hint skipped freed space */
+	if (region->hint != 0) {
+		region->hint = 0;
+		return region_reserve(region, pages);
+	}
+	return 0;
+}
+
+/* Release pages reserved from a region */
+static void region_release(VmRegion *region, unsigned long virt, unsigned int pages)
+{
+	unsigned int start = (virt - region->base) >> PAGE_SHIFT;
+	unsigned int i;
+
+	for (i = start; i < start + pages; i++) {
+		region->bitmap[i / 32] &= ~(1u << (i % 32));
+	}
+	region->used -= pages;
+	if (start < region->hint) {
+		region->hint = start;
+	}
+}
+
+/* Allocate virtually contiguous, 4 KB-mapped kernel memory */
+void* vm_alloc(unsigned int pages)
+{
+	unsigned long flags;
+	unsigned long virt;
+	unsigned int i;
+	void *phys;
+
+	flags = spin_lock_irqsave(&vm_lock);
+	virt = region_reserve(&heap_region, pages);
+	spin_unlock_irqrestore(&vm_lock, flags);
+	if (!virt) {
+		return 0;
+	}
+
+	for (i = 0; i < pages; i++) {
+		phys = page_alloc();
+		if (!phys || paging_map_page(virt + i * PAGE_SIZE, (unsigned long)phys,
+		                             PTE_WRITE | global_flag) != 0) {
+			if (phys) {
+				page_free(phys);
+			}
+			vm_free((void*)virt, i);
+			flags = spin_lock_irqsave(&vm_lock);
+			region_release(&heap_region, virt + i * PAGE_SIZE, pages - i);
+			spin_unlock_irqrestore(&vm_lock, flags);
+			return 0;
+		}
+	}
+	return (void*)virt;
+}
+
+/* Free memory returned by vm_alloc() */
+void vm_free(void *addr, unsigned int pages)
+{
+	unsigned long virt = (unsigned long)addr;
+	unsigned long flags;
+	unsigned int i;
+
+	for (i = 0; i < pages; i++) {
+		page_free((void*)paging_virt_to_phys(virt + i * PAGE_SIZE));
+		paging_unmap_page(virt + i * PAGE_SIZE);
+	}
+
+	flags = spin_lock_irqsave(&vm_lock);
+	region_release(&heap_region, virt, pages);
+	spin_unlock_irqrestore(&vm_lock, flags);
+}
+
+/* Map device memory with the requested cache mode */
+void* vm_map_device(unsigned long phys, unsigned int size, int cache_mode)
+{
+	unsigned long offset = phys & (PAGE_SIZE - 1);
+	unsigned int pages = PAGE_ALIGN_UP(offset + size) >> PAGE_SHIFT;
+	unsigned int pte_cache;
+	unsigned long flags;
+	unsigned long virt;
+	unsigned int i;
+
+	flags = spin_lock_irqsave(&vm_lock);
+	virt = region_reserve(&device_region, pages);
+	spin_unlock_irqrestore(&vm_lock, flags);
+	if (!virt) {
+		return 0;
+	}
+
+	pte_cache = cache_pte_flags(cache_mode, phys - offset, pages * PAGE_SIZE);
+	for (i = 0; i < pages; i++) {
+		paging_map_page(virt + i * PAGE_SIZE, phys - offset + i * PAGE_SIZE,
+		                PTE_WRITE | global_flag | pte_cache);
+	}
+	return (void*)(virt + offset);
+}
+
+/* Remove a device mapping */
+void vm_unmap_device(void *addr, unsigned int size)
+{
+	unsigned long virt = PAGE_ALIGN_DOWN(addr);
+	unsigned int pages = PAGE_ALIGN_UP((unsigned long)addr - virt + size) >> PAGE_SHIFT;
+	unsigned long flags;
+	unsigned int i;
+
+	for (i = 0; i < pages; i++) {
+		paging_unmap_page(virt + i * PAGE_SIZE);
+	}
+
+	flags = spin_lock_irqsave(&vm_lock);
+	region_release(&device_region, virt, pages);
+	spin_unlock_irqrestore(&vm_lock, flags);
+}
+
+/* Page fault - demand paging, else a user task is killed and the kernel halts */
+void page_fault_handler_main(unsigned long address, unsigned long error, unsigned long eip,
+                             unsigned long eflags)
+{
+	int filled;
+
+	/* First touch of user memory, by the program or by a system call */
+	if (active_space && is_user_address(address) && !(error & PTE_PRESENT)) {
+		/* Filling may wait for the disk: allow interrupts if the faulting code did */
+		if (eflags & EFLAGS_IF) {
+			irq_enable();
+		}
+		filled = vma_fault(active_space, address, error & PTE_WRITE) == 0;
+		irq_disable();
+		if (filled) {
+			return;
+		}
+	}
+
+	/*
+	 * A program's bad address, or one a system call touched for it that
+	 * couldn't be filled (out of memory, read error): the program dies,
+	 * not the kernel
+	 */
+	if ((error & PF_USER) || (is_user_address(address) && task_current()->process)) {
+		user_fault("page fault", address);
+		return;
+	}
+
+	kprint_colored("\nPage fault at ", 0x04);
+	kprint_hex(address);
+	kprint(" eip ");
+	kprint_hex(eip);
+	kprint(" error ");
+	kprint_hex(error);
+	kprint(error & PTE_PRESENT ? " (protection)" : " (not present)");
+	kprint_newline();
+
+	while (1) {
+		__asm__ volatile("cli; hlt");
+	}
+}
+
+/* Build the kernel page tables and turn paging on */
+__init void paging_init(void)
+{
+	unsigned long addr;
+	unsigned long cr4;
+	unsigned int flags;
+	int i;
+
+	heap_region.name = "heap";
+	heap_region.base = VM_HEAP_BASE;
+	heap_region.end = VM_HEAP_END;
+	device_region.name = "devices";
+	device_region.base = VM_DEVICE_BASE;
+	device_region.end = VM_DEVICE_END;
+
+	large_pages = cpu_has_feature(CPU_FEATURE_PSE);
+	if (cpu_has_feature(CPU_FEATURE_PGE)) {
+		global_flag = PTE_GLOBAL;
+	}
+
+	/* Low 4 MB: page 0 stays unmapped to catch null pointers */
+	for (i = 1; i < PT_ENTRIES; i++) {
+		addr = (unsigned long)i * PAGE_SIZE;
+		flags = PTE_PRESENT | PTE_WRITE | global_flag;
+		if (addr >= LEGACY_START && addr < LEGACY_END) {
+			flags |= cache_pte_flags(VM_CACHE_UC, addr, PAGE_SIZE);
+		}
+		low_page_table[i] = addr | flags;
+	}
+	page_directory[0] = (unsigned long)low_page_table | PTE_PRESENT | PTE_WRITE;
+
+	/* Kernel image and all RAM above it: identity-mapped 4 MB pages */
+	direct_map_end = (page_memory_top() + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+	if (direct_map_end < (unsigned long)_kernel_end) {
+		direct_map_end = ((unsigned long)_kernel_end + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+	}
+	for (addr = VM_KERNEL_BASE; addr < direct_map_end; addr += LARGE_PAGE_SIZE) {
+		map_large(addr);
+	}
+
+	idt_set_gate(VECTOR_PAGE_FAULT, page_fault_handler, INTERRUPT_GATE);
+
+	/* Memory types must be set up before the first TLB fill */
+	cache_init();
+
+	cr4 = cpu_read_cr4();
+	if (large_pages) {
+		cr4 |= CR4_PSE;
+	}
+	cpu_write_cr4(cr4);
+	cpu_write_cr3((unsigned long)page_directory);
+	cpu_write_cr0(cpu_read_cr0() | CR0_PG | CR0_WP);
+
+	/* Global pages only after paging is on */
+	if (global_flag) {
+		cpu_write_cr4(cpu_read_cr4() | CR4_PGE);
+	}
+}
+
+/* Print one layout line */
+static void print_range(unsigned long start, unsigned long end, const char *what)
+{
+	kprint(" ");
+	kprint_hex(start);
+	kprint(" - ");
+	kprint_hex(end - 1);
+	kprint("  ");
+	kprint(what);
+}
+
+/* Print a 4 KB region's usage */
+static void print_region(VmRegion *region)
+{
+	print_range(region->base, region->end, region->name);
+	kprint(", 4 KB pages, ");
+	kprint_dec(region->used);
+	kprint(" mapped");
+	kprint_newline();
+}
+
+/* Print the virtual memory layout */
+void paging_print_map(void)
+{
+	kprint("Virtual memory layout:\n");
+	print_range(0, PAGE_SIZE, "null guard (unmapped)\n");
+	print_range(PAGE_SIZE, LEGACY_START, "low memory, 4 KB pages, WB\n");
+	print_range(LEGACY_START, LEGACY_END, "VGA/BIOS, 4 KB pages, UC\n");
+	print_range(LEGACY_END, VM_LOW_END, "free pages, 4 KB pages, WB\n");
+	print_range((unsigned long)_kernel_start, (unsigned long)_kernel_end, "kernel image\n");
+	print_range(VM_KERNEL_BASE, direct_map_end, large_pages ? "direct map, 4 MB pages, WB" :
+	            "direct map, 4 KB pages (no PSE), WB");
+	kprint(global_flag ? ", global\n" : "\n");
+	print_range(VM_USER_BASE, VM_USER_END, "user space, per task, 4 KB pages\n");
+	print_region(&heap_region);
+	print_region(&device_region);
+	vma_print_stats();
+
+	kprint("Write-combining: ");
+	if (cache_wc_method() == CACHE_WC_PAT) {
+		kprint("PAT\n");
+	} else if (cache_wc_method() == CACHE_WC_MTRR) {
+		kprint("fixed-range MTRR (legacy VGA window only)\n");
+	} else {
+		kprint("unavailable, WC mappings fall back to UC\n");
+	}
+}
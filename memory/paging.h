@@ -0,0 +1,78 @@
+/*
+ * Paging - Virtual memory layout and page table management
+ */
+
+#ifndef PAGING_H
+#define PAGING_H
+
+/* Page directory / page table entry flags */
+#define PTE_PRESENT 0x001
+#define PTE_WRITE 0x002
+#define PTE_USER 0x004
+#define PTE_PWT 0x008
+#define PTE_PCD 0x010
+#define PTE_ACCESSED 0x020
+#define PTE_DIRTY 0x040
+#define PDE_LARGE 0x080  /* 4 MB page (PSE) */
+#define PTE_GLOBAL 0x100
+#define PTE_SHARED 0x200  /* Software bit: the frame is not owned by the address space */
+
+#define LARGE_PAGE_SIZE 0x400000
+#define LARGE_PAGE_SHIFT 22
+
+/*
+ * Virtual memory layout
+ *
+ * 0x00000000 - 0x003FFFFF  Low memory, 4 KB pages, page 0 unmapped
+ * 0x00400000 - RAM top     Kernel image + direct map of RAM, 4 MB pages
+ * 0x40000000 - 0xBFFFFFFF  User space, one per address space, 4 KB pages
+ * 0xD0000000 - 0xDFFFFFFF  Kernel heap region, 4 KB pages
+ * 0xE0000000 - 0xEFFFFFFF  Device mappings, 4 KB pages
+ */
+#define VM_LOW_END 0x00400000
+#define VM_KERNEL_BASE 0x00400000
+#define VM_USER_BASE 0x40000000
+#define VM_USER_END 0xC0000000
+#define VM_HEAP_BASE 0xD0000000
+#define VM_HEAP_END 0xE0000000
+#define VM_DEVICE_BASE 0xE0000000
+#define VM_DEVICE_END 0xF0000000
+
+/* Cache modes for mappings */
+#define VM_CACHE_WB 0
+#define VM_CACHE_UC 1
+#define VM_CACHE_WC 2  /* Falls back to UC without PAT/MTRR support */
+
+/*
+ * A user address space: its own page directory, sharing every kernel
+ * page table with the others. Addresses in the user range always refer
+ * to the active space.
+ */
+typedef struct AddressSpace {
+	unsigned long *directory;
+	struct Vma *vmas;           /* Demand-paged areas, sorted by address */
+	struct AddressSpace *next;  /* All spaces, for kernel page table updates */
+} AddressSpace;
+
+/* Paging functions */
+void paging_init(void);
+int paging_map_page(unsigned long virt, unsigned long phys, unsigned int flags);
+void paging_unmap_page(unsigned long virt);
+unsigned long paging_virt_to_phys(unsigned long virt);
+
+/* User address spaces */
+AddressSpace* paging_space_create(void);
+void paging_space_destroy(AddressSpace *space);
+void paging_space_switch(AddressSpace *space);
+unsigned long paging_take_page(unsigned long virt);
+
+/* 4 KB-granular kernel regions */
+void* vm_alloc(unsigned int pages);
+void vm_free(void *addr, unsigned int pages);
+void* vm_map_device(unsigned long phys, unsigned int size, int cache_mode);
+void vm_unmap_device(void *addr, unsigned int size);
+
+/* Print the virtual memory layout */
+void paging_print_map(void);
+
+#endif /* PAGING_H */
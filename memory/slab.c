@@ -0,0 +1,329 @@
+/*
+ * Slab Allocator Implementation
+ * Power-of-two size classes carved from the page allocator, with a
+ * per-CPU magazine in front of each cache so the common path never
+ * takes the cache lock.
+ */
+
+#include "slab.h"
+#include "page.h"
+#include "../output/output.h"
+#include "../essentials/sections.h"
+
+/* Owner word tag for multi-page allocations larger than any size class */
+#define OWNER_LARGE 1
+
+/* Slab header - lives at the start of the slab's first page */
+typedef struct Slab {
+	SlabCache *cache;
+	struct Slab *next;
+	struct Slab *prev;
+	void *free_list;
+	unsigned int in_use;
+} Slab;
+
+/* Header rounded up so objects stay 16-byte aligned */
+#define SLAB_HEADER_SIZE ((sizeof(Slab) + 15) & ~15)
+
+static SlabCache caches[SLAB_NR_CACHES];
+
+/* Large allocation statistics */
+static unsigned int large_allocs;
+static unsigned int large_frees;
+static unsigned int large_pages_in_use;
+
+/* Map a request size to its cache index */
+static int slab_index(unsigned int size)
+{
+	if (size <= (1u << SLAB_MIN_SHIFT)) {
+		return 0;
+	}
+	return (32 - __builtin_clz(size - 1)) - SLAB_MIN_SHIFT;
+}
+
+/* Unlink a slab from its cache's partial list */
+static void slab_unlink(SlabCache *cache, Slab *slab)
+{
+	if (slab->prev) {
+		slab->prev->next = slab->next;
+	} else {
+		cache->partial = slab->next;
+	}
+	if (slab->next) {
+		slab->next->prev = slab->prev;
+	}
+	slab->next = 0;
+	slab->prev = 0;
+}
+
+/* Push a slab onto its cache's partial list */
+static void slab_link(SlabCache *cache, Slab *slab)
+{
+	slab->prev = 0;
+	slab->next = cache->partial;
+	if (cache->partial) {
+		cache->partial->prev = slab;
+	}
+	cache->partial = slab;
+}
+
+/* Allocate and carve a fresh slab (cache lock held) */
+static Slab* slab_grow(SlabCache *cache)
+{
+	Slab *slab;
+	char *obj;
+	unsigned int i;
+
+	slab = (Slab*)page_alloc_contig(cache->slab_pages);
+	if (!slab) {
+		return 0;
+	}
+	page_set_owner(slab, cache->slab_pages, (unsigned long)slab);
+
+	slab->cache = cache;
+	slab->in_use = 0;
+	slab->free_list = 0;
+
+	/* Thread the free list through the objects, lowest address first */
+	obj = (char*)slab + SLAB_HEADER_SIZE + (cache->objects_per_slab - 1) * cache->object_size;
+	for (i = 0; i < cache->objects_per_slab; i++) {
+		*(void**)obj = slab->free_list;
+		slab->free_list = obj;
+		obj -= cache->object_size;
+	}
+
+	slab_link(cache, slab);
+	cache->slab_count++;
+	cache->empty_count++;
+	return slab;
+}
+
+/* Refill an empty magazine from the shared slabs */
+static void slab_refill(SlabCache *cache, SlabCpuCache *cpu)
+{
+	unsigned long flags;
+	Slab *slab;
+	void *obj;
+
+	flags = spin_lock_irqsave(&cache->lock);
+	while (cpu->count < SLAB_MAGAZINE_SIZE / 2) {
+		slab = cache->partial;
+		if (!slab) {
+			slab = slab_grow(cache);
+			if (!slab) {
+				break;
+			}
+		}
+
+		obj = slab->free_list;
+		slab->free_list = *(void**)obj;
+		if (slab->in_use++ == 0) {
+			cache->empty_count--;
+		}
+		if (!slab->free_list) {
+			slab_unlink(cache, slab);
+		}
+		cpu->objects[cpu->count++] = obj;
+	}
+	cpu->refills++;
+	spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+/* Return half of a full magazine to the shared slabs */
+static void slab_flush(SlabCache *cache, SlabCpuCache *cpu)
+{
+	unsigned long flags;
+	Slab *slab;
+	void *obj;
+
+	flags = spin_lock_irqsave(&cache->lock);
+	while (cpu->count > SLAB_MAGAZINE_SIZE / 2) {
+		obj = cpu->objects[--cpu->count];
+		slab = (Slab*)page_get_owner(obj);
+
+		if (!slab->free_list) {
+			slab_link(cache, slab);
+		}
+		*(void**)obj = slab->free_list;
+		slab->free_list = obj;
+
+		if (--slab->in_use == 0) {
+			/* Keep one empty slab around, give the rest back */
+			if (cache->empty_count > 0) {
+				slab_unlink(cache, slab);
+				page_free_contig(slab, cache->slab_pages);
+				cache->slab_count--;
+			} else {
+				cache->empty_count++;
+			}
+		}
+	}
+	cpu->flushes++;
+	spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+/* Initialize the size-class caches */
+__init void slab_init(void)
+{
+	int i;
+	unsigned int size;
+	SlabCache *cache;
+
+	for (i = 0; i < SLAB_NR_CACHES; i++) {
+		cache = &caches[i];
+		size = 1u << (SLAB_MIN_SHIFT + i);
+
+		cache->object_size = size;
+		cache->slab_pages = 1;
+		while ((cache->slab_pages * PAGE_SIZE - SLAB_HEADER_SIZE) / size < SLAB_MIN_OBJECTS &&
+		       cache->slab_pages < 8) {
+			cache->slab_pages *= 2;
+		}
+		cache->objects_per_slab = (cache->slab_pages * PAGE_SIZE - SLAB_HEADER_SIZE) / size;
+	}
+}
+
+/* Allocate pages directly for requests above the largest size class */
+static void* kmalloc_large(unsigned int size)
+{
+	unsigned int count = PAGE_ALIGN_UP(size) >> PAGE_SHIFT;
+	void *pages;
+
+	pages = page_alloc_contig(count);
+	if (!pages) {
+		return 0;
+	}
+	page_set_owner(pages, 1, (count << 1) | OWNER_LARGE);
+
+	__sync_fetch_and_add(&large_allocs, 1);
+	__sync_fetch_and_add(&large_pages_in_use, count);
+	return pages;
+}
+
+/* Allocate kernel memory */
+void* kmalloc(unsigned int size)
+{
+	SlabCache *cache;
+	SlabCpuCache *cpu;
+	unsigned long flags;
+	void *obj = 0;
+
+	if (size == 0) {
+		return 0;
+	}
+	if (size > SLAB_MAX_SIZE) {
+		return kmalloc_large(size);
+	}
+
+	cache = &caches[slab_index(size)];
+
+	/* Fast path: pop from this CPU's magazine with interrupts held off */
+	flags = irq_save();
+	cpu = &cache->cpu[cpu_id()];
+	if (cpu->count == 0) {
+		slab_refill(cache, cpu);
+	}
+	if (cpu->count > 0) {
+		obj = cpu->objects[--cpu->count];
+		cpu->allocs++;
+		if (++cpu->in_use > cpu->high_water) {
+			cpu->high_water = cpu->in_use;
+		}
+	}
+	irq_restore(flags);
+	return obj;
+}
+
+/* Allocate zeroed kernel memory */
+void* kzalloc(unsigned int size)
+{
+	unsigned int *words;
+	unsigned int i;
+
+	words = (unsigned int*)kmalloc(size);
+	if (words) {
+		for (i = 0; i < (size + 3) / 4; i++) {
+			words[i] = 0;
+		}
+	}
+	return words;
+}
+
+/* Free kernel memory */
+void kfree(void *ptr)
+{
+	unsigned long owner;
+	SlabCache *cache;
+	SlabCpuCache *cpu;
+	unsigned long flags;
+
+	if (!ptr) {
+		return;
+	}
+
+	owner = page_get_owner(ptr);
+	if (owner & OWNER_LARGE) {
+		__sync_fetch_and_add(&large_frees, 1);
+		__sync_fetch_and_sub(&large_pages_in_use, owner >> 1);
+		page_free_contig(ptr, owner >> 1);
+		return;
+	}
+
+	cache = ((Slab*)owner)->cache;
+
+	/* Fast path: push onto this CPU's magazine */
+	flags = irq_save();
+	cpu = &cache->cpu[cpu_id()];
+	if (cpu->count == SLAB_MAGAZINE_SIZE) {
+		slab_flush(cache, cpu);
+	}
+	cpu->objects[cpu->count++] = ptr;
+	cpu->frees++;
+	cpu->in_use--;
+	irq_restore(flags);
+}
+
+/* Print one statistic as "label value" */
+static void print_stat(const char *label, unsigned int value)
+{
+	kprint(label);
+	kprint_dec((int)value);
+}
+
+/* Print per-cache statistics */
+void slab_print_info(void)
+{
+	int i;
+	int c;
+	SlabCache *cache;
+	unsigned int allocs, frees, in_use, high_water, cached;
+
+	for (i = 0; i < SLAB_NR_CACHES; i++) {
+		cache = &caches[i];
+		allocs = frees = in_use = high_water = cached = 0;
+		for (c = 0; c < NR_CPUS; c++) {
+			allocs += cache->cpu[c].allocs;
+			frees += cache->cpu[c].frees;
+			in_use += cache->cpu[c].in_use;
+			high_water += cache->cpu[c].high_water;
+			cached += cache->cpu[c].count;
+		}
+
+		print_stat("kmalloc-", cache->object_size);
+		print_stat(" active ", in_use);
+		print_stat(" peak ", high_water);
+		print_stat(" allocs ", allocs);
+		print_stat(" frees ", frees);
+		print_stat(" slabs ", cache->slab_count);
+		print_stat(" cached ", cached);
+		kprint_newline();
+	}
+
+	print_stat("large: allocs ", large_allocs);
+	print_stat(" frees ", large_frees);
+	print_stat(" pages ", large_pages_in_use);
+	kprint_newline();
+	print_stat("pages: free ", page_free_count());
+	print_stat(" of ", page_total_count());
+	kprint_newline();
+}
@@ -0,0 +1,57 @@
+/*
+ * Slab Allocator - Kernel heap (kmalloc/kfree)
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "../cpu/cpu.h"
+
+/* Size classes: 16, 32, 64, ... 2048 bytes */
+#define SLAB_MIN_SHIFT 4
+#define SLAB_MAX_SHIFT 11
+#define SLAB_MAX_SIZE (1 << SLAB_MAX_SHIFT)
+#define SLAB_NR_CACHES (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+
+/* Objects each CPU keeps cached before touching the shared slabs */
+#define SLAB_MAGAZINE_SIZE 16
+
+/* Minimum objects per slab; larger classes use multi-page slabs */
+#define SLAB_MIN_OBJECTS 8
+
+struct Slab;
+
+/* Per-CPU magazine and counters - only touched by the owning CPU */
+typedef struct {
+	void *objects[SLAB_MAGAZINE_SIZE];
+	int count;
+	unsigned int allocs;
+	unsigned int frees;
+	unsigned int in_use;
+	unsigned int high_water;
+	unsigned int refills;
+	unsigned int flushes;
+} SlabCpuCache;
+
+/* Cache for one object size */
+typedef struct {
+	unsigned int object_size;
+	unsigned int slab_pages;
+	unsigned int objects_per_slab;
+	SpinLock lock;
+	struct Slab *partial;   /* Slabs with at least one free object */
+	unsigned int slab_count;
+	unsigned int empty_count;
+	SlabCpuCache cpu[NR_CPUS];
+} SlabCache;
+
+/* Heap functions */
+void slab_init(void);
+void* kmalloc(unsigned int size);
+void* kzalloc(unsigned int size);
+void kfree(void *ptr);
+
+/* Statistics */
+void slab_print_info(void);
+
+#endif /* SLAB_H */
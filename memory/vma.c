@@ -0,0 +1,134 @@
+/*
+ * VMA Implementation
+ * Nothing of a program is read when it starts: each area only records
+ * where its pages come from, and the first access to a page faults it
+ * in. File reads go through the filesystem, so FAT-backed programs are
+ * served from the block cache and initrd ones straight from the module.
+ */
+
+#include "vma.h"
+#include "page.h"
+#include "slab.h"
+#include "../output/output.h"
+#include "../lib/string.h"
+
+static VmaStats stats;
+
+/* Add an area; the space takes its own reference to file */
+int vma_add(AddressSpace *space, unsigned long start, unsigned long end, unsigned int flags,
+            Inode *file, unsigned int offset, unsigned int file_size)
+{
+	Vma **link = &space->vmas;
+	Vma *vma;
+
+	/* The list is sorted by address; refuse overlaps */
+	while (*link && (*link)->end <= start) {
+		link = &(*link)->next;
+	}
+	if (start >= end || (*link && (*link)->start < end)) {
+		return -1;
+	}
+
+	vma = (Vma*)kzalloc(sizeof(Vma));
+	if (!vma) {
+		return -1;
+	}
+	vma->start = start;
+	vma->end = end;
+	vma->flags = flags;
+	vma->file = file;
+	vma->offset = offset;
+	vma->file_size = file ? file_size : 0;
+	if (file) {
+		file->refs++;
+	}
+	vma->next = *link;
+	*link = vma;
+	return 0;
+}
+
+/* The area containing addr, or 0 */
+Vma* vma_find(AddressSpace *space, unsigned long addr)
+{
+	Vma *vma;
+
+	for (vma = space->vmas; vma && vma->start <= addr; vma = vma->next) {
+		if (addr < vma->end) {
+			return vma;
+		}
+	}
+	return 0;
+}
+
+/* Drop every area and its file reference (pages go with the space) */
+void vma_destroy_all(AddressSpace *space)
+{
+	Vma *vma;
+
+	while (space->vmas) {
+		vma = space->vmas;
+		space->vmas = vma->next;
+		if (vma->file) {
+			vfs_iput(vma->file);
+		}
+		kfree(vma);
+	}
+}
+
+/* Fill a fresh frame for the page at addr and map it */
+int vma_fault(AddressSpace *space, unsigned long addr, int write)
+{
+	Vma *vma = vma_find(space, addr);
+	unsigned long page = PAGE_ALIGN_DOWN(addr);
+	unsigned int within;
+	unsigned int length;
+	char *frame;
+
+	if (!vma || (write && !(vma->flags & VMA_WRITE))) {
+		stats.failed++;
+		return -1;
+	}
+	frame = (char*)page_alloc();
+	if (!frame) {
+		stats.failed++;
+		return -1;
+	}
+
+	within = page - vma->start;
+	length = 0;
+	if (within < vma->file_size) {
+		length = vma->file_size - within < PAGE_SIZE ? vma->file_size - within : PAGE_SIZE;
+		if (vfs_iread(vma->file, vma->offset + within, frame, length) != (int)length) {
+			page_free(frame);
+			stats.failed++;
+			return -1;
+		}
+		stats.file_pages++;
+		stats.bytes_read += length;
+	} else {
+		stats.zero_pages++;
+	}
+	memset(frame + length, 0, PAGE_SIZE - length);
+
+	if (paging_map_page(page, (unsigned long)frame,
+	                    PTE_USER | ((vma->flags & VMA_WRITE) ? PTE_WRITE : 0)) != 0) {
+		page_free(frame);
+		stats.failed++;
+		return -1;
+	}
+	return 0;
+}
+
+/* Print the demand paging counters */
+void vma_print_stats(void)
+{
+	kprint("Demand paging: ");
+	kprint_dec(stats.file_pages);
+	kprint(" pages read (");
+	kprint_dec(stats.bytes_read / 1024);
+	kprint(" KB), ");
+	kprint_dec(stats.zero_pages);
+	kprint(" zero-filled, ");
+	kprint_dec(stats.failed);
+	kprint(" refused\n");
+}
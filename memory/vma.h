@@ -0,0 +1,49 @@
+/*
+ * VMAs - User memory areas, filled page by page on first touch
+ */
+
+#ifndef VMA_H
+#define VMA_H
+
+#include "paging.h"
+#include "../fs/vfs.h"
+
+/* Area flags */
+#define VMA_WRITE 0x01
+
+/*
+ * An area of a user address space. Pages are mapped by the page fault
+ * handler: the first file_size bytes come from the file at offset, the
+ * rest of the area reads as zeros.
+ */
+typedef struct Vma {
+	unsigned long start;            /* Page aligned */
+	unsigned long end;
+	unsigned int flags;
+	Inode *file;                    /* 0 = anonymous memory */
+	unsigned int offset;            /* File offset of start */
+	unsigned int file_size;
+	struct Vma *next;
+} Vma;
+
+/* Demand paging counters shown by vmmap */
+typedef struct {
+	unsigned int file_pages;        /* Pages read from a file */
+	unsigned int zero_pages;        /* Pages that only needed zeroing */
+	unsigned int bytes_read;
+	unsigned int failed;            /* Faults outside any area, or out of memory */
+} VmaStats;
+
+/* Areas - 0 on success, -1 on overlap or out of memory */
+int vma_add(AddressSpace *space, unsigned long start, unsigned long end, unsigned int flags,
+            Inode *file, unsigned int offset, unsigned int file_size);
+Vma* vma_find(AddressSpace *space, unsigned long addr);
+void vma_destroy_all(AddressSpace *space);
+
+/* Map the page holding addr - 0 on success, -1 if the access is not allowed */
+int vma_fault(AddressSpace *space, unsigned long addr, int write);
+
+/* Statistics */
+void vma_print_stats(void);
+
+#endif /* VMA_H */
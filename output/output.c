@@ -4,19 +4,34 @@
  */
 
 #include "output.h"
+#include "../memory/slab.h"
+#include "../memory/paging.h"
+#include "../memory/cache.h"
+#include "../cpu/cpu.h"
+#include "../bench/bench.h"
+#include "../lib/string.h"
+#include "../debug/trace.h"
+#include "../task/task.h"
+#include "../essentials/sections.h"
+
+/* Two blank cells (space, light grey on black) as one 32-bit word */
+#define BLANK_CELLS 0x07200720
+
+/* Full-screen flushes per benchmark pass */
+#define BENCH_FLUSHES 64
 
 /* External video memory pointer and cursor location */
 extern unsigned int current_loc;
 extern char *vidptr;
 extern void write_port(unsigned short port, unsigned char data);
 
-/* Global output history */
+/* Global output history (.bss - starts empty, no init needed) */
 static OutputHistory global_output_history;
 static char current_line_buffer[MAX_LINE_LENGTH];
 static int current_line_pos = 0;
 
 /* Update hardware cursor position to match software cursor */
-void update_hardware_cursor(void)
+__hot void update_hardware_cursor(void)
 {
 	/* Convert byte offset to character position (divide by 2) */
 	unsigned short position = current_loc / 2;
@@ -30,48 +45,47 @@ void update_hardware_cursor(void)
 	write_port(0x3D5, position & 0xFF);
 }
 
-/* Helper: copy string with length limit */
-static void strncpy_safe(char *dest, const char *src, int max_len)
-{
-	int i = 0;
-	while (i < max_len - 1 && src[i] != '\0') {
-		dest[i] = src[i];
-		i++;
-	}
-	dest[i] = '\0';
-}
-
 /* Initialize output history */
 void output_history_init(OutputHistory *hist)
 {
-	int i, j;
+	int i;
+	for (i = 0; i < hist->count; i++) {
+		kfree(hist->lines[i]);
+		hist->lines[i] = 0;
+	}
 	hist->count = 0;
 	hist->scroll_offset = 0;
-	for (i = 0; i < MAX_OUTPUT_LINES; i++) {
-		for (j = 0; j < MAX_LINE_LENGTH; j++) {
-			hist->lines[i][j] = '\0';
-		}
-	}
 }
 
 /* Add a line to output history */
 void output_history_add_line(OutputHistory *hist, const char *line)
 {
+	unsigned int len;
+	char *copy;
+	
 	if (line[0] == '\0') {
 		return;
 	}
 	
-	/* Shift older lines if history is full */
+	len = strlen(line);
+	if (len > MAX_LINE_LENGTH - 1) {
+		len = MAX_LINE_LENGTH - 1;
+	}
+	copy = (char*)kmalloc(len + 1);
+	if (!copy) {
+		return;
+	}
+	strlcpy(copy, line, len + 1);
+	
+	/* Drop the oldest line if history is full */
 	if (hist->count >= MAX_OUTPUT_LINES) {
-		int i;
-		for (i = 0; i < MAX_OUTPUT_LINES - 1; i++) {
-			strncpy_safe(hist->lines[i], hist->lines[i + 1], MAX_LINE_LENGTH);
-		}
+		kfree(hist->lines[0]);
+		memmove(&hist->lines[0], &hist->lines[1], (MAX_OUTPUT_LINES - 1) * sizeof(char*));
 		hist->count = MAX_OUTPUT_LINES - 1;
 	}
 	
 	/* Add new line to end */
-	strncpy_safe(hist->lines[hist->count], line, MAX_LINE_LENGTH);
+	hist->lines[hist->count] = copy;
 	hist->count++;
 }
 
@@ -130,7 +144,7 @@ OutputHistory* get_output_history(void)
 }
 
 /* Add character to current line buffer */
-static void add_to_line_buffer(char c)
+__hot static void add_to_line_buffer(char c)
 {
 	if (c == CHAR_NEWLINE) {
 		/* Flush current line to history */
@@ -144,11 +158,36 @@ static void add_to_line_buffer(char c)
 	}
 }
 
-/* Print a string to screen */
-void kprint(const char *str)
+OutputSink* output_set_sink(OutputSink *sink)
+{
+	Task *task = task_current();
+	OutputSink *old = task->sink;
+
+	task->sink = sink;
+	return old;
+}
+
+/*
+ * Where this task's output goes, 0 = the screen. Interrupt handlers and
+ * softirqs borrow whichever task they interrupted, so they always draw
+ * to the screen: a sink may sleep or reach the filesystem.
+ */
+static inline OutputSink* output_sink(void)
+{
+	return cpu_in_irq() ? 0 : task_current()->sink;
+}
+
+/* Print length bytes to the sink, or to the screen */
+__hot void output_write(const char *str, unsigned int length)
 {
+	OutputSink *sink = output_sink();
 	unsigned int i = 0;
-	while (str[i] != '\0') {
+
+	if (sink) {
+		sink->write(sink, str, length);
+		return;
+	}
+	while (i < length) {
 		/* Check if we need to scroll before printing */
 		if (current_loc >= SCREENSIZE) {
 			scroll_screen();
@@ -168,10 +207,22 @@ void kprint(const char *str)
 	update_hardware_cursor();
 }
 
+/* Print a string to screen */
+__hot void kprint(const char *str)
+{
+	output_write(str, strlen(str));
+}
+
 /* Print a string with custom color */
 void kprint_colored(const char *str, unsigned char color)
 {
+	OutputSink *sink = output_sink();
 	unsigned int i = 0;
+
+	if (sink) {
+		sink->write(sink, str, strlen(str));
+		return;
+	}
 	while (str[i] != '\0') {
 		/* Check if we need to scroll before printing */
 		if (current_loc >= SCREENSIZE) {
@@ -193,21 +244,17 @@ void kprint_colored(const char *str, unsigned char color)
 }
 
 /* Scroll the screen up by one line */
-void scroll_screen(void)
+__hot void scroll_screen(void)
 {
-	unsigned int i;
 	unsigned int line_size = BYTES_FOR_EACH_ELEMENT * COLUMNS_IN_LINE;
 	
-	/* Copy each line to the line above it */
-	for (i = 0; i < (LINES - 1) * line_size; i++) {
-		vidptr[i] = vidptr[i + line_size];
-	}
+	TRACE(TRACE_SCROLL, 0);
+	
+	/* Move every line up by one */
+	memmove(vidptr, vidptr + line_size, (LINES - 1) * line_size);
 	
 	/* Clear the last line */
-	for (i = (LINES - 1) * line_size; i < LINES * line_size; i += 2) {
-		vidptr[i] = ' ';
-		vidptr[i + 1] = 0x07;
-	}
+	memset32(vidptr + (LINES - 1) * line_size, BLANK_CELLS, line_size / 4);
 	
 	/* Move cursor to start of last line */
 	current_loc = (LINES - 1) * line_size;
@@ -215,9 +262,15 @@ void scroll_screen(void)
 }
 
 /* Print a newline */
-void kprint_newline(void)
+__hot void kprint_newline(void)
 {
 	unsigned int line_size = BYTES_FOR_EACH_ELEMENT * COLUMNS_IN_LINE;
+	OutputSink *sink = output_sink();
+
+	if (sink) {
+		sink->write(sink, "\n", 1);
+		return;
+	}
 	current_loc = current_loc + (line_size - current_loc % (line_size));
 	
 	/* Check if we need to scroll */
@@ -229,8 +282,14 @@ void kprint_newline(void)
 }
 
 /* Print a single character */
-void kprint_char(char c)
+__hot void kprint_char(char c)
 {
+	OutputSink *sink = output_sink();
+
+	if (sink) {
+		sink->write(sink, &c, 1);
+		return;
+	}
 	vidptr[current_loc++] = c;
 	vidptr[current_loc++] = 0x07;
 	update_hardware_cursor();
@@ -302,24 +361,104 @@ void kprint_dec(int num)
 	kprint(buffer);
 }
 
+/* Print a 64-bit unsigned number in decimal (no libgcc 64-bit division) */
+void kprint_dec64(unsigned long long num)
+{
+	char buffer[21];
+	int i = 20;
+	
+	buffer[i] = '\0';
+	do {
+		unsigned long long quotient = 0;
+		unsigned int remainder = 0;
+		int bit;
+		
+		/* Binary long division by 10 */
+		for (bit = 63; bit >= 0; bit--) {
+			remainder = (remainder << 1) | (unsigned int)((num >> bit) & 1);
+			if (remainder >= 10) {
+				remainder -= 10;
+				quotient |= 1ULL << bit;
+			}
+		}
+		buffer[--i] = '0' + remainder;
+		num = quotient;
+	} while (num > 0);
+	
+	kprint(&buffer[i]);
+}
+
 /* Clear the entire screen */
 void clear_screen(void)
 {
-	unsigned int i = 0;
-	while (i < SCREENSIZE) {
-		vidptr[i++] = ' ';
-		vidptr[i++] = 0x07;
-	}
+	memset32(vidptr, BLANK_CELLS, SCREENSIZE / 4);
 	current_loc = 0;
 	update_hardware_cursor();
+}
+
+/* Switch console output to a write-combining mapping of video memory */
+__init void output_init_video(void)
+{
+	char *mapped = (char*)vm_map_device(VGA_TEXT_PHYS, SCREENSIZE, VM_CACHE_WC);
+	if (mapped) {
+		vidptr = mapped;
+	}
+}
+
+/* Write BENCH_FLUSHES full screens through a mapping and time it */
+static unsigned long long time_flushes(volatile unsigned int *screen)
+{
+	unsigned long long start;
+	unsigned int pattern;
+	int n;
+	int i;
+
+	start = cpu_rdtsc();
+	for (n = 0; n < BENCH_FLUSHES; n++) {
+		pattern = 0x07000700 | (('A' + n % 26) << 16) | ('A' + n % 26);
+		for (i = 0; i < SCREENSIZE / 4; i++) {
+			screen[i] = pattern;
+		}
+		/* A locked instruction drains the write-combining buffers */
+		__asm__ volatile("lock; addl $0, (%%esp)" : : : "memory");
+	}
+	return cpu_rdtsc() - start;
+}
+
+/* Console flush benchmark - uncached identity mapping vs the console mapping */
+void output_bench_flush(void)
+{
+	volatile unsigned int *uc_screen = (volatile unsigned int*)VGA_TEXT_PHYS;
+	volatile unsigned int *console_screen = (volatile unsigned int*)vidptr;
+	unsigned int *saved;
+	unsigned long long uc_cycles;
+	unsigned long long console_cycles;
+	int i;
 	
-	/* Initialize output history on first clear */
-	static int history_initialized = 0;
-	if (!history_initialized) {
-		output_history_init(&global_output_history);
-		current_line_pos = 0;
-		current_line_buffer[0] = '\0';
-		history_initialized = 1;
+	saved = (unsigned int*)kmalloc(SCREENSIZE);
+	if (!saved) {
+		kprint("  out of memory\n");
+		return;
+	}
+	for (i = 0; i < SCREENSIZE / 4; i++) {
+		saved[i] = uc_screen[i];
+	}
+	
+	uc_cycles = time_flushes(uc_screen);
+	console_cycles = time_flushes(console_screen);
+	
+	for (i = 0; i < SCREENSIZE / 4; i++) {
+		uc_screen[i] = saved[i];
+	}
+	kfree(saved);
+	
+	bench_report("uncached flush", uc_cycles, BENCH_FLUSHES);
+	if (console_screen == uc_screen) {
+		bench_report("console flush (no device mapping)", console_cycles, BENCH_FLUSHES);
+	} else if (cache_wc_method() == CACHE_WC_NONE) {
+		bench_report("console flush (UC fallback)", console_cycles, BENCH_FLUSHES);
+	} else {
+		bench_report("console flush (write-combining)", console_cycles, BENCH_FLUSHES);
 	}
 }
 
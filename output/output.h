@@ -11,6 +11,9 @@
 #define BYTES_FOR_EACH_ELEMENT 2
 #define SCREENSIZE BYTES_FOR_EACH_ELEMENT * COLUMNS_IN_LINE * LINES
 
+/* Physical address of VGA text memory */
+#define VGA_TEXT_PHYS 0xB8000
+
 /* Special characters - using ASCII values without raw chars */
 #define CHAR_NEWLINE (10)
 
@@ -18,23 +21,38 @@
 #define MAX_OUTPUT_LINES 500
 #define MAX_LINE_LENGTH 256
 
-/* Output history structure */
+/* Output history structure - lines are kmalloc'd to their actual length */
 typedef struct {
-	char lines[MAX_OUTPUT_LINES][MAX_LINE_LENGTH];
+	char *lines[MAX_OUTPUT_LINES];
 	int count;
 	int scroll_offset;  /* Current scroll offset (0 = most recent) */
 } OutputHistory;
 
-/* Output functions */
+/* Somewhere other than the console for a task's output (a pipe, a file) */
+typedef struct OutputSink {
+	int (*write)(struct OutputSink *sink, const char *data, unsigned int length);
+	void *data;
+} OutputSink;
+
+/* Redirect the running task's output; 0 = the console. Returns the old sink */
+OutputSink* output_set_sink(OutputSink *sink);
+
+/* Output functions - all go to the running task's sink if it has one */
+void output_write(const char *str, unsigned int length);
 void kprint(const char *str);
 void kprint_newline(void);
 void kprint_char(char c);
 void kprint_hex(unsigned int num);
 void kprint_dec(int num);
+void kprint_dec64(unsigned long long num);
 void kprint_colored(const char *str, unsigned char color);
 void clear_screen(void);
 void scroll_screen(void);
 
+/* Video memory mapping and benchmark */
+void output_init_video(void);
+void output_bench_flush(void);
+
 /* Cursor management */
 unsigned int get_cursor_position(void);
 void set_cursor_position(unsigned int pos);
@@ -12,10 +12,27 @@ mkfs.fat -F 16 disk.img
 
 cd ..
 
+# initrd/ and the user programs (bin/initrd/) are packed as one ustar
+# archive, mounted read-only at /initrd
+tar --format=ustar -cf run/initrd.tar -C initrd . -C ../bin/initrd .
+
+# --disk boots through NaoBoot from a disk image instead of QEMU's loader;
+# the FAT disk moves to the second drive. The compressed kernel is used
+# unless another is named (./run.sh --disk bin/kernel to compare)
+if [[ "$1" == "--disk" ]]; then
+    tools/mkboot.py -o run/boot.img --initrd run/initrd.tar bin/stage1.bin bin/stage2.bin ${2:-bin/kernelz}
+    echo "Starting NaoKernel from boot image..."
+    qemu-system-i386 -drive file=run/boot.img,format=raw,index=0 -drive file=run/disk.img,format=raw,index=1 -serial file:run/serial.log
+    exit
+fi
+
 echo "Starting NaoKernel with mounted disk image..."
 
-qemu-system-i386 -kernel bin/kernel -hda run/disk.img # -m 512M -boot c -serial stdio
+qemu-system-i386 -kernel bin/kernel -initrd run/initrd.tar -hda run/disk.img -serial file:run/serial.log # -m 512M -boot c
 
 # Small doc
+# -initrd loads a multiboot module (comma-separated for several; cpio newc archives work too)
 # -hda specifies the hard disk image to use
+# -drive file=run/disk.img,format=raw,if=virtio attaches it as a virtio-blk disk (vda) instead
+# -serial file:run/serial.log captures COM1 (e.g. `trace dump serial`)
 # -fda would specify a floppy disk image (-fdb, -hdc, -hdd for additional drives)
\ No newline at end of file
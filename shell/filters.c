@@ -0,0 +1,317 @@
+/*
+ * Filter Commands
+ * grep, wc and head read a file, or the pipe feeding their pipeline
+ * stage. Pipe data is scanned in place in the pipe's pages; only a line
+ * that wraps around the ring (or spans two file reads) is copied.
+ */
+
+#include "shell.h"
+#include "../task/pipe.h"
+#include "../fs/vfs.h"
+#include "../memory/slab.h"
+#include "../output/output.h"
+#include "../lib/string.h"
+
+#define FILTER_CHUNK 4096
+#define FILTER_LINE_LENGTH 1024        /* Longer split lines are cut */
+#define HEAD_DEFAULT_LINES 10
+
+typedef struct {
+	Pipe *pipe;
+	int fd;
+	const char *data;               /* Unscanned part of the current chunk */
+	unsigned int length;
+	unsigned int taken;             /* Pipe bytes to hand back before the next peek */
+	char *buffer;                   /* File reads */
+	char *partial;                  /* A line split across chunks */
+	unsigned int partial_length;
+	unsigned int consumed;          /* Raw bytes scanned, newlines and cut text included */
+} LineReader;
+
+/* Open the file named in args, or take the stage's pipe - 0, or -1 after a message */
+static int reader_open(LineReader *r, const char *file, const char *command)
+{
+	memset(r, 0, sizeof(LineReader));
+	r->fd = -1;
+	if (file && file[0]) {
+		r->fd = vfs_open(file, VFS_O_READ);
+		if (r->fd < 0) {
+			shell_error();
+			kprint(command);
+			kprint(": no such file\n");
+			return -1;
+		}
+	} else {
+		r->pipe = task_current()->input;
+		if (!r->pipe) {
+			shell_error();
+			kprint(command);
+			kprint(": needs a file or a pipe\n");
+			return -1;
+		}
+	}
+	r->partial = (char*)kmalloc(FILTER_LINE_LENGTH + (r->pipe ? 0 : FILTER_CHUNK));
+	if (!r->partial) {
+		if (r->fd >= 0) {
+			vfs_close(r->fd);
+		}
+		shell_error();
+		kprint("Out of memory\n");
+		return -1;
+	}
+	r->buffer = r->partial + FILTER_LINE_LENGTH;
+	return 0;
+}
+
+static void reader_close(LineReader *r)
+{
+	if (r->pipe) {
+		pipe_consume(r->pipe, r->taken);
+	}
+	if (r->fd >= 0) {
+		vfs_close(r->fd);
+	}
+	kfree(r->partial);
+}
+
+static unsigned int reader_fill(LineReader *r)
+{
+	int bytes;
+
+	if (r->pipe) {
+		pipe_consume(r->pipe, r->taken);
+		r->length = pipe_peek(r->pipe, &r->data);
+		r->taken = r->length;
+	} else {
+		bytes = vfs_read(r->fd, r->buffer, FILTER_CHUNK);
+		r->data = r->buffer;
+		r->length = bytes > 0 ? bytes : 0;
+	}
+	return r->length;
+}
+
+/* Next line, without its newline; 0 at the end */
+static const char* reader_next(LineReader *r, unsigned int *length)
+{
+	const char *line;
+	unsigned int n;
+	unsigned int copy;
+
+	r->partial_length = 0;
+	for (;;) {
+		if (r->length == 0 && reader_fill(r) == 0) {
+			*length = r->partial_length;
+			return r->partial_length ? r->partial : 0;
+		}
+		for (n = 0; n < r->length && r->data[n] != '\n'; n++) {
+		}
+
+		/* A whole line in one chunk: hand it out where it is */
+		if (n < r->length && r->partial_length == 0) {
+			r->consumed += n + 1;
+			line = r->data;
+			r->data += n + 1;
+			r->length -= n + 1;
+			*length = n;
+			return line;
+		}
+
+		copy = FILTER_LINE_LENGTH - r->partial_length;
+		if (copy > n) {
+			copy = n;
+		}
+		memcpy(r->partial + r->partial_length, r->data, copy);
+		r->partial_length += copy;
+		if (n < r->length) {
+			r->consumed += n + 1;
+			r->data += n + 1;
+			r->length -= n + 1;
+			*length = r->partial_length;
+			return r->partial;
+		}
+		r->consumed += n;
+		r->length = 0;
+	}
+}
+
+/* Next word of args, which may be in double quotes - 0 if none */
+static char* next_word(char **args)
+{
+	char *word = *args;
+	char end = ' ';
+
+	while (*word == ' ') {
+		word++;
+	}
+	if (*word == '\0') {
+		return 0;
+	}
+	if (*word == '"') {
+		end = '"';
+		word++;
+	}
+	*args = word;
+	while (**args && **args != end) {
+		(*args)++;
+	}
+	if (**args) {
+		*(*args)++ = '\0';
+	}
+	return word;
+}
+
+/* Decimal count, or -1 */
+static int parse_count(const char *text)
+{
+	int value = 0;
+
+	if (*text == '\0') {
+		return -1;
+	}
+	for (; *text; text++) {
+		if (*text < '0' || *text > '9' || value > 100000000) {
+			return -1;
+		}
+		value = value * 10 + (*text - '0');
+	}
+	return value;
+}
+
+static int contains(const char *line, unsigned int length, const char *pattern, unsigned int pattern_length)
+{
+	unsigned int i;
+
+	if (pattern_length > length) {
+		return 0;
+	}
+	for (i = 0; i + pattern_length <= length; i++) {
+		if (line[i] == pattern[0] && memcmp(line + i, pattern, pattern_length) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Grep command - print lines containing a string; -v inverts, -c counts */
+void cmd_grep(char *args)
+{
+	LineReader reader;
+	const char *line;
+	char *pattern;
+	char *word;
+	unsigned int pattern_length;
+	unsigned int length;
+	unsigned int matches = 0;
+	int invert = 0;
+	int count = 0;
+
+	while ((word = next_word(&args)) != 0 && word[0] == '-' && word[1]) {
+		if (strcmp(word, "-v") == 0) {
+			invert = 1;
+		} else if (strcmp(word, "-c") == 0) {
+			count = 1;
+		} else {
+			word = 0;
+			break;
+		}
+	}
+	pattern = word;
+	if (!pattern) {
+		shell_error();
+		kprint("Usage: grep [-v] [-c] <pattern> [file]\n");
+		return;
+	}
+	pattern_length = strlen(pattern);
+	if (reader_open(&reader, next_word(&args), "grep") != 0) {
+		return;
+	}
+
+	while ((line = reader_next(&reader, &length)) != 0) {
+		if (contains(line, length, pattern, pattern_length) != invert) {
+			matches++;
+			if (!count) {
+				output_write(line, length);
+				kprint_newline();
+			}
+		}
+	}
+	reader_close(&reader);
+
+	if (count) {
+		kprint_dec(matches);
+		kprint_newline();
+	}
+	if (matches == 0) {
+		shell_error();
+	}
+}
+
+/* Wc command - lines, words and bytes */
+void cmd_wc(char *args)
+{
+	LineReader reader;
+	const char *line;
+	unsigned int length;
+	unsigned int lines = 0;
+	unsigned int words = 0;
+	unsigned int bytes;
+	unsigned int i;
+	int in_word;
+
+	if (reader_open(&reader, next_word(&args), "wc") != 0) {
+		return;
+	}
+	while ((line = reader_next(&reader, &length)) != 0) {
+		lines++;
+		in_word = 0;
+		for (i = 0; i < length; i++) {
+			if (line[i] == ' ' || line[i] == '\t') {
+				in_word = 0;
+			} else if (!in_word) {
+				in_word = 1;
+				words++;
+			}
+		}
+	}
+	bytes = reader.consumed;
+	reader_close(&reader);
+
+	kprint_dec(lines);
+	kprint(" ");
+	kprint_dec(words);
+	kprint(" ");
+	kprint_dec(bytes);
+	kprint_newline();
+}
+
+/* Head command - first lines; stops reading early, so upstream output is dropped */
+void cmd_head(char *args)
+{
+	LineReader reader;
+	const char *line;
+	char *word = next_word(&args);
+	unsigned int length;
+	int lines = HEAD_DEFAULT_LINES;
+
+	if (word && strcmp(word, "-n") == 0) {
+		word = next_word(&args);
+		lines = word ? parse_count(word) : -1;
+		word = next_word(&args);
+	} else if (word && word[0] == '-' && word[1] >= '0' && word[1] <= '9') {
+		lines = parse_count(word + 1);
+		word = next_word(&args);
+	}
+	if (lines < 0) {
+		shell_error();
+		kprint("Usage: head [-n N] [file]\n");
+		return;
+	}
+	if (reader_open(&reader, word, "head") != 0) {
+		return;
+	}
+	while (lines-- > 0 && (line = reader_next(&reader, &length)) != 0) {
+		output_write(line, length);
+		kprint_newline();
+	}
+	reader_close(&reader);
+}
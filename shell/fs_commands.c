@@ -0,0 +1,252 @@
+/*
+ * Filesystem Commands
+ * ls, cat, cd, pwd, cp, rm and mkdir on the VFS namespace, plus mount
+ * and vfsstat to look at the mount table and the dentry cache.
+ */
+
+#include "shell.h"
+#include "../fs/vfs.h"
+#include "../memory/slab.h"
+#include "../output/output.h"
+#include "../lib/string.h"
+
+#define FS_COPY_CHUNK (64 * 1024)
+
+/* Split "a b" into "a" and "b" - returns the second word or 0 */
+static char* fs_split(char *args)
+{
+	char *space = strchr(args, ' ');
+
+	if (!space) {
+		return 0;
+	}
+	*space++ = '\0';
+	while (*space == ' ') {
+		space++;
+	}
+	return *space ? space : 0;
+}
+
+/* Last component of a path */
+static const char* fs_basename(const char *path)
+{
+	const char *name = path;
+
+	for (; *path; path++) {
+		if (*path == '/' && path[1] && path[1] != '/') {
+			name = path + 1;
+		}
+	}
+	return name;
+}
+
+static void fs_print_entry(const char *name, int type, unsigned int size)
+{
+	int pad = 16 - strlen(name);
+
+	kprint("  ");
+	kprint(name);
+	if (type == VFS_DIR) {
+		kprint("/");
+		pad--;
+	}
+	while (pad-- > 0) {
+		kprint_char(' ');
+	}
+	if (type == VFS_DIR) {
+		kprint("<DIR>\n");
+	} else {
+		kprint_dec(size);
+		kprint_newline();
+	}
+}
+
+/* Ls command - list a directory (default: the current one) */
+void cmd_ls(char *args)
+{
+	const char *path = args[0] ? args : ".";
+	VfsStat st;
+	VfsDirent entry;
+	int count = 0;
+	int fd;
+
+	if (vfs_stat(path, &st) != 0) {
+		shell_error();
+		kprint("No such file or directory\n");
+		return;
+	}
+	if (st.type != VFS_DIR) {
+		fs_print_entry(fs_basename(path), st.type, st.size);
+		return;
+	}
+	fd = vfs_open(path, VFS_O_READ);
+	if (fd < 0) {
+		shell_error();
+		kprint("Cannot open directory\n");
+		return;
+	}
+	while (vfs_readdir(fd, &entry) == 0) {
+		fs_print_entry(entry.name, entry.type, entry.size);
+		count++;
+	}
+	vfs_close(fd);
+	if (count == 0) {
+		kprint("(empty)\n");
+	}
+}
+
+/* Cat command - print a file */
+void cmd_cat(char *args)
+{
+	char buffer[512];
+	int bytes;
+	int fd;
+	int i;
+
+	if (args[0] == '\0') {
+		shell_error();
+		kprint("Usage: cat <file>\n");
+		return;
+	}
+	fd = vfs_open(args, VFS_O_READ);
+	if (fd < 0) {
+		shell_error();
+		kprint("No such file\n");
+		return;
+	}
+	while ((bytes = vfs_read(fd, buffer, sizeof(buffer))) > 0) {
+		for (i = 0; i < bytes; i++) {
+			if (buffer[i] == '\n' || buffer[i] == '\t' || (buffer[i] >= 32 && buffer[i] < 127)) {
+				kprint_char(buffer[i]);
+			}
+		}
+	}
+	vfs_close(fd);
+	kprint_newline();
+}
+
+/* Cd command - change the current directory (default: the root) */
+void cmd_cd(char *args)
+{
+	if (vfs_chdir(args[0] ? args : "/") != 0) {
+		shell_error();
+		kprint("No such directory\n");
+	}
+}
+
+/* Pwd command - print the current directory */
+void cmd_pwd(void)
+{
+	char path[VFS_PATH_LENGTH];
+
+	vfs_getcwd(path, sizeof(path));
+	kprint(path);
+	kprint_newline();
+}
+
+/* Cp command - copy a file; the destination may be a directory */
+void cmd_cp(char *args)
+{
+	char target[VFS_PATH_LENGTH];
+	char *dest = fs_split(args);
+	VfsStat from;
+	VfsStat to;
+	char *buffer;
+	int in;
+	int out;
+	int bytes;
+
+	if (!dest) {
+		shell_error();
+		kprint("Usage: cp <source> <destination>\n");
+		return;
+	}
+	if (vfs_stat(args, &from) != 0 || from.type != VFS_FILE) {
+		shell_error();
+		kprint("No such file\n");
+		return;
+	}
+
+	/* Into a directory: keep the source name */
+	if (vfs_stat(dest, &to) == 0 && to.type == VFS_DIR) {
+		if (strlen(dest) + strlen(fs_basename(args)) + 2 > VFS_PATH_LENGTH) {
+			shell_error();
+			kprint("Path too long\n");
+			return;
+		}
+		strcpy(target, dest);
+		target[strlen(dest)] = '/';
+		strcpy(target + strlen(dest) + 1, fs_basename(args));
+		dest = target;
+	}
+	if (vfs_stat(dest, &to) == 0 && to.dev == from.dev && to.ino == from.ino) {
+		shell_error();
+		kprint("Source and destination are the same file\n");
+		return;
+	}
+
+	in = vfs_open(args, VFS_O_READ);
+	out = vfs_open(dest, VFS_O_WRITE | VFS_O_CREATE | VFS_O_TRUNC);
+	buffer = (char*)kmalloc(FS_COPY_CHUNK);
+	if (in < 0 || out < 0 || !buffer) {
+		shell_error();
+		kprint("Cannot create ");
+		kprint(dest);
+		kprint_newline();
+	} else {
+		while ((bytes = vfs_read(in, buffer, FS_COPY_CHUNK)) > 0) {
+			if (vfs_write(out, buffer, bytes) != bytes) {
+				shell_error();
+				kprint("Disk full\n");
+				break;
+			}
+		}
+	}
+	kfree(buffer);
+	vfs_close(in);
+	vfs_close(out);
+}
+
+/* Rm command - delete a file or an empty directory */
+void cmd_rm(char *args)
+{
+	if (args[0] == '\0') {
+		shell_error();
+		kprint("Usage: rm <path>\n");
+		return;
+	}
+	if (vfs_unlink(args) != 0) {
+		shell_error();
+		kprint("Cannot remove ");
+		kprint(args);
+		kprint(" (missing, busy, or a non-empty directory)\n");
+	}
+}
+
+/* Mkdir command - make a directory */
+void cmd_mkdir(char *args)
+{
+	if (args[0] == '\0') {
+		shell_error();
+		kprint("Usage: mkdir <path>\n");
+		return;
+	}
+	if (vfs_mkdir(args) != 0) {
+		shell_error();
+		kprint("Cannot create ");
+		kprint(args);
+		kprint_newline();
+	}
+}
+
+/* Mount command - show the mount table */
+void cmd_mount(void)
+{
+	vfs_print_mounts();
+}
+
+/* Vfsstat command - dentry cache usage and lookup hit rate */
+void cmd_vfsstat(void)
+{
+	vfs_print_stats();
+}
@@ -0,0 +1,252 @@
+/*
+ * Pipelines and Redirection
+ * "a | b | c > file": every stage but the last runs as its own task,
+ * writing through its task's output sink into a pipe that the next
+ * stage reads; the last stage runs in the calling task, its output
+ * going to the console or to the redirection target. Operators inside
+ * double quotes are left alone.
+ */
+
+#include "shell.h"
+#include "../task/pipe.h"
+#include "../cpu/cpu.h"
+#include "../fs/vfs.h"
+#include "../output/output.h"
+#include "../memory/slab.h"
+#include "../memory/page.h"
+#include "../lib/string.h"
+
+#define PIPELINE_MAX_STAGES 8
+
+typedef struct {
+	char *command;
+	Pipe *input;
+	Pipe *output;
+	int found;
+	int done;
+} Stage;
+
+/* Redirection target; output collects in a page so FAT sees few writes */
+typedef struct {
+	int fd;
+	char *buffer;                   /* 0 = write through */
+	unsigned int length;
+} FileSink;
+
+static WaitQueue stage_exits = WAIT_QUEUE_INIT;
+
+/* First c outside double quotes, or 0 */
+static char* find_unquoted(char *line, char c)
+{
+	int quoted = 0;
+
+	for (; *line; line++) {
+		if (*line == '"') {
+			quoted = !quoted;
+		} else if (*line == c && !quoted) {
+			return line;
+		}
+	}
+	return 0;
+}
+
+int pipeline_needed(char *line)
+{
+	return find_unquoted(line, '|') || find_unquoted(line, '>');
+}
+
+/* Strip spaces from both ends, in place */
+static char* trim(char *text)
+{
+	char *end;
+
+	while (*text == ' ' || *text == '\t') {
+		text++;
+	}
+	end = text + strlen(text);
+	while (end > text && (end[-1] == ' ' || end[-1] == '\t')) {
+		*--end = '\0';
+	}
+	return text;
+}
+
+static int file_sink_flush(FileSink *file)
+{
+	unsigned int length = file->length;
+
+	file->length = 0;
+	if (length > 0 && vfs_write(file->fd, file->buffer, length) != (int)length) {
+		return -1;
+	}
+	return 0;
+}
+
+static int file_sink_write(OutputSink *sink, const char *data, unsigned int length)
+{
+	FileSink *file = (FileSink*)sink->data;
+
+	if (file->length + length > PAGE_SIZE && file_sink_flush(file) != 0) {
+		return -1;
+	}
+	if (!file->buffer || length > PAGE_SIZE) {
+		return vfs_write(file->fd, data, length);
+	}
+	memcpy(file->buffer + file->length, data, length);
+	file->length += length;
+	return (int)length;
+}
+
+static void stage_task(void *arg)
+{
+	Stage *stage = (Stage*)arg;
+	Task *self = task_current();
+
+	self->sink = &stage->output->sink;
+	self->input = stage->input;
+	stage->found = shell_execute_single(stage->command);
+	self->sink = 0;
+	self->input = 0;
+
+	if (stage->input) {
+		pipe_close_read(stage->input);
+	}
+	pipe_close_write(stage->output);
+	stage->done = 1;
+	wait_queue_wake_all(&stage_exits);
+}
+
+/* Split line in place into stages and run them */
+static int pipeline_exec(char *line)
+{
+	Stage stages[PIPELINE_MAX_STAGES];
+	OutputSink file_sink;
+	FileSink file;
+	OutputSink *old_sink;
+	Pipe *old_input;
+	Task *self = task_current();
+	char *redirect = find_unquoted(line, '>');
+	char *target = 0;
+	char *next;
+	int flags = VFS_O_WRITE | VFS_O_CREATE | VFS_O_TRUNC;
+	int count = 0;
+	int created;
+	int found = 1;
+	int failed = 1;
+	unsigned long irq_flags;
+	int i;
+
+	if (redirect) {
+		*redirect++ = '\0';
+		if (*redirect == '>') {
+			redirect++;
+			flags = VFS_O_WRITE | VFS_O_CREATE | VFS_O_APPEND;
+		}
+		target = trim(redirect);
+	}
+
+	memset(stages, 0, sizeof(stages));
+	for (; line && count < PIPELINE_MAX_STAGES; line = next) {
+		next = find_unquoted(line, '|');
+		if (next) {
+			*next++ = '\0';
+		}
+		stages[count].command = trim(line);
+		if (stages[count++].command[0] == '\0') {
+			break;
+		}
+	}
+	if (line || stages[count - 1].command[0] == '\0' ||
+	    (target && (target[0] == '\0' || find_unquoted(target, '>') || find_unquoted(target, '|')))) {
+		shell_error();
+		kprint("Syntax error in pipeline or redirection\n");
+		return 0;
+	}
+
+	file.fd = -1;
+	if (target) {
+		file.fd = vfs_open(target, flags);
+		if (file.fd < 0) {
+			shell_error();
+			kprint("Cannot write ");
+			kprint(target);
+			kprint_newline();
+			return 0;
+		}
+		file.buffer = (char*)page_alloc();
+		file.length = 0;
+		file_sink.write = file_sink_write;
+		file_sink.data = &file;
+	}
+
+	/* Every stage but the last becomes a task feeding a pipe */
+	for (created = 0; created < count - 1; created++) {
+		stages[created].output = pipe_create();
+		stages[created + 1].input = stages[created].output;
+		if (!stages[created].output || !task_create("pipe", stage_task, &stages[created])) {
+			break;
+		}
+	}
+
+	if (created < count - 1) {
+		/* The stage that failed never reads, so its writer drains */
+		if (created > 0) {
+			pipe_close_read(stages[created - 1].output);
+		}
+		kprint("Out of memory for pipeline\n");
+		found = 0;
+	} else {
+		old_sink = self->sink;
+		old_input = self->input;
+		if (target) {
+			output_set_sink(&file_sink);
+		}
+		self->input = stages[count - 1].input;
+		found = shell_execute_single(stages[count - 1].command);
+		failed = shell_last_status();
+		self->input = old_input;
+		output_set_sink(old_sink);
+		if (stages[count - 1].input) {
+			pipe_close_read(stages[count - 1].input);
+		}
+	}
+
+	irq_flags = irq_save();
+	for (i = 0; i < created; i++) {
+		while (!stages[i].done) {
+			wait_queue_sleep(&stage_exits);
+		}
+		found = found && stages[i].found;
+	}
+	irq_restore(irq_flags);
+
+	for (i = 0; i < count; i++) {
+		pipe_destroy(stages[i].output);
+	}
+	if (file.fd >= 0) {
+		if (file.buffer) {
+			file_sink_flush(&file);
+			page_free(file.buffer);
+		}
+		vfs_close(file.fd);
+	}
+	shell_set_status(failed);
+	return found;
+}
+
+/* Run a line with '|', '>' or '>>' - returns 1 if every command exists */
+int pipeline_run(char *line)
+{
+	/* Parse a copy: the caller still needs the line, e.g. for history */
+	char *copy = (char*)kmalloc(strlen(line) + 1);
+	int found;
+
+	if (!copy) {
+		shell_error();
+		kprint("Out of memory for pipeline\n");
+		return 0;
+	}
+	strcpy(copy, line);
+	found = pipeline_exec(copy);
+	kfree(copy);
+	return found;
+}
@@ -0,0 +1,194 @@
+/*
+ * Shell Scripts
+ * A script is read whole and split into lines in place, in one pass;
+ * each line goes straight to shell_execute_command() - no keyboard echo,
+ * no history. Lines starting with '#' are comments. `set -e` stops a
+ * script at the first failing command, `set -x` prints each command
+ * before it runs, and `source` runs another script.
+ */
+
+#include "shell.h"
+#include "../fs/vfs.h"
+#include "../boot/multiboot.h"
+#include "../memory/slab.h"
+#include "../output/output.h"
+#include "../lib/string.h"
+
+#define SCRIPT_OPT_ERREXIT 0x01
+#define SCRIPT_OPT_XTRACE 0x02
+
+static int options = 0;
+static int depth = 0;
+
+/* Run the lines of text, which is modified - 0, or -1 if set -e stopped it */
+int script_run(char *text, const char *name)
+{
+	char *line = text;
+	char *end;
+	char *next;
+	unsigned int number = 0;
+	unsigned int mark;
+	int saved = options;
+	int result = 0;
+
+	if (depth == SCRIPT_MAX_DEPTH) {
+		kprint("source: nested too deeply\n");
+		return -1;
+	}
+	depth++;
+	while (*line) {
+		for (end = line; *end && *end != '\n'; end++) {
+		}
+		next = *end ? end + 1 : end;
+		if (end > line && end[-1] == '\r') {
+			end--;
+		}
+		*end = '\0';
+		number++;
+
+		while (*line == ' ' || *line == '\t') {
+			line++;
+		}
+		if (*line && *line != '#') {
+			if (options & SCRIPT_OPT_XTRACE) {
+				kprint("+ ");
+				kprint(line);
+				kprint_newline();
+			}
+			/* Free the line's scratch only: the caller's (e.g. `time`) stays */
+			mark = shell_arena()->used;
+			shell_execute_command(line);
+			arena_release(shell_arena(), mark);
+			if (shell_last_status() != 0 && (options & SCRIPT_OPT_ERREXIT)) {
+				kprint(name);
+				kprint(":");
+				kprint_dec(number);
+				kprint(": command failed, stopping (set -e)\n");
+				result = -1;
+				break;
+			}
+		}
+		line = next;
+	}
+
+	/* Options set by a script and what it sources end with it */
+	if (--depth == 0) {
+		options = saved;
+	}
+	return result;
+}
+
+/* Read a whole file and run it */
+int script_run_file(const char *path)
+{
+	VfsStat st;
+	char *text;
+	unsigned int total = 0;
+	int bytes = 0;
+	int result;
+	int fd;
+
+	if (vfs_stat(path, &st) != 0 || st.type != VFS_FILE || (fd = vfs_open(path, VFS_O_READ)) < 0) {
+		kprint("source: cannot read ");
+		kprint(path);
+		kprint_newline();
+		return -1;
+	}
+	text = (char*)kmalloc(st.size + 1);
+	if (!text) {
+		vfs_close(fd);
+		kprint("source: out of memory\n");
+		return -1;
+	}
+	while (total < st.size && (bytes = vfs_read(fd, text + total, st.size - total)) > 0) {
+		total += bytes;
+	}
+	vfs_close(fd);
+	text[total] = '\0';
+
+	result = script_run(text, path);
+	kfree(text);
+	return result;
+}
+
+/*
+ * Before the first prompt: run the boot script, then the kernel command
+ * line's run= commands. rc=<file> picks another boot script, rc=none
+ * skips it; run= takes the rest of the line, commands split by ';'.
+ */
+void script_run_boot(void)
+{
+	static char cmdline[MULTIBOOT_CMDLINE_LENGTH];
+	char rc[VFS_PATH_LENGTH];
+	char *word = cmdline;
+	char *commands = 0;
+	char *end;
+	char *p;
+	unsigned int length;
+	VfsStat st;
+
+	strcpy(rc, SCRIPT_BOOT_FILE);
+	strlcpy(cmdline, multiboot_cmdline(), sizeof(cmdline));
+	while (*word) {
+		while (*word == ' ') {
+			word++;
+		}
+		if (strncmp(word, "run=", 4) == 0) {
+			commands = word + 4;
+			break;
+		}
+		for (end = word; *end && *end != ' '; end++) {
+		}
+		length = end - word;
+		if (strncmp(word, "rc=", 3) == 0 && length - 3 < sizeof(rc)) {
+			memcpy(rc, word + 3, length - 3);
+			rc[length - 3] = '\0';
+		}
+		word = end;
+	}
+
+	if (strcmp(rc, "none") != 0 && vfs_stat(rc, &st) == 0) {
+		script_run_file(rc);
+	}
+	if (commands) {
+		for (p = commands; *p; p++) {
+			if (*p == ';') {
+				*p = '\n';
+			}
+		}
+		script_run(commands, "cmdline");
+	}
+}
+
+/* Source command - run a script */
+void cmd_source(char *args)
+{
+	if (args[0] == '\0') {
+		shell_error();
+		kprint("Usage: source <file>\n");
+		return;
+	}
+	if (script_run_file(args) != 0) {
+		shell_error();
+	}
+}
+
+/* Set command - script options; no argument shows them */
+void cmd_set(char *args)
+{
+	if (strcmp(args, "-e") == 0) {
+		options |= SCRIPT_OPT_ERREXIT;
+	} else if (strcmp(args, "+e") == 0) {
+		options &= ~SCRIPT_OPT_ERREXIT;
+	} else if (strcmp(args, "-x") == 0) {
+		options |= SCRIPT_OPT_XTRACE;
+	} else if (strcmp(args, "+x") == 0) {
+		options &= ~SCRIPT_OPT_XTRACE;
+	} else if (args[0] == '\0') {
+		kprint((options & SCRIPT_OPT_ERREXIT) ? "set -e\n" : "set +e\n");
+		kprint((options & SCRIPT_OPT_XTRACE) ? "set -x\n" : "set +x\n");
+	} else {
+		shell_error();
+		kprint("Usage: set [-e|+e|-x|+x]\n");
+	}
+}
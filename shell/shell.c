@@ -6,11 +6,33 @@
 #include "../input/input.h"
 #include "../output/output.h"
 #include "../essentials/types.h"
+#include "../memory/slab.h"
+#include "../memory/paging.h"
+#include "../bench/bench.h"
+#include "../lib/string.h"
+#include "../cpu/cpu.h"
+#include "../task/task.h"
+#include "../task/softirq.h"
+#include "../task/exec.h"
+#include "../debug/trace.h"
+#include "../debug/prof.h"
+#include "../debug/bootlog.h"
+#include "../block/block.h"
+#include "../block/bcache.h"
+#include "../drivers/ata.h"
+#include "../drivers/pci.h"
+#include "../drivers/virtio_blk.h"
+#include "../fs/fat.h"
+#include "../fs/vfs.h"
+#include "../boot/multiboot.h"
+#include "shell.h"
 
 /* Shell state */
 static InputBuffer input;
-static CommandHistory history;
+/* Starts empty with no entry selected - no history_init() at boot */
+static CommandHistory history = { {0}, {0}, 0, -1 };
 static int shell_running = 1;
+static Arena scratch_arena;
 
 /* Command function pointer types */
 typedef void (*CommandFunc)(void);
@@ -50,11 +72,15 @@ void cmd_clear(void)
 	clear_screen();
 }
 
-/* Echo command - print arguments */
+/* Echo command - print arguments, without one pair of enclosing quotes */
 void cmd_echo(char *args)
 {
-	if (args[0] != '\0') {
-		kprint(args);
+	unsigned int length = strlen(args);
+
+	if (length >= 2 && args[0] == '"' && args[length - 1] == '"') {
+		output_write(args + 1, length - 2);
+	} else {
+		output_write(args, length);
 	}
 	kprint_newline();
 }
@@ -88,12 +114,14 @@ void cmd_history(void)
 	kprint("Command History:\n");
 	int i;
 	for (i = 0; i < history.count; i++) {
-		char num_str[16];
+		char *num_str = (char*)arena_alloc(&scratch_arena, 16);
 		int num = i + 1;
 		int len = 0;
 		int temp = num;
 
-		// Add additional spacing for alignment
+		if (!num_str) {
+			break;
+		}
 		
 		/* Convert number to string */
 		if (temp == 0) {
@@ -128,6 +156,174 @@ void cmd_history(void)
 	}
 }
 
+/* Slabinfo command - show kernel heap statistics */
+void cmd_slabinfo(void)
+{
+	slab_print_info();
+}
+
+/* Vmmap command - show the virtual memory layout */
+void cmd_vmmap(void)
+{
+	paging_print_map();
+}
+
+/* Ps command - list kernel tasks */
+void cmd_ps(void)
+{
+	task_print_list();
+}
+
+/* Trace command - control the kernel event trace */
+void cmd_trace(char *args)
+{
+	if (strcmp(args, "start") == 0) {
+		trace_start();
+	} else if (strcmp(args, "stop") == 0) {
+		trace_stop();
+	} else if (strcmp(args, "clear") == 0) {
+		trace_clear();
+	} else if (strcmp(args, "dump") == 0) {
+		trace_dump();
+	} else if (strcmp(args, "dump serial") == 0) {
+		trace_dump_serial();
+	} else {
+		shell_error();
+		kprint("Usage: trace <start|stop|clear|dump [serial]>\n");
+		kprint("Tracing is ");
+		kprint(trace_enabled ? "on\n" : "off\n");
+	}
+}
+
+/* Prof command - sampling profiler */
+void cmd_prof(char *args)
+{
+	if (strcmp(args, "start") == 0) {
+		if (prof_start() != 0) {
+			kprint("Profiler unavailable (no symbol table or memory)\n");
+		}
+	} else if (strcmp(args, "stop") == 0) {
+		prof_stop();
+	} else if (strcmp(args, "clear") == 0) {
+		prof_clear();
+	} else if (strcmp(args, "order") == 0) {
+		prof_dump_order();
+	} else if (args[0] == '\0') {
+		prof_report();
+	} else {
+		shell_error();
+		kprint("Usage: prof [start|stop|clear|order]\n");
+	}
+}
+
+/* Softirq command - deferred work counters */
+void cmd_softirq(void)
+{
+	softirq_print_stats();
+}
+
+/* Lsblk command - list disks */
+void cmd_lsblk(void)
+{
+	block_print_devices();
+	ata_print_drives();
+	virtio_blk_print();
+	fat_print_volumes();
+}
+
+/* Cachestat command - block cache hit rate and read-ahead efficiency */
+void cmd_cachestat(void)
+{
+	bcache_print_stats();
+}
+
+/* Sync command - write dirty cached blocks back to disk */
+void cmd_sync(void)
+{
+	if (bcache_sync(0) != 0) {
+		shell_error();
+		kprint("Write-back failed\n");
+	}
+}
+
+/* Diskbench command - disk read throughput */
+void cmd_diskbench(char *args)
+{
+	BlockDevice *dev = args[0] ? block_find(args) : block_get(0);
+
+	if (!dev) {
+		shell_error();
+		kprint("No such disk (see lsblk)\n");
+		return;
+	}
+	/* ATA disks compare PIO with DMA */
+	if (ata_bench(dev) != 0) {
+		block_bench(dev);
+	}
+}
+
+/* Lspci command - list PCI devices */
+void cmd_lspci(void)
+{
+	pci_print_devices();
+}
+
+/* Bootlog command - boot phase timings */
+void cmd_bootlog(void)
+{
+	bootlog_print();
+}
+
+/* Bootinfo command - boot loader, command line and modules */
+void cmd_bootinfo(void)
+{
+	multiboot_print();
+}
+
+/* Bench command - run in-kernel benchmarks */
+void cmd_bench(char *args)
+{
+	if (args[0] == '\0') {
+		bench_list();
+		return;
+	}
+	if (bench_run(args) != 0) {
+		shell_error();
+		kprint("Unknown benchmark: ");
+		kprint(args);
+		kprint_newline();
+	}
+}
+
+/* Time command - run a command and report cycles and scratch usage */
+void cmd_time(char *args)
+{
+	unsigned int overflows;
+	unsigned long long start;
+	unsigned long long cycles;
+	
+	if (args[0] == '\0') {
+		shell_error();
+		kprint("Usage: time <command>\n");
+		return;
+	}
+	
+	overflows = scratch_arena.overflows;
+	start = cpu_rdtsc();
+	shell_execute_command(args);
+	cycles = cpu_rdtsc() - start;
+	
+	kprint("cycles: ");
+	kprint_dec64(cycles);
+	kprint("  arena peak: ");
+	kprint_dec(scratch_arena.peak);
+	kprint(" of ");
+	kprint_dec(scratch_arena.size);
+	kprint(" bytes  overflows: ");
+	kprint_dec(scratch_arena.overflows - overflows);
+	kprint_newline();
+}
+
 /* Command map - array of all available commands */
 static Command command_map[] = {
 	{"help", (void*)cmd_help, 0, "Show available commands"},
@@ -137,6 +333,35 @@ static Command command_map[] = {
 	{"exit", (void*)cmd_exit, 0, "Shutdown the system"},
 	{"test", (void*)cmd_test, 0, "Run a test command"},
 	{"history", (void*)cmd_history, 0, "Show command history"},
+	{"slabinfo", (void*)cmd_slabinfo, 0, "Show kernel heap statistics"},
+	{"time", (void*)cmd_time, 1, "Time a command"},
+	{"grep", (void*)cmd_grep, 1, "Lines containing a pattern (grep [-v] [-c] <pattern> [file])"},
+	{"wc", (void*)cmd_wc, 1, "Count lines, words and bytes (wc [file])"},
+	{"head", (void*)cmd_head, 1, "First lines (head [-n N] [file])"},
+	{"source", (void*)cmd_source, 1, "Run a script (source <file>)"},
+	{"set", (void*)cmd_set, 1, "Script options (set [-e|+e|-x|+x])"},
+	{"vmmap", (void*)cmd_vmmap, 0, "Show the virtual memory layout"},
+	{"bench", (void*)cmd_bench, 1, "Run benchmarks (bench <name|all>)"},
+	{"ps", (void*)cmd_ps, 0, "List kernel tasks"},
+	{"lspci", (void*)cmd_lspci, 0, "List PCI devices"},
+	{"lsblk", (void*)cmd_lsblk, 0, "List disks"},
+	{"ls", (void*)cmd_ls, 1, "List a directory (ls [path])"},
+	{"cat", (void*)cmd_cat, 1, "Print a file (cat <file>)"},
+	{"cd", (void*)cmd_cd, 1, "Change directory (cd [path])"},
+	{"pwd", (void*)cmd_pwd, 0, "Print the current directory"},
+	{"cp", (void*)cmd_cp, 1, "Copy a file (cp <source> <destination>)"},
+	{"rm", (void*)cmd_rm, 1, "Delete a file or empty directory (rm <path>)"},
+	{"mkdir", (void*)cmd_mkdir, 1, "Make a directory (mkdir <path>)"},
+	{"mount", (void*)cmd_mount, 0, "Show mounted filesystems"},
+	{"vfsstat", (void*)cmd_vfsstat, 0, "Show dentry cache hit rate"},
+	{"cachestat", (void*)cmd_cachestat, 0, "Show block cache statistics"},
+	{"sync", (void*)cmd_sync, 0, "Write cached disk changes back"},
+	{"diskbench", (void*)cmd_diskbench, 1, "Disk read throughput (diskbench [disk])"},
+	{"softirq", (void*)cmd_softirq, 0, "Show deferred work counters"},
+	{"bootlog", (void*)cmd_bootlog, 0, "Show boot phase timings"},
+	{"bootinfo", (void*)cmd_bootinfo, 0, "Show boot command line and modules"},
+	{"prof", (void*)cmd_prof, 1, "Sampling profiler (prof [start|stop|clear|order])"},
+	{"trace", (void*)cmd_trace, 1, "Kernel event trace (start|stop|clear|dump [serial])"},
 	{0, 0, 0, 0}  /* Sentinel entry */
 };
 
@@ -158,16 +383,6 @@ static char* find_space(char *str)
 	return str;
 }
 
-/* Calculate string length */
-static int strlen_custom(const char *str)
-{
-	int len = 0;
-	while (str[len] != '\0') {
-		len++;
-	}
-	return len;
-}
-
 /* Convert character to lowercase */
 static char to_lower(char c)
 {
@@ -191,8 +406,26 @@ static int strncmp_case_insensitive(const char *s1, const char *s2, int n)
 	return 0;
 }
 
-/* Parse and execute shell commands - returns 1 if command found, 0 if not */
-int shell_execute_command(char *command)
+/* Run a program for a name that is not built in - returns 1 if there was one */
+static int shell_run_program(const char *name, int length, const char *args)
+{
+	char program[VFS_PATH_LENGTH];
+	int status;
+
+	if (length >= VFS_PATH_LENGTH) {
+		return 0;
+	}
+	memcpy(program, name, length);
+	program[length] = '\0';
+	if (exec_command(program, args, &status) != 0) {
+		return 0;
+	}
+	task_current()->command_failed = status != 0;
+	return 1;
+}
+
+/* Parse and execute one command - returns 1 if command found, 0 if not */
+int shell_execute_single(char *command)
 {
 	char *cmd_start;
 	char *cmd_end;
@@ -217,12 +450,13 @@ int shell_execute_command(char *command)
 	args = skip_spaces(cmd_end);
 	
 	/* Search through command map */
+	task_current()->command_failed = 0;
 	for (i = 0; command_map[i].name != 0; i++) {
 		cmd = &command_map[i];
 		
 		/* Check if command name matches (case-insensitive) */
 		if (strncmp_case_insensitive(cmd_start, cmd->name, cmd_len) == 0 && 
-		    strlen_custom(cmd->name) == cmd_len) {
+		    (int)strlen(cmd->name) == cmd_len) {
 			
 			/* Execute command based on whether it takes arguments */
 			if (cmd->takes_argument) {
@@ -236,7 +470,13 @@ int shell_execute_command(char *command)
 		}
 	}
 	
+	/* Not built in - a program in EXEC_PATH or at a path */
+	if (shell_run_program(cmd_start, cmd_len, args)) {
+		return 1;
+	}
+
 	/* Unknown command - print just the command name */
+	task_current()->command_failed = 1;
 	kprint("Unknown command: ");
 	/* Temporarily null-terminate command for printing */
 	char temp = *cmd_end;
@@ -248,6 +488,44 @@ int shell_execute_command(char *command)
 	return 0;  /* Command not found */
 }
 
+/* Execute a command line - returns 1 if the command exists */
+int shell_execute_command(char *command)
+{
+	int result;
+	
+	TRACE(TRACE_COMMAND_BEGIN, 0);
+	if (pipeline_needed(command)) {
+		result = pipeline_run(command);
+	} else {
+		result = shell_execute_single(command);
+	}
+	TRACE(TRACE_COMMAND_END, result);
+	return result;
+}
+
+/* Mark the running command as failed */
+void shell_error(void)
+{
+	task_current()->command_failed = 1;
+}
+
+void shell_set_status(int failed)
+{
+	task_current()->command_failed = failed;
+}
+
+/* 0 if the last command succeeded */
+int shell_last_status(void)
+{
+	return task_current()->command_failed;
+}
+
+/* Get the scratch arena for the running command */
+Arena* shell_arena(void)
+{
+	return &scratch_arena;
+}
+
 /* Shell main loop */
 void nano_shell(void)
 {
@@ -259,14 +537,24 @@ void nano_shell(void)
 	kprint("Use UP/DOWN arrows to browse command history.\n\n");
 	
 	/* Initialize input system with prompt */
-	input_init(&input, "> ");
-	
-	/* Initialize command history */
-	history_init(&history);
+	if (input_init(&input, "> ") != 0) {
+		kprint("Error: no memory for input buffer\n");
+		return;
+	}
 	
 	/* Share history with input system for arrow key navigation */
 	input_set_history(&history);
 	
+	/* Per-command scratch memory */
+	if (arena_init(&scratch_arena, SHELL_ARENA_SIZE) != 0) {
+		kprint("Warning: no memory for shell scratch arena\n");
+	}
+	
+	/* Boot script and kernel command line, before the first prompt */
+	script_run_boot();
+	arena_reset(&scratch_arena);
+	bootlog_mark("shell");
+	
 	while (shell_running) {
 		/* Get line of input (blocks until Enter is pressed) */
 		line = input_getline(&input);
@@ -274,11 +562,12 @@ void nano_shell(void)
 		/* Execute command and check if it was valid */
 		command_valid = shell_execute_command(line);
 		
+		/* Drop everything the command allocated from scratch */
+		arena_reset(&scratch_arena);
+		
 		/* Add all non-empty commands to history (both valid and invalid) */
 		if (line[0] != '\0') {
 			history_add(&history, line, command_valid);
-			/* Update input system's history */
-			input_set_history(&history);
 		}
 	}
 }
@@ -6,9 +6,58 @@
 #ifndef SHELL_H
 #define SHELL_H
 
+#include "../memory/arena.h"
+
+/* Scratch arena size available to each command */
+#define SHELL_ARENA_SIZE (16 * 1024)
+
 /* Main shell function */
 void nano_shell(void);
 
+/* Parse and execute a command line - returns 1 if command found, 0 if not */
+int shell_execute_command(char *command);
+
+/* One command, no pipes or redirection */
+int shell_execute_single(char *command);
+
+/* Pipelines (pipeline.c) */
+int pipeline_needed(char *line);
+int pipeline_run(char *line);
+
+/* Scratch arena for the running command, emptied after it returns */
+Arena* shell_arena(void);
+
+/* Command status: commands call shell_error() when they fail */
+void shell_error(void);
+void shell_set_status(int failed);
+int shell_last_status(void);
+
+/* Filters (filters.c) - read a file, or the pipe feeding the stage */
+void cmd_grep(char *args);
+void cmd_wc(char *args);
+void cmd_head(char *args);
+
+/* Scripts (script.c) */
+#define SCRIPT_MAX_DEPTH 8
+#define SCRIPT_BOOT_FILE "/initrd/etc/rc"
+
+int script_run(char *text, const char *name);
+int script_run_file(const char *path);
+void script_run_boot(void);
+void cmd_source(char *args);
+void cmd_set(char *args);
+
+/* Filesystem commands (fs_commands.c) */
+void cmd_ls(char *args);
+void cmd_cat(char *args);
+void cmd_cd(char *args);
+void cmd_pwd(void);
+void cmd_cp(char *args);
+void cmd_rm(char *args);
+void cmd_mkdir(char *args);
+void cmd_mount(void);
+void cmd_vfsstat(void);
+
 /* Keyboard handler - called from kernel interrupt handler */
 void shell_handle_keyboard(char keycode);
 
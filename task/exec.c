@@ -0,0 +1,234 @@
+/*
+ * Exec Implementation
+ * Only the ELF header and program headers are read before a program
+ * starts. Every PT_LOAD segment becomes a VMA backed by the file, so the
+ * program's pages are read as it touches them: start-up costs what the
+ * program uses, not what the file holds.
+ */
+
+#include "exec.h"
+#include "user.h"
+#include "task.h"
+#include "../memory/page.h"
+#include "../memory/paging.h"
+#include "../memory/vma.h"
+#include "../fs/vfs.h"
+#include "../output/output.h"
+#include "../lib/string.h"
+
+#define ELFCLASS32 1
+#define ELFDATA2LSB 1
+#define ET_EXEC 2
+#define EM_386 3
+#define PT_LOAD 1
+#define PF_W 0x2
+
+typedef struct {
+	unsigned char ident[16];
+	unsigned short type;
+	unsigned short machine;
+	unsigned int version;
+	unsigned int entry;
+	unsigned int phoff;
+	unsigned int shoff;
+	unsigned int flags;
+	unsigned short ehsize;
+	unsigned short phentsize;
+	unsigned short phnum;
+	unsigned short shentsize;
+	unsigned short shnum;
+	unsigned short shstrndx;
+} Elf32Header;
+
+typedef struct {
+	unsigned int type;
+	unsigned int offset;
+	unsigned int vaddr;
+	unsigned int paddr;
+	unsigned int filesz;
+	unsigned int memsz;
+	unsigned int flags;
+	unsigned int align;
+} Elf32Segment;
+
+/* A checked program, handed from the caller to the new task */
+typedef struct {
+	Inode *inode;
+	unsigned long entry;
+	Elf32Segment segments[EXEC_MAX_SEGMENTS];
+	int count;
+	const char *argv0;
+	const char *args;
+} ExecImage;
+
+/* Read and check the headers - 0 if the file is a program we can run */
+static int exec_read_headers(ExecImage *image)
+{
+	Elf32Header header;
+	Elf32Segment segment;
+	unsigned int size = image->inode->size;
+	int entry_found = 0;
+	unsigned int i;
+
+	if (vfs_iread(image->inode, 0, &header, sizeof(header)) != sizeof(header) ||
+	    memcmp(header.ident, "\x7F" "ELF", 4) != 0 || header.ident[4] != ELFCLASS32 ||
+	    header.ident[5] != ELFDATA2LSB || header.type != ET_EXEC || header.machine != EM_386 ||
+	    header.phentsize != sizeof(Elf32Segment)) {
+		return -1;
+	}
+
+	image->count = 0;
+	for (i = 0; i < header.phnum; i++) {
+		if (vfs_iread(image->inode, header.phoff + i * sizeof(segment), &segment,
+		              sizeof(segment)) != sizeof(segment)) {
+			return -1;
+		}
+		if (segment.type != PT_LOAD || segment.memsz == 0) {
+			continue;
+		}
+		/* File pages become memory pages: offset and address must agree within a page */
+		if (image->count == EXEC_MAX_SEGMENTS ||
+		    (segment.vaddr & (PAGE_SIZE - 1)) != (segment.offset & (PAGE_SIZE - 1)) ||
+		    segment.filesz > segment.memsz || segment.filesz > size ||
+		    segment.offset > size - segment.filesz ||
+		    segment.vaddr < VM_USER_BASE || segment.vaddr >= USER_STACK_BASE ||
+		    segment.memsz > USER_STACK_BASE - segment.vaddr) {
+			return -1;
+		}
+		if (header.entry >= segment.vaddr && header.entry - segment.vaddr < segment.memsz) {
+			entry_found = 1;
+		}
+		image->segments[image->count++] = segment;
+	}
+	image->entry = header.entry;
+	return entry_found ? 0 : -1;
+}
+
+/* Copy a string below *top in the stack's top page - returns its user address */
+static unsigned long push_string(char *frame, char **top, const char *text, unsigned int length)
+{
+	*top -= length + 1;
+	memcpy(*top, text, length);
+	(*top)[length] = '\0';
+	return USER_STACK_TOP - PAGE_SIZE + (*top - frame);
+}
+
+/* Build main(argc, argv)'s frame on the new stack */
+static int exec_push_args(ExecImage *image, unsigned long *stack)
+{
+	unsigned long argv[EXEC_MAX_ARGS + 1];
+	const char *word = image->args;
+	unsigned long *frame_words;
+	unsigned int length;
+	char *frame;
+	char *top;
+	int argc = 0;
+	int i;
+
+	frame = user_setup_stack();
+	if (!frame) {
+		return -1;
+	}
+
+	/* Strings at the top of the page, then the frame below them */
+	top = frame + PAGE_SIZE;
+	argv[argc++] = push_string(frame, &top, image->argv0, strlen(image->argv0));
+	while (argc < EXEC_MAX_ARGS) {
+		while (*word == ' ') {
+			word++;
+		}
+		if (*word == '\0') {
+			break;
+		}
+		for (length = 0; word[length] != '\0' && word[length] != ' '; length++) {
+		}
+		argv[argc++] = push_string(frame, &top, word, length);
+		word += length;
+	}
+	argv[argc] = 0;
+
+	frame_words = (unsigned long*)((unsigned long)top & ~3UL) - (argc + 4);
+	frame_words[0] = 0;  /* Return address - programs end with SYS_EXIT */
+	frame_words[1] = argc;
+	frame_words[2] = USER_STACK_TOP - PAGE_SIZE + ((char*)&frame_words[3] - frame);
+	for (i = 0; i <= argc; i++) {
+		frame_words[3 + i] = argv[i];
+	}
+	*stack = USER_STACK_TOP - PAGE_SIZE + ((char*)frame_words - frame);
+	return 0;
+}
+
+/* UserSetup for an ExecImage: one file-backed area per segment, then the stack */
+static unsigned long exec_setup(void *arg, unsigned long *stack)
+{
+	ExecImage *image = (ExecImage*)arg;
+	AddressSpace *space = task_current()->space;
+	Elf32Segment *segment;
+	unsigned int lead;
+	int i;
+
+	for (i = 0; i < image->count; i++) {
+		segment = &image->segments[i];
+		lead = segment->vaddr & (PAGE_SIZE - 1);
+		if (vma_add(space, segment->vaddr - lead, PAGE_ALIGN_UP(segment->vaddr + segment->memsz),
+		            (segment->flags & PF_W) ? VMA_WRITE : 0, image->inode,
+		            segment->offset - lead, segment->filesz + lead) != 0) {
+			return 0;
+		}
+	}
+	if (exec_push_args(image, stack) != 0) {
+		return 0;
+	}
+	return image->entry;
+}
+
+/* Find name as given (with a '/') or in EXEC_PATH - a referenced inode or 0 */
+static Inode* exec_lookup(const char *name)
+{
+	static const char *directories[] = EXEC_PATH;
+	char path[VFS_PATH_LENGTH];
+	unsigned int length;
+	Inode *inode;
+	int i;
+
+	if (strchr(name, '/')) {
+		return vfs_iget_path(name);
+	}
+	for (i = 0; directories[i]; i++) {
+		length = strlcpy(path, directories[i], sizeof(path));
+		if (length + 1 + strlen(name) >= sizeof(path)) {
+			continue;
+		}
+		path[length] = '/';
+		strlcpy(path + length + 1, name, sizeof(path) - length - 1);
+		inode = vfs_iget_path(path);
+		if (inode) {
+			return inode;
+		}
+	}
+	return 0;
+}
+
+/* Run a program and wait for it - -1 if there is no such program */
+int exec_command(const char *name, const char *args, int *status)
+{
+	ExecImage image;
+
+	image.inode = exec_lookup(name);
+	if (!image.inode) {
+		return -1;
+	}
+	image.argv0 = name;
+	image.args = args;
+
+	*status = USER_STATUS_KILLED;
+	if (exec_read_headers(&image) != 0) {
+		kprint(name);
+		kprint(": not an executable\n");
+	} else if (user_run(name, exec_setup, &image, status) != 0) {
+		kprint(name);
+		kprint(": out of memory\n");
+	}
+	vfs_iput(image.inode);
+	return 0;
+}
@@ -0,0 +1,21 @@
+/*
+ * Exec - Run ELF32 programs from the filesystem as user tasks
+ */
+
+#ifndef EXEC_H
+#define EXEC_H
+
+/* Directories searched for a command name without a '/' */
+#define EXEC_PATH { "/initrd/bin", "/bin", 0 }
+
+#define EXEC_MAX_ARGS 16
+#define EXEC_MAX_SEGMENTS 8
+
+/*
+ * Run a program and wait for it. name is a path or a command looked up
+ * in EXEC_PATH; args are split on spaces into argv[1..]. Returns -1 if
+ * there is no such program, else 0 with its exit status in *status.
+ */
+int exec_command(const char *name, const char *args, int *status);
+
+#endif /* EXEC_H */
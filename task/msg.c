@@ -0,0 +1,509 @@
+/*
+ * Message Queue Implementation
+ * A ring of slots with a sequence number each (Vyukov's bounded queue,
+ * single consumer). A sender claims position n with one compare-and-swap
+ * on tail, fills slot n and stores n + 1 in its sequence; the receiver
+ * takes the slot when it sees n + 1 and frees it for the sender one lap
+ * later by storing n + MSG_QUEUE_SLOTS. Nothing is locked, and a sender
+ * that is interrupted between claim and publish only delays the
+ * receiver, never another sender.
+ *
+ * Blocking goes through the tasks' wait queues: the receiver sleeps on
+ * readable while its next slot is empty, senders on writable while
+ * theirs is full. The wakers look at the wait queue first, so a busy
+ * queue with nobody asleep never enters the scheduler.
+ */
+
+#include "msg.h"
+#include "user.h"
+#include "../cpu/cpu.h"
+#include "../memory/page.h"
+#include "../memory/paging.h"
+#include "../memory/slab.h"
+#include "../drivers/pit.h"
+#include "../output/output.h"
+#include "../lib/string.h"
+#include "../bench/bench.h"
+#include "../essentials/sections.h"
+
+/* x86 keeps stores in order: only the compiler must not move them */
+#define msg_barrier() __asm__ volatile("" : : : "memory")
+
+/* Benchmark sizes: round trips, messages per sender, 4 KB round trips */
+#define BENCH_MSG_ROUNDS 20000
+#define BENCH_MSG_BURST 50000
+#define BENCH_MSG_PAGE_ROUNDS 5000
+
+/* Where the page benchmark's tasks keep their page */
+#define BENCH_MSG_PAGE_ADDR USER_CODE_BASE
+
+#define BENCH_MSG_DATA 1
+#define BENCH_MSG_STOP 2
+#define BENCH_MSG_READY 3
+#define BENCH_MSG_FAILED 4
+
+MsgQueue* msg_queue_create(void)
+{
+	MsgQueue *queue = (MsgQueue*)kzalloc(sizeof(MsgQueue));
+	unsigned int i;
+
+	if (!queue) {
+		return 0;
+	}
+	for (i = 0; i < MSG_QUEUE_SLOTS; i++) {
+		queue->slots[i].sequence = i;
+	}
+	return queue;
+}
+
+void msg_queue_destroy(MsgQueue *queue)
+{
+	Message msg;
+
+	if (!queue) {
+		return;
+	}
+	while (msg_try_receive(queue, &msg) == 0) {
+		if (msg.page) {
+			page_free(msg.page);
+		}
+	}
+	kfree(queue);
+}
+
+__hot int msg_try_send(MsgQueue *queue, const Message *msg)
+{
+	MsgSlot *slot;
+	unsigned int pos;
+	int diff;
+
+	for (;;) {
+		pos = queue->tail;
+		slot = &queue->slots[pos & (MSG_QUEUE_SLOTS - 1)];
+		diff = (int)(slot->sequence - pos);
+		if (diff == 0) {
+			if (__sync_bool_compare_and_swap(&queue->tail, pos, pos + 1)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return -1;  /* The receiver hasn't freed this slot yet: full */
+		}
+		/* Another sender took pos - try the next one */
+	}
+
+	slot->message = *msg;
+	msg_barrier();
+	slot->sequence = pos + 1;
+
+	if (queue->readable.head) {
+		wait_queue_wake_all(&queue->readable);
+	}
+	return 0;
+}
+
+__hot int msg_try_receive(MsgQueue *queue, Message *msg)
+{
+	MsgSlot *slot = &queue->slots[queue->head & (MSG_QUEUE_SLOTS - 1)];
+
+	if (slot->sequence != queue->head + 1) {
+		return -1;
+	}
+	*msg = slot->message;
+	msg_barrier();
+	slot->sequence = queue->head + MSG_QUEUE_SLOTS;
+	queue->head++;
+
+	if (queue->writable.head) {
+		wait_queue_wake_all(&queue->writable);
+	}
+	return 0;
+}
+
+/* The slot the next sender would claim is still in use */
+static inline int msg_queue_full(MsgQueue *queue)
+{
+	unsigned int pos = queue->tail;
+
+	return (int)(queue->slots[pos & (MSG_QUEUE_SLOTS - 1)].sequence - pos) < 0;
+}
+
+void msg_send(MsgQueue *queue, const Message *msg)
+{
+	unsigned long flags;
+
+	while (msg_try_send(queue, msg) != 0) {
+		flags = irq_save();
+		while (msg_queue_full(queue)) {
+			wait_queue_sleep(&queue->writable);
+		}
+		irq_restore(flags);
+	}
+}
+
+void msg_receive(MsgQueue *queue, Message *msg)
+{
+	unsigned long flags = irq_save();
+
+	while (msg_try_receive(queue, msg) != 0) {
+		wait_queue_sleep(&queue->readable);
+	}
+	irq_restore(flags);
+}
+
+/* Unmap an owned page of the current task's space - returns its frame or 0 */
+void* msg_page_detach(unsigned long virt)
+{
+	if (!task_current()->space || (virt & (PAGE_SIZE - 1))) {
+		return 0;
+	}
+	return (void*)paging_take_page(virt);
+}
+
+/* Map a received frame at a free address of the current task's space */
+int msg_page_attach(void *page, unsigned long virt)
+{
+	if (!task_current()->space || (virt & (PAGE_SIZE - 1)) ||
+	    virt < VM_USER_BASE || virt >= VM_USER_END || paging_virt_to_phys(virt)) {
+		return -1;
+	}
+	return paging_map_page(virt, (unsigned long)page, PTE_USER | PTE_WRITE);
+}
+
+/* State shared by the benchmark's tasks */
+typedef struct {
+	MsgQueue *server;               /* Requests */
+	MsgQueue *client;               /* Replies */
+	unsigned int count;
+	int transfer;                   /* Page mode: move pages, else copy */
+	void *bounce;                   /* Page mode: kernel copy of the payload */
+	unsigned long long cycles;
+	int failed;
+	volatile int done;              /* Page tasks finished */
+	WaitQueue done_wait;
+} MsgBench;
+
+static void bench_send_type(MsgQueue *queue, unsigned int type)
+{
+	Message msg;
+
+	msg.type = type;
+	msg.page = 0;
+	msg_send(queue, &msg);
+}
+
+/* Reflect every request until BENCH_MSG_STOP */
+static void bench_echo(void *arg)
+{
+	MsgBench *bench = (MsgBench*)arg;
+	Message msg;
+
+	do {
+		msg_receive(bench->server, &msg);
+		msg_send(bench->client, &msg);
+	} while (msg.type != BENCH_MSG_STOP);
+}
+
+/* Send count messages, then BENCH_MSG_STOP */
+static void bench_producer(void *arg)
+{
+	MsgBench *bench = (MsgBench*)arg;
+	Message msg;
+	unsigned int i;
+
+	msg.type = BENCH_MSG_DATA;
+	msg.page = 0;
+	for (i = 0; i < bench->count; i++) {
+		msg.words[0] = i;
+		msg_send(bench->server, &msg);
+	}
+	bench_send_type(bench->server, BENCH_MSG_STOP);
+}
+
+/* Give the calling kernel thread an address space of its own */
+static int bench_space_enter(void)
+{
+	Task *task = task_current();
+
+	task->space = paging_space_create();
+	if (!task->space) {
+		return -1;
+	}
+	paging_space_switch(task->space);
+	return 0;
+}
+
+static void bench_space_leave(void)
+{
+	Task *task = task_current();
+
+	if (task->space) {
+		paging_space_switch(0);
+		paging_space_destroy(task->space);
+		task->space = 0;
+	}
+}
+
+/* A page task is finished with the benchmark's state */
+static void bench_page_done(MsgBench *bench)
+{
+	bench->done++;
+	wait_queue_wake_all(&bench->done_wait);
+}
+
+/* Pass the page at BENCH_MSG_PAGE_ADDR on, moved or copied */
+static void bench_page_send(MsgBench *bench, MsgQueue *to)
+{
+	Message msg;
+
+	msg.type = BENCH_MSG_DATA;
+	if (bench->transfer) {
+		msg.page = msg_page_detach(BENCH_MSG_PAGE_ADDR);
+	} else {
+		memcpy(bench->bounce, (const void*)BENCH_MSG_PAGE_ADDR, PAGE_SIZE);
+		msg.page = 0;
+	}
+	msg_send(to, &msg);
+}
+
+/* Take the page at BENCH_MSG_PAGE_ADDR and use it - returns the message type */
+static unsigned int bench_page_receive(MsgBench *bench, MsgQueue *from)
+{
+	Message msg;
+
+	msg_receive(from, &msg);
+	if (msg.type != BENCH_MSG_DATA) {
+		return msg.type;
+	}
+	if (!bench->transfer) {
+		memcpy((void*)BENCH_MSG_PAGE_ADDR, bench->bounce, PAGE_SIZE);
+	} else if (!msg.page || msg_page_attach(msg.page, BENCH_MSG_PAGE_ADDR) != 0) {
+		if (msg.page) {
+			page_free(msg.page);
+		}
+		bench->failed = 1;
+		return BENCH_MSG_FAILED;
+	}
+	(*(volatile unsigned int*)BENCH_MSG_PAGE_ADDR)++;
+	return BENCH_MSG_DATA;
+}
+
+/*
+ * Both page tasks start with their own page so the page table exists;
+ * in transfer mode the server gives its page back and waits for the
+ * client's.
+ */
+static int bench_page_setup(int own_page)
+{
+	void *page;
+
+	if (bench_space_enter() != 0 || !user_map_page(BENCH_MSG_PAGE_ADDR, PTE_WRITE)) {
+		return -1;
+	}
+	if (!own_page) {
+		page = msg_page_detach(BENCH_MSG_PAGE_ADDR);
+		if (page) {
+			page_free(page);
+		}
+	}
+	return 0;
+}
+
+static void bench_page_server(void *arg)
+{
+	MsgBench *bench = (MsgBench*)arg;
+	unsigned int type;
+
+	if (bench_page_setup(!bench->transfer) != 0) {
+		bench_space_leave();
+		bench_send_type(bench->client, BENCH_MSG_FAILED);
+		bench_page_done(bench);
+		return;
+	}
+	bench_send_type(bench->client, BENCH_MSG_READY);
+	while ((type = bench_page_receive(bench, bench->server)) == BENCH_MSG_DATA) {
+		bench_page_send(bench, bench->client);
+	}
+	if (type == BENCH_MSG_FAILED) {
+		bench_send_type(bench->client, BENCH_MSG_FAILED);
+	}
+	bench_space_leave();
+	bench_page_done(bench);
+}
+
+static void bench_page_client(void *arg)
+{
+	MsgBench *bench = (MsgBench*)arg;
+	unsigned long long start;
+	Message msg;
+	unsigned int i;
+
+	msg_receive(bench->client, &msg);
+	if (msg.type != BENCH_MSG_READY || bench_page_setup(1) != 0) {
+		bench->failed = 1;
+	} else {
+		start = cpu_rdtsc();
+		for (i = 0; i < bench->count && !bench->failed; i++) {
+			bench_page_send(bench, bench->server);
+			if (bench_page_receive(bench, bench->client) != BENCH_MSG_DATA) {
+				bench->failed = 1;
+				msg.type = BENCH_MSG_FAILED;  /* The server is gone */
+			}
+		}
+		bench->cycles = cpu_rdtsc() - start;
+
+		/* Both sides bumped the first word on every round */
+		if (!bench->failed && *(volatile unsigned int*)BENCH_MSG_PAGE_ADDR != 2 * bench->count) {
+			bench->failed = 1;
+		}
+	}
+	if (msg.type == BENCH_MSG_READY) {
+		bench_send_type(bench->server, BENCH_MSG_STOP);
+	}
+	bench_space_leave();
+	bench_page_done(bench);
+}
+
+/* Round trips through an echo task */
+static int bench_round_trips(MsgBench *bench)
+{
+	unsigned long long start;
+	Message msg;
+	unsigned int i;
+
+	if (!task_create("msg-echo", bench_echo, bench)) {
+		return -1;
+	}
+	msg.type = BENCH_MSG_DATA;
+	msg.page = 0;
+	start = cpu_rdtsc();
+	for (i = 0; i < bench->count; i++) {
+		msg.words[0] = i;
+		msg_send(bench->server, &msg);
+		msg_receive(bench->client, &msg);
+	}
+	bench->cycles = cpu_rdtsc() - start;
+
+	bench_send_type(bench->server, BENCH_MSG_STOP);
+	msg_receive(bench->client, &msg);
+	return 0;
+}
+
+/* Two producers into one queue - returns the messages received */
+static unsigned int bench_burst(MsgBench *bench)
+{
+	unsigned long long start;
+	unsigned int received = 0;
+	int producers = 0;
+	Message msg;
+
+	if (task_create("msg-send", bench_producer, bench)) {
+		producers++;
+	}
+	if (task_create("msg-send", bench_producer, bench)) {
+		producers++;
+	}
+
+	start = cpu_rdtsc();
+	while (producers > 0) {
+		msg_receive(bench->server, &msg);
+		if (msg.type == BENCH_MSG_STOP) {
+			producers--;
+		} else {
+			received++;
+		}
+	}
+	bench->cycles = cpu_rdtsc() - start;
+	return received;
+}
+
+/*
+ * 4 KB round trips between two address spaces, copied or moved. Waits
+ * for both tasks, so the next run never shares a queue with them.
+ */
+static int bench_pages(MsgBench *bench, int transfer)
+{
+	unsigned long flags;
+	int tasks = 2;
+
+	bench->transfer = transfer;
+	bench->failed = 0;
+	bench->done = 0;
+	if (!task_create("msg-server", bench_page_server, bench)) {
+		return -1;
+	}
+	if (!task_create("msg-client", bench_page_client, bench)) {
+		bench_send_type(bench->server, BENCH_MSG_STOP);
+		bench->failed = 1;
+		tasks = 1;
+	}
+
+	flags = irq_save();
+	while (bench->done < tasks) {
+		wait_queue_sleep(&bench->done_wait);
+	}
+	irq_restore(flags);
+	return bench->failed ? -1 : 0;
+}
+
+/* Print "label: <messages/s> msgs/s" for count messages in cycles */
+static void bench_print_rate(const char *label, unsigned int count, unsigned long long cycles)
+{
+	unsigned long long us = bench_div64(cycles * 1000, pit_tsc_khz());
+
+	if (us == 0) {
+		us = 1;
+	}
+	kprint("  ");
+	kprint(label);
+	kprint(": ");
+	kprint_dec64(bench_div64((unsigned long long)count * 1000000, (unsigned int)us));
+	kprint(" msgs/s\n");
+}
+
+/* Round-trip latency, one-way throughput, and 4 KB payloads copied against moved */
+void msg_bench(void)
+{
+	MsgBench bench;
+	unsigned int received;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.server = msg_queue_create();
+	bench.client = msg_queue_create();
+	bench.bounce = page_alloc();
+	if (!bench.server || !bench.client || !bench.bounce) {
+		kprint("Out of memory\n");
+		goto out;
+	}
+
+	bench.count = BENCH_MSG_ROUNDS;
+	if (bench_round_trips(&bench) != 0) {
+		kprint("Out of memory\n");
+		goto out;
+	}
+	bench_report("round trip via echo task", bench.cycles, BENCH_MSG_ROUNDS);
+
+	bench.count = BENCH_MSG_BURST;
+	received = bench_burst(&bench);
+	bench_print_rate("2 senders, 1 receiver", received, bench.cycles);
+
+	bench.count = BENCH_MSG_PAGE_ROUNDS;
+	if (bench_pages(&bench, 0) != 0) {
+		kprint("Page benchmark failed\n");
+		goto out;
+	}
+	bench_report("4 KB round trip, copied", bench.cycles, BENCH_MSG_PAGE_ROUNDS);
+	if (bench_pages(&bench, 1) != 0) {
+		kprint("Page benchmark failed\n");
+		goto out;
+	}
+	bench_report("4 KB round trip, page moved", bench.cycles, BENCH_MSG_PAGE_ROUNDS);
+
+out:
+	/* Let the benchmark's tasks finish before their queues go */
+	task_yield();
+	msg_queue_destroy(bench.server);
+	msg_queue_destroy(bench.client);
+	if (bench.bounce) {
+		page_free(bench.bounce);
+	}
+}
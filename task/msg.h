@@ -0,0 +1,65 @@
+/*
+ * Messages - Bounded message queues between tasks
+ */
+
+#ifndef MSG_H
+#define MSG_H
+
+#include "task.h"
+
+#define MSG_QUEUE_SLOTS 64   /* Power of two */
+#define MSG_WORDS 4
+
+/* A fixed-size message, copied into and out of the queue */
+typedef struct {
+	unsigned int type;
+	unsigned long words[MSG_WORDS];
+	void *page;                     /* Frame moved with the message, 0 = none */
+} Message;
+
+/* A slot is free for sender n when sequence == n, full when n + 1 */
+typedef struct {
+	volatile unsigned int sequence;
+	Message message;
+} MsgSlot;
+
+/*
+ * Any number of senders, one receiving task. Senders claim a slot with a
+ * compare-and-swap on tail and publish it through the slot's sequence
+ * number, so they never wait for each other and msg_try_send() is safe
+ * from interrupt handlers. Only the receiver moves head.
+ */
+typedef struct MsgQueue {
+	MsgSlot slots[MSG_QUEUE_SLOTS];
+	volatile unsigned int tail;     /* Next slot a sender claims */
+	unsigned int head;              /* Next slot the receiver reads */
+	WaitQueue readable;
+	WaitQueue writable;
+} MsgQueue;
+
+MsgQueue* msg_queue_create(void);
+
+/* Pages of messages never received are freed with the queue */
+void msg_queue_destroy(MsgQueue *queue);
+
+/* Non-blocking - return -1 when the queue is full / empty */
+int msg_try_send(MsgQueue *queue, const Message *msg);
+int msg_try_receive(MsgQueue *queue, Message *msg);
+
+/* Block while the queue is full / empty */
+void msg_send(MsgQueue *queue, const Message *msg);
+void msg_receive(MsgQueue *queue, Message *msg);
+
+/*
+ * Page transfer: msg_page_detach() unmaps a page the current task's
+ * address space owns and returns its frame for Message.page; the
+ * receiver maps it into its own space with msg_page_attach(), which
+ * takes ownership. Nothing is copied.
+ */
+void* msg_page_detach(unsigned long virt);
+int msg_page_attach(void *page, unsigned long virt);
+
+/* Benchmark */
+void msg_bench(void);
+
+#endif /* MSG_H */
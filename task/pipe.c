@@ -0,0 +1,131 @@
+/*
+ * Pipe Implementation
+ * A ring buffer over a few contiguous pages with free-running head and
+ * tail counters. Tasks are cooperative, so a writer fills the ring until
+ * it is full before the reader runs, and the reader then scans the data
+ * where it lies: one copy in (from the writer), none out.
+ */
+
+#include "pipe.h"
+#include "../cpu/cpu.h"
+#include "../memory/slab.h"
+#include "../lib/string.h"
+
+static int pipe_sink_write(OutputSink *sink, const char *data, unsigned int length)
+{
+	pipe_write((Pipe*)sink->data, data, length);
+	return length;
+}
+
+Pipe* pipe_create(void)
+{
+	Pipe *pipe = (Pipe*)kzalloc(sizeof(Pipe));
+
+	if (!pipe) {
+		return 0;
+	}
+	pipe->buffer = (char*)page_alloc_contig(PIPE_PAGES);
+	if (!pipe->buffer) {
+		kfree(pipe);
+		return 0;
+	}
+	pipe->reader_open = 1;
+	pipe->writer_open = 1;
+	pipe->sink.write = pipe_sink_write;
+	pipe->sink.data = pipe;
+	return pipe;
+}
+
+void pipe_destroy(Pipe *pipe)
+{
+	if (pipe) {
+		page_free_contig(pipe->buffer, PIPE_PAGES);
+		kfree(pipe);
+	}
+}
+
+void pipe_write(Pipe *pipe, const char *data, unsigned int length)
+{
+	unsigned long flags;
+	unsigned int offset;
+	unsigned int chunk;
+
+	while (length > 0) {
+		flags = irq_save();
+		while (pipe->reader_open && pipe->head - pipe->tail == PIPE_SIZE) {
+			wait_queue_sleep(&pipe->writable);
+		}
+		irq_restore(flags);
+		if (!pipe->reader_open) {
+			pipe->dropped += length;
+			return;
+		}
+
+		offset = pipe->head & (PIPE_SIZE - 1);
+		chunk = PIPE_SIZE - (pipe->head - pipe->tail);
+		if (chunk > PIPE_SIZE - offset) {
+			chunk = PIPE_SIZE - offset;
+		}
+		if (chunk > length) {
+			chunk = length;
+		}
+		memcpy(pipe->buffer + offset, data, chunk);
+		pipe->head += chunk;
+		data += chunk;
+		length -= chunk;
+		wait_queue_wake_all(&pipe->readable);
+	}
+}
+
+unsigned int pipe_peek(Pipe *pipe, const char **data)
+{
+	unsigned long flags = irq_save();
+	unsigned int offset;
+	unsigned int length;
+
+	while (pipe->writer_open && pipe->head == pipe->tail) {
+		wait_queue_sleep(&pipe->readable);
+	}
+	irq_restore(flags);
+
+	offset = pipe->tail & (PIPE_SIZE - 1);
+	length = pipe->head - pipe->tail;
+	if (length > PIPE_SIZE - offset) {
+		length = PIPE_SIZE - offset;
+	}
+	*data = pipe->buffer + offset;
+	return length;
+}
+
+void pipe_consume(Pipe *pipe, unsigned int length)
+{
+	if (length > 0) {
+		pipe->tail += length;
+		wait_queue_wake_all(&pipe->writable);
+	}
+}
+
+unsigned int pipe_read(Pipe *pipe, void *buffer, unsigned int length)
+{
+	const char *data;
+	unsigned int available = pipe_peek(pipe, &data);
+
+	if (length > available) {
+		length = available;
+	}
+	memcpy(buffer, data, length);
+	pipe_consume(pipe, length);
+	return length;
+}
+
+void pipe_close_read(Pipe *pipe)
+{
+	pipe->reader_open = 0;
+	wait_queue_wake_all(&pipe->writable);
+}
+
+void pipe_close_write(Pipe *pipe)
+{
+	pipe->writer_open = 0;
+	wait_queue_wake_all(&pipe->readable);
+}
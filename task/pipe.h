@@ -0,0 +1,47 @@
+/*
+ * Pipes - Byte streams between tasks
+ */
+
+#ifndef PIPE_H
+#define PIPE_H
+
+#include "task.h"
+#include "../output/output.h"
+#include "../memory/page.h"
+
+#define PIPE_PAGES 4
+#define PIPE_SIZE (PIPE_PAGES * PAGE_SIZE)   /* Power of two */
+
+typedef struct Pipe {
+	char *buffer;                   /* PIPE_PAGES contiguous pages */
+	unsigned int head;              /* Bytes ever written */
+	unsigned int tail;              /* Bytes ever consumed */
+	int reader_open;
+	int writer_open;
+	WaitQueue readable;
+	WaitQueue writable;
+	OutputSink sink;                /* kprint into the pipe */
+	unsigned int dropped;           /* Written after the reader left */
+} Pipe;
+
+Pipe* pipe_create(void);
+void pipe_destroy(Pipe *pipe);
+
+/* Blocks while full; after the reader closes, data is dropped */
+void pipe_write(Pipe *pipe, const char *data, unsigned int length);
+
+/*
+ * Zero-copy reading: pipe_peek() blocks until there is data, points
+ * *data at it in the ring and returns how many bytes are contiguous
+ * there (0 = end of stream); pipe_consume() hands them back.
+ */
+unsigned int pipe_peek(Pipe *pipe, const char **data);
+void pipe_consume(Pipe *pipe, unsigned int length);
+
+/* Copying read - 0 at the end of the stream */
+unsigned int pipe_read(Pipe *pipe, void *buffer, unsigned int length);
+
+void pipe_close_read(Pipe *pipe);
+void pipe_close_write(Pipe *pipe);
+
+#endif /* PIPE_H */
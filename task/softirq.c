@@ -0,0 +1,158 @@
+/*
+ * Softirq Implementation
+ * Interrupt handlers do the minimum with interrupts off and queue a
+ * tasklet for the rest. Tasklets run with interrupts enabled, first at
+ * the exit of the outermost interrupt (at most SOFTIRQ_IRQ_BUDGET of
+ * them), and whatever is left by the ksoftirqd kernel thread, which
+ * yields after SOFTIRQ_THREAD_BUDGET so a flood cannot starve the shell.
+ */
+
+#include "softirq.h"
+#include "task.h"
+#include "../cpu/cpu.h"
+#include "../output/output.h"
+#include "../debug/trace.h"
+#include "../essentials/sections.h"
+
+static SoftirqCpu softirq_cpus[NR_CPUS];
+
+/* ksoftirqd sleeps here while there is nothing to run */
+static WaitQueue softirq_wait = WAIT_QUEUE_INIT;
+
+/* Queue a tasklet to run soon (interrupt-safe) */
+__hot void tasklet_schedule(Tasklet *tasklet)
+{
+	SoftirqCpu *sc = &softirq_cpus[cpu_id()];
+	unsigned long flags = irq_save();
+
+	if (tasklet->queued) {
+		sc->coalesced++;
+		irq_restore(flags);
+		return;
+	}
+
+	tasklet->queued = 1;
+	tasklet->next = 0;
+	if (sc->tail) {
+		sc->tail->next = tasklet;
+	} else {
+		sc->head = tasklet;
+	}
+	sc->tail = tasklet;
+	sc->queued++;
+	sc->pending++;
+	if (sc->pending > sc->max_pending) {
+		sc->max_pending = sc->pending;
+	}
+
+	/* Outside interrupts no IRQ exit is coming soon - use the thread */
+	if (!cpu_in_irq()) {
+		wait_queue_wake_all(&softirq_wait);
+	}
+	irq_restore(flags);
+}
+
+/*
+ * Run up to budget tasklets with interrupts enabled. Called with
+ * interrupts disabled and returns the same way; the count run is
+ * returned. sc->active keeps a nested interrupt from starting another
+ * pass underneath this one.
+ */
+__hot static unsigned int softirq_run(SoftirqCpu *sc, unsigned int budget)
+{
+	Tasklet *tasklet;
+	unsigned int run = 0;
+
+	sc->active = 1;
+	while (sc->head && run < budget) {
+		tasklet = sc->head;
+		sc->head = tasklet->next;
+		if (!sc->head) {
+			sc->tail = 0;
+		}
+		sc->pending--;
+		tasklet->queued = 0;
+
+		irq_enable();
+		tasklet->func(tasklet->data);
+		irq_disable();
+		run++;
+	}
+	sc->active = 0;
+
+	TRACE(TRACE_SOFTIRQ, run);
+	return run;
+}
+
+/* Softirq pass at the exit of the outermost interrupt (interrupts off) */
+__hot void softirq_irq_exit(void)
+{
+	SoftirqCpu *sc = &softirq_cpus[cpu_id()];
+
+	if (!sc->head || sc->active) {
+		return;
+	}
+
+	sc->run_irq += softirq_run(sc, SOFTIRQ_IRQ_BUDGET);
+	if (sc->head) {
+		sc->deferred++;
+		wait_queue_wake_all(&softirq_wait);
+	}
+}
+
+/* Kernel thread that finishes what the IRQ-exit passes left */
+static void ksoftirqd(void *arg)
+{
+	SoftirqCpu *sc = &softirq_cpus[cpu_id()];
+	unsigned long flags;
+
+	(void)arg;
+	while (1) {
+		flags = irq_save();
+		while (!sc->head) {
+			wait_queue_sleep(&softirq_wait);
+		}
+		if (!sc->active) {
+			sc->run_thread += softirq_run(sc, SOFTIRQ_THREAD_BUDGET);
+		}
+		irq_restore(flags);
+
+		task_yield();
+	}
+}
+
+/* Start the ksoftirqd thread */
+__init void softirq_init(void)
+{
+	if (!task_create("ksoftirqd", ksoftirqd, 0)) {
+		kprint("Softirq: cannot create ksoftirqd\n");
+	}
+}
+
+static void print_stat(const char *label, unsigned int value)
+{
+	kprint(label);
+	kprint_dec(value);
+}
+
+/* Per-CPU counters */
+__cold void softirq_print_stats(void)
+{
+	int cpu;
+	SoftirqCpu *sc;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		sc = &softirq_cpus[cpu];
+		print_stat("CPU ", cpu);
+		print_stat(": queued ", sc->queued);
+		print_stat(" coalesced ", sc->coalesced);
+		print_stat(" pending ", sc->pending);
+		print_stat(" (max ", sc->max_pending);
+		kprint(")");
+		kprint_newline();
+		print_stat("  run at irq exit ", sc->run_irq);
+		print_stat(" run by ksoftirqd ", sc->run_thread);
+		print_stat(" deferred by budget ", sc->deferred);
+		kprint_newline();
+	}
+}
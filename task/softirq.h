@@ -0,0 +1,45 @@
+/*
+ * Softirq - Deferred interrupt work (tasklets)
+ */
+
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+/* Tasklets run per softirq pass at IRQ exit, before the rest goes to ksoftirqd */
+#define SOFTIRQ_IRQ_BUDGET 8
+
+/* Tasklets ksoftirqd runs before yielding to other tasks */
+#define SOFTIRQ_THREAD_BUDGET 32
+
+/* A unit of deferred work; scheduling one that is already queued is a no-op */
+typedef struct Tasklet {
+	void (*func)(unsigned long data);
+	unsigned long data;
+	const char *name;
+	volatile int queued;
+	struct Tasklet *next;
+} Tasklet;
+
+#define TASKLET_INIT(name, func, data) { (func), (data), (name), 0, 0 }
+
+/* Per-CPU queue and counters */
+typedef struct {
+	Tasklet *head;
+	Tasklet *tail;
+	int active;                 /* A softirq pass is running on this CPU */
+	unsigned int pending;
+	unsigned int max_pending;
+	unsigned int queued;        /* tasklet_schedule() calls that queued */
+	unsigned int coalesced;     /* ...that found the tasklet already queued */
+	unsigned int run_irq;       /* Run at IRQ exit */
+	unsigned int run_thread;    /* Run by ksoftirqd */
+	unsigned int deferred;      /* IRQ-exit passes that hit the budget */
+} SoftirqCpu;
+
+/* Softirq functions */
+void softirq_init(void);
+void tasklet_schedule(Tasklet *tasklet);
+void softirq_irq_exit(void);
+void softirq_print_stats(void);
+
+#endif /* SOFTIRQ_H */
@@ -0,0 +1,26 @@
+; Context switch between kernel tasks
+
+bits 32
+section .text
+
+global task_switch
+
+; void task_switch(unsigned long *old_esp, unsigned long new_esp)
+; Saves the callee-saved registers and EFLAGS on the old stack, stores
+; the old stack pointer and resumes the new task where it left off.
+task_switch:
+	mov eax, [esp + 4]
+	mov edx, [esp + 8]
+	push ebp
+	push ebx
+	push esi
+	push edi
+	pushfd
+	mov [eax], esp
+	mov esp, edx
+	popfd
+	pop edi
+	pop esi
+	pop ebx
+	pop ebp
+	ret
@@ -0,0 +1,120 @@
+; Ring 3 entry and exit, system call gates and the vsyscall trampolines
+;
+; Calling convention from user code: eax = number, ebx/esi/edi = the
+; arguments, `call` into the vsyscall page; the result is in eax and
+; ecx/edx are clobbered. Both gates preserve every other register.
+
+; Must match cpu/gdt.h and task/syscall.h
+GDT_USER_CODE	equ 0x1B
+GDT_USER_DATA	equ 0x23
+SYS_EXIT	equ 0
+SYS_GETPID	equ 3
+
+bits 32
+section .text
+
+global user_enter
+global sysenter_entry
+global syscall_int80_entry
+global vsyscall_sysenter
+global vsyscall_sysenter_end
+global vsyscall_int80
+global vsyscall_int80_end
+global user_bench_start
+global user_bench_end
+
+extern syscall_dispatch
+
+; void user_enter(unsigned long eip, unsigned long esp)
+; Drop to ring 3 with interrupts on; never returns.
+user_enter:
+	mov ecx, [esp + 4]
+	mov edx, [esp + 8]
+	mov ax, GDT_USER_DATA
+	mov ds, ax
+	mov es, ax
+	mov fs, ax
+	mov gs, ax
+	push dword GDT_USER_DATA	;ss
+	push edx			;esp
+	push dword 0x202		;eflags: IF
+	push dword GDT_USER_CODE	;cs
+	push ecx			;eip
+	xor eax, eax			;leave nothing of the kernel's behind
+	xor ebx, ebx
+	xor ecx, ecx
+	xor edx, edx
+	xor esi, esi
+	xor edi, edi
+	xor ebp, ebp
+	iretd
+
+; SYSENTER lands here with interrupts off and esp = &tss.esp0 + 4 (the
+; MSR never changes; task_yield() updates esp0). The trampoline passed
+; the user stack in ecx and the return address in edx, which is what
+; SYSEXIT takes back.
+sysenter_entry:
+	mov esp, [esp - 4]		;tss.esp0
+	push ecx			;user esp
+	push edx			;user eip
+	push edi
+	push esi
+	push ebx
+	push eax
+	cld
+	sti
+	call syscall_dispatch		;syscall_dispatch(num, a1, a2, a3)
+	add esp, 16
+	cli
+	pop edx
+	pop ecx
+	sti				;takes effect after SYSEXIT
+	sysexit
+
+; int 0x80 through a DPL 3 interrupt gate - works on every CPU
+syscall_int80_entry:
+	push edi
+	push esi
+	push ebx
+	push eax
+	cld
+	sti
+	call syscall_dispatch
+	add esp, 16
+	iretd
+
+; Trampolines copied into the vsyscall page; user code calls them
+vsyscall_sysenter:
+	pop edx				;return address
+	mov ecx, esp
+	sysenter
+vsyscall_sysenter_end:
+
+vsyscall_int80:
+	int 0x80
+	ret
+vsyscall_int80_end:
+
+section .rodata
+
+; Syscall latency benchmark, copied to a user task and run in ring 3:
+; user_bench(entry, rounds) times `rounds` getpid calls through entry
+; and exits with the cycle count.
+user_bench_start:
+	mov ebp, [esp + 4]		;vsyscall entry
+	mov edi, [esp + 8]		;rounds
+	mov eax, SYS_GETPID		;warm up the entry path
+	call ebp
+	rdtsc
+	mov esi, eax
+.loop:
+	mov eax, SYS_GETPID
+	call ebp
+	dec edi
+	jnz .loop
+	rdtsc
+	sub eax, esi			;low 32 bits are enough for the run
+	mov ebx, eax
+	mov eax, SYS_EXIT
+	call ebp
+user_bench_end:
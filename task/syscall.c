@@ -0,0 +1,188 @@
+/*
+ * System Call Implementation
+ * SYSENTER/SYSEXIT when the CPU has them - no descriptor lookups or
+ * stack frame checks on the way in or out - and an int 0x80 gate that
+ * always works. The vsyscall page hides the difference from programs.
+ */
+
+#include "syscall.h"
+#include "user.h"
+#include "task.h"
+#include "../kernel.h"
+#include "../cpu/cpu.h"
+#include "../cpu/gdt.h"
+#include "../memory/page.h"
+#include "../memory/paging.h"
+#include "../output/output.h"
+#include "../lib/string.h"
+#include "../bench/bench.h"
+#include "../essentials/sections.h"
+
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+/* Bytes copied from user memory at a time */
+#define SYSCALL_COPY_CHUNK 256
+
+/* getpid calls per benchmark phase */
+#define BENCH_SYSCALL_ROUNDS 100000
+
+typedef int (*SyscallHandler)(unsigned long a1, unsigned long a2, unsigned long a3);
+
+/* Entry points and code copied to user memory (syscall.asm) */
+extern void sysenter_entry(void);
+extern void syscall_int80_entry(void);
+extern char vsyscall_sysenter[], vsyscall_sysenter_end[];
+extern char vsyscall_int80[], vsyscall_int80_end[];
+extern char user_bench_start[], user_bench_end[];
+
+/* The vsyscall page's frame, shared by every address space */
+static void *vsyscall_page;
+static int use_sysenter = 0;
+
+static int sys_exit(unsigned long status, unsigned long unused1, unsigned long unused2)
+{
+	(void)unused1;
+	(void)unused2;
+	user_exit((int)status);
+	return 0;
+}
+
+/*
+ * The buffer is copied out before output_write() sees it: touching user
+ * memory may fault a page in from disk, which must not happen while the
+ * console holds its locks.
+ */
+static int sys_write(unsigned long buffer, unsigned long length, unsigned long unused)
+{
+	char chunk[SYSCALL_COPY_CHUNK];
+	unsigned long done;
+	unsigned long count;
+
+	(void)unused;
+	if (!user_access_ok(buffer, length)) {
+		return -1;
+	}
+	for (done = 0; done < length; done += count) {
+		count = length - done < SYSCALL_COPY_CHUNK ? length - done : SYSCALL_COPY_CHUNK;
+		memcpy(chunk, (const char*)buffer + done, count);
+		output_write(chunk, count);
+	}
+	return (int)length;
+}
+
+static int sys_yield(unsigned long unused1, unsigned long unused2, unsigned long unused3)
+{
+	(void)unused1;
+	(void)unused2;
+	(void)unused3;
+	task_yield();
+	return 0;
+}
+
+static int sys_getpid(unsigned long unused1, unsigned long unused2, unsigned long unused3)
+{
+	(void)unused1;
+	(void)unused2;
+	(void)unused3;
+	return task_current()->id;
+}
+
+/* System call table, indexed by number */
+static const SyscallHandler syscall_table[NR_SYSCALLS] = {
+	sys_exit,
+	sys_write,
+	sys_yield,
+	sys_getpid,
+};
+
+/* Common C entry of both gates - interrupts are on */
+__hot int syscall_dispatch(unsigned int num, unsigned long a1, unsigned long a2, unsigned long a3)
+{
+	if (num >= NR_SYSCALLS) {
+		return -1;
+	}
+	return syscall_table[num](a1, a2, a3);
+}
+
+/* Install the gates and fill the vsyscall page */
+__init void syscall_init(void)
+{
+	char *page;
+
+	page = (char*)page_alloc();
+	if (!page) {
+		kprint("Syscalls: out of memory\n");
+		return;
+	}
+	memset(page, 0xCC, PAGE_SIZE);  /* int3 around the trampolines */
+	memcpy(page + (VSYSCALL_INT80 - VSYSCALL_ADDR), vsyscall_int80,
+	       vsyscall_int80_end - vsyscall_int80);
+
+	idt_set_gate(SYSCALL_VECTOR, syscall_int80_entry, USER_INTERRUPT_GATE);
+
+	if (cpu_has_feature(CPU_FEATURE_SEP)) {
+		/* The entry stub reads tss.esp0 just below its initial esp */
+		cpu_wrmsr(MSR_SYSENTER_CS, GDT_KERNEL_CODE);
+		cpu_wrmsr(MSR_SYSENTER_ESP, (unsigned long)&tss.esp0 + 4);
+		cpu_wrmsr(MSR_SYSENTER_EIP, (unsigned long)sysenter_entry);
+		memcpy(page, vsyscall_sysenter, vsyscall_sysenter_end - vsyscall_sysenter);
+		use_sysenter = 1;
+	} else {
+		memcpy(page, vsyscall_int80, vsyscall_int80_end - vsyscall_int80);
+	}
+	vsyscall_page = page;
+}
+
+/* Map the vsyscall page into the active address space */
+int syscall_map_vsyscall(void)
+{
+	if (!vsyscall_page) {
+		return -1;
+	}
+	return paging_map_page(VSYSCALL_ADDR, (unsigned long)vsyscall_page, PTE_USER | PTE_SHARED);
+}
+
+/* Cycles for BENCH_SYSCALL_ROUNDS getpid calls from ring 3 through entry */
+static int bench_entry(unsigned long entry, unsigned long long *cycles)
+{
+	UserBlob blob;
+	int status;
+
+	blob.code = user_bench_start;
+	blob.size = user_bench_end - user_bench_start;
+	blob.args[0] = entry;
+	blob.args[1] = BENCH_SYSCALL_ROUNDS;
+	if (user_run("sysbench", user_setup_blob, &blob, &status) != 0 || status < 0) {
+		return -1;
+	}
+	*cycles = (unsigned int)status;
+	return 0;
+}
+
+/* System call round trip, SYSENTER/SYSEXIT against int 0x80/iret */
+void syscall_bench(void)
+{
+	unsigned long long cycles;
+
+	if (!vsyscall_page) {
+		kprint("System calls unavailable\n");
+		return;
+	}
+	if (use_sysenter) {
+		if (bench_entry(VSYSCALL_ENTRY, &cycles) != 0) {
+			kprint("User task failed\n");
+			return;
+		}
+		bench_report("getpid, sysenter/sysexit", cycles, BENCH_SYSCALL_ROUNDS);
+	} else {
+		kprint("  No SYSENTER on this CPU, int 0x80 only\n");
+	}
+
+	if (bench_entry(VSYSCALL_INT80, &cycles) != 0) {
+		kprint("User task failed\n");
+		return;
+	}
+	bench_report("getpid, int 0x80/iret", cycles, BENCH_SYSCALL_ROUNDS);
+}
@@ -0,0 +1,34 @@
+/*
+ * System Calls - Ring 3 entry through SYSENTER/SYSEXIT or int 0x80
+ */
+
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#define SYSCALL_VECTOR 0x80
+
+/*
+ * The vsyscall page, the last page of user space, is mapped read-only
+ * into every user task. User code calls into it rather than issuing
+ * SYSENTER or int 0x80 itself, so programs run on any CPU.
+ */
+#define VSYSCALL_ADDR 0xBFFFF000
+#define VSYSCALL_ENTRY VSYSCALL_ADDR          /* Fastest entry the CPU has */
+#define VSYSCALL_INT80 (VSYSCALL_ADDR + 16)   /* Always int 0x80 */
+
+/* System call numbers (task/syscall.asm repeats the ones it uses) */
+#define SYS_EXIT 0      /* exit(status) */
+#define SYS_WRITE 1     /* write(buffer, length) - to the task's output */
+#define SYS_YIELD 2     /* yield() */
+#define SYS_GETPID 3    /* getpid() */
+#define NR_SYSCALLS 4
+
+/* System call functions */
+void syscall_init(void);
+int syscall_map_vsyscall(void);
+int syscall_dispatch(unsigned int num, unsigned long a1, unsigned long a2, unsigned long a3);
+
+/* Benchmark */
+void syscall_bench(void);
+
+#endif /* SYSCALL_H */
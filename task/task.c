@@ -0,0 +1,346 @@
+/*
+ * Task Scheduler Implementation
+ * Cooperative kernel threads on a circular list. A task runs until it
+ * calls task_yield() or task_exit(); interrupts never switch tasks.
+ */
+
+#include "task.h"
+#include "../cpu/cpu.h"
+#include "../cpu/fpu.h"
+#include "../cpu/gdt.h"
+#include "../memory/paging.h"
+#include "../output/output.h"
+#include "../memory/slab.h"
+#include "../lib/string.h"
+#include "../bench/bench.h"
+#include "../debug/trace.h"
+#include "../essentials/sections.h"
+
+/* Yield round trips per benchmark phase */
+#define BENCH_SWITCH_ROUNDS 10000
+
+/* Save the current context and resume another (switch.asm) */
+extern void task_switch(unsigned long *old_esp, unsigned long new_esp);
+
+/* The boot context becomes task 0 - its stack is the one from kernel.asm */
+static Task boot_task;
+static Task *current = &boot_task;
+static int next_id = 1;
+
+/* Cycles spent halted because no task could run */
+static unsigned long long idle_cycles = 0;
+
+/* Adopt the running boot context as the first task */
+__init void task_init(void)
+{
+	boot_task.id = 0;
+	boot_task.state = TASK_RUNNING;
+	strlcpy(boot_task.name, "shell", TASK_NAME_LENGTH);
+	boot_task.next = &boot_task;
+}
+
+/* The task that is running now */
+Task* task_current(void)
+{
+	return current;
+}
+
+/* First code a new task runs: task_switch() returns here */
+static void task_start(void)
+{
+	current->entry(current->arg);
+	task_exit();
+}
+
+/* Release a dead task's memory */
+static void task_free(Task *task)
+{
+	kfree(task->stack);
+	kfree(task);
+}
+
+/* Create a ready task - returns 0 when out of memory */
+Task* task_create(const char *name, void (*entry)(void *arg), void *arg)
+{
+	Task *task;
+	unsigned long *sp;
+	unsigned long flags;
+
+	task = (Task*)kzalloc(sizeof(Task));
+	if (!task) {
+		return 0;
+	}
+	task->stack = kmalloc(TASK_STACK_SIZE);
+	if (!task->stack) {
+		kfree(task);
+		return 0;
+	}
+
+	strlcpy(task->name, name, TASK_NAME_LENGTH);
+	task->entry = entry;
+	task->arg = arg;
+	task->state = TASK_READY;
+
+	/* Initial frame in the layout task_switch() pops */
+	sp = (unsigned long*)((char*)task->stack + TASK_STACK_SIZE);
+	*--sp = 0;                          /* Return address of task_start */
+	*--sp = (unsigned long)task_start;  /* ret */
+	*--sp = 0;                          /* ebp */
+	*--sp = 0;                          /* ebx */
+	*--sp = 0;                          /* esi */
+	*--sp = 0;                          /* edi */
+	*--sp = EFLAGS_IF | 0x2;            /* eflags: interrupts on */
+	task->esp = (unsigned long)sp;
+
+	flags = irq_save();
+	task->id = next_id++;
+	task->next = current->next;
+	current->next = task;
+	irq_restore(flags);
+
+	return task;
+}
+
+/* Next ready task after prev, unlinking dead ones on the way */
+__hot static Task* pick_next(Task *prev)
+{
+	Task *t = prev;
+	Task *candidate;
+
+	while (t->next != prev) {
+		candidate = t->next;
+		if (candidate->state == TASK_DEAD) {
+			t->next = candidate->next;
+			task_free(candidate);
+			continue;
+		}
+		if (candidate->state == TASK_READY) {
+			return candidate;
+		}
+		t = candidate;
+	}
+	return prev;
+}
+
+/* Give the CPU to the next ready task */
+__hot void task_yield(void)
+{
+	unsigned long flags = irq_save();
+	Task *prev = current;
+	Task *next = pick_next(prev);
+
+	if (next != prev) {
+		if (prev->state == TASK_RUNNING) {
+			prev->state = TASK_READY;
+		}
+		next->state = TASK_RUNNING;
+		next->switches++;
+		TRACE(TRACE_TASK_SWITCH, next->id);
+		current = next;
+		fpu_switch_to(next);
+
+		/* Kernel threads run in whichever space is loaded */
+		if (next->space) {
+			paging_space_switch(next->space);
+			tss_set_kernel_stack((unsigned long)next->stack + TASK_STACK_SIZE);
+		}
+		task_switch(&prev->esp, next->esp);
+	}
+	irq_restore(flags);
+}
+
+/* End the current task - its memory is reclaimed by a later yield */
+void task_exit(void)
+{
+	irq_save();
+	fpu_task_exit(current);
+	current->state = TASK_DEAD;
+	task_yield();
+
+	/* Only reached if nothing else can run */
+	while (1) {
+		__asm__ volatile("hlt");
+	}
+}
+
+/* Unlink a task from a wait queue if it is still on it */
+static void wait_queue_remove(WaitQueue *wq, Task *task)
+{
+	Task **link = &wq->head;
+
+	while (*link) {
+		if (*link == task) {
+			*link = task->wait_next;
+			task->wait_next = 0;
+			return;
+		}
+		link = &(*link)->wait_next;
+	}
+}
+
+/*
+ * Block the current task until wait_queue_wake_all(). Callers test their
+ * condition with interrupts disabled and loop, e.g.
+ *     flags = irq_save();
+ *     while (!condition)
+ *         wait_queue_sleep(&wq);
+ *     irq_restore(flags);
+ * so a wakeup from an interrupt cannot slip in between test and sleep.
+ * Returns early (spuriously) when no other task can run.
+ */
+__hot void wait_queue_sleep(WaitQueue *wq)
+{
+	unsigned long flags = irq_save();
+
+	current->wait_next = wq->head;
+	wq->head = current;
+	current->state = TASK_BLOCKED;
+	task_yield();
+
+	/* Nothing else was runnable - idle until an interrupt, then let the caller recheck */
+	if (current->state == TASK_BLOCKED) {
+		unsigned long long start = cpu_rdtsc();
+
+		wait_queue_remove(wq, current);
+		current->state = TASK_RUNNING;
+		cpu_wait_for_interrupt();
+		idle_cycles += cpu_rdtsc() - start;
+	}
+	irq_restore(flags);
+}
+
+/* Make every waiting task ready (safe from interrupt handlers) */
+__hot void wait_queue_wake_all(WaitQueue *wq)
+{
+	unsigned long flags = irq_save();
+	Task *task;
+
+	while (wq->head) {
+		task = wq->head;
+		wq->head = task->wait_next;
+		task->wait_next = 0;
+		if (task->state == TASK_BLOCKED) {
+			task->state = TASK_READY;
+		}
+	}
+	irq_restore(flags);
+}
+
+/* Total cycles the CPU sat idle waiting for an interrupt */
+unsigned long long task_idle_cycles(void)
+{
+	return idle_cycles;
+}
+
+/* Print a column padded to width */
+static void print_column(const char *text, int width)
+{
+	int len = strlen(text);
+
+	kprint(text);
+	while (len++ < width) {
+		kprint_char(' ');
+	}
+}
+
+static void print_number(unsigned int value, int width)
+{
+	char digits[12];
+	int pos = 11;
+
+	digits[pos] = '\0';
+	do {
+		digits[--pos] = '0' + value % 10;
+		value /= 10;
+	} while (value && pos > 0);
+	print_column(&digits[pos], width);
+}
+
+/* List every task with its switch and FPU statistics */
+__cold void task_print_list(void)
+{
+	static const char *state_names[] = {"ready", "running", "dead", "blocked"};
+	unsigned long flags = irq_save();
+	Task *t = current;
+
+	kprint("ID   STATE    SWITCHES  FPU TRAPS  FPU  NAME\n");
+	do {
+		print_number(t->id, 5);
+		print_column(state_names[t->state], 9);
+		print_number(t->switches, 10);
+		print_number(t->fpu_traps, 11);
+		print_column(t == fpu_owner() ? "live" : (t->fpu ? "saved" : "-"), 5);
+		kprint(t->name);
+		kprint_newline();
+		t = t->next;
+	} while (t != current);
+	irq_restore(flags);
+}
+
+/* Benchmark state shared with the partner task */
+static volatile int bench_rounds_left;
+static volatile int bench_use_fpu;
+
+/* Execute one x87 instruction so the task owns the FPU */
+static inline void fpu_touch(void)
+{
+	__asm__ volatile("fldz\n\tfstp %%st(0)" : : : "memory");
+}
+
+static void bench_partner(void *arg)
+{
+	(void)arg;
+	while (bench_rounds_left > 0) {
+		if (bench_use_fpu) {
+			fpu_touch();
+		}
+		task_yield();
+	}
+}
+
+/* Cycles for BENCH_SWITCH_ROUNDS yield round trips with a partner task */
+static int bench_round_trips(int use_fpu, unsigned long long *cycles)
+{
+	unsigned long long start;
+
+	bench_use_fpu = use_fpu;
+	bench_rounds_left = BENCH_SWITCH_ROUNDS;
+	if (!task_create("bench", bench_partner, 0)) {
+		return -1;
+	}
+
+	start = cpu_rdtsc();
+	while (bench_rounds_left > 0) {
+		if (use_fpu) {
+			fpu_touch();
+		}
+		bench_rounds_left--;
+		task_yield();
+	}
+	*cycles = cpu_rdtsc() - start;
+
+	/* Reap the partner */
+	task_yield();
+	return 0;
+}
+
+/* Context switch cost without and with lazy FPU state switching */
+void task_bench_switch(void)
+{
+	unsigned long long cycles;
+
+	if (bench_round_trips(0, &cycles) != 0) {
+		kprint("Out of memory\n");
+		return;
+	}
+	bench_report("yield round trip, no FPU", cycles, BENCH_SWITCH_ROUNDS);
+
+	if (!cpu_has_feature(CPU_FEATURE_FPU)) {
+		return;
+	}
+	if (bench_round_trips(1, &cycles) != 0) {
+		kprint("Out of memory\n");
+		return;
+	}
+	bench_report("yield round trip, both use FPU", cycles, BENCH_SWITCH_ROUNDS);
+}
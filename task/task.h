@@ -0,0 +1,67 @@
+/*
+ * Tasks - Kernel threads and the scheduler
+ */
+
+#ifndef TASK_H
+#define TASK_H
+
+#define TASK_NAME_LENGTH 16
+#define TASK_STACK_SIZE 8192
+
+/* Task states */
+#define TASK_READY 0
+#define TASK_RUNNING 1
+#define TASK_DEAD 2
+#define TASK_BLOCKED 3
+
+struct FpuState;
+struct OutputSink;
+struct Pipe;
+struct AddressSpace;
+struct UserProcess;
+
+/* Task control block */
+typedef struct Task {
+	unsigned long esp;          /* Saved stack pointer - task_switch() relies on this being first */
+	int id;
+	int state;
+	char name[TASK_NAME_LENGTH];
+	void *stack;                /* Kernel stack (0 for the boot task) */
+	void (*entry)(void *arg);
+	void *arg;
+	struct FpuState *fpu;       /* FPU/SSE state, allocated on first use */
+	unsigned int fpu_traps;     /* #NM faults taken to load this task's state */
+	unsigned int switches;      /* Times this task was switched in */
+	struct OutputSink *sink;    /* Where kprint goes, 0 = the console */
+	struct Pipe *input;         /* Pipeline stage input, 0 = none */
+	int command_failed;         /* Last shell command run by this task failed */
+	struct AddressSpace *space; /* User address space, 0 for kernel threads */
+	struct UserProcess *process; /* Program this task runs in ring 3, 0 = none */
+	struct Task *next;          /* Circular list of all tasks */
+	struct Task *wait_next;     /* Wait queue link while blocked */
+} Task;
+
+/* Tasks sleeping until an event; wakers may run in interrupt context */
+typedef struct {
+	Task *head;
+} WaitQueue;
+
+#define WAIT_QUEUE_INIT { 0 }
+
+/* Task functions */
+void task_init(void);
+Task* task_create(const char *name, void (*entry)(void *arg), void *arg);
+void task_yield(void);
+void task_exit(void);
+Task* task_current(void);
+
+/* Wait queues - check the condition with interrupts disabled, then sleep */
+void wait_queue_sleep(WaitQueue *wq);
+void wait_queue_wake_all(WaitQueue *wq);
+
+/* Statistics and benchmark */
+unsigned long long task_idle_cycles(void);
+void task_print_list(void);
+void task_bench_switch(void);
+
+#endif /* TASK_H */
@@ -0,0 +1,185 @@
+/*
+ * User Task Implementation
+ * A user task is a kernel thread that builds an address space, drops to
+ * ring 3 and comes back only through system calls, interrupts and
+ * faults. Its kernel stack is the thread's; a fault kills the task
+ * instead of halting the kernel.
+ */
+
+#include "user.h"
+#include "syscall.h"
+#include "../cpu/cpu.h"
+#include "../cpu/gdt.h"
+#include "../memory/page.h"
+#include "../memory/paging.h"
+#include "../memory/vma.h"
+#include "../output/output.h"
+#include "../lib/string.h"
+
+/* Drop to ring 3 (syscall.asm) */
+extern void user_enter(unsigned long eip, unsigned long esp);
+
+/* First code of a user task, still in ring 0 */
+static void user_task_main(void *arg)
+{
+	UserProcess *process = (UserProcess*)arg;
+	Task *task = task_current();
+	unsigned long entry;
+	unsigned long stack;
+
+	task->process = process;
+	task->space = paging_space_create();
+	if (!task->space) {
+		user_exit(USER_STATUS_KILLED);
+	}
+	paging_space_switch(task->space);
+	tss_set_kernel_stack((unsigned long)task->stack + TASK_STACK_SIZE);
+
+	if (syscall_map_vsyscall() != 0) {
+		user_exit(USER_STATUS_KILLED);
+	}
+	entry = process->setup(process->arg, &stack);
+	if (!entry) {
+		user_exit(USER_STATUS_KILLED);
+	}
+	user_enter(entry, stack);
+}
+
+/* Run a program in a new user task and wait for it - returns -1 if it could not start */
+int user_run(const char *name, UserSetup setup, void *arg, int *status)
+{
+	UserProcess process;
+	unsigned long flags;
+	Task *task;
+
+	process.setup = setup;
+	process.arg = arg;
+	process.status = 0;
+	process.exited = 0;
+	process.exit_wait.head = 0;
+
+	task = task_create(name, user_task_main, &process);
+	if (!task) {
+		return -1;
+	}
+	/* Output goes where the caller's does, e.g. into a pipe */
+	task->sink = task_current()->sink;
+
+	flags = irq_save();
+	while (!process.exited) {
+		wait_queue_sleep(&process.exit_wait);
+	}
+	irq_restore(flags);
+
+	*status = process.status;
+	return 0;
+}
+
+/* Map a zeroed page into the active space - returns its frame or 0 */
+void* user_map_page(unsigned long virt, unsigned int flags)
+{
+	void *frame = page_alloc();
+
+	if (!frame) {
+		return 0;
+	}
+	memset(frame, 0, PAGE_SIZE);
+	if (paging_map_page(virt, (unsigned long)frame, PTE_USER | flags) != 0) {
+		page_free(frame);
+		return 0;
+	}
+	return frame;
+}
+
+/*
+ * Add the stack area and map its top page now, for the caller to put
+ * the program's arguments in - returns that page's frame or 0
+ */
+char* user_setup_stack(void)
+{
+	AddressSpace *space = task_current()->space;
+
+	if (vma_add(space, USER_STACK_BASE, USER_STACK_TOP, VMA_WRITE, 0, 0, 0) != 0) {
+		return 0;
+	}
+	return (char*)user_map_page(USER_STACK_TOP - PAGE_SIZE, PTE_WRITE);
+}
+
+/* UserSetup for a UserBlob: read-only code at USER_CODE_BASE and a stack */
+unsigned long user_setup_blob(void *arg, unsigned long *stack)
+{
+	UserBlob *blob = (UserBlob*)arg;
+	unsigned long *args;
+	unsigned int offset;
+	unsigned int chunk;
+	char *frame;
+
+	for (offset = 0; offset < blob->size; offset += PAGE_SIZE) {
+		frame = (char*)user_map_page(USER_CODE_BASE + offset, 0);
+		if (!frame) {
+			return 0;
+		}
+		chunk = blob->size - offset < PAGE_SIZE ? blob->size - offset : PAGE_SIZE;
+		memcpy(frame, (const char*)blob->code + offset, chunk);
+	}
+
+	/* cdecl frame: return address (programs end with SYS_EXIT), then the arguments */
+	frame = user_setup_stack();
+	if (!frame) {
+		return 0;
+	}
+	args = (unsigned long*)(frame + PAGE_SIZE) - 3;
+	args[0] = 0;
+	args[1] = blob->args[0];
+	args[2] = blob->args[1];
+	*stack = USER_STACK_TOP - 3 * sizeof(unsigned long);
+	return USER_CODE_BASE;
+}
+
+/* End the current user task, free its memory and wake the waiter */
+void user_exit(int status)
+{
+	Task *task = task_current();
+	UserProcess *process = task->process;
+
+	paging_space_switch(0);
+	if (task->space) {
+		paging_space_destroy(task->space);
+		task->space = 0;
+	}
+	task->process = 0;
+
+	process->status = status;
+	process->exited = 1;
+	wait_queue_wake_all(&process->exit_wait);
+	task_exit();
+}
+
+/* A fault in ring 3 - report it and kill the task */
+void user_fault(const char *what, unsigned long address)
+{
+	kprint_colored(task_current()->name, 0x04);
+	kprint_colored(": ", 0x04);
+	kprint_colored(what, 0x04);
+	kprint_colored(" at ", 0x04);
+	kprint_hex(address);
+	kprint(", killed\n");
+	user_exit(USER_STATUS_KILLED);
+}
+
+/* Check that user memory may be read by a system call - untouched pages fault in */
+int user_access_ok(unsigned long addr, unsigned long size)
+{
+	AddressSpace *space = task_current()->space;
+	unsigned long page;
+
+	if (!space || addr < VM_USER_BASE || addr >= VM_USER_END || size > VM_USER_END - addr) {
+		return 0;
+	}
+	for (page = PAGE_ALIGN_DOWN(addr); page < addr + size; page += PAGE_SIZE) {
+		if (!paging_virt_to_phys(page) && !vma_find(space, page)) {
+			return 0;
+		}
+	}
+	return 1;
+}
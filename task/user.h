@@ -0,0 +1,50 @@
+/*
+ * User Tasks - Programs running in ring 3 in their own address space
+ */
+
+#ifndef USER_H
+#define USER_H
+
+#include "task.h"
+
+/* User address space layout (within VM_USER_BASE - VM_USER_END) */
+#define USER_CODE_BASE 0x40000000
+#define USER_STACK_TOP 0xBFFFE000   /* A guard page below the vsyscall page */
+#define USER_STACK_PAGES 64         /* Zero-filled on first touch */
+#define USER_STACK_BASE (USER_STACK_TOP - USER_STACK_PAGES * 4096)
+
+/* Exit status of a task killed by a fault */
+#define USER_STATUS_KILLED -1
+
+/*
+ * Builds the program in the new task's address space, which is active
+ * when it runs. Returns the entry point and sets *stack, or returns 0.
+ */
+typedef unsigned long (*UserSetup)(void *arg, unsigned long *stack);
+
+/* A program started by user_run(), owned by the waiting caller */
+typedef struct UserProcess {
+	UserSetup setup;
+	void *arg;
+	int status;
+	int exited;
+	WaitQueue exit_wait;
+} UserProcess;
+
+/* Position-independent code run at USER_CODE_BASE as code(args[0], args[1]) */
+typedef struct {
+	const void *code;
+	unsigned int size;
+	unsigned long args[2];
+} UserBlob;
+
+/* User task functions */
+int user_run(const char *name, UserSetup setup, void *arg, int *status);
+unsigned long user_setup_blob(void *arg, unsigned long *stack);
+char* user_setup_stack(void);
+void* user_map_page(unsigned long virt, unsigned int flags);
+void user_exit(int status);
+void user_fault(const char *what, unsigned long address);
+int user_access_ok(unsigned long addr, unsigned long size);
+
+#endif /* USER_H */
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""Build a bootable NaoBoot disk image.
+
+Lays out stage 1 (the MBR), stage 2, the kernel ELF and an optional
+initrd back to back, and patches stage 2's config block with where the
+kernel and initrd are and the kernel command line:
+    tools/mkboot.py -o run/boot.img --initrd run/initrd.tar \\
+        --cmdline "rc=none" bin/stage1.bin bin/stage2.bin bin/kernel
+Boot it with qemu-system-i386 -drive file=run/boot.img,format=raw.
+The layout is described in boot/naoboot.inc.
+"""
+
+import argparse
+import struct
+import sys
+
+SECTOR = 512
+CONFIG_OFFSET = 8
+CONFIG_MAGIC = 0x4643424E  # "NBCF"
+CMDLINE_LENGTH = 128
+# Images are padded to whole megabytes so every BIOS sees a sane geometry
+IMAGE_ALIGN = 1024 * 1024
+
+
+def sectors(size):
+    return (size + SECTOR - 1) // SECTOR
+
+
+def pad(data, align):
+    return data + bytes(-len(data) % align)
+
+
+def build(stage1, stage2, kernel, initrd, cmdline):
+    if len(stage1) != SECTOR or stage1[510:512] != b"\x55\xaa":
+        sys.exit("stage 1 is not a 512-byte boot sector")
+    if len(stage2) % SECTOR or struct.unpack_from("<I", stage2, CONFIG_OFFSET)[0] != CONFIG_MAGIC:
+        sys.exit("stage 2 has no config block")
+    if kernel[:4] != b"\x7fELF":
+        sys.exit("kernel is not an ELF image")
+    cmd = cmdline.encode()
+    if len(cmd) >= CMDLINE_LENGTH:
+        sys.exit("command line longer than %d bytes" % (CMDLINE_LENGTH - 1))
+
+    kernel_lba = 1 + len(stage2) // SECTOR
+    initrd_lba = kernel_lba + sectors(len(kernel))
+    stage2 = bytearray(stage2)
+    struct.pack_into("<IIII", stage2, CONFIG_OFFSET + 4,
+                     kernel_lba, len(kernel), initrd_lba, len(initrd))
+    struct.pack_into("%ds" % CMDLINE_LENGTH, stage2, CONFIG_OFFSET + 20, cmd)
+
+    image = stage1 + bytes(stage2) + pad(kernel, SECTOR) + initrd
+    return pad(image, IMAGE_ALIGN), kernel_lba, initrd_lba
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("stage1")
+    parser.add_argument("stage2")
+    parser.add_argument("kernel")
+    parser.add_argument("-o", "--output", required=True)
+    parser.add_argument("--initrd", help="archive loaded as the boot module")
+    parser.add_argument("--cmdline", default="", help="kernel command line")
+    args = parser.parse_args()
+
+    def read(path):
+        with open(path, "rb") as f:
+            return f.read()
+
+    initrd = read(args.initrd) if args.initrd else b""
+    image, kernel_lba, initrd_lba = build(read(args.stage1), read(args.stage2),
+                                          read(args.kernel), initrd, args.cmdline)
+    with open(args.output, "wb") as f:
+        f.write(image)
+    print("%s: kernel at LBA %d, initrd at LBA %d (%d bytes), %d KB"
+          % (args.output, kernel_lba, initrd_lba, len(initrd), len(image) // 1024))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Compress the kernel ELF into the payload of the LZ4 boot stub.
+
+The loadable segments are flattened into one image starting at the
+lowest physical address, compressed as a single LZ4 block and written
+behind a header the stub (boot/lz4stub.asm) reads:
+    magic "LZ4K", load address, image size, bss end, entry, block size
+    tools/mklz4.py bin/kernel bin/kernel.lz4
+The block is decompressed again here and compared before it is written.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"LZ4K"
+PT_LOAD = 1
+MIN_MATCH = 4
+LAST_LITERALS = 5       # the block always ends in at least 5 literals
+MATCH_LIMIT = 12        # and no match starts in its last 12 bytes
+MAX_OFFSET = 65535
+
+
+def flatten(elf):
+    """Loadable segments as (image, load address, bss end, entry)."""
+    if elf[:4] != b"\x7fELF" or elf[4] != 1:
+        sys.exit("not a 32-bit ELF image")
+    entry, phoff = struct.unpack_from("<II", elf, 24)
+    phentsize, phnum = struct.unpack_from("<HH", elf, 42)
+    segments = []
+    for i in range(phnum):
+        fields = struct.unpack_from("<8I", elf, phoff + i * phentsize)
+        p_type, p_offset, _, p_paddr, p_filesz, p_memsz = fields[:6]
+        if p_type == PT_LOAD and p_memsz:
+            segments.append((p_paddr, elf[p_offset:p_offset + p_filesz], p_memsz))
+    if not segments:
+        sys.exit("no loadable segments")
+    segments.sort()
+    base = segments[0][0]
+    image = bytearray()
+    for paddr, data, _ in segments:
+        if paddr - base < len(image):
+            sys.exit("overlapping segments")
+        image += bytes(paddr - base - len(image)) + data
+    bss_end = max(paddr + memsz for paddr, _, memsz in segments)
+    return bytes(image), base, bss_end, entry
+
+
+def write_length(out, value):
+    while value >= 255:
+        out.append(255)
+        value -= 255
+    out.append(value)
+
+
+def emit(out, literals, offset, length):
+    token = min(len(literals), 15) << 4
+    if offset:
+        token |= min(length - MIN_MATCH, 15)
+    out.append(token)
+    if len(literals) >= 15:
+        write_length(out, len(literals) - 15)
+    out += literals
+    if offset:
+        out += struct.pack("<H", offset)
+        if length - MIN_MATCH >= 15:
+            write_length(out, length - MIN_MATCH - 15)
+
+
+def compress(data):
+    """Greedy LZ4 block: the most recent position for each 4-byte key."""
+    out = bytearray()
+    table = {}
+    anchor = 0
+    pos = 0
+    limit = len(data) - MATCH_LIMIT
+    while pos < limit:
+        key = data[pos:pos + MIN_MATCH]
+        candidate = table.get(key)
+        table[key] = pos
+        if candidate is None or pos - candidate > MAX_OFFSET:
+            pos += 1
+            continue
+        length = MIN_MATCH
+        longest = len(data) - LAST_LITERALS - pos
+        while length < longest and data[candidate + length] == data[pos + length]:
+            length += 1
+        emit(out, data[anchor:pos], pos - candidate, length)
+        for inside in range(pos + 1, min(pos + length, limit)):
+            table[data[inside:inside + MIN_MATCH]] = inside
+        pos += length
+        anchor = pos
+    emit(out, data[anchor:], 0, 0)
+    return bytes(out)
+
+
+def decompress(block):
+    out = bytearray()
+    pos = 0
+    while True:
+        token = block[pos]
+        pos += 1
+        length = token >> 4
+        if length == 15:
+            while True:
+                length += block[pos]
+                pos += 1
+                if block[pos - 1] != 255:
+                    break
+        out += block[pos:pos + length]
+        pos += length
+        if pos >= len(block):
+            return bytes(out)
+        offset = block[pos] | block[pos + 1] << 8
+        pos += 2
+        length = token & 15
+        if length == 15:
+            while True:
+                length += block[pos]
+                pos += 1
+                if block[pos - 1] != 255:
+                    break
+        for _ in range(length + MIN_MATCH):
+            out.append(out[-offset])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("kernel")
+    parser.add_argument("output")
+    args = parser.parse_args()
+
+    with open(args.kernel, "rb") as f:
+        image, base, bss_end, entry = flatten(f.read())
+    block = compress(image)
+    if decompress(block) != image:
+        sys.exit("LZ4 round trip failed")
+    with open(args.output, "wb") as f:
+        f.write(struct.pack("<4s5I", MAGIC, base, len(image), bss_end, entry, len(block)))
+        f.write(block)
+    print("%s: %d -> %d bytes (%d%%), load %#x, entry %#x"
+          % (args.output, len(image), len(block), 100 * len(block) // len(image), base, entry))
+
+
+if __name__ == "__main__":
+    main()
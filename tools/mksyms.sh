@@ -0,0 +1,20 @@
+#!/bin/bash
+# Generate the kernel symbol table as C source.
+# Usage: tools/mksyms.sh [bin/kernel] > bin/ksyms.c
+# Without an argument an empty table is produced (first link pass).
+
+kernel="$1"
+
+echo "/* Generated by tools/mksyms.sh - do not edit */"
+echo '#include "../debug/ksyms.h"'
+echo
+echo "const KernelSymbol kernel_symbols[] = {"
+if [[ -n "$kernel" ]]; then
+    nm -n --defined-only "$kernel" | awk '$2 ~ /^[Tt]$/ && $3 !~ /^_kernel_|^_etext$|^_init_|^_edata$/ {
+        printf "\t{0x%s, \"%s\"},\n", $1, $3
+    }'
+fi
+echo "	{0, 0}  /* Sentinel entry */"
+echo "};"
+echo
+echo "const unsigned int kernel_symbol_count = sizeof(kernel_symbols) / sizeof(kernel_symbols[0]) - 1;"
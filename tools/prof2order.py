@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+"""Turn a NaoKernel profile dump into the link order for the next build.
+
+Profile the workload with QEMU's serial port captured, e.g.
+    qemu-system-i386 -kernel bin/kernel -serial file:serial.log
+then run `prof start`, the workload, `prof stop` and `prof order` in the
+shell and convert the last dump in the log:
+    tools/prof2order.py serial.log > link.order
+build.sh places the listed functions right after the __hot ones, in this
+order, so the code the profile saw running shares cache lines and pages.
+"""
+
+import argparse
+import sys
+
+
+def last_dump(lines):
+    dump = None
+    current = None
+    for line in lines:
+        line = line.strip()
+        if line == "#naoprof order":
+            current = []
+        elif line == "#end" and current is not None:
+            dump = current
+            current = None
+        elif current is not None and line:
+            fields = line.split()
+            if len(fields) == 2:
+                current.append((fields[0], int(fields[1], 16)))
+    return dump
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", help="serial log containing `prof order` output")
+    parser.add_argument("--min-samples", type=int, default=1,
+                        help="leave colder functions to the default order")
+    args = parser.parse_args()
+
+    with open(args.log, errors="replace") as f:
+        dump = last_dump(f)
+    if dump is None:
+        sys.exit("no `prof order` dump in %s" % args.log)
+    for name, samples in dump:
+        if samples >= args.min_samples:
+            print(name)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+"""Convert a NaoKernel serial trace dump into Chrome trace JSON.
+
+Capture the dump with QEMU's serial port, e.g.
+    qemu-system-i386 -kernel bin/kernel -serial file:serial.log
+then run `trace dump serial` in the shell and convert:
+    tools/trace2json.py serial.log --mhz 2400 > trace.json
+Open trace.json in chrome://tracing or https://ui.perfetto.dev.
+"""
+
+import argparse
+import json
+import sys
+
+# Events that open and close a slice: begin name -> end name
+PAIRS = {
+    "irq_entry": "irq_exit",
+    "command_begin": "command_end",
+}
+
+
+def parse(lines):
+    names = {}
+    events = []
+    for line in lines:
+        line = line.strip()
+        if not line:
+            continue
+        if line.startswith("#event "):
+            _, ident, name = line.split(None, 2)
+            names[int(ident, 16)] = name
+            continue
+        if line.startswith("#"):
+            continue
+        fields = line.split()
+        if len(fields) != 4:
+            continue
+        try:
+            cpu, tsc, ident, arg = (int(f, 16) for f in fields)
+        except ValueError:
+            continue
+        events.append((tsc, cpu, ident, arg))
+    events.sort()
+    return names, events
+
+
+def convert(names, events, mhz):
+    ends = {end: begin for begin, end in PAIRS.items()}
+    base = events[0][0] if events else 0
+    out = []
+    for tsc, cpu, ident, arg in events:
+        name = names.get(ident, "event_%d" % ident)
+        entry = {"pid": 0, "tid": cpu, "ts": (tsc - base) / mhz, "args": {"arg": hex(arg)}}
+        if name in PAIRS:
+            entry.update(name=name.rsplit("_", 1)[0], ph="B")
+        elif name in ends:
+            entry.update(name=ends[name].rsplit("_", 1)[0], ph="E")
+        else:
+            entry.update(name=name, ph="i", s="t")
+        out.append(entry)
+    return {"traceEvents": out, "displayTimeUnit": "ns"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", help="serial log containing a '#naotrace' dump")
+    parser.add_argument("--mhz", type=float, default=1000.0,
+                        help="TSC frequency in MHz (default 1000)")
+    args = parser.parse_args()
+
+    with open(args.log, errors="replace") as f:
+        names, events = parse(f)
+    if not events:
+        sys.exit("no trace events found in %s" % args.log)
+    json.dump(convert(names, events, args.mhz), sys.stdout, indent=1)
+    sys.stdout.write("\n")
+
+
+if __name__ == "__main__":
+    main()
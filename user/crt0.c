@@ -0,0 +1,106 @@
+/*
+ * User Runtime Implementation
+ * The kernel enters _start like a cdecl call with argc and argv and a
+ * null return address; system calls go through the vsyscall page.
+ */
+
+#include "nao.h"
+
+/* eax = number, ebx/esi/edi = arguments; ecx and edx are clobbered */
+static inline int nao_syscall(int num, unsigned long a1, unsigned long a2, unsigned long a3)
+{
+	unsigned long ecx, edx;
+	int result;
+
+	__asm__ volatile("call *%%ecx"
+	                 : "=a"(result), "=c"(ecx), "=d"(edx)
+	                 : "0"(num), "b"(a1), "S"(a2), "D"(a3), "1"(VSYSCALL_ENTRY)
+	                 : "memory");
+	return result;
+}
+
+void _start(int argc, char **argv)
+{
+	nao_exit(main(argc, argv));
+}
+
+void nao_exit(int status)
+{
+	nao_syscall(SYS_EXIT, status, 0, 0);
+	while (1) {
+	}
+}
+
+int nao_write(const char *buffer, unsigned int length)
+{
+	return nao_syscall(SYS_WRITE, (unsigned long)buffer, length, 0);
+}
+
+void nao_yield(void)
+{
+	nao_syscall(SYS_YIELD, 0, 0, 0);
+}
+
+int nao_getpid(void)
+{
+	return nao_syscall(SYS_GETPID, 0, 0, 0);
+}
+
+unsigned int strlen(const char *str)
+{
+	unsigned int length = 0;
+
+	while (str[length]) {
+		length++;
+	}
+	return length;
+}
+
+void* memcpy(void *dest, const void *src, unsigned int n)
+{
+	char *d = (char*)dest;
+	const char *s = (const char*)src;
+
+	while (n--) {
+		*d++ = *s++;
+	}
+	return dest;
+}
+
+void* memset(void *dest, int c, unsigned int n)
+{
+	char *d = (char*)dest;
+
+	while (n--) {
+		*d++ = (char)c;
+	}
+	return dest;
+}
+
+void nao_print(const char *str)
+{
+	nao_write(str, strlen(str));
+}
+
+void nao_print_dec(unsigned int value)
+{
+	char digits[12];
+	int pos = 11;
+
+	digits[pos] = '\0';
+	do {
+		digits[--pos] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	nao_print(&digits[pos]);
+}
+
+unsigned int nao_atoi(const char *str)
+{
+	unsigned int value = 0;
+
+	while (*str >= '0' && *str <= '9') {
+		value = value * 10 + (*str++ - '0');
+	}
+	return value;
+}
@@ -0,0 +1,19 @@
+/*
+ * hello - Greets from ring 3 and echoes its arguments
+ */
+
+#include "nao.h"
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	nao_print("Hello from ring 3, pid ");
+	nao_print_dec(nao_getpid());
+	nao_print("\n");
+	for (i = 1; i < argc; i++) {
+		nao_print(argv[i]);
+		nao_print(i + 1 < argc ? " " : "\n");
+	}
+	return 0;
+}
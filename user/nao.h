@@ -0,0 +1,27 @@
+/*
+ * User Runtime - System calls and helpers for NaoKernel programs
+ */
+
+#ifndef NAO_H
+#define NAO_H
+
+#include "../task/syscall.h"
+
+/* System calls */
+void nao_exit(int status) __attribute__((noreturn));
+int nao_write(const char *buffer, unsigned int length);
+void nao_yield(void);
+int nao_getpid(void);
+
+/* Helpers */
+unsigned int strlen(const char *str);
+void* memcpy(void *dest, const void *src, unsigned int n);
+void* memset(void *dest, int c, unsigned int n);
+void nao_print(const char *str);
+void nao_print_dec(unsigned int value);
+unsigned int nao_atoi(const char *str);
+
+/* Every program provides main(); its return value is the exit status */
+int main(int argc, char **argv);
+
+#endif /* NAO_H */
@@ -0,0 +1,33 @@
+/*
+ * pagetest - A 1 MB program that only touches as much of itself as asked
+ * Usage: pagetest [pages]. Each page of the table is read once; with
+ * demand paging only those pages come off the disk (see vmmap).
+ */
+
+#include "nao.h"
+
+#define TABLE_PAGES 256
+#define PAGE_WORDS 1024
+
+/* Initialized, so it is part of the file rather than bss */
+static const unsigned int table[TABLE_PAGES][PAGE_WORDS] = { [0 ... TABLE_PAGES - 1] = { 1 } };
+
+int main(int argc, char **argv)
+{
+	unsigned int pages = argc > 1 ? nao_atoi(argv[1]) : 1;
+	unsigned int sum = 0;
+	unsigned int i;
+
+	if (pages > TABLE_PAGES) {
+		pages = TABLE_PAGES;
+	}
+	for (i = 0; i < pages; i++) {
+		sum += *(volatile const unsigned int*)&table[i][0];
+	}
+	nao_print("Touched ");
+	nao_print_dec(sum);
+	nao_print(" of ");
+	nao_print_dec(TABLE_PAGES);
+	nao_print(" table pages\n");
+	return 0;
+}